@@ -0,0 +1,630 @@
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "aot.h"
+#include "cache.h"
+#include "compiler.h"
+#include "debug.h"
+#include "error.h"
+#include "memory.h"
+
+/* Ahead of time compilation to C.
+ *
+ * The script is compiled to bytecode as usual. The C file carries the
+ * bytecode as an image (see cache.c), which brings along every constant
+ * and function body, and a run() function with the module level code
+ * translated to straight-line C.
+ *
+ * The translation walks the instructions keeping track of how many of
+ * the values on top of the stack are held in the locals v0, v1, ...
+ * instead (see aotvalue). Number constants, name loads and stores,
+ * arithmetic and comparisons feeding a jump work on those locals, with
+ * numbers unboxed, and jumps are gotos. Everything else is an object
+ * operation: the locals are pushed onto the stack and the instruction
+ * is handed to vm_dispatch(), which is also where arithmetic and
+ * comparisons on anything but two ints or two doubles go.
+ *
+ * Jump targets start with nothing held in locals, and every instruction
+ * that does gets a label. When an instruction run by the vm jumps, the
+ * code carries on at the label of the new pc through the switch at the
+ * end of run(). A pc without one is left to the interpreter. Function
+ * bodies run in the vm (and its jit) as they would under bin/ari.
+ */
+
+#define BYTES_PER_LINE  12
+
+typedef struct
+{
+    FILE *out;
+    instruct *instructs;
+    bool *targets;      // Instructions something jumps to
+    bool *labels;       // Instructions the switch in run() can go to
+    int indent;
+    int depth;          // Values held in locals rather than on the stack
+    int maxdepth;
+    bool dispatched;    // Whether run() needs its state variable
+    char **names;
+    int num_names;
+    int name_capacity;
+} aotgen;
+
+static void emit_line(aotgen *gen, const char *format, ...)
+{
+    fprintf(gen->out, "%*s", gen->indent * 4, "");
+    va_list args;
+    va_start(args, format);
+    vfprintf(gen->out, format, args);
+    va_end(args);
+    fputc('\n', gen->out);
+}
+
+static inline bool is_compare_jump(instruct *instructs, int pc)
+{
+    uint8_t bytecode = instructs->code[pc]->bytecode;
+    return (bytecode == OP_COMPARE || bytecode == OP_COMPARE_DOUBLE_JMP ||
+            bytecode == OP_COMPARE_INT_JMP) &&
+        pc + 1 < instructs->count &&
+        instructs->code[pc + 1]->bytecode == OP_JMP_FALSE;
+}
+
+// The operator of an arithmetic instruction, quickened or not, or 0
+static inline char arith_operator(uint8_t bytecode)
+{
+    switch (bytecode) {
+        case OP_BINARY_ADD:
+        case OP_ADD_DOUBLE:
+        case OP_ADD_INT:
+            return '+';
+        case OP_BINARY_SUB:
+        case OP_SUB_DOUBLE:
+        case OP_SUB_INT:
+            return '-';
+        case OP_BINARY_MULT:
+        case OP_MULT_DOUBLE:
+        case OP_MULT_INT:
+            return '*';
+        case OP_BINARY_DIVIDE:
+        case OP_DIVIDE_DOUBLE:
+            return '/';
+        default:
+            return 0;
+    }
+}
+
+// The C operator for a comparison, or NULL for one left to the vm
+static inline const char *compare_operator(int cmptype)
+{
+    switch (cmptype) {
+        case TOKEN_EQUAL_EQUAL:     return "==";
+        case TOKEN_BANG_EQUAL:      return "!=";
+        case TOKEN_GREATER:         return ">";
+        case TOKEN_GREATER_EQUAL:   return ">=";
+        case TOKEN_LESS:            return "<";
+        case TOKEN_LESS_EQUAL:      return "<=";
+        default:                    return NULL;
+    }
+}
+
+static inline bool is_number(value *constant)
+{
+    return constant->type == VAL_LONG || constant->type == VAL_DOUBLE;
+}
+
+// A superinstruction whose constant is a number, which is done in C
+static inline bool translated_fused(instruct *instructs, int pc)
+{
+    return pc + 3 < instructs->count &&
+        is_number(&instructs->code[pc + 1]->operand);
+}
+
+static inline bool translated_compare_jump(aotgen *gen, int pc)
+{
+    return is_compare_jump(gen->instructs, pc) && !gen->targets[pc + 1] &&
+        compare_operator(VAL_AS_INT((&gen->instructs->code[pc]->operand)));
+}
+
+// How far the vm moves on from an instruction that doesn't jump
+static inline int instruction_width(uint8_t bytecode)
+{
+    switch (bytecode) {
+        case OP_GET_NAME_PROPERTY:
+        case OP_SET_NAME_PROPERTY:
+            return 2;
+        case OP_FOR_RANGE:
+            return 3;
+        case OP_COMPARE_NAME_CONST_JMP:
+        case OP_ADD_NAME_CONST_STORE:
+            return 4;
+        default:
+            return 1;
+    }
+}
+
+static inline void mark_target(bool *targets, int pc, int count)
+{
+    if (pc >= 0 && pc < count)
+        targets[pc] = true;
+}
+
+// Instructions that some instruction jumps to
+static void find_targets(instruct *instructs, bool *targets)
+{
+    int count = instructs->count;
+    for (int pc = 0; pc < count; pc++) {
+        code8 *code = instructs->code[pc];
+        value *operand = &code->operand;
+        int width = instruction_width(code->bytecode);
+        if (width > 1)
+            mark_target(targets, pc + width, count);
+        switch (code->bytecode) {
+            case OP_JMP_LOC:
+            case OP_JMP_FALSE:
+            case OP_JMP_IF_FALSE_KEEP:
+            case OP_JMP_IF_TRUE_KEEP:
+            case OP_FOR_STEP:
+            case OP_FOR_ITER:
+                mark_target(targets, VAL_AS_INT(operand), count);
+                break;
+            case OP_JMP_AFTER:
+                mark_target(targets, pc + VAL_AS_INT(operand), count);
+                break;
+            case OP_COMPARE:
+            case OP_COMPARE_DOUBLE_JMP:
+            case OP_COMPARE_INT_JMP:
+                if (is_compare_jump(instructs, pc))
+                    mark_target(targets, pc + 2, count);
+                break;
+            case OP_COMPARE_NAME_CONST_JMP:
+                if (pc + 3 < count)
+                    mark_target(targets,
+                            VAL_AS_INT((&instructs->code[pc + 3]->operand)),
+                            count);
+                break;
+            case OP_FOR_RANGE:
+                if (pc + 2 < count)
+                    mark_target(targets,
+                            VAL_AS_INT((&instructs->code[pc + 2]->operand)),
+                            count);
+                break;
+        }
+    }
+}
+
+// The index of a name in the names array of the generated file
+static int aot_name(aotgen *gen, char *name)
+{
+    for (int i = 0; i < gen->num_names; i++) {
+        if (!strcmp(gen->names[i], name))
+            return i;
+    }
+    if (gen->num_names + 1 > gen->name_capacity) {
+        int oldcapacity = gen->name_capacity;
+        gen->name_capacity = GROW_CAPACITY(oldcapacity);
+        gen->names = GROW_ARRAY(gen->names, char*, oldcapacity,
+                gen->name_capacity);
+    }
+    gen->names[gen->num_names] = name;
+    return gen->num_names++;
+}
+
+static inline void use_locals(aotgen *gen, int depth)
+{
+    if (depth > gen->maxdepth)
+        gen->maxdepth = depth;
+}
+
+// Pushes the values held in locals onto the stack
+static void emit_flush(aotgen *gen)
+{
+    for (int i = 0; i < gen->depth; i++)
+        emit_line(gen, "aot_push(vm, &v%d);", i);
+    gen->depth = 0;
+}
+
+// Pops the top count values of the stack into the locals
+static void emit_reload(aotgen *gen, int count)
+{
+    use_locals(gen, count);
+    for (int i = count - 1; i >= 0; i--)
+        emit_line(gen, "v%d = aot_pop(vm);", i);
+    gen->depth = count;
+}
+
+/* Makes sure the top count values are held in locals, popping the ones
+ * that aren't off the stack.
+ */
+static void emit_ensure(aotgen *gen, int count)
+{
+    int missing = count - gen->depth;
+    if (missing <= 0)
+        return;
+    use_locals(gen, count);
+    for (int i = gen->depth - 1; i >= 0; i--)
+        emit_line(gen, "v%d = v%d;", i + missing, i);
+    for (int i = missing - 1; i >= 0; i--)
+        emit_line(gen, "v%d = aot_pop(vm);", i);
+    gen->depth = count;
+}
+
+// Holds exactly the top count values in locals
+static void emit_spill(aotgen *gen, int count)
+{
+    emit_ensure(gen, count);
+    int spilled = gen->depth - count;
+    if (spilled <= 0)
+        return;
+    for (int i = 0; i < spilled; i++)
+        emit_line(gen, "aot_push(vm, &v%d);", i);
+    for (int i = 0; i < count; i++)
+        emit_line(gen, "v%d = v%d;", i, i + spilled);
+    gen->depth = count;
+}
+
+static void emit_goto(aotgen *gen, int pc)
+{
+    if (pc >= 0 && pc < gen->instructs->count)
+        emit_line(gen, "goto pc_%d;", pc);
+    else
+        emit_line(gen, "return INTERPRET_OK;");
+}
+
+/* Has the vm run the instruction at pc, once the locals are pushed.
+ * Carries on at the label of wherever it went unless that is next, or
+ * always for a next of -1.
+ */
+static void emit_dispatch(aotgen *gen, int pc, int next)
+{
+    gen->dispatched = true;
+    emit_line(gen, "if (!aot_dispatch(vm, instructs, %d, &state))", pc);
+    emit_line(gen, "    return state;");
+    if (next < 0) {
+        emit_line(gen, "goto resume;");
+        return;
+    }
+    emit_line(gen, "if (vm->top->pc != %d)", next);
+    emit_line(gen, "    goto resume;");
+}
+
+static void emit_constant(aotgen *gen, int local, value *constant)
+{
+    if (constant->type == VAL_LONG)
+        emit_line(gen, "v%d = aot_int(INT64_C(%" PRId64 "));", local,
+                VAL_AS_LONG(constant));
+    else
+        emit_line(gen, "v%d = aot_double(%.17g);", local,
+                VAL_AS_DOUBLE(constant));
+}
+
+/* Goes to taken if v0 op v1 holds and to other if not, for two ints or
+ * two doubles. Falls through for anything else.
+ */
+static void emit_compare(aotgen *gen, const char *op, int taken, int other)
+{
+    static const char *const types[][2] = {
+        { "AOT_INT", "i" },
+        { "AOT_DOUBLE", "d" },
+    };
+    for (int i = 0; i < 2; i++) {
+        const char *type = types[i][0], *field = types[i][1];
+        emit_line(gen, "if (v0.type == %s && v1.type == %s) {", type, type);
+        gen->indent++;
+        emit_line(gen, "if (v0.%s %s v1.%s)", field, op, field);
+        gen->indent++;
+        emit_goto(gen, taken);
+        gen->indent--;
+        emit_goto(gen, other);
+        gen->indent--;
+        emit_line(gen, "}");
+    }
+}
+
+// COMPARE and the JMP_FALSE after it
+static void emit_compare_jump(aotgen *gen, int pc)
+{
+    code8 **code = &gen->instructs->code[pc];
+    const char *op = compare_operator(VAL_AS_INT((&code[0]->operand)));
+
+    emit_spill(gen, 2);
+    emit_compare(gen, op, pc + 2, VAL_AS_INT((&code[1]->operand)));
+    emit_flush(gen);
+    gen->dispatched = true;
+    emit_line(gen, "if (!aot_dispatch(vm, instructs, %d, &state))", pc);
+    emit_line(gen, "    return state;");
+    emit_line(gen, "if (vm->top->pc == %d &&", pc + 1);
+    emit_line(gen, "        !aot_dispatch(vm, instructs, %d, &state))",
+            pc + 1);
+    emit_line(gen, "    return state;");
+    emit_line(gen, "goto resume;");
+}
+
+static void emit_arith(aotgen *gen, int pc, char op)
+{
+    emit_ensure(gen, 2);
+    int a = gen->depth - 2;
+    emit_line(gen, "if (!aot_arith('%c', &v%d, &v%d)) {", op, a, a + 1);
+    gen->indent++;
+    emit_flush(gen);
+    emit_dispatch(gen, pc, pc + 1);
+    emit_reload(gen, a + 1);
+    gen->indent--;
+    emit_line(gen, "}");
+}
+
+static void emit_compare_name_const(aotgen *gen, int pc)
+{
+    code8 **code = &gen->instructs->code[pc];
+    const char *op = compare_operator(VAL_AS_INT((&code[2]->operand)));
+
+    emit_flush(gen);
+    use_locals(gen, 2);
+    emit_constant(gen, 1, &code[1]->operand);
+    emit_line(gen, "if (aot_load_name(vm, name[%d], &v0)) {",
+            aot_name(gen, VAL_AS_STRING((&code[0]->operand))));
+    gen->indent++;
+    emit_compare(gen, op, pc + 4, VAL_AS_INT((&code[3]->operand)));
+    gen->indent--;
+    emit_line(gen, "}");
+    emit_dispatch(gen, pc, -1);
+}
+
+static void emit_add_name_const(aotgen *gen, int pc)
+{
+    code8 **code = &gen->instructs->code[pc];
+
+    emit_flush(gen);
+    use_locals(gen, 2);
+    emit_constant(gen, 1, &code[1]->operand);
+    emit_line(gen, "if (aot_load_name(vm, name[%d], &v0) &&",
+            aot_name(gen, VAL_AS_STRING((&code[0]->operand))));
+    emit_line(gen, "        aot_arith('+', &v0, &v1)) {");
+    gen->indent++;
+    emit_line(gen, "aot_store_name(vm, name[%d], &v0);",
+            aot_name(gen, VAL_AS_STRING((&code[3]->operand))));
+    emit_goto(gen, pc + 4);
+    gen->indent--;
+    emit_line(gen, "}");
+    emit_dispatch(gen, pc, -1);
+}
+
+/* Translates the instruction at pc. Returns how many instructions that
+ * took, where a superinstruction or a compare and its jump count as one.
+ */
+static int emit_instruction(aotgen *gen, int pc)
+{
+    instruct *instructs = gen->instructs;
+    code8 *code = instructs->code[pc];
+    value *operand = &code->operand;
+
+    if (gen->targets[pc])
+        emit_flush(gen);
+    if (!gen->depth) {
+        gen->labels[pc] = true;
+        fprintf(gen->out, "pc_%d:\n", pc);
+    }
+    emit_line(gen, "// %s, line %d", bytecode_name(code->bytecode),
+            code->line);
+
+    if (translated_compare_jump(gen, pc)) {
+        emit_compare_jump(gen, pc);
+        return 2;
+    }
+    char op = arith_operator(code->bytecode);
+    if (op) {
+        emit_arith(gen, pc, op);
+        return 1;
+    }
+    switch (code->bytecode) {
+        case OP_JMP_LOC:
+            emit_flush(gen);
+            emit_goto(gen, VAL_AS_INT(operand));
+            return 1;
+        case OP_JMP_AFTER:
+            emit_flush(gen);
+            emit_goto(gen, pc + VAL_AS_INT(operand));
+            return 1;
+        case OP_LOAD_CONSTANT:
+            if (!is_number(operand))
+                break;
+            use_locals(gen, gen->depth + 1);
+            emit_constant(gen, gen->depth++, operand);
+            return 1;
+        case OP_LOAD_NAME:
+        {
+            int depth = gen->depth;
+            use_locals(gen, depth + 1);
+            emit_line(gen, "if (!aot_load_name(vm, name[%d], &v%d)) {",
+                    aot_name(gen, VAL_AS_STRING(operand)), depth);
+            gen->indent++;
+            emit_flush(gen);
+            emit_dispatch(gen, pc, -1);
+            gen->indent--;
+            emit_line(gen, "}");
+            gen->depth = depth + 1;
+            return 1;
+        }
+        case OP_STORE_NAME:
+            emit_ensure(gen, 1);
+            emit_line(gen, "aot_store_name(vm, name[%d], &v%d);",
+                    aot_name(gen, VAL_AS_STRING(operand)), --gen->depth);
+            return 1;
+        case OP_POP:
+            if (!gen->depth)
+                break;
+            gen->depth--;
+            return 1;
+        case OP_COMPARE_NAME_CONST_JMP:
+            if (!translated_fused(instructs, pc) || !compare_operator(
+                        VAL_AS_INT((&instructs->code[pc + 2]->operand))))
+                break;
+            emit_compare_name_const(gen, pc);
+            return 4;
+        case OP_ADD_NAME_CONST_STORE:
+            if (!translated_fused(instructs, pc))
+                break;
+            emit_add_name_const(gen, pc);
+            return 4;
+    }
+    int width = instruction_width(code->bytecode);
+    emit_flush(gen);
+    emit_dispatch(gen, pc, pc + width);
+    return width;
+}
+
+static void emit_image(FILE *out, const uint8_t *image, size_t size)
+{
+    fprintf(out, "static const uint8_t image[%zu] = {", size);
+    for (size_t i = 0; i < size; i++) {
+        if (i % BYTES_PER_LINE == 0)
+            fprintf(out, "\n   ");
+        fprintf(out, " 0x%02x,", image[i]);
+    }
+    fprintf(out, "\n};\n\n");
+}
+
+static void emit_names(FILE *out, aotgen *gen)
+{
+    fprintf(out, "static const char *const names[] = {\n");
+    for (int i = 0; i < gen->num_names; i++)
+        fprintf(out, "    \"%s\",\n", gen->names[i]);
+    if (!gen->num_names)
+        fprintf(out, "    NULL,\n");
+    fprintf(out, "};\n\n");
+}
+
+/* Writes run() and the names it uses. The body is translated first,
+ * into memory, since the locals it needs are only known after.
+ */
+static void emit_run(FILE *out, aotgen *gen)
+{
+    instruct *instructs = gen->instructs;
+    int count = instructs->count;
+    char *body = NULL;
+    size_t length = 0;
+
+    gen->out = open_memstream(&body, &length);
+    gen->indent = 1;
+    for (int pc = 0; pc < count;) {
+        // Only the instructions inside one that something jumps to
+        int next = pc + emit_instruction(gen, pc);
+        for (pc++; pc < next && !gen->targets[pc]; pc++)
+            ;
+        if (pc < next)
+            emit_goto(gen, next);
+    }
+    fclose(gen->out);
+
+    emit_names(out, gen);
+    fprintf(out, "static intrpstate run(VM *vm, instruct *instructs, "
+            "primstring **name)\n");
+    fprintf(out, "{\n");
+    for (int i = 0; i < gen->maxdepth; i++)
+        fprintf(out, "    aotvalue v%d;\n", i);
+    if (gen->dispatched)
+        fprintf(out, "    intrpstate state;\n");
+    fprintf(out, "    goto resume;\n\n");
+    fwrite(body, 1, length, out);
+    fprintf(out, "    return INTERPRET_OK;\n\n");
+    fprintf(out, "resume:\n");
+    fprintf(out, "    switch (vm->top->pc) {\n");
+    for (int pc = 0; pc < count; pc++) {
+        if (gen->labels[pc])
+            fprintf(out, "        case %d: goto pc_%d;\n", pc, pc);
+    }
+    fprintf(out, "        default:\n");
+    fprintf(out, "            if (vm->top->pc < (size_t)instructs->count)\n");
+    fprintf(out, "                return execute(vm, instructs);\n");
+    fprintf(out, "            return INTERPRET_OK;\n");
+    fprintf(out, "    }\n");
+    fprintf(out, "}\n\n");
+    free(body);
+}
+
+/* Compiles the script and writes it out as C. Returns false if it
+ * doesn't compile.
+ */
+bool emit_c(AriFile *file, FILE *out)
+{
+    VM *vm = init_vm();
+    instruct instructs = compile(&vm->analyzer, file->source);
+    size_t size = 0;
+    uint8_t *image = instructs.count ?
+        write_bytecode_image(&instructs, &size) : NULL;
+    if (!image) {
+        reset_instruct(&instructs);
+        free_vm(vm);
+        return false;
+    }
+
+    aotgen gen;
+    memset(&gen, 0, sizeof(aotgen));
+    gen.instructs = &instructs;
+    gen.targets = ALLOCATE(bool, instructs.count);
+    gen.labels = ALLOCATE(bool, instructs.count);
+    memset(gen.targets, 0, sizeof(bool) * instructs.count);
+    memset(gen.labels, 0, sizeof(bool) * instructs.count);
+    find_targets(&instructs, gen.targets);
+
+    fprintf(out, "/* Generated by 'ari --emit-c %s'. */\n\n", file->path);
+    fprintf(out, "#include \"aot.h\"\n\n");
+    emit_image(out, image, size);
+    emit_run(out, &gen);
+    fprintf(out, "int main(void)\n");
+    fprintf(out, "{\n");
+    fprintf(out, "    return aot_main(image, sizeof(image), names, %d, run);\n",
+            gen.num_names);
+    fprintf(out, "}\n");
+
+    FREE_ARRAY(bool, gen.targets, instructs.count);
+    FREE_ARRAY(bool, gen.labels, instructs.count);
+    FREE_ARRAY(char*, gen.names, gen.name_capacity);
+    FREE_ARRAY(uint8_t, image, size);
+    reset_instruct(&instructs);
+    free_vm(vm);
+    return true;
+}
+
+/* Runs the instruction at pc in the vm, again if it deoptimized and
+ * stayed where it was. Returns false once the script is done, with how
+ * it ended in state.
+ */
+bool aot_dispatch(VM *vm, instruct *instructs, int pc, intrpstate *state)
+{
+    vm->top->pc = pc;
+    do {
+        if (!vm_dispatch(vm, instructs)) {
+            *state = INTERPRET_OK;
+            return false;
+        }
+        if (vm->haderror) {
+            *state = runtime_error_line(vm, instructs);
+            return false;
+        }
+    } while (vm->top->pc == (size_t)pc);
+    return true;
+}
+
+int aot_main(const uint8_t *image, size_t size, const char *const *names,
+        int num_names, aotentry run)
+{
+    VM *vm = init_vm();
+    init_instruct(&vm->global.instructs);
+    if (!load_bytecode_image(image, size, &vm->global.instructs)) {
+        fprintf(stderr, "Compiled for a different version of ari\n");
+        free_vm(vm);
+        return EXIT_FAILURE;
+    }
+
+    primstring **pnames = ALLOCATE(primstring*, num_names);
+    for (int i = 0; i < num_names; i++)
+        pnames[i] = create_primstring((char*)names[i]);
+    intrpstate state = run(vm, &vm->global.instructs, pnames);
+    for (int i = 0; i < num_names; i++)
+        free_primstring(pnames[i]);
+    FREE_ARRAY(primstring*, pnames, num_names);
+
+    reset_instruct(&vm->global.instructs);
+    free_vm(vm);
+    return state == INTERPRET_OK ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -1,12 +1,24 @@
 #include <stdio.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
 
 #include "builtin.h"
+#include "error.h"
+#include "eventloop.h"
 #include "memory.h"
+#include "objarray.h"
+#include "objdict.h"
+#include "objfile.h"
+#include "objgen.h"
+#include "objiter.h"
 #include "object.h"
+#include "objlist.h"
 #include "objprim.h"
 #include "objstack.h"
+#include "objwait.h"
+#include "parallel.h"
+#include "simd.h"
 #include "vm.h"
 
 
@@ -88,6 +100,9 @@ object *builtin_type(VM *vm, int argcount, object **args)
                 case PRIM_DOUBLE:
                     msg = "<double>";
                     break;
+                case PRIM_INT:
+                    msg = "<int>";
+                    break;
                 case PRIM_STRING:
                     msg = "<string>";
                     break;
@@ -118,6 +133,30 @@ object *builtin_type(VM *vm, int argcount, object **args)
         case OBJ_BUILTIN:
             msg = "<builtin>";
             break;
+        case OBJ_LIST:
+            msg = "<list>";
+            break;
+        case OBJ_FLOAT64ARRAY:
+            msg = "<float64array>";
+            break;
+        case OBJ_DICT:
+            msg = "<dict>";
+            break;
+        case OBJ_RANGE:
+            msg = "<range>";
+            break;
+        case OBJ_ITERATOR:
+            msg = "<iterator>";
+            break;
+        case OBJ_FILE:
+            msg = "<file>";
+            break;
+        case OBJ_GENERATOR:
+            msg = "<generator>";
+            break;
+        case OBJ_WAIT:
+            msg = "<wait>";
+            break;
         default:
             msg = "<unknown object type>";
             break;
@@ -133,3 +172,561 @@ object *builtin_clock(VM *vm, int argcount, object **args)
     PRIM_AS_DOUBLE(prim) = ((double)clock() / CLOCKS_PER_SEC);
     return (object*)prim;
 }
+
+object *builtin_len(VM *vm, int argcount, object **args)
+{
+    if (argcount != 1) {
+        runtime_error(vm, &vm->evalstack, 0,
+                "TypeError: len() takes one argument");
+        return NULL;
+    }
+    object *obj = args[0];
+    int64_t length = 0;
+    if (OBJ_IS_LIST(obj))
+        length = ((objlist*)obj)->count;
+    else if (OBJ_IS_FLOAT64ARRAY(obj))
+        length = ((objarray*)obj)->count;
+    else if (OBJ_IS_DICT(obj))
+        length = ((objdict*)obj)->count;
+    else if (OBJ_IS_PRIMITIVE(obj) && ((objprim*)obj)->ptype == PRIM_STRING)
+        length = PRIM_AS_STRING(((objprim*)obj))->length;
+    else {
+        runtime_error(vm, &vm->evalstack, 0,
+                "TypeError: len() takes a list, a float64array, a dict or a "
+                "string");
+        return NULL;
+    }
+    return vm_new_int(vm, length);
+}
+
+object *builtin_append(VM *vm, int argcount, object **args)
+{
+    if (argcount != 2 || !OBJ_IS_LIST(args[1])) {
+        runtime_error(vm, &vm->evalstack, 0,
+                "TypeError: append() takes a list and an item");
+        return NULL;
+    }
+    objlist_append((objlist*)args[1], args[0]);
+    return NULL;
+}
+
+/* Checks the arguments of a dict builtin: the dict, then a key if
+ * takes_key is set.
+ */
+static bool dict_args(VM *vm, const char *name, int argcount,
+        object **args, bool takes_key)
+{
+    int expected = takes_key ? 2 : 1;
+    if (argcount != expected || !OBJ_IS_DICT(args[argcount - 1])) {
+        runtime_error(vm, &vm->evalstack, 0, takes_key ?
+                "TypeError: %s() takes a dict and a key" :
+                "TypeError: %s() takes a dict", name);
+        return false;
+    }
+    if (takes_key && !objdict_valid_key(args[0])) {
+        runtime_error(vm, &vm->evalstack, 0,
+                "TypeError: dict keys must be strings or numbers");
+        return false;
+    }
+    return true;
+}
+
+object *builtin_contains(VM *vm, int argcount, object **args)
+{
+    if (!dict_args(vm, "contains", argcount, args, true))
+        return NULL;
+    if (objdict_get((objdict*)args[1], args[0]))
+        return vm->trueobj;
+    return vm->falseobj;
+}
+
+object *builtin_delete(VM *vm, int argcount, object **args)
+{
+    if (!dict_args(vm, "delete", argcount, args, true))
+        return NULL;
+    if (!objdict_remove((objdict*)args[1], args[0]))
+        runtime_error(vm, &vm->evalstack, 0, "KeyError: key not found");
+    return NULL;
+}
+
+object *builtin_keys(VM *vm, int argcount, object **args)
+{
+    if (!dict_args(vm, "keys", argcount, args, false))
+        return NULL;
+    objdict *dict = (objdict*)args[0];
+    objlist *result = init_objlist(dict->count);
+    for (int i = 0; i < dict->used; i++)
+        if (dict->entries[i].key)
+            objlist_append(result,
+                    (object*)objdict_copy_key(dict->entries[i].key));
+    return (object*)result;
+}
+
+object *builtin_values(VM *vm, int argcount, object **args)
+{
+    if (!dict_args(vm, "values", argcount, args, false))
+        return NULL;
+    objdict *dict = (objdict*)args[0];
+    objlist *result = init_objlist(dict->count);
+    for (int i = 0; i < dict->used; i++)
+        if (dict->entries[i].key)
+            objlist_append(result, dict->entries[i].value);
+    return (object*)result;
+}
+
+static inline bool is_string(object *obj)
+{
+    return OBJ_IS_PRIMITIVE(obj) && ((objprim*)obj)->ptype == PRIM_STRING;
+}
+
+/* range(stop), range(start, stop) or range(start, stop, step), with
+ * ints for all three.
+ */
+object *builtin_range(VM *vm, int argcount, object **args)
+{
+    int64_t bounds[3] = {0, 0, 1};
+    bool valid = argcount >= 1 && argcount <= 3;
+    for (int i = 0; valid && i < argcount; i++) {
+        objprim *arg = (objprim*)args[argcount - 1 - i];
+        valid = OBJ_IS_PRIMITIVE(args[argcount - 1 - i]) &&
+            arg->ptype == PRIM_INT;
+        if (valid)
+            bounds[i] = PRIM_AS_INT(arg);
+    }
+    if (!valid) {
+        runtime_error(vm, &vm->evalstack, 0,
+                "TypeError: range() takes one to three ints");
+        return NULL;
+    }
+    if (argcount == 1) {
+        bounds[1] = bounds[0];
+        bounds[0] = 0;
+    }
+    if (bounds[2] == 0) {
+        runtime_error(vm, &vm->evalstack, 0,
+                "ValueError: range() step must not be zero");
+        return NULL;
+    }
+    return (object*)init_objrange(bounds[0], bounds[1], bounds[2]);
+}
+
+// open(path) or open(path, mode), where mode is as for fopen()
+object *builtin_open(VM *vm, int argcount, object **args)
+{
+    if (argcount < 1 || argcount > 2 || !is_string(args[argcount - 1]) ||
+            (argcount == 2 && !is_string(args[0]))) {
+        runtime_error(vm, &vm->evalstack, 0,
+                "TypeError: open() takes a path and an optional mode");
+        return NULL;
+    }
+    char *path = PRIM_AS_RAWSTRING(((objprim*)args[argcount - 1]));
+    char *mode = argcount == 2 ? PRIM_AS_RAWSTRING(((objprim*)args[0])) : "r";
+    FILE *fp = fopen(path, mode);
+    if (!fp) {
+        runtime_error(vm, &vm->evalstack, 0,
+                "IOError: could not open '%s'", path);
+        return NULL;
+    }
+    return (object*)init_objfile(fp);
+}
+
+object *builtin_close(VM *vm, int argcount, object **args)
+{
+    if (argcount != 1 || !OBJ_IS_FILE(args[0])) {
+        runtime_error(vm, &vm->evalstack, 0,
+                "TypeError: close() takes a file");
+        return NULL;
+    }
+    if (!objfile_close((objfile*)args[0]))
+        runtime_error(vm, &vm->evalstack, 0,
+                "IOError: could not finish writing the file");
+    return NULL;
+}
+
+// Deletes the file at a path
+object *builtin_remove(VM *vm, int argcount, object **args)
+{
+    if (argcount != 1 || !is_string(args[0])) {
+        runtime_error(vm, &vm->evalstack, 0,
+                "TypeError: remove() takes a path");
+        return NULL;
+    }
+    char *path = PRIM_AS_RAWSTRING(((objprim*)args[0]));
+    if (remove(path) != 0)
+        runtime_error(vm, &vm->evalstack, 0,
+                "IOError: could not remove '%s'", path);
+    return NULL;
+}
+
+// read(file, count) gives up to count bytes, or null at the end
+object *builtin_read(VM *vm, int argcount, object **args)
+{
+    if (argcount != 2 || !OBJ_IS_FILE(args[1]) ||
+            !OBJ_IS_PRIMITIVE(args[0]) ||
+            ((objprim*)args[0])->ptype != PRIM_INT ||
+            PRIM_AS_INT(((objprim*)args[0])) < 0) {
+        runtime_error(vm, &vm->evalstack, 0,
+                "TypeError: read() takes a file and a count");
+        return NULL;
+    }
+    size_t length = 0;
+    char *data = objfile_read((objfile*)args[1],
+            PRIM_AS_INT(((objprim*)args[0])), &length);
+    if (!data)
+        return vm->nullobj;
+    objprim *result = create_new_primitive(PRIM_STRING);
+    PRIM_AS_STRING(result) = create_primstring(data);
+    return (object*)result;
+}
+
+// Writes a string to a file, then a newline if newline is set
+static object *write_string(VM *vm, const char *name, int argcount,
+        object **args, bool newline)
+{
+    if (argcount != 2 || !OBJ_IS_FILE(args[1]) || !is_string(args[0])) {
+        runtime_error(vm, &vm->evalstack, 0,
+                "TypeError: %s() takes a file and a string", name);
+        return NULL;
+    }
+    objfile *file = (objfile*)args[1];
+    primstring *string = PRIM_AS_STRING(((objprim*)args[0]));
+    if (!objfile_write(file, string->_string_, string->length) ||
+            (newline && !objfile_write(file, "\n", 1)))
+        runtime_error(vm, &vm->evalstack, 0,
+                "IOError: could not write to the file");
+    return NULL;
+}
+
+object *builtin_write(VM *vm, int argcount, object **args)
+{
+    return write_string(vm, "write", argcount, args, false);
+}
+
+object *builtin_writeline(VM *vm, int argcount, object **args)
+{
+    return write_string(vm, "writeline", argcount, args, true);
+}
+
+// The next value of a generator, or null once it has finished
+object *builtin_next(VM *vm, int argcount, object **args)
+{
+    if (argcount != 1 || !OBJ_IS_GENERATOR(args[0])) {
+        runtime_error(vm, &vm->evalstack, 0,
+                "TypeError: next() takes a generator");
+        return NULL;
+    }
+    object *item = vm_resume_generator(vm, (objgen*)args[0]);
+    if (vm->haderror)
+        return NULL;
+    return item ? item : vm->nullobj;
+}
+
+static inline bool is_number(object *obj)
+{
+    return OBJ_IS_PRIMITIVE(obj) && PRIM_IS_NUMBER(((objprim*)obj));
+}
+
+/* Checks the arguments of a float64array builtin: count arrays, and a
+ * number after them if takes_number is set. Arrays taken together must
+ * be the same length.
+ */
+static bool array_args(VM *vm, const char *name, int argcount,
+        object **args, int count, bool takes_number)
+{
+    int expected = count + (takes_number ? 1 : 0);
+    bool valid = argcount == expected;
+    for (int i = 0; valid && i < count; i++) {
+        object *obj = args[argcount - 1 - i];
+        valid = OBJ_IS_FLOAT64ARRAY(obj) &&
+            ((objarray*)obj)->count == ((objarray*)args[argcount - 1])->count;
+    }
+    if (valid && takes_number)
+        valid = is_number(args[0]);
+    if (!valid) {
+        if (takes_number)
+            runtime_error(vm, &vm->evalstack, 0,
+                    "TypeError: %s() takes a float64array and a number", name);
+        else if (count == 1)
+            runtime_error(vm, &vm->evalstack, 0,
+                    "TypeError: %s() takes a float64array", name);
+        else
+            runtime_error(vm, &vm->evalstack, 0,
+                    "TypeError: %s() takes %d float64arrays of the same "
+                    "length", name, count);
+    }
+    return valid;
+}
+
+object *builtin_float64array(VM *vm, int argcount, object **args)
+{
+    if (argcount != 1) {
+        runtime_error(vm, &vm->evalstack, 0,
+                "TypeError: float64array() takes a length, a list or a "
+                "float64array");
+        return NULL;
+    }
+    object *obj = args[0];
+    objarray *arrayobj = NULL;
+    if (is_number(obj)) {
+        double length = PRIM_NUMBER_AS_DOUBLE(((objprim*)obj));
+        if (length < 0 || length != (int)length) {
+            runtime_error(vm, &vm->evalstack, 0,
+                    "ValueError: float64array() length must be a whole "
+                    "number");
+            return NULL;
+        }
+        arrayobj = init_objarray((int)length);
+    }
+    else if (OBJ_IS_LIST(obj)) {
+        objlist *listobj = (objlist*)obj;
+        for (int i = 0; i < listobj->count; i++) {
+            if (!is_number(listobj->items[i])) {
+                runtime_error(vm, &vm->evalstack, 0,
+                        "TypeError: float64array() list items must be "
+                        "numbers");
+                return NULL;
+            }
+        }
+        arrayobj = init_objarray(listobj->count);
+        for (int i = 0; i < listobj->count; i++) {
+            objprim *item = (objprim*)listobj->items[i];
+            arrayobj->data[i] = PRIM_NUMBER_AS_DOUBLE(item);
+        }
+    }
+    else if (OBJ_IS_FLOAT64ARRAY(obj)) {
+        objarray *source = (objarray*)obj;
+        arrayobj = init_objarray(source->count);
+        if (source->count)
+            memcpy(arrayobj->data, source->data,
+                    sizeof(double) * source->count);
+    }
+    else {
+        runtime_error(vm, &vm->evalstack, 0,
+                "TypeError: float64array() takes a length, a list or a "
+                "float64array");
+        return NULL;
+    }
+    return (object*)arrayobj;
+}
+
+object *builtin_sum(VM *vm, int argcount, object **args)
+{
+    if (!array_args(vm, "sum", argcount, args, 1, false))
+        return NULL;
+    objarray *a = (objarray*)args[0];
+    return vm_new_double(vm, simd_sum(a->data, a->count));
+}
+
+object *builtin_min(VM *vm, int argcount, object **args)
+{
+    if (!array_args(vm, "min", argcount, args, 1, false))
+        return NULL;
+    objarray *a = (objarray*)args[0];
+    if (!a->count) {
+        runtime_error(vm, &vm->evalstack, 0,
+                "ValueError: min() of an empty float64array");
+        return NULL;
+    }
+    return vm_new_double(vm, simd_min(a->data, a->count));
+}
+
+object *builtin_max(VM *vm, int argcount, object **args)
+{
+    if (!array_args(vm, "max", argcount, args, 1, false))
+        return NULL;
+    objarray *a = (objarray*)args[0];
+    if (!a->count) {
+        runtime_error(vm, &vm->evalstack, 0,
+                "ValueError: max() of an empty float64array");
+        return NULL;
+    }
+    return vm_new_double(vm, simd_max(a->data, a->count));
+}
+
+object *builtin_dot(VM *vm, int argcount, object **args)
+{
+    if (!array_args(vm, "dot", argcount, args, 2, false))
+        return NULL;
+    objarray *a = (objarray*)args[1];
+    objarray *b = (objarray*)args[0];
+    return vm_new_double(vm, simd_dot(a->data, b->data, a->count));
+}
+
+object *builtin_add(VM *vm, int argcount, object **args)
+{
+    if (!array_args(vm, "add", argcount, args, 2, false))
+        return NULL;
+    objarray *a = (objarray*)args[1];
+    objarray *b = (objarray*)args[0];
+    objarray *result = init_objarray(a->count);
+    simd_add(result->data, a->data, b->data, a->count);
+    return (object*)result;
+}
+
+object *builtin_mul(VM *vm, int argcount, object **args)
+{
+    if (!array_args(vm, "mul", argcount, args, 2, false))
+        return NULL;
+    objarray *a = (objarray*)args[1];
+    objarray *b = (objarray*)args[0];
+    objarray *result = init_objarray(a->count);
+    simd_mul(result->data, a->data, b->data, a->count);
+    return (object*)result;
+}
+
+object *builtin_scale(VM *vm, int argcount, object **args)
+{
+    if (!array_args(vm, "scale", argcount, args, 1, true))
+        return NULL;
+    objarray *a = (objarray*)args[1];
+    double k = PRIM_NUMBER_AS_DOUBLE(((objprim*)args[0]));
+    objarray *result = init_objarray(a->count);
+    simd_scale(result->data, a->data, k, a->count);
+    return (object*)result;
+}
+
+object *builtin_prefix_sum(VM *vm, int argcount, object **args)
+{
+    if (!array_args(vm, "prefix_sum", argcount, args, 1, false))
+        return NULL;
+    objarray *a = (objarray*)args[0];
+    objarray *result = init_objarray(a->count);
+    simd_prefix_sum(result->data, a->data, a->count);
+    return (object*)result;
+}
+
+// Adds a generator to the tasks the next run() runs
+object *builtin_spawn(VM *vm, int argcount, object **args)
+{
+    if (argcount != 1 || !OBJ_IS_GENERATOR(args[0])) {
+        runtime_error(vm, &vm->evalstack, 0,
+                "TypeError: spawn() takes a generator");
+        return NULL;
+    }
+    if (!vm->events)
+        vm->events = init_eventloop();
+    eventloop_spawn(vm->events, (objgen*)args[0]);
+    return NULL;
+}
+
+// Runs the spawned tasks until all of them have finished
+object *builtin_run(VM *vm, int argcount, object **args)
+{
+    if (argcount != 0) {
+        runtime_error(vm, &vm->evalstack, 0,
+                "TypeError: run() takes no arguments");
+        return NULL;
+    }
+    if (vm->events)
+        eventloop_run(vm, vm->events);
+    return NULL;
+}
+
+object *builtin_sleep(VM *vm, int argcount, object **args)
+{
+    if (argcount != 1 || !is_number(args[0])) {
+        runtime_error(vm, &vm->evalstack, 0,
+                "TypeError: sleep() takes a number of seconds");
+        return NULL;
+    }
+    objwait *wait = init_objwait(WAIT_TIMER);
+    wait->seconds = PRIM_NUMBER_AS_DOUBLE(((objprim*)args[0]));
+    return (object*)wait;
+}
+
+// Makes the wait for await_read() or await_write(), on a file or an fd
+static object *await_fd(VM *vm, const char *name, int argcount,
+        object **args, waitkind kind)
+{
+    object *arg = argcount == 1 ? args[0] : NULL;
+    int fd = -1;
+    FILE *fp = NULL;
+    if (arg && OBJ_IS_FILE(arg)) {
+        fp = ((objfile*)arg)->fp;
+        if (!fp) {
+            runtime_error(vm, &vm->evalstack, 0, "IOError: file is closed");
+            return NULL;
+        }
+        fd = fileno(fp);
+    }
+    else if (arg && OBJ_IS_PRIMITIVE(arg) &&
+            ((objprim*)arg)->ptype == PRIM_INT) {
+        fd = (int)PRIM_AS_INT(((objprim*)arg));
+        // input() reads fd 0 through stdin
+        if (fd == 0)
+            fp = stdin;
+    }
+    if (fd < 0) {
+        runtime_error(vm, &vm->evalstack, 0,
+                "TypeError: %s() takes a file or a file descriptor", name);
+        return NULL;
+    }
+    objwait *wait = init_objwait(kind);
+    wait->fd = fd;
+    wait->fp = fp;
+    return (object*)wait;
+}
+
+object *builtin_await_read(VM *vm, int argcount, object **args)
+{
+    return await_fd(vm, "await_read", argcount, args, WAIT_READ);
+}
+
+object *builtin_await_write(VM *vm, int argcount, object **args)
+{
+    return await_fd(vm, "await_write", argcount, args, WAIT_WRITE);
+}
+
+// The next line of a file without its newline, or null at the end
+object *builtin_readline(VM *vm, int argcount, object **args)
+{
+    if (argcount != 1 || !OBJ_IS_FILE(args[0])) {
+        runtime_error(vm, &vm->evalstack, 0,
+                "TypeError: readline() takes a file");
+        return NULL;
+    }
+    char *line = objfile_readline((objfile*)args[0]);
+    if (!line)
+        return vm->nullobj;
+    objprim *result = create_new_primitive(PRIM_STRING);
+    PRIM_AS_STRING(result) = create_primstring(line);
+    return (object*)result;
+}
+
+/* parallel_map(func, list) or parallel_map(func, list, workers), which
+ * gives a list of func(item) for each item. Without a worker count there
+ * is one worker per processor. func sees the global functions and classes
+ * and copies of the global values it could be passed, but not instances,
+ * files or generators, whose names it won't find.
+ */
+object *builtin_parallel_map(VM *vm, int argcount, object **args)
+{
+    bool valid = (argcount == 2 || argcount == 3) &&
+        OBJ_IS_CODE(args[argcount - 1]) && OBJ_IS_LIST(args[argcount - 2]);
+    if (valid && argcount == 3)
+        valid = OBJ_IS_PRIMITIVE(args[0]) &&
+            ((objprim*)args[0])->ptype == PRIM_INT &&
+            PRIM_AS_INT(((objprim*)args[0])) > 0;
+    if (!valid) {
+        runtime_error(vm, &vm->evalstack, 0,
+                "TypeError: parallel_map() takes a function, a list and an "
+                "optional number of workers");
+        return NULL;
+    }
+    objcode *funcobj = (objcode*)args[argcount - 1];
+    objlist *list = (objlist*)args[argcount - 2];
+    if (funcobj->argcount != 1 || is_generator(funcobj)) {
+        runtime_error(vm, &vm->evalstack, 0,
+                "TypeError: parallel_map() takes a function of one argument");
+        return NULL;
+    }
+    if (!parallel_can_pass(vm, (object*)list, "pass"))
+        return NULL;
+    int64_t workers = argcount == 3 ? PRIM_AS_INT(((objprim*)args[0])) :
+        sysconf(_SC_NPROCESSORS_ONLN);
+    if (workers < 1)
+        workers = 1;
+    if (workers > PARALLEL_MAX_WORKERS)
+        workers = PARALLEL_MAX_WORKERS;
+    return parallel_map(vm, funcobj, list, (int)workers);
+}
@@ -22,5 +22,41 @@ object *builtin_println(VM *vm, int argcount, object **args);
 object *builtin_input(VM *vm, int argcount, object **args);
 object *builtin_type(VM *Vm, int argcount, object **args);
 object *builtin_clock(VM *vm, int argcount, object **args);
+object *builtin_len(VM *vm, int argcount, object **args);
+object *builtin_append(VM *vm, int argcount, object **args);
+object *builtin_contains(VM *vm, int argcount, object **args);
+object *builtin_delete(VM *vm, int argcount, object **args);
+object *builtin_keys(VM *vm, int argcount, object **args);
+object *builtin_values(VM *vm, int argcount, object **args);
+object *builtin_range(VM *vm, int argcount, object **args);
+object *builtin_open(VM *vm, int argcount, object **args);
+object *builtin_close(VM *vm, int argcount, object **args);
+object *builtin_remove(VM *vm, int argcount, object **args);
+object *builtin_read(VM *vm, int argcount, object **args);
+object *builtin_write(VM *vm, int argcount, object **args);
+object *builtin_writeline(VM *vm, int argcount, object **args);
+object *builtin_next(VM *vm, int argcount, object **args);
+object *builtin_readline(VM *vm, int argcount, object **args);
+
+/* Event loop builtins, for generators run as tasks by eventloop.c */
+object *builtin_spawn(VM *vm, int argcount, object **args);
+object *builtin_run(VM *vm, int argcount, object **args);
+object *builtin_sleep(VM *vm, int argcount, object **args);
+object *builtin_await_read(VM *vm, int argcount, object **args);
+object *builtin_await_write(VM *vm, int argcount, object **args);
+
+/* Runs a function over a list on worker threads, in parallel.c */
+object *builtin_parallel_map(VM *vm, int argcount, object **args);
+
+/* float64array builtins, run with the loops in simd.c */
+object *builtin_float64array(VM *vm, int argcount, object **args);
+object *builtin_sum(VM *vm, int argcount, object **args);
+object *builtin_min(VM *vm, int argcount, object **args);
+object *builtin_max(VM *vm, int argcount, object **args);
+object *builtin_dot(VM *vm, int argcount, object **args);
+object *builtin_add(VM *vm, int argcount, object **args);
+object *builtin_mul(VM *vm, int argcount, object **args);
+object *builtin_scale(VM *vm, int argcount, object **args);
+object *builtin_prefix_sum(VM *vm, int argcount, object **args);
 
 #endif
@@ -0,0 +1,504 @@
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "memory.h"
+#include "objclass.h"
+#include "objcode.h"
+#include "opcode.h"
+
+/* Layout of an .aric file. Every integer is little-endian, and doubles
+ * are stored as their IEEE-754 bits, so a cache file does not depend on
+ * the machine that wrote it.
+ *
+ *   header   magic "ARIC", u32 version, u32 opcode count, u32 reserved,
+ *            u64 source hash, i64 mtime sec, i64 mtime nsec, u64 size
+ *   instruct u32 count, then per instruction:
+ *            u8 bytecode, u8 value type, i32 line, operand
+ *   operand  empty/bool/int/null: i32; double, long: u64;
+ *            string: u32 length + bytes;
+ *            object: u8 object type, then
+ *              OBJ_CODE:  name, u32 argcount, argcount names, instruct
+ *              OBJ_CLASS: name, instruct
+ *
+ * The opcode count is part of the header so that adding an opcode
+ * invalidates old caches even if ARIC_VERSION was not bumped.
+ */
+#define ARIC_MAGIC      "ARIC"
+#define ARIC_VERSION    3
+#define ARIC_HEADER     48
+
+typedef struct
+{
+    uint8_t *bytes;
+    size_t count;
+    size_t capacity;
+} cachewriter;
+
+typedef struct
+{
+    const uint8_t *cursor;
+    const uint8_t *end;
+    bool ok;
+} cachereader;
+
+typedef struct
+{
+    uint64_t hash;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t size;
+} sourcestamp;
+
+/* FNV-1a, 64 bit */
+static uint64_t hash_source(const char *source, size_t length)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (uint8_t)source[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static bool stamp_source(AriFile *file, sourcestamp *stamp)
+{
+    struct stat st;
+    if (stat(file->path, &st) != 0)
+        return false;
+    stamp->hash = hash_source(file->source, strlen(file->source));
+    stamp->mtime_sec = st.st_mtim.tv_sec;
+    stamp->mtime_nsec = st.st_mtim.tv_nsec;
+    stamp->size = st.st_size;
+    return true;
+}
+
+static char *cache_path(AriFile *file)
+{
+    const char *dir = getenv(ARI_CACHE_DIR_ENV);
+    char *path = NULL;
+
+    if (dir && *dir) {
+        /* Scripts with the same name in different directories share a
+         * cache dir, so the name carries a hash of the source path.
+         */
+        const char *name = file->filename;
+        const char *dot = strrchr(name, '.');
+        int namelength = dot ? (int)(dot - name) : (int)strlen(name);
+        uint64_t pathhash = hash_source(file->path, strlen(file->path));
+        size_t length = strlen(dir) + namelength + 32;
+        path = ALLOCATE(char, length);
+        snprintf(path, length, "%s/%.*s-%016llx.aric", dir, namelength,
+                name, (unsigned long long)pathhash);
+    }
+    else {
+        size_t length = strlen(file->path) + 2;
+        path = ALLOCATE(char, length);
+        snprintf(path, length, "%sc", file->path);
+    }
+    return path;
+}
+
+/* Writing */
+
+static void write_bytes(cachewriter *writer, const void *bytes, size_t count)
+{
+    if (writer->count + count > writer->capacity) {
+        size_t oldcapacity = writer->capacity;
+        while (writer->count + count > writer->capacity)
+            writer->capacity = GROW_CAPACITY(writer->capacity);
+        writer->bytes = GROW_ARRAY(writer->bytes, uint8_t, oldcapacity,
+                writer->capacity);
+    }
+    memcpy(writer->bytes + writer->count, bytes, count);
+    writer->count += count;
+}
+
+static void write_u8(cachewriter *writer, uint8_t byte)
+{
+    write_bytes(writer, &byte, 1);
+}
+
+static void write_u32(cachewriter *writer, uint32_t number)
+{
+    uint8_t bytes[4];
+    for (int i = 0; i < 4; i++)
+        bytes[i] = (uint8_t)(number >> (8 * i));
+    write_bytes(writer, bytes, 4);
+}
+
+static void write_u64(cachewriter *writer, uint64_t number)
+{
+    uint8_t bytes[8];
+    for (int i = 0; i < 8; i++)
+        bytes[i] = (uint8_t)(number >> (8 * i));
+    write_bytes(writer, bytes, 8);
+}
+
+static void write_string(cachewriter *writer, const char *string)
+{
+    uint32_t length = string ? strlen(string) : 0;
+    write_u32(writer, length);
+    write_bytes(writer, string, length);
+}
+
+static bool write_instruct(cachewriter *writer, instruct *instructs);
+
+static bool write_object(cachewriter *writer, object *obj)
+{
+    write_u8(writer, obj->type);
+    switch (obj->type) {
+        case OBJ_CODE:
+        {
+            objcode *codeobj = (objcode*)obj;
+            write_string(writer, codeobj->name);
+            write_u32(writer, codeobj->argcount);
+            for (size_t i = 0; i < codeobj->argcount; i++)
+                write_string(writer,
+                        PRIM_AS_RAWSTRING(codeobj->arguments[i]));
+            return write_instruct(writer, &codeobj->instructs);
+        }
+        case OBJ_CLASS:
+        {
+            objclass *classobj = (objclass*)obj;
+            write_string(writer, PRIMSTRING_AS_RAWSTRING(classobj->name));
+            return write_instruct(writer, &classobj->instructs);
+        }
+        default:
+            return false;
+    }
+}
+
+static bool write_instruct(cachewriter *writer, instruct *instructs)
+{
+    write_u32(writer, instructs->count);
+    for (int i = 0; i < instructs->count; i++) {
+        code8 *code = instructs->code[i];
+        value *operand = &code->operand;
+        write_u8(writer, code->bytecode);
+        write_u8(writer, operand->type);
+        write_u32(writer, (uint32_t)code->line);
+        switch (operand->type) {
+            /* Jump targets and compare types are patched into operands
+             * that are still typed VAL_EMPTY, so the int is always kept.
+             */
+            case VAL_EMPTY:
+            case VAL_BOOL:
+            case VAL_INT:
+            case VAL_NULL:
+                write_u32(writer, (uint32_t)VAL_AS_INT(operand));
+                break;
+            case VAL_DOUBLE:
+            {
+                uint64_t bits;
+                memcpy(&bits, &VAL_AS_DOUBLE(operand), sizeof(bits));
+                write_u64(writer, bits);
+                break;
+            }
+            case VAL_LONG:
+                write_u64(writer, (uint64_t)VAL_AS_LONG(operand));
+                break;
+            case VAL_STRING:
+                write_string(writer, VAL_AS_STRING(operand));
+                break;
+            case VAL_OBJECT:
+                if (!write_object(writer, VAL_AS_OBJECT(operand)))
+                    return false;
+                break;
+            default:
+                return false;
+        }
+    }
+    return true;
+}
+
+static void write_header(cachewriter *writer, sourcestamp *stamp)
+{
+    write_bytes(writer, ARIC_MAGIC, 4);
+    write_u32(writer, ARIC_VERSION);
+    write_u32(writer, OP_COUNT);
+    write_u32(writer, 0);
+    write_u64(writer, stamp->hash);
+    write_u64(writer, (uint64_t)stamp->mtime_sec);
+    write_u64(writer, (uint64_t)stamp->mtime_nsec);
+    write_u64(writer, stamp->size);
+}
+
+void write_bytecode_cache(AriFile *file, instruct *instructs)
+{
+    sourcestamp stamp;
+    if (!instructs->count || !stamp_source(file, &stamp))
+        return;
+
+    cachewriter writer = {NULL, 0, 0};
+    write_header(&writer, &stamp);
+    bool ok = write_instruct(&writer, instructs);
+
+    char *path = cache_path(file);
+    size_t templength = strlen(path) + 24;
+    char *temp = ALLOCATE(char, templength);
+    snprintf(temp, templength, "%s.%ld.tmp", path, (long)getpid());
+
+    /* Write to a private file and rename it into place, so concurrent
+     * runs of the same script never see a half written cache.
+     */
+    if (ok) {
+        FILE *out = fopen(temp, "wb");
+        if (out) {
+            ok = fwrite(writer.bytes, 1, writer.count, out) == writer.count;
+            ok = (fclose(out) == 0) && ok;
+            if (!ok || rename(temp, path) != 0)
+                remove(temp);
+        }
+    }
+
+    FREE(char, temp);
+    FREE(char, path);
+    FREE_ARRAY(uint8_t, writer.bytes, writer.capacity);
+}
+
+/* An image is a cache without a source stamp, for compiled scripts that
+ * are carried inside something else, like the C written by --emit-c.
+ * Returns NULL if the instructions can't be written.
+ */
+uint8_t *write_bytecode_image(instruct *instructs, size_t *size)
+{
+    sourcestamp stamp = {0, 0, 0, 0};
+    cachewriter writer = {NULL, 0, 0};
+    write_header(&writer, &stamp);
+    if (!write_instruct(&writer, instructs)) {
+        FREE_ARRAY(uint8_t, writer.bytes, writer.capacity);
+        return NULL;
+    }
+    *size = writer.count;
+    return writer.bytes;
+}
+
+/* Reading */
+
+static const uint8_t *read_bytes(cachereader *reader, size_t count)
+{
+    if (!reader->ok || (size_t)(reader->end - reader->cursor) < count) {
+        reader->ok = false;
+        return NULL;
+    }
+    const uint8_t *bytes = reader->cursor;
+    reader->cursor += count;
+    return bytes;
+}
+
+static uint8_t read_u8(cachereader *reader)
+{
+    const uint8_t *bytes = read_bytes(reader, 1);
+    return bytes ? bytes[0] : 0;
+}
+
+static uint32_t read_u32(cachereader *reader)
+{
+    const uint8_t *bytes = read_bytes(reader, 4);
+    uint32_t number = 0;
+    if (bytes)
+        for (int i = 0; i < 4; i++)
+            number |= (uint32_t)bytes[i] << (8 * i);
+    return number;
+}
+
+static uint64_t read_u64(cachereader *reader)
+{
+    const uint8_t *bytes = read_bytes(reader, 8);
+    uint64_t number = 0;
+    if (bytes)
+        for (int i = 0; i < 8; i++)
+            number |= (uint64_t)bytes[i] << (8 * i);
+    return number;
+}
+
+static char *read_string(cachereader *reader)
+{
+    uint32_t length = read_u32(reader);
+    const uint8_t *bytes = read_bytes(reader, length);
+    if (!bytes)
+        return NULL;
+    char *string = ALLOCATE(char, length + 1);
+    memcpy(string, bytes, length);
+    string[length] = '\0';
+    return string;
+}
+
+static bool read_instruct(cachereader *reader, instruct *instructs);
+
+static object *read_object(cachereader *reader)
+{
+    switch (read_u8(reader)) {
+        case OBJ_CODE:
+        {
+            char *name = read_string(reader);
+            uint32_t argcount = read_u32(reader);
+            if (!reader->ok || argcount > (size_t)(reader->end -
+                        reader->cursor)) {
+                reader->ok = false;
+                return NULL;
+            }
+            objprim **arguments = ALLOCATE(objprim*, argcount);
+            for (uint32_t i = 0; i < argcount; i++) {
+                char *argname = read_string(reader);
+                if (!argname) {
+                    argname = ALLOCATE(char, 1);
+                    argname[0] = '\0';
+                }
+                int length = strlen(argname);
+                objprim *prim = create_new_primitive(PRIM_STRING);
+                PRIM_AS_STRING(prim) = init_primstring(length,
+                        hashkey(argname, length), argname);
+                arguments[i] = prim;
+            }
+            objcode *codeobj = init_objcode(argcount, arguments);
+            codeobj->name = name;
+            read_instruct(reader, &codeobj->instructs);
+            return (object*)codeobj;
+        }
+        case OBJ_CLASS:
+        {
+            char *name = read_string(reader);
+            objclass *classobj = init_objclass();
+            classobj->name = create_primstring(name ? name : "");
+            if (name)
+                FREE(char, name);
+            read_instruct(reader, &classobj->instructs);
+            return (object*)classobj;
+        }
+        default:
+            reader->ok = false;
+            return NULL;
+    }
+}
+
+static bool read_instruct(cachereader *reader, instruct *instructs)
+{
+    uint32_t count = read_u32(reader);
+    // Each instruction takes at least ten bytes
+    if (!reader->ok || count > (size_t)(reader->end - reader->cursor) / 10) {
+        reader->ok = false;
+        return false;
+    }
+
+    instructs->code = ALLOCATE(code8*, count);
+    instructs->capacity = count;
+    for (uint32_t i = 0; i < count; i++)
+        instructs->code[i] = NULL;
+
+    for (uint32_t i = 0; i < count && reader->ok; i++) {
+        code8 *code = ALLOCATE(code8, 1);
+        code->bytecode = read_u8(reader);
+        code->hotness = 0;
+        code->deopts = 0;
+        value *operand = &code->operand;
+        operand->type = read_u8(reader);
+        code->line = (int)read_u32(reader);
+        VAL_AS_OBJECT(operand) = NULL;
+        switch (operand->type) {
+            case VAL_EMPTY:
+            case VAL_BOOL:
+            case VAL_INT:
+            case VAL_NULL:
+                VAL_AS_INT(operand) = (int)read_u32(reader);
+                break;
+            case VAL_DOUBLE:
+            {
+                uint64_t bits = read_u64(reader);
+                memcpy(&VAL_AS_DOUBLE(operand), &bits, sizeof(bits));
+                break;
+            }
+            case VAL_LONG:
+                VAL_AS_LONG(operand) = (int64_t)read_u64(reader);
+                break;
+            case VAL_STRING:
+                VAL_AS_STRING(operand) = read_string(reader);
+                if (!VAL_AS_STRING(operand))
+                    operand->type = VAL_EMPTY;
+                break;
+            case VAL_OBJECT:
+                VAL_AS_OBJECT(operand) = read_object(reader);
+                break;
+            default:
+                operand->type = VAL_EMPTY;
+                reader->ok = false;
+                break;
+        }
+        if (code->bytecode >= OP_COUNT)
+            reader->ok = false;
+        instructs->code[i] = code;
+        instructs->count = i + 1;
+    }
+    return reader->ok;
+}
+
+static bool read_header(cachereader *reader, sourcestamp *stamp)
+{
+    const uint8_t *magic = read_bytes(reader, 4);
+    if (!magic || memcmp(magic, ARIC_MAGIC, 4) != 0)
+        return false;
+    if (read_u32(reader) != ARIC_VERSION || read_u32(reader) != OP_COUNT)
+        return false;
+    read_u32(reader);
+    return read_u64(reader) == stamp->hash &&
+        (int64_t)read_u64(reader) == stamp->mtime_sec &&
+        (int64_t)read_u64(reader) == stamp->mtime_nsec &&
+        read_u64(reader) == stamp->size && reader->ok;
+}
+
+/* Maps the cache file for the script, if there is one, and rebuilds the
+ * compiled instructions from it. Returns false when the cache is missing
+ * or doesn't belong to the current source, and the script has to be
+ * compiled.
+ */
+bool load_bytecode_cache(AriFile *file, instruct *instructs)
+{
+    sourcestamp stamp;
+    if (!stamp_source(file, &stamp))
+        return false;
+
+    char *path = cache_path(file);
+    int fd = open(path, O_RDONLY);
+    FREE(char, path);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < ARIC_HEADER) {
+        close(fd);
+        return false;
+    }
+    size_t size = st.st_size;
+    void *mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+        return false;
+
+    cachereader reader = {mapped, (const uint8_t*)mapped + size, true};
+    bool loaded = read_header(&reader, &stamp) &&
+        read_instruct(&reader, instructs) && reader.cursor == reader.end;
+    munmap(mapped, size);
+
+    if (!loaded)
+        reset_instruct(instructs);
+    return loaded;
+}
+
+bool load_bytecode_image(const uint8_t *image, size_t size,
+        instruct *instructs)
+{
+    sourcestamp stamp = {0, 0, 0, 0};
+    cachereader reader = {image, image + size, true};
+    bool loaded = read_header(&reader, &stamp) &&
+        read_instruct(&reader, instructs) && reader.cursor == reader.end;
+    if (!loaded)
+        reset_instruct(instructs);
+    return loaded;
+}
@@ -1,3 +1,4 @@
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -8,7 +9,9 @@
 #include "object.h"
 #include "objclass.h"
 #include "objcode.h"
+#include "objprim.h"
 #include "opcode.h"
+#include "optimize.h"
 #include "parser.h"
 #include "token.h"
 #include "tokenizer.h"
@@ -19,7 +22,6 @@ static void compile_block(instruct *instructs, stmt *statement,
 static void start_compile(instruct *instructs, stmt **statements, 
         int num_statements);
 
-
 static char *take_string(token *tok)
 {
     int length = tok->length;
@@ -62,6 +64,8 @@ static code8 *create_code(uint8_t bytecode, value operand, int line)
 {
     code8 *code = ALLOCATE(code8, 1);
     code->bytecode = bytecode;
+    code->hotness = 0;
+    code->deopts = 0;
     code->operand = operand;
     code->line = line;
     return code;
@@ -79,12 +83,278 @@ static int emit_instruction(instruct *instructs, uint8_t bytecode,
     return current;
 }
 
-static void compile_expression(instruct *instructs, expr *expression, 
+static bool fold_constant(expr *expression, value *result);
+
+static inline void free_constant(value *constant)
+{
+    if (VAL_IS_STRING(constant))
+        FREE(char, VAL_AS_STRING(constant));
+}
+
+/* String constants keep the quotes of their source literal, which
+ * op_load_constant strips when the primstring is built.
+ */
+static char *fold_concatenate(char *a, char *b)
+{
+    int length_a = strlen(a) - 2;
+    int length_b = strlen(b) - 2;
+    int length = length_a + length_b + 2;
+    char *buffer = ALLOCATE(char, length + 1);
+
+    buffer[0] = '"';
+    memcpy(buffer + 1, a + 1, length_a);
+    memcpy(buffer + 1 + length_a, b + 1, length_b);
+    buffer[length - 1] = '"';
+    buffer[length] = '\0';
+    return buffer;
+}
+
+static inline bool is_number_value(value *constant)
+{
+    return VAL_IS_DOUBLE(constant) || VAL_IS_LONG(constant);
+}
+
+static inline double number_value(value *constant)
+{
+    return VAL_IS_LONG(constant) ? (double)VAL_AS_LONG(constant) :
+        VAL_AS_DOUBLE(constant);
+}
+
+/* Folds an operation on two ints the way the vm runs it. Returns false
+ * for division and for results that overflow, which come out as doubles.
+ */
+static bool fold_ints(int64_t x, int64_t y, tokentype optype, value *c)
+{
+    c->type = VAL_BOOL;
+    switch (optype) {
+        case TOKEN_PLUS:
+        case TOKEN_MINUS:
+        case TOKEN_STAR:
+        {
+            char op = optype == TOKEN_PLUS ? '+' :
+                optype == TOKEN_MINUS ? '-' : '*';
+            c->type = VAL_LONG;
+            return int_arith(op, x, y, &VAL_AS_LONG(c));
+        }
+        case TOKEN_EQUAL_EQUAL:
+            VAL_AS_BOOL(c) = (x == y);
+            return true;
+        case TOKEN_BANG_EQUAL:
+            VAL_AS_BOOL(c) = (x != y);
+            return true;
+        case TOKEN_GREATER:
+            VAL_AS_BOOL(c) = (x > y);
+            return true;
+        case TOKEN_GREATER_EQUAL:
+            VAL_AS_BOOL(c) = (x >= y);
+            return true;
+        case TOKEN_LESS:
+            VAL_AS_BOOL(c) = (x < y);
+            return true;
+        case TOKEN_LESS_EQUAL:
+            VAL_AS_BOOL(c) = (x <= y);
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool fold_binary(expr_binary *binary_expr, value *result)
+{
+    value left = EMPTY_VAL;
+    value right = EMPTY_VAL;
+    value folded = EMPTY_VAL;
+    value *a = &left;
+    value *b = &right;
+    value *c = &folded;
+
+    if (!fold_constant(binary_expr->left, a))
+        return false;
+    if (!fold_constant(binary_expr->right, b)) {
+        free_constant(a);
+        return false;
+    }
+
+    tokentype optype = binary_expr->operator->type;
+    bool success = true;
+    if (VAL_IS_LONG(a) && VAL_IS_LONG(b) &&
+            fold_ints(VAL_AS_LONG(a), VAL_AS_LONG(b), optype, c)) {
+        // Overflow and division are folded as doubles below
+    }
+    else if (is_number_value(a) && is_number_value(b)) {
+        double x = number_value(a);
+        double y = number_value(b);
+        c->type = VAL_DOUBLE;
+        switch (optype) {
+            case TOKEN_PLUS:
+                VAL_AS_DOUBLE(c) = x + y;
+                break;
+            case TOKEN_MINUS:
+                VAL_AS_DOUBLE(c) = x - y;
+                break;
+            case TOKEN_STAR:
+                VAL_AS_DOUBLE(c) = x * y;
+                break;
+            case TOKEN_SLASH:
+                /* Leave division by zero for the runtime error */
+                if (y == 0)
+                    success = false;
+                else
+                    VAL_AS_DOUBLE(c) = x / y;
+                break;
+            case TOKEN_EQUAL_EQUAL:
+                c->type = VAL_BOOL;
+                VAL_AS_BOOL(c) = (x == y);
+                break;
+            case TOKEN_BANG_EQUAL:
+                c->type = VAL_BOOL;
+                VAL_AS_BOOL(c) = (x != y);
+                break;
+            case TOKEN_GREATER:
+                c->type = VAL_BOOL;
+                VAL_AS_BOOL(c) = (x > y);
+                break;
+            case TOKEN_GREATER_EQUAL:
+                c->type = VAL_BOOL;
+                VAL_AS_BOOL(c) = (x >= y);
+                break;
+            case TOKEN_LESS:
+                c->type = VAL_BOOL;
+                VAL_AS_BOOL(c) = (x < y);
+                break;
+            case TOKEN_LESS_EQUAL:
+                c->type = VAL_BOOL;
+                VAL_AS_BOOL(c) = (x <= y);
+                break;
+            default:
+                success = false;
+                break;
+        }
+    }
+    else if (VAL_IS_STRING(a) && VAL_IS_STRING(b) && optype == TOKEN_PLUS) {
+        c->type = VAL_STRING;
+        VAL_AS_STRING(c) = fold_concatenate(VAL_AS_STRING(a),
+                VAL_AS_STRING(b));
+    }
+    else
+        success = false;
+
+    free_constant(a);
+    free_constant(b);
+    if (success)
+        *result = folded;
+    return success;
+}
+
+/* Number literals without a decimal point are ints, unless they are too
+ * big for 64 bits.
+ */
+static void number_literal(const char *literal, value *result)
+{
+    if (!strchr(literal, '.')) {
+        errno = 0;
+        long long number = strtoll(literal, NULL, 10);
+        if (errno == 0) {
+            result->type = VAL_LONG;
+            VAL_AS_LONG(result) = number;
+            return;
+        }
+    }
+    result->type = VAL_DOUBLE;
+    VAL_AS_DOUBLE(result) = atof(literal);
+}
+
+/* Evaluates literal subexpressions at compile time. Returns false if
+ * any part of the expression depends on runtime state, or if folding it
+ * would change the error behavior of the program.
+ */
+static bool fold_constant(expr *expression, value *result)
+{
+    switch (expression->type) {
+        case EXPR_LITERAL_NUMBER:
+        {
+            expr_literal *literal_expr = (expr_literal*)expression;
+            number_literal(literal_expr->literal, result);
+            return true;
+        }
+        case EXPR_LITERAL_STRING:
+        {
+            expr_literal *literal_expr = (expr_literal*)expression;
+            int length = strlen(literal_expr->literal);
+            char *buffer = ALLOCATE(char, length + 1);
+            memcpy(buffer, literal_expr->literal, length);
+            buffer[length] = '\0';
+            result->type = VAL_STRING;
+            VAL_AS_STRING(result) = buffer;
+            return true;
+        }
+        case EXPR_LITERAL_BOOL:
+        {
+            expr_literal *literal_expr = (expr_literal*)expression;
+            result->type = VAL_BOOL;
+            VAL_AS_BOOL(result) = atoi(literal_expr->literal);
+            return true;
+        }
+        case EXPR_LITERAL_NULL:
+        {
+            *result = NULL_VAL;
+            return true;
+        }
+        case EXPR_GROUPING:
+        {
+            expr_grouping *grouping_expr = (expr_grouping*)expression;
+            return fold_constant(grouping_expr->expression, result);
+        }
+        case EXPR_UNARY:
+        {
+            expr_unary *unary_expr = (expr_unary*)expression;
+            value folded = EMPTY_VAL;
+            value *right = &folded;
+            if (unary_expr->operator->type != TOKEN_MINUS)
+                return false;
+            if (!fold_constant(unary_expr->right, right))
+                return false;
+            int64_t negated;
+            if (VAL_IS_LONG(right) &&
+                    int_arith('-', 0, VAL_AS_LONG(right), &negated)) {
+                result->type = VAL_LONG;
+                VAL_AS_LONG(result) = negated;
+                return true;
+            }
+            if (!is_number_value(right)) {
+                free_constant(right);
+                return false;
+            }
+            result->type = VAL_DOUBLE;
+            VAL_AS_DOUBLE(result) = -number_value(right);
+            return true;
+        }
+        case EXPR_BINARY:
+            return fold_binary((expr_binary*)expression, result);
+        default:
+            return false;
+    }
+}
+
+static void compile_expression(instruct *instructs, expr *expression,
         int line)
 {
     uint8_t byte = 0;
     value empty = {.type = VAL_EMPTY, .val_int = 0};
     value *operand = &empty;
+    value folded = EMPTY_VAL;
+
+    /* Literal arithmetic, concatenation and comparisons are folded into
+     * a single constant load.
+     */
+    if ((expression->type == EXPR_BINARY ||
+         expression->type == EXPR_UNARY ||
+         expression->type == EXPR_GROUPING) &&
+            fold_constant(expression, &folded)) {
+        emit_instruction(instructs, OP_LOAD_CONSTANT, folded, line);
+        return;
+    }
+
     switch (expression->type) {
         case EXPR_ASSIGN: 
         {
@@ -116,6 +386,7 @@ static void compile_expression(instruct *instructs, expr *expression,
                     byte = OP_BINARY_MULT;
                     break;
                 case TOKEN_EQUAL_EQUAL:
+                case TOKEN_BANG_EQUAL:
                 case TOKEN_GREATER:
                 case TOKEN_GREATER_EQUAL:
                 case TOKEN_LESS:
@@ -129,6 +400,20 @@ static void compile_expression(instruct *instructs, expr *expression,
             }
             break;
         }
+        /* The left side is left on the stack as the result when it
+         * decides the outcome, and the right side is never run.
+         */
+        case EXPR_LOGICAL:
+        {
+            expr_binary *logical_expr = (expr_binary*)expression;
+            compile_expression(instructs, logical_expr->left, line);
+            byte = logical_expr->operator->type == TOKEN_AND ?
+                OP_JMP_IF_FALSE_KEEP : OP_JMP_IF_TRUE_KEEP;
+            int skip = emit_instruction(instructs, byte, EMPTY_VAL, line);
+            compile_expression(instructs, logical_expr->right, line);
+            patch_jump(instructs, skip, instructs->count);
+            return;
+        }
         case EXPR_GROUPING:
         {
             expr_grouping *grouping_expr = (expr_grouping*)expression;
@@ -153,8 +438,7 @@ static void compile_expression(instruct *instructs, expr *expression,
             byte = OP_LOAD_CONSTANT;
             expr_literal *literal_expr = (expr_literal*)expression;
 
-            VAL_AS_DOUBLE(operand) = atof(literal_expr->literal);
-            operand->type = VAL_DOUBLE;
+            number_literal(literal_expr->literal, operand);
             break;
         }
         case EXPR_LITERAL_BOOL:
@@ -177,6 +461,8 @@ static void compile_expression(instruct *instructs, expr *expression,
             expr_unary *unary_expr = (expr_unary*)expression;
             switch (unary_expr->operator->type) {
                 case TOKEN_BANG:
+                    compile_expression(instructs, unary_expr->right, line);
+                    byte = OP_NOT;
                     break;
                 case TOKEN_MINUS:
                     compile_expression(instructs, unary_expr->right, line);
@@ -268,6 +554,54 @@ static void compile_expression(instruct *instructs, expr *expression,
             VAL_AS_STRING(operand) = take_string(name);
             break;
         }
+        case EXPR_LIST:
+        {
+            byte = OP_BUILD_LIST;
+            operand->type = VAL_INT;
+            expr_list *list_expr = (expr_list*)expression;
+
+            for (int i = 0; i < list_expr->count; i++)
+                compile_expression(instructs, list_expr->items[i], line);
+
+            /* item count is passed as the operand */
+            VAL_AS_INT(operand) = list_expr->count;
+            break;
+        }
+        case EXPR_DICT:
+        {
+            byte = OP_BUILD_DICT;
+            operand->type = VAL_INT;
+            expr_dict *dict_expr = (expr_dict*)expression;
+
+            for (int i = 0; i < dict_expr->count; i++) {
+                compile_expression(instructs, dict_expr->keys[i], line);
+                compile_expression(instructs, dict_expr->values[i], line);
+            }
+
+            /* entry count is passed as the operand */
+            VAL_AS_INT(operand) = dict_expr->count;
+            break;
+        }
+        case EXPR_GET_INDEX:
+        {
+            byte = OP_INDEX_GET;
+            expr_index *index_expr = (expr_index*)expression;
+
+            compile_expression(instructs, index_expr->refobj, line);
+            compile_expression(instructs, index_expr->index, line);
+            break;
+        }
+        case EXPR_SET_INDEX:
+        {
+            byte = OP_INDEX_SET;
+            expr_index *index_expr = (expr_index*)expression;
+
+            /* Put new value on stack, then the list and the index */
+            compile_expression(instructs, index_expr->value, line);
+            compile_expression(instructs, index_expr->refobj, line);
+            compile_expression(instructs, index_expr->index, line);
+            break;
+        }
     }
     emit_instruction(instructs, byte, *operand, line);
 }
@@ -308,8 +642,10 @@ static void compile_if(instruct *instructs, stmt *statement)
     compile_statement(instructs, if_stmt->thenbranch);
 
     if (if_stmt->elsebranch) {
+        int jmpend = emit_instruction(instructs, OP_JMP_LOC, EMPTY_VAL, line);
         patch_jump(instructs, jmpfalse, instructs->count);
         compile_statement(instructs, if_stmt->elsebranch);
+        patch_jump(instructs, jmpend, instructs->count);
     }
     else 
         patch_jump(instructs, jmpfalse, instructs->count);
@@ -335,6 +671,257 @@ static void compile_while(instruct *instructs, stmt *statement)
     patch_jump(instructs, jmpfalse, instructs->count);
 }
 
+static inline bool same_name(token *a, token *b)
+{
+    return a->length == b->length &&
+        memcmp(a->start, b->start, a->length) == 0;
+}
+
+static bool expr_assigns(expr *expression, token *name);
+
+static bool exprs_assign(expr **expressions, int count, token *name)
+{
+    for (int i = 0; i < count; i++)
+        if (expr_assigns(expressions[i], name))
+            return true;
+    return false;
+}
+
+// Whether evaluating the expression can rebind name in the current frame
+static bool expr_assigns(expr *expression, token *name)
+{
+    if (!expression)
+        return false;
+    switch (expression->type) {
+        case EXPR_ASSIGN:
+        {
+            expr_assign *assign_expr = (expr_assign*)expression;
+            return same_name(assign_expr->name, name) ||
+                expr_assigns(assign_expr->value, name);
+        }
+        case EXPR_BINARY:
+        case EXPR_LOGICAL:
+        {
+            expr_binary *binary_expr = (expr_binary*)expression;
+            return expr_assigns(binary_expr->left, name) ||
+                expr_assigns(binary_expr->right, name);
+        }
+        case EXPR_GROUPING:
+            return expr_assigns(((expr_grouping*)expression)->expression,
+                    name);
+        case EXPR_UNARY:
+            return expr_assigns(((expr_unary*)expression)->right, name);
+        case EXPR_CALL:
+        {
+            expr_call *call_expr = (expr_call*)expression;
+            return expr_assigns(call_expr->expression, name) ||
+                exprs_assign(call_expr->arguments, call_expr->count, name);
+        }
+        case EXPR_SET_PROP:
+        {
+            expr_set *set_expr = (expr_set*)expression;
+            return expr_assigns(set_expr->refobj, name) ||
+                expr_assigns(set_expr->value, name);
+        }
+        case EXPR_GET_PROP:
+            return expr_assigns(((expr_get*)expression)->refobj, name);
+        case EXPR_METHOD:
+        {
+            expr_method *method_expr = (expr_method*)expression;
+            return expr_assigns(method_expr->refobj, name) ||
+                expr_assigns(method_expr->call, name);
+        }
+        case EXPR_LIST:
+        {
+            expr_list *list_expr = (expr_list*)expression;
+            return exprs_assign(list_expr->items, list_expr->count, name);
+        }
+        case EXPR_DICT:
+        {
+            expr_dict *dict_expr = (expr_dict*)expression;
+            return exprs_assign(dict_expr->keys, dict_expr->count, name) ||
+                exprs_assign(dict_expr->values, dict_expr->count, name);
+        }
+        case EXPR_GET_INDEX:
+        case EXPR_SET_INDEX:
+        {
+            expr_index *index_expr = (expr_index*)expression;
+            return expr_assigns(index_expr->refobj, name) ||
+                expr_assigns(index_expr->index, name) ||
+                expr_assigns(index_expr->value, name);
+        }
+        case EXPR_LITERAL_STRING:
+        case EXPR_LITERAL_NUMBER:
+        case EXPR_LITERAL_BOOL:
+        case EXPR_LITERAL_NULL:
+        case EXPR_VARIABLE:
+            return false;
+        default:
+            return true;
+    }
+}
+
+/* Whether running the statement can rebind name in the current frame.
+ * Functions and classes only bind their own name here; what their
+ * bodies assign lands in frames of their own.
+ */
+static bool stmt_assigns(stmt *statement, token *name)
+{
+    if (!statement)
+        return false;
+    switch (statement->type) {
+        case STMT_EXPR:
+            return expr_assigns(((stmt_expr*)statement)->expression, name);
+        case STMT_BLOCK:
+        {
+            stmt_block *block_stmt = (stmt_block*)statement;
+            for (int i = 0; block_stmt->stmts[i]; i++)
+                if (stmt_assigns(block_stmt->stmts[i], name))
+                    return true;
+            return false;
+        }
+        case STMT_IF:
+        {
+            stmt_if *if_stmt = (stmt_if*)statement;
+            return expr_assigns(if_stmt->condition, name) ||
+                stmt_assigns(if_stmt->thenbranch, name) ||
+                stmt_assigns(if_stmt->elsebranch, name);
+        }
+        case STMT_WHILE:
+        {
+            stmt_while *while_stmt = (stmt_while*)statement;
+            return expr_assigns(while_stmt->condition, name) ||
+                stmt_assigns(while_stmt->loopbody, name);
+        }
+        case STMT_FOR:
+        {
+            stmt_for *for_stmt = (stmt_for*)statement;
+            for (int i = 0; i < for_stmt->count; i++)
+                if (stmt_assigns(for_stmt->stmts[i], name))
+                    return true;
+            return stmt_assigns(for_stmt->loopbody, name);
+        }
+        case STMT_FOR_IN:
+        {
+            stmt_for_in *for_stmt = (stmt_for_in*)statement;
+            return same_name(for_stmt->name, name) ||
+                expr_assigns(for_stmt->iterable, name) ||
+                stmt_assigns(for_stmt->loopbody, name);
+        }
+        case STMT_FUNCTION:
+            return same_name(((stmt_function*)statement)->name, name);
+        case STMT_CLASS:
+            return same_name(((stmt_class*)statement)->name, name);
+        case STMT_RETURN:
+            return expr_assigns(((stmt_return*)statement)->value, name);
+        case STMT_YIELD:
+            return expr_assigns(((stmt_yield*)statement)->value, name);
+        default:
+            return true;
+    }
+}
+
+static inline expr *stmt_expression(stmt *statement)
+{
+    if (!statement || statement->type != STMT_EXPR)
+        return NULL;
+    return ((stmt_expr*)statement)->expression;
+}
+
+static inline bool is_variable(expr *expression, token *name)
+{
+    return expression && expression->type == EXPR_VARIABLE &&
+        same_name(((expr_var*)expression)->name, name);
+}
+
+/* Matches for (i = start; i < bound; i = i + step) with a constant
+ * numeric step, and a bound that is either constant or a name, where
+ * the body assigns neither i nor the bound. < can be any ordering
+ * comparison and + can be -. Sets the comparison, bound and step of
+ * the loop.
+ */
+static bool counted_loop(stmt_for *for_stmt, tokentype *cmptype,
+        expr **bound, value *step)
+{
+    expr *init = stmt_expression(for_stmt->stmts[0]);
+    expr *cond = stmt_expression(for_stmt->stmts[1]);
+    expr *iter = stmt_expression(for_stmt->stmts[2]);
+    if (!init || !cond || !iter || init->type != EXPR_ASSIGN ||
+            cond->type != EXPR_BINARY || iter->type != EXPR_ASSIGN)
+        return false;
+
+    token *name = ((expr_assign*)init)->name;
+    expr_binary *cond_expr = (expr_binary*)cond;
+    tokentype optype = cond_expr->operator->type;
+    if (optype != TOKEN_LESS && optype != TOKEN_LESS_EQUAL &&
+            optype != TOKEN_GREATER && optype != TOKEN_GREATER_EQUAL)
+        return false;
+    if (!is_variable(cond_expr->left, name))
+        return false;
+
+    expr *right = cond_expr->right;
+    value folded = EMPTY_VAL;
+    if (fold_constant(right, &folded))
+        free_constant(&folded);
+    else if (right->type != EXPR_VARIABLE ||
+            same_name(((expr_var*)right)->name, name) ||
+            stmt_assigns(for_stmt->loopbody, ((expr_var*)right)->name))
+        return false;
+
+    expr_assign *iter_expr = (expr_assign*)iter;
+    expr_binary *add_expr = (expr_binary*)iter_expr->value;
+    if (!same_name(iter_expr->name, name) ||
+            add_expr->header.type != EXPR_BINARY ||
+            !is_variable(add_expr->left, name))
+        return false;
+    tokentype addtype = add_expr->operator->type;
+    if (addtype != TOKEN_PLUS && addtype != TOKEN_MINUS)
+        return false;
+    if (!fold_constant(add_expr->right, step))
+        return false;
+    if (!is_number_value(step)) {
+        free_constant(step);
+        return false;
+    }
+    if (addtype == TOKEN_MINUS) {
+        if (VAL_IS_DOUBLE(step))
+            VAL_AS_DOUBLE(step) = -VAL_AS_DOUBLE(step);
+        else if (!int_arith('-', 0, VAL_AS_LONG(step), &VAL_AS_LONG(step)))
+            return false;
+    }
+
+    if (stmt_assigns(for_stmt->loopbody, name))
+        return false;
+    *cmptype = optype;
+    *bound = right;
+    return true;
+}
+
+/* A counted loop keeps its bound and step on the stack for FOR_RANGE,
+ * which reads its comparison and exit from the COMPARE and JMP_FALSE
+ * after it. Those two are never run.
+ */
+static void compile_counted_for(instruct *instructs, stmt_for *for_stmt,
+        tokentype cmptype, expr *bound, value step)
+{
+    int line = for_stmt->header.line;
+    token *name = ((expr_assign*)stmt_expression(for_stmt->stmts[0]))->name;
+
+    compile_expression(instructs, bound, line);
+    emit_instruction(instructs, OP_LOAD_CONSTANT, step, line);
+    value operand = {.type = VAL_STRING, .val_string = take_string(name)};
+    emit_instruction(instructs, OP_FOR_RANGE, operand, line);
+    value compare = {.type = VAL_BOOL, .val_int = cmptype};
+    emit_instruction(instructs, OP_COMPARE, compare, line);
+    int jmpexit = emit_instruction(instructs, OP_JMP_FALSE, EMPTY_VAL, line);
+
+    int body = instructs->count;
+    compile_block(instructs, for_stmt->loopbody, false);
+    value target = {.type = VAL_EMPTY, .val_int = body};
+    emit_instruction(instructs, OP_FOR_STEP, target, line);
+    patch_jump(instructs, jmpexit, instructs->count);
+}
+
 static void compile_for(instruct *instructs, stmt *statement)
 {
     stmt_for *for_stmt = (stmt_for*)statement;
@@ -346,6 +933,16 @@ static void compile_for(instruct *instructs, stmt *statement)
 
     // Initializer_statement
     compile_statement(instructs, for_stmt->stmts[0]);
+
+    tokentype cmptype;
+    expr *bound = NULL;
+    value step = EMPTY_VAL;
+    if (counted_loop(for_stmt, &cmptype, &bound, &step)) {
+        compile_counted_for(instructs, for_stmt, cmptype, bound, step);
+        emit_instruction(instructs, OP_POP_FRAME, EMPTY_VAL,
+                statement->line);
+        return;
+    }
     // thenbranch used for compare statement
     forbegin = instructs->count;
     compile_statement(instructs, for_stmt->stmts[1]);
@@ -366,6 +963,31 @@ static void compile_for(instruct *instructs, stmt *statement)
     emit_instruction(instructs, OP_POP_FRAME, EMPTY_VAL, statement->line);
 }
 
+/* The iterator lives in the frame the loop pushes, so leaving the loop
+ * early by returning from a function leaves nothing behind. FOR_ITER
+ * jumps to the POP_FRAME once the iterator runs out.
+ */
+static void compile_for_in(instruct *instructs, stmt *statement)
+{
+    stmt_for_in *for_stmt = (stmt_for_in*)statement;
+    int line = statement->line;
+
+    emit_instruction(instructs, OP_PUSH_FRAME, EMPTY_VAL, line);
+    compile_expression(instructs, for_stmt->iterable, line);
+    emit_instruction(instructs, OP_GET_ITER, EMPTY_VAL, line);
+
+    int loop = emit_instruction(instructs, OP_FOR_ITER, EMPTY_VAL, line);
+    value operand = {.type = VAL_STRING,
+        .val_string = take_string(for_stmt->name)};
+    emit_instruction(instructs, OP_STORE_NAME, operand, line);
+    compile_block(instructs, for_stmt->loopbody, false);
+    int jmpbegin = emit_instruction(instructs, OP_JMP_LOC, EMPTY_VAL, line);
+
+    patch_jump(instructs, jmpbegin, loop);
+    patch_jump(instructs, loop, instructs->count);
+    emit_instruction(instructs, OP_POP_FRAME, EMPTY_VAL, line);
+}
+
 static void compile_function(instruct *instructs, stmt *statement)
 {
     stmt_function *function_stmt = (stmt_function*)statement;
@@ -389,6 +1011,7 @@ static void compile_function(instruct *instructs, stmt *statement)
 
     emit_instruction(&(codeobj->instructs), OP_RETURN, NULL_VAL, 
             statement->line);
+    optimize_instructs(&codeobj->instructs);
     /* Push new code object onto the stack */
     value valobj = {.type = VAL_OBJECT, .val_obj = (object*)codeobj};
     emit_instruction(instructs, OP_MAKE_FUNCTION, valobj, statement->line);
@@ -428,6 +1051,7 @@ static void compile_method(instruct *instructs, stmt *statement)
 
     emit_instruction(&(codeobj->instructs), OP_RETURN, NULL_VAL,
             statement->line);
+    optimize_instructs(&codeobj->instructs);
     /* Push new code object onto the stack */
     value valobj = {.type = VAL_OBJECT, .val_obj = (object*)codeobj};
     emit_instruction(instructs, OP_MAKE_METHOD, valobj, 
@@ -461,6 +1085,7 @@ static void compile_class(instruct *instructs, stmt *statement)
 
     emit_instruction(&classobj->instructs, OP_RETURN, EMPTY_VAL, 
             statement->line);
+    optimize_instructs(&classobj->instructs);
     
     /* Push new code object onto the stack */
     value valobj = {.type = VAL_OBJECT, .val_obj = (object*)classobj};
@@ -476,11 +1101,30 @@ static void compile_class(instruct *instructs, stmt *statement)
 static void compile_return(instruct *instructs, stmt *statement)
 {
     stmt_return *return_stmt = (stmt_return*)statement;
-    compile_expression(instructs, return_stmt->value, 
-            statement->line);
+    // A bare return pushes nothing, like running off the end
+    if (return_stmt->value) {
+        compile_expression(instructs, return_stmt->value,
+                statement->line);
+        /* A call in tail position may reuse the frame it returns from */
+        code8 *last = instructs->code[instructs->count - 1];
+        if (last->bytecode == OP_CALL_FUNCTION)
+            last->bytecode = OP_TAIL_CALL;
+    }
     emit_instruction(instructs, OP_RETURN, EMPTY_VAL, statement->line);
 }
 
+// A bare yield gives null
+static void compile_yield(instruct *instructs, stmt *statement)
+{
+    stmt_yield *yield_stmt = (stmt_yield*)statement;
+    if (yield_stmt->value)
+        compile_expression(instructs, yield_stmt->value, statement->line);
+    else
+        emit_instruction(instructs, OP_LOAD_CONSTANT, NULL_VAL,
+                statement->line);
+    emit_instruction(instructs, OP_YIELD, EMPTY_VAL, statement->line);
+}
+
 static void compile_statement(instruct *instructs, stmt *statement)
 {
     switch (statement->type) {
@@ -509,6 +1153,11 @@ static void compile_statement(instruct *instructs, stmt *statement)
             compile_for(instructs, statement);
             break;
         }
+        case STMT_FOR_IN:
+        {
+            compile_for_in(instructs, statement);
+            break;
+        }
         case STMT_FUNCTION:
         {
             compile_function(instructs, statement);
@@ -529,6 +1178,11 @@ static void compile_statement(instruct *instructs, stmt *statement)
             compile_return(instructs, statement);
             break;
         }
+        case STMT_YIELD:
+        {
+            compile_yield(instructs, statement);
+            break;
+        }
     }
 }
 
@@ -555,6 +1209,7 @@ instruct compile(parser *analyzer, const char *source)
 
     emit_instruction(&instructs, OP_RETURN, EMPTY_VAL, 
             analyzer->num_statements);
+    optimize_instructs(&instructs);
 
     return instructs;
 }
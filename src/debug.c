@@ -4,7 +4,7 @@
 #include "opcode.h"
 
 
-void print_bytecode(uint8_t bytecode)
+const char *bytecode_name(uint8_t bytecode)
 {
     char *msg = NULL;
     switch (bytecode) {
@@ -38,6 +38,45 @@ void print_bytecode(uint8_t bytecode)
         case OP_CALL_FUNCTION:
             msg = "CALL_FUNCTION";
             break;
+        case OP_TAIL_CALL:
+            msg = "TAIL_CALL";
+            break;
+        case OP_BUILD_LIST:
+            msg = "BUILD_LIST";
+            break;
+        case OP_INDEX_GET:
+            msg = "INDEX_GET";
+            break;
+        case OP_INDEX_SET:
+            msg = "INDEX_SET";
+            break;
+        case OP_BUILD_DICT:
+            msg = "BUILD_DICT";
+            break;
+        case OP_FOR_RANGE:
+            msg = "FOR_RANGE";
+            break;
+        case OP_FOR_STEP:
+            msg = "FOR_STEP";
+            break;
+        case OP_GET_ITER:
+            msg = "GET_ITER";
+            break;
+        case OP_FOR_ITER:
+            msg = "FOR_ITER";
+            break;
+        case OP_JMP_IF_FALSE_KEEP:
+            msg = "JMP_IF_FALSE_KEEP";
+            break;
+        case OP_JMP_IF_TRUE_KEEP:
+            msg = "JMP_IF_TRUE_KEEP";
+            break;
+        case OP_NOT:
+            msg = "NOT";
+            break;
+        case OP_YIELD:
+            msg = "YIELD";
+            break;
         case OP_MAKE_FUNCTION:
             msg = "MAKE_FUNCTION";
             break;
@@ -62,6 +101,9 @@ void print_bytecode(uint8_t bytecode)
         case OP_STORE_NAME:
             msg = "STORE_NAME";
             break;
+        case OP_STORE_NAME_KEEP:
+            msg = "STORE_NAME_KEEP";
+            break;
         case OP_COMPARE:
             msg = "COMPARE";
             break;
@@ -83,6 +125,86 @@ void print_bytecode(uint8_t bytecode)
         case OP_RETURN:
             msg = "RETURN";
             break;
+        case OP_GET_NAME_PROPERTY:
+            msg = "GET_NAME_PROPERTY";
+            break;
+        case OP_SET_NAME_PROPERTY:
+            msg = "SET_NAME_PROPERTY";
+            break;
+        case OP_COMPARE_NAME_CONST_JMP:
+            msg = "COMPARE_NAME_CONST_JMP";
+            break;
+        case OP_ADD_NAME_CONST_STORE:
+            msg = "ADD_NAME_CONST_STORE";
+            break;
+        case OP_ADD_DOUBLE:
+            msg = "ADD_DOUBLE";
+            break;
+        case OP_SUB_DOUBLE:
+            msg = "SUB_DOUBLE";
+            break;
+        case OP_MULT_DOUBLE:
+            msg = "MULT_DOUBLE";
+            break;
+        case OP_DIVIDE_DOUBLE:
+            msg = "DIVIDE_DOUBLE";
+            break;
+        case OP_COMPARE_DOUBLE_JMP:
+            msg = "COMPARE_DOUBLE_JMP";
+            break;
+        case OP_ADD_INT:
+            msg = "ADD_INT";
+            break;
+        case OP_SUB_INT:
+            msg = "SUB_INT";
+            break;
+        case OP_MULT_INT:
+            msg = "MULT_INT";
+            break;
+        case OP_COMPARE_INT_JMP:
+            msg = "COMPARE_INT_JMP";
+            break;
+    }
+    return msg;
+}
+
+void print_bytecode(uint8_t bytecode)
+{
+    printf("%-20s", bytecode_name(bytecode));
+}
+
+#ifdef DEBUG_ARI_OPSTATS
+#define OPSTATS_TOP 20
+
+/* Dynamic counts of adjacent opcode pairs, used to pick which
+ * sequences are worth fusing into superinstructions.
+ */
+static uint64_t pair_counts[UINT8_MAX + 1][UINT8_MAX + 1];
+
+void record_opcode_pair(uint8_t previous, uint8_t current)
+{
+    pair_counts[previous][current]++;
+}
+
+void print_opcode_stats(void)
+{
+    fprintf(stderr, "Opcode pair\t\t\t\t\tcount\n");
+    for (int n = 0; n < OPSTATS_TOP; n++) {
+        uint64_t best = 0;
+        int first = 0;
+        int second = 0;
+        for (int i = 0; i <= UINT8_MAX; i++)
+            for (int j = 0; j <= UINT8_MAX; j++)
+                if (pair_counts[i][j] > best) {
+                    best = pair_counts[i][j];
+                    first = i;
+                    second = j;
+                }
+        if (!best)
+            break;
+        fprintf(stderr, "%-20s%-20s\t%lu\n", bytecode_name(first),
+                bytecode_name(second), best);
+        pair_counts[first][second] = 0;
     }
-    printf("%-20s", msg);
 }
+#endif
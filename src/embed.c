@@ -0,0 +1,50 @@
+#include "ari.h"
+#include "compiler.h"
+#include "instruct.h"
+#include "objstack.h"
+#include "vm.h"
+
+ari_vm *ari_vm_new(void)
+{
+    VM *vm = init_vm();
+    init_instruct(&vm->global.instructs);
+    return vm;
+}
+
+bool ari_compile(ari_vm *vm, const char *source)
+{
+    reset_instruct(&vm->global.instructs);
+    reset_parser(&vm->analyzer);
+    vm->global.instructs = compile(&vm->analyzer, source);
+    return vm->global.instructs.count > 0;
+}
+
+/* A runtime error leaves the frames and the evaluation stack as they were
+ * when it happened. Dropping them leaves only the globals, as after a run
+ * that finished.
+ */
+static void unwind(VM *vm)
+{
+    while (vm->top != &vm->global.local)
+        vm_pop_frame(vm);
+    reset_objstack(&vm->evalstack);
+    init_objstack(&vm->evalstack);
+    vm->generator = NULL;
+    vm->haderror = false;
+}
+
+bool ari_run(ari_vm *vm)
+{
+    vm->global.local.pc = 0;
+    intrpstate state = execute(vm, &vm->global.instructs);
+    bool ok = state == INTERPRET_OK && !vm->haderror;
+    if (!ok)
+        unwind(vm);
+    return ok;
+}
+
+void ari_vm_free(ari_vm *vm)
+{
+    reset_instruct(&vm->global.instructs);
+    free_vm(vm);
+}
@@ -21,6 +21,18 @@ intrpstate runtime_error(VM *vm, objstack *stack, size_t line,
     return INTERPRET_RUNTIME_ERROR;
 }
 
+/* Called by compiled code on the way out once an instruction reported an
+ * error. Mirrors the check at the top of the interpreter loop.
+ */
+intrpstate runtime_error_line(VM *vm, instruct *instructs)
+{
+    size_t pc = vm->top->pc;
+    if (pc >= (size_t)instructs->count)
+        return INTERPRET_OK;
+    fprintf(stderr, "[line %d] in script\n", instructs->code[pc]->line);
+    return INTERPRET_RUNTIME_ERROR;
+}
+
 intrpstate runtime_error_loadname(VM *vm, char *name, uint64_t current)
 {
     char msg[100];
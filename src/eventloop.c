@@ -0,0 +1,363 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#else
+#include <poll.h>
+#endif
+
+#include "error.h"
+#include "eventloop.h"
+#include "memory.h"
+
+// Most events taken from epoll at a time
+#define MAX_EVENTS      64
+// Longest sleep, so the deadline can't overflow
+#define MAX_SLEEP       1e9
+
+
+static uint64_t now_ms(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+eventloop *init_eventloop(void)
+{
+    eventloop *loop = ALLOCATE(eventloop, 1);
+    loop->ready = NULL;
+    loop->head = 0;
+    loop->count = 0;
+    loop->capacity = 0;
+    for (int i = 0; i < WHEEL_SLOTS; i++)
+        loop->wheel[i] = NULL;
+    loop->tick = 0;
+    loop->sleepers = 0;
+    loop->waiters = NULL;
+    loop->waitercount = 0;
+    loop->waitercapacity = 0;
+#ifdef __linux__
+    loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+#else
+    loop->epfd = -1;
+#endif
+    loop->running = false;
+    return loop;
+}
+
+void free_eventloop(eventloop *loop)
+{
+    for (int i = 0; i < WHEEL_SLOTS; i++) {
+        sleeper *entry = loop->wheel[i];
+        while (entry) {
+            sleeper *next = entry->next;
+            FREE(sleeper, entry);
+            entry = next;
+        }
+    }
+    FREE_ARRAY(objgen*, loop->ready, loop->capacity);
+    FREE_ARRAY(fdwaiter, loop->waiters, loop->waitercapacity);
+    if (loop->epfd >= 0)
+        close(loop->epfd);
+    FREE(eventloop, loop);
+}
+
+static void make_ready(eventloop *loop, objgen *task)
+{
+    if (loop->count == loop->capacity) {
+        if (loop->head > 0) {
+            memmove(loop->ready, loop->ready + loop->head,
+                    sizeof(objgen*) * (loop->count - loop->head));
+            loop->count -= loop->head;
+            loop->head = 0;
+        }
+        else {
+            int oldcapacity = loop->capacity;
+            loop->capacity = GROW_CAPACITY(oldcapacity);
+            loop->ready = GROW_ARRAY(loop->ready, objgen*, oldcapacity,
+                    loop->capacity);
+        }
+    }
+    loop->ready[loop->count++] = task;
+}
+
+static objgen *next_ready(eventloop *loop)
+{
+    objgen *task = loop->ready[loop->head++];
+    if (loop->head == loop->count)
+        loop->head = loop->count = 0;
+    return task;
+}
+
+void eventloop_spawn(eventloop *loop, objgen *task)
+{
+    make_ready(loop, task);
+}
+
+/* A sleeper goes at the end of the slot of its deadline, so tasks due at
+ * the same millisecond wake in the order they went to sleep.
+ */
+static void add_sleeper(eventloop *loop, objgen *task, double seconds)
+{
+    uint64_t now = now_ms();
+    if (loop->sleepers == 0)
+        loop->tick = now;
+    if (seconds > MAX_SLEEP)
+        seconds = MAX_SLEEP;
+    uint64_t deadline = now + (uint64_t)(seconds * 1000 + 0.999);
+    if (deadline < loop->tick)
+        deadline = loop->tick;
+
+    sleeper *entry = ALLOCATE(sleeper, 1);
+    entry->task = task;
+    entry->deadline = deadline;
+    entry->next = NULL;
+    sleeper **tail = &loop->wheel[deadline % WHEEL_SLOTS];
+    while (*tail)
+        tail = &(*tail)->next;
+    *tail = entry;
+    loop->sleepers++;
+}
+
+// Readies the sleepers due by now, looking at each slot once at most
+static void expire_sleepers(eventloop *loop, uint64_t now)
+{
+    if (loop->sleepers == 0 || loop->tick > now)
+        return;
+    uint64_t last = now - loop->tick >= WHEEL_SLOTS ?
+        loop->tick + WHEEL_SLOTS - 1 : now;
+    for (uint64_t tick = loop->tick; tick <= last; tick++) {
+        sleeper **entry = &loop->wheel[tick % WHEEL_SLOTS];
+        while (*entry) {
+            sleeper *current = *entry;
+            if (current->deadline <= now) {
+                *entry = current->next;
+                make_ready(loop, current->task);
+                FREE(sleeper, current);
+                loop->sleepers--;
+            }
+            else
+                entry = &current->next;
+        }
+    }
+    loop->tick = now + 1;
+}
+
+// Milliseconds until the next sleeper is due, or -1 if there are none
+static int next_timeout(eventloop *loop, uint64_t now)
+{
+    if (loop->sleepers == 0)
+        return -1;
+    for (uint64_t tick = loop->tick; tick < loop->tick + WHEEL_SLOTS; tick++)
+        for (sleeper *entry = loop->wheel[tick % WHEEL_SLOTS]; entry;
+                entry = entry->next)
+            if (entry->deadline <= tick)
+                return tick > now ? (int)(tick - now) : 0;
+    // Nothing is due before the wheel has gone round once
+    return WHEEL_SLOTS;
+}
+
+static fdwaiter *find_waiter(eventloop *loop, int fd)
+{
+    for (int i = 0; i < loop->waitercount; i++)
+        if (loop->waiters[i].fd == fd)
+            return &loop->waiters[i];
+    return NULL;
+}
+
+static void remove_waiter(eventloop *loop, fdwaiter *waiter)
+{
+    *waiter = loop->waiters[--loop->waitercount];
+}
+
+#ifdef __linux__
+// Tells epoll what the tasks waiting on a descriptor wait for now
+static int watch_fd(eventloop *loop, fdwaiter *waiter, int op)
+{
+    struct epoll_event event;
+    event.events = (waiter->reader ? EPOLLIN : 0) |
+        (waiter->writer ? EPOLLOUT : 0);
+    event.data.fd = waiter->fd;
+    return epoll_ctl(loop->epfd, event.events ? op : EPOLL_CTL_DEL,
+            waiter->fd, &event);
+}
+#endif
+
+/* Puts a task aside until the file descriptor it waits on is ready.
+ * Returns false if it can't be watched, or another task already waits
+ * on it the same way.
+ */
+static bool add_waiter(VM *vm, eventloop *loop, objgen *task, objwait *wait)
+{
+    fdwaiter *waiter = find_waiter(loop, wait->fd);
+    bool added = !waiter;
+    if (added) {
+        if (loop->waitercount == loop->waitercapacity) {
+            int oldcapacity = loop->waitercapacity;
+            loop->waitercapacity = GROW_CAPACITY(oldcapacity);
+            loop->waiters = GROW_ARRAY(loop->waiters, fdwaiter, oldcapacity,
+                    loop->waitercapacity);
+        }
+        waiter = &loop->waiters[loop->waitercount++];
+        waiter->fd = wait->fd;
+        waiter->reader = NULL;
+        waiter->writer = NULL;
+    }
+    objgen **task_slot = wait->kind == WAIT_WRITE ? &waiter->writer :
+        &waiter->reader;
+    if (*task_slot) {
+        runtime_error(vm, &vm->evalstack, 0,
+                "IOError: another task already waits on this file");
+        return false;
+    }
+    *task_slot = task;
+
+#ifdef __linux__
+    if (watch_fd(loop, waiter, added ? EPOLL_CTL_ADD : EPOLL_CTL_MOD) < 0) {
+        *task_slot = NULL;
+        if (added)
+            remove_waiter(loop, waiter);
+        // epoll takes no regular files, which are never waited on anyway
+        if (errno != EPERM) {
+            runtime_error(vm, &vm->evalstack, 0,
+                    "IOError: cannot wait on this file");
+            return false;
+        }
+        make_ready(loop, task);
+    }
+#endif
+    return true;
+}
+
+static void wake_waiter(eventloop *loop, fdwaiter *waiter, bool readable,
+        bool writable)
+{
+    if (readable && waiter->reader) {
+        make_ready(loop, waiter->reader);
+        waiter->reader = NULL;
+    }
+    if (writable && waiter->writer) {
+        make_ready(loop, waiter->writer);
+        waiter->writer = NULL;
+    }
+#ifdef __linux__
+    watch_fd(loop, waiter, EPOLL_CTL_MOD);
+#endif
+    if (!waiter->reader && !waiter->writer)
+        remove_waiter(loop, waiter);
+}
+
+// Waits up to timeout milliseconds, or for ever if it is -1
+static void wait_for_events(eventloop *loop, int timeout)
+{
+#ifdef __linux__
+    struct epoll_event events[MAX_EVENTS];
+    int count = epoll_wait(loop->epfd, events, MAX_EVENTS, timeout);
+    for (int i = 0; i < count; i++) {
+        fdwaiter *waiter = find_waiter(loop, events[i].data.fd);
+        if (!waiter)
+            continue;
+        uint32_t ready = events[i].events;
+        // A hung up or failed descriptor wakes both, to find out by reading
+        bool failed = ready & (EPOLLERR | EPOLLHUP);
+        wake_waiter(loop, waiter, failed || (ready & EPOLLIN),
+                failed || (ready & EPOLLOUT));
+    }
+#else
+    int count = loop->waitercount;
+    struct pollfd *fds = ALLOCATE(struct pollfd, count);
+    for (int i = 0; i < count; i++) {
+        fds[i].fd = loop->waiters[i].fd;
+        fds[i].events = (loop->waiters[i].reader ? POLLIN : 0) |
+            (loop->waiters[i].writer ? POLLOUT : 0);
+        fds[i].revents = 0;
+    }
+    if (poll(fds, count, timeout) > 0) {
+        for (int i = 0; i < count; i++) {
+            short ready = fds[i].revents;
+            fdwaiter *waiter = find_waiter(loop, fds[i].fd);
+            if (!ready || !waiter)
+                continue;
+            bool failed = ready & (POLLERR | POLLHUP | POLLNVAL);
+            wake_waiter(loop, waiter, failed || (ready & POLLIN),
+                    failed || (ready & POLLOUT));
+        }
+    }
+    FREE_ARRAY(struct pollfd, fds, count);
+#endif
+}
+
+// Whether stdio has already read input ahead of what was taken from fp
+static bool has_buffered_input(FILE *fp)
+{
+#ifdef __GLIBC__
+    return fp->_IO_read_ptr < fp->_IO_read_end;
+#else
+    (void)fp;
+    return false;
+#endif
+}
+
+/* Runs a task up to its next yield and puts it where what it yielded
+ * says. Returns false if it failed.
+ */
+static bool run_task(VM *vm, eventloop *loop, objgen *task)
+{
+    object *item = vm_resume_generator(vm, task);
+    if (vm->haderror)
+        return false;
+    if (!item)
+        return true;
+    if (!OBJ_IS_WAIT(item)) {
+        make_ready(loop, task);
+        return true;
+    }
+
+    objwait *wait = (objwait*)item;
+    if (wait->kind == WAIT_TIMER) {
+        if (wait->seconds > 0)
+            add_sleeper(loop, task, wait->seconds);
+        else
+            make_ready(loop, task);
+        return true;
+    }
+    if (wait->kind == WAIT_READ && wait->fp && has_buffered_input(wait->fp)) {
+        make_ready(loop, task);
+        return true;
+    }
+    return add_waiter(vm, loop, task, wait);
+}
+
+/* Runs the tasks until all of them have finished. Each round runs the
+ * tasks that were ready when it began, then checks the timers and file
+ * descriptors, without blocking if there are tasks ready for the next
+ * round. Returns false if a task failed, which stops the loop.
+ */
+bool eventloop_run(VM *vm, eventloop *loop)
+{
+    if (loop->running) {
+        runtime_error(vm, &vm->evalstack, 0,
+                "RuntimeError: the event loop is already running");
+        return false;
+    }
+    loop->running = true;
+    bool ok = true;
+    while (ok && (loop->head < loop->count || loop->sleepers ||
+                loop->waitercount)) {
+        int round = loop->count - loop->head;
+        for (int i = 0; ok && i < round; i++)
+            ok = run_task(vm, loop, next_ready(loop));
+        if (!ok || (!loop->sleepers && !loop->waitercount))
+            continue;
+        int timeout = loop->head < loop->count ? 0 :
+            next_timeout(loop, now_ms());
+        wait_for_events(loop, timeout);
+        expire_sleepers(loop, now_ms());
+    }
+    loop->running = false;
+    return ok;
+}
@@ -0,0 +1,418 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "filestream.h"
+#include "memory.h"
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#ifdef __NR_io_uring_setup
+#define HAVE_IO_URING
+#endif
+#endif
+
+
+#ifdef HAVE_IO_URING
+/* Only one transfer of a stream is ever in flight, so the rings are as
+ * small as they come and a completion is always for the transfer that
+ * is being waited for.
+ */
+#define RING_ENTRIES    2
+
+struct ioring_t
+{
+    int fd;
+    // Whether the buffers could be registered, which needs locked memory
+    bool registered;
+    struct iovec iovecs[2];
+    void *sqmap;
+    size_t sqsize;
+    void *cqmap;
+    size_t cqsize;
+    struct io_uring_sqe *sqes;
+    size_t sqesize;
+    unsigned *sqtail;
+    unsigned *sqmask;
+    unsigned *sqarray;
+    unsigned *cqhead;
+    unsigned *cqtail;
+    unsigned *cqmask;
+    struct io_uring_cqe *cqes;
+};
+
+static void close_ring(ioring *ring)
+{
+    if (ring->sqes != MAP_FAILED)
+        munmap(ring->sqes, ring->sqesize);
+    if (ring->cqmap != MAP_FAILED && ring->cqmap != ring->sqmap)
+        munmap(ring->cqmap, ring->cqsize);
+    if (ring->sqmap != MAP_FAILED)
+        munmap(ring->sqmap, ring->sqsize);
+    close(ring->fd);
+    FREE(ioring, ring);
+}
+
+static void *map_ring(int fd, size_t size, off_t offset)
+{
+    return mmap(NULL, size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, fd, offset);
+}
+
+// Returns NULL if the kernel has no io_uring or won't give one
+static ioring *open_ring(char **buffers)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = syscall(__NR_io_uring_setup, RING_ENTRIES, &params);
+    if (fd < 0)
+        return NULL;
+
+    ioring *ring = ALLOCATE(ioring, 1);
+    ring->fd = fd;
+    ring->sqsize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cqsize = params.cq_off.cqes +
+        params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqesize = params.sq_entries * sizeof(struct io_uring_sqe);
+    bool single = false;
+#ifdef IORING_FEAT_SINGLE_MMAP
+    single = params.features & IORING_FEAT_SINGLE_MMAP;
+#endif
+    if (single && ring->cqsize > ring->sqsize)
+        ring->sqsize = ring->cqsize;
+    ring->sqmap = map_ring(fd, ring->sqsize, IORING_OFF_SQ_RING);
+    ring->cqmap = single ? ring->sqmap :
+        map_ring(fd, ring->cqsize, IORING_OFF_CQ_RING);
+    ring->sqes = map_ring(fd, ring->sqesize, IORING_OFF_SQES);
+    if (ring->sqmap == MAP_FAILED || ring->cqmap == MAP_FAILED ||
+            ring->sqes == MAP_FAILED) {
+        close_ring(ring);
+        return NULL;
+    }
+
+    char *sq = ring->sqmap;
+    ring->sqtail = (unsigned*)(sq + params.sq_off.tail);
+    ring->sqmask = (unsigned*)(sq + params.sq_off.ring_mask);
+    ring->sqarray = (unsigned*)(sq + params.sq_off.array);
+    char *cq = ring->cqmap;
+    ring->cqhead = (unsigned*)(cq + params.cq_off.head);
+    ring->cqtail = (unsigned*)(cq + params.cq_off.tail);
+    ring->cqmask = (unsigned*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    for (int i = 0; i < 2; i++) {
+        ring->iovecs[i].iov_base = buffers[i];
+        ring->iovecs[i].iov_len = STREAM_BUFFER_SIZE;
+    }
+    ring->registered = syscall(__NR_io_uring_register, fd,
+            IORING_REGISTER_BUFFERS, ring->iovecs, 2) == 0;
+    return ring;
+}
+
+static bool submit_ring(ioring *ring, filestream *stream, int index)
+{
+    unsigned tail = *ring->sqtail;
+    unsigned entry = tail & *ring->sqmask;
+    struct io_uring_sqe *sqe = &ring->sqes[entry];
+    memset(sqe, 0, sizeof(*sqe));
+    if (ring->registered) {
+        sqe->opcode = stream->writing ? IORING_OP_WRITE_FIXED :
+            IORING_OP_READ_FIXED;
+        sqe->addr = (unsigned long)stream->buffers[index];
+        sqe->len = stream->lengths[index];
+        sqe->buf_index = index;
+    }
+    else {
+        ring->iovecs[index].iov_len = stream->lengths[index];
+        sqe->opcode = stream->writing ? IORING_OP_WRITEV : IORING_OP_READV;
+        sqe->addr = (unsigned long)&ring->iovecs[index];
+        sqe->len = 1;
+    }
+    sqe->fd = stream->fd;
+    sqe->off = stream->offsets[index];
+    sqe->user_data = index;
+    ring->sqarray[entry] = entry;
+    __atomic_store_n(ring->sqtail, tail + 1, __ATOMIC_RELEASE);
+    return syscall(__NR_io_uring_enter, ring->fd, 1, 0, 0, NULL, 0) == 1;
+}
+
+// Waits for the transfer in flight. Returns its result, or -errno
+static int wait_ring(ioring *ring)
+{
+    for (;;) {
+        unsigned head = *ring->cqhead;
+        if (head != __atomic_load_n(ring->cqtail, __ATOMIC_ACQUIRE)) {
+            int result = ring->cqes[head & *ring->cqmask].res;
+            __atomic_store_n(ring->cqhead, head + 1, __ATOMIC_RELEASE);
+            return result;
+        }
+        if (syscall(__NR_io_uring_enter, ring->fd, 0, 1,
+                    IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR)
+            return -errno;
+    }
+}
+#endif
+
+// Reads into a buffer with pread(). Returns the bytes read, or -errno
+static ssize_t read_now(filestream *stream, int index)
+{
+    ssize_t done;
+    do
+        done = pread(stream->fd, stream->buffers[index],
+                stream->lengths[index], stream->offsets[index]);
+    while (done < 0 && errno == EINTR);
+    return done < 0 ? -errno : done;
+}
+
+// Writes what is left of a buffer from written on with pwrite()
+static bool write_now(filestream *stream, int index, size_t written)
+{
+    while (written < stream->lengths[index]) {
+        ssize_t done = pwrite(stream->fd, stream->buffers[index] + written,
+                stream->lengths[index] - written,
+                stream->offsets[index] + written);
+        if (done < 0 && errno != EINTR)
+            return false;
+        if (done > 0)
+            written += done;
+    }
+    return true;
+}
+
+/* Starts filling a buffer from the file, or writing it out. Without a
+ * ring a read only asks the kernel to read ahead, and the transfer is
+ * made by finish_transfer().
+ */
+static void start_transfer(filestream *stream, int index)
+{
+    stream->offsets[index] = stream->offset;
+    if (stream->writing)
+        stream->offset += stream->lengths[index];
+    else
+        stream->lengths[index] = STREAM_BUFFER_SIZE;
+    stream->pending = true;
+#ifdef HAVE_IO_URING
+    if (stream->ring && !submit_ring(stream->ring, stream, index)) {
+        close_ring(stream->ring);
+        stream->ring = NULL;
+    }
+    if (stream->ring)
+        return;
+#endif
+#ifdef POSIX_FADV_WILLNEED
+    if (!stream->writing)
+        posix_fadvise(stream->fd, stream->offsets[index],
+                STREAM_BUFFER_SIZE, POSIX_FADV_WILLNEED);
+#endif
+}
+
+// Waits for the transfer in flight on a buffer. Returns false if it failed
+static bool finish_transfer(filestream *stream, int index)
+{
+    stream->pending = false;
+    ssize_t done = 0;
+    bool waited = false;
+#ifdef HAVE_IO_URING
+    if (stream->ring) {
+        done = wait_ring(stream->ring);
+        // Anything the ring gave up on is done here instead
+        waited = done != -EAGAIN && done != -EINTR;
+        if (!waited)
+            done = 0;
+    }
+#endif
+    if (!waited && !stream->writing)
+        done = read_now(stream, index);
+    if (done < 0) {
+        errno = -done;
+        stream->failed = true;
+        stream->lengths[index] = 0;
+        return false;
+    }
+
+    if (stream->writing) {
+        bool written = write_now(stream, index, done);
+        stream->lengths[index] = 0;
+        if (!written) {
+            stream->failed = true;
+            return false;
+        }
+    }
+    else {
+        stream->lengths[index] = done;
+        stream->offset += done;
+    }
+    return true;
+}
+
+/* Opens a stream on a file descriptor, which reads from or writes to
+ * the file from where it is now. Returns NULL if it isn't a regular
+ * file.
+ */
+filestream *open_filestream(int fd, bool writing)
+{
+    struct stat info;
+    if (fstat(fd, &info) < 0 || !S_ISREG(info.st_mode))
+        return NULL;
+    off_t offset = lseek(fd, 0, SEEK_CUR);
+    if (offset < 0)
+        return NULL;
+
+    filestream *stream = ALLOCATE(filestream, 1);
+    stream->fd = fd;
+    stream->writing = writing;
+    stream->offset = offset;
+    for (int i = 0; i < 2; i++) {
+        stream->buffers[i] = ALLOCATE(char, STREAM_BUFFER_SIZE);
+        stream->lengths[i] = 0;
+        stream->offsets[i] = offset;
+    }
+    stream->current = 0;
+    stream->position = 0;
+    stream->pending = false;
+    stream->failed = false;
+    stream->ring = NULL;
+#ifdef HAVE_IO_URING
+    stream->ring = open_ring(stream->buffers);
+#endif
+    if (!writing)
+        start_transfer(stream, 1);
+    return stream;
+}
+
+// Writes out what is left and frees the stream. Returns false if it failed
+bool close_filestream(filestream *stream)
+{
+    bool ok = filestream_flush(stream);
+    if (stream->pending)
+        finish_transfer(stream, !stream->current);
+#ifdef HAVE_IO_URING
+    if (stream->ring)
+        close_ring(stream->ring);
+#endif
+    for (int i = 0; i < 2; i++)
+        FREE_ARRAY(char, stream->buffers[i], STREAM_BUFFER_SIZE);
+    FREE(filestream, stream);
+    return ok;
+}
+
+/* Moves on to the buffer read ahead and starts reading ahead into the
+ * one that was just used up. Returns false at the end of the file, or
+ * if the read failed. A later call tries again, in case the file grew.
+ */
+static bool refill(filestream *stream)
+{
+    int next = !stream->current;
+    if (!stream->pending)
+        start_transfer(stream, next);
+    if (!finish_transfer(stream, next) || stream->lengths[next] == 0)
+        return false;
+    stream->current = next;
+    stream->position = 0;
+    start_transfer(stream, !next);
+    return true;
+}
+
+/* Reads the next line with its newline, as getline() does, into a line
+ * buffer grown with GROW_ARRAY. Returns its length, or -1 at the end of
+ * the file.
+ */
+ssize_t filestream_readline(filestream *stream, char **line,
+        size_t *capacity)
+{
+    size_t length = 0;
+    bool found = false;
+    while (!found) {
+        if (stream->position == stream->lengths[stream->current] &&
+                !refill(stream))
+            break;
+        char *start = stream->buffers[stream->current] + stream->position;
+        size_t available = stream->lengths[stream->current] -
+            stream->position;
+        char *newline = memchr(start, '\n', available);
+        size_t take = newline ? (size_t)(newline - start) + 1 : available;
+        if (length + take + 1 > *capacity) {
+            size_t oldcapacity = *capacity;
+            size_t newcapacity = oldcapacity;
+            while (length + take + 1 > newcapacity)
+                newcapacity = GROW_CAPACITY(newcapacity);
+            *line = GROW_ARRAY(*line, char, oldcapacity, newcapacity);
+            *capacity = newcapacity;
+        }
+        memcpy(*line + length, start, take);
+        length += take;
+        stream->position += take;
+        found = newline != NULL;
+    }
+    if (length == 0)
+        return -1;
+    (*line)[length] = '\0';
+    return length;
+}
+
+// Reads up to count bytes. Returns how many, which is 0 at the end
+size_t filestream_read(filestream *stream, char *data, size_t count)
+{
+    size_t total = 0;
+    while (total < count) {
+        if (stream->position == stream->lengths[stream->current] &&
+                !refill(stream))
+            break;
+        size_t available = stream->lengths[stream->current] -
+            stream->position;
+        size_t take = available < count - total ? available : count - total;
+        memcpy(data + total,
+                stream->buffers[stream->current] + stream->position, take);
+        total += take;
+        stream->position += take;
+    }
+    return total;
+}
+
+/* Starts writing out the current buffer, once the one before it has
+ * been written, and moves on to the other.
+ */
+static bool send_current(filestream *stream)
+{
+    int next = !stream->current;
+    if (stream->pending && !finish_transfer(stream, next))
+        return false;
+    start_transfer(stream, stream->current);
+    stream->current = next;
+    return true;
+}
+
+bool filestream_write(filestream *stream, const char *data, size_t count)
+{
+    if (stream->failed)
+        return false;
+    while (count > 0) {
+        size_t *length = &stream->lengths[stream->current];
+        size_t room = STREAM_BUFFER_SIZE - *length;
+        size_t take = room < count ? room : count;
+        memcpy(stream->buffers[stream->current] + *length, data, take);
+        *length += take;
+        data += take;
+        count -= take;
+        if (*length == STREAM_BUFFER_SIZE && !send_current(stream))
+            return false;
+    }
+    return true;
+}
+
+// Waits until everything written so far is in the file
+bool filestream_flush(filestream *stream)
+{
+    if (!stream->writing)
+        return true;
+    if (stream->lengths[stream->current] && !send_current(stream))
+        return false;
+    if (stream->pending && !finish_transfer(stream, !stream->current))
+        return false;
+    return !stream->failed;
+}
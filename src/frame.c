@@ -10,6 +10,7 @@ void init_frame(frame *f)
     f->pc = 0;
     f->next = NULL;
     f->is_adhoc = false;
+    f->is_block = false;
     f->name = NULL;
 }
 
@@ -19,6 +20,7 @@ void reset_frame(frame *f)
     f->pc = 0;
     f->next = NULL;
     f->is_adhoc = false;
+    f->is_block = false;
     f->name = NULL;
 }
 
@@ -0,0 +1,139 @@
+#ifndef ari_aot_h
+#define ari_aot_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "instruct.h"
+#include "io.h"
+#include "objprim.h"
+#include "objstack.h"
+#include "opcode.h"
+#include "vm.h"
+
+/* 'ari --emit-c script.ari' writes a C file that runs the script without
+ * the front end. It is built against libari.a, e.g. with
+ * 'make aot SCRIPT=script.ari', and its main() calls aot_main().
+ */
+typedef intrpstate (*aotentry)(VM *vm, instruct *instructs,
+        primstring **names);
+
+bool emit_c(AriFile *file, FILE *out);
+int aot_main(const uint8_t *image, size_t size, const char *const *names,
+        int num_names, aotentry run);
+bool aot_dispatch(VM *vm, instruct *instructs, int pc, intrpstate *state);
+
+/* The generated code keeps the values an expression works on in locals
+ * rather than on the stack. Numbers stay unboxed there, and are only
+ * made into objects when they are stored or handed to the vm.
+ */
+typedef enum
+{
+    AOT_OBJECT,
+    AOT_INT,
+    AOT_DOUBLE,
+} aottype;
+
+typedef struct
+{
+    aottype type;
+    union
+    {
+        int64_t i;
+        double d;
+    };
+    object *obj;    // NULL for a number worked out in C
+} aotvalue;
+
+static inline aotvalue aot_int(int64_t number)
+{
+    return (aotvalue){ .type = AOT_INT, .i = number, .obj = NULL };
+}
+
+static inline aotvalue aot_double(double number)
+{
+    return (aotvalue){ .type = AOT_DOUBLE, .d = number, .obj = NULL };
+}
+
+static inline aotvalue aot_object(object *obj)
+{
+    aotvalue local = { .type = AOT_OBJECT, .i = 0, .obj = obj };
+    if (obj && OBJ_IS_PRIMITIVE(obj)) {
+        objprim *prim = (objprim*)obj;
+        if (prim->ptype == PRIM_INT) {
+            local.type = AOT_INT;
+            local.i = PRIM_AS_INT(prim);
+        }
+        else if (prim->ptype == PRIM_DOUBLE) {
+            local.type = AOT_DOUBLE;
+            local.d = PRIM_AS_DOUBLE(prim);
+        }
+    }
+    return local;
+}
+
+static inline object *aot_box(VM *vm, aotvalue *local)
+{
+    if (local->type != AOT_OBJECT && !local->obj)
+        local->obj = local->type == AOT_INT ? vm_new_int(vm, local->i) :
+            vm_new_double(vm, local->d);
+    return local->obj;
+}
+
+static inline void aot_push(VM *vm, aotvalue *local)
+{
+    push_objstack(&vm->evalstack, aot_box(vm, local));
+}
+
+static inline aotvalue aot_pop(VM *vm)
+{
+    return aot_object(pop_objstack(&vm->evalstack));
+}
+
+static inline bool aot_load_name(VM *vm, primstring *name, aotvalue *local)
+{
+    object *obj = vm_find_name(vm, name);
+    if (!obj)
+        return false;
+    *local = aot_object(obj);
+    return true;
+}
+
+static inline void aot_store_name(VM *vm, primstring *name, aotvalue *local)
+{
+    vm_store_name(vm, name, aot_box(vm, local));
+}
+
+/* a = a op b for two ints or two doubles, the way the quickened
+ * instructions do it: ints that overflow give a double, and int division
+ * and division by zero are left to the vm. Returns false, changing
+ * nothing, for anything it doesn't do.
+ */
+static inline bool aot_arith(char op, aotvalue *a, aotvalue *b)
+{
+    if (a->type == AOT_INT && b->type == AOT_INT && op != '/') {
+        int64_t result;
+        if (int_arith(op, a->i, b->i, &result))
+            *a = aot_int(result);
+        else {
+            double x = (double)a->i, y = (double)b->i;
+            *a = aot_double(op == '+' ? x + y : op == '-' ? x - y : x * y);
+        }
+        return true;
+    }
+    if (a->type == AOT_DOUBLE && b->type == AOT_DOUBLE &&
+            (op != '/' || b->d != 0)) {
+        switch (op) {
+            case '+':   *a = aot_double(a->d + b->d); break;
+            case '-':   *a = aot_double(a->d - b->d); break;
+            case '*':   *a = aot_double(a->d * b->d); break;
+            default:    *a = aot_double(a->d / b->d); break;
+        }
+        return true;
+    }
+    return false;
+}
+
+#endif
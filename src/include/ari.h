@@ -0,0 +1,33 @@
+#ifndef ari_h
+#define ari_h
+
+#include <stdbool.h>
+
+/* The API for running ari inside another program, built into libari.a.
+ *
+ * Each ari_vm has its own objects, globals, compiled code and machine
+ * code, and vms share nothing but read-only tables. Different vms can
+ * be used on different threads at the same time, but one vm must only
+ * be used by one thread at a time. Errors are reported on stderr.
+ *
+ * Whether vms use the jit is decided by jit_enabled in jit.h, which is
+ * only read after startup, so set it before any thread makes a vm.
+ */
+typedef struct VM_t ari_vm;
+
+// Makes a vm with the builtins loaded
+ari_vm *ari_vm_new(void);
+
+/* Compiles source as the script of vm, in place of any compiled before.
+ * Returns false if it has a syntax error.
+ */
+bool ari_compile(ari_vm *vm, const char *source);
+
+/* Runs the script compiled last from its beginning. Globals it sets stay
+ * set for the next run. Returns false if it stopped on a runtime error.
+ */
+bool ari_run(ari_vm *vm);
+
+void ari_vm_free(ari_vm *vm);
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef ari_cache_h
+#define ari_cache_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "instruct.h"
+#include "io.h"
+
+/* Compiled scripts are cached in .aric files, either next to the source
+ * (script.ari -> script.aric) or in the directory named by ARI_CACHE_DIR.
+ */
+#define ARI_CACHE_DIR_ENV   "ARI_CACHE_DIR"
+
+bool load_bytecode_cache(AriFile *file, instruct *instructs);
+void write_bytecode_cache(AriFile *file, instruct *instructs);
+uint8_t *write_bytecode_image(instruct *instructs, size_t *size);
+bool load_bytecode_image(const uint8_t *image, size_t size,
+        instruct *instructs);
+
+#endif
@@ -6,10 +6,18 @@
 #define DEBUG_ARI
 #define DEBUG_TOKENIZER
 #define DEBUG_ARI_PARSER
+#define DEBUG_ARI_OPSTATS
 
 #undef DEBUG_TOKENIZER
 #undef DEBUG_ARI_PARSER
+#undef DEBUG_ARI_OPSTATS
 
+const char *bytecode_name(uint8_t bytecode);
 void print_bytecode(uint8_t bytecode);
 
+#ifdef DEBUG_ARI_OPSTATS
+void record_opcode_pair(uint8_t previous, uint8_t current);
+void print_opcode_stats(void);
+#endif
+
 #endif
@@ -9,6 +9,7 @@
 
 intrpstate runtime_error(VM *vm, objstack *stack, size_t line, 
         const char *format, ...);
+intrpstate runtime_error_line(VM *vm, instruct *instructs);
 intrpstate runtime_error_loadname(VM *vm, char *name, uint64_t current);
 intrpstate runtime_error_unsupported_operation(VM *vm, uint64_t current, 
         char optype);
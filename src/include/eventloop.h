@@ -0,0 +1,62 @@
+#ifndef ari_eventloop_h
+#define ari_eventloop_h
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "objgen.h"
+#include "objwait.h"
+#include "vm.h"
+
+/* The event loop runs generators as tasks, all on the thread of the vm.
+ * A task runs until it yields. If it yields what sleep(), await_read()
+ * or await_write() gave, it is put aside until its timer runs out or
+ * its file descriptor is ready, and the other tasks run meanwhile.
+ *
+ * Sleeping tasks are kept in a timer wheel of WHEEL_SLOTS lists, one
+ * per millisecond, which a sleep longer than a turn of the wheel stays
+ * in for several turns. File descriptors are watched with epoll on
+ * Linux and with poll() elsewhere. A regular file is always ready.
+ */
+#define WHEEL_SLOTS     256
+
+typedef struct sleeper_t
+{
+    objgen *task;
+    // Millisecond the task is woken at
+    uint64_t deadline;
+    struct sleeper_t *next;
+} sleeper;
+
+// The tasks waiting on one file descriptor
+typedef struct
+{
+    int fd;
+    objgen *reader;
+    objgen *writer;
+} fdwaiter;
+
+typedef struct eventloop_t
+{
+    // Tasks ready to run, from head up to count
+    objgen **ready;
+    int head;
+    int count;
+    int capacity;
+    sleeper *wheel[WHEEL_SLOTS];
+    // The next millisecond the wheel has to look at
+    uint64_t tick;
+    int sleepers;
+    fdwaiter *waiters;
+    int waitercount;
+    int waitercapacity;
+    int epfd;
+    bool running;
+} eventloop;
+
+eventloop *init_eventloop(void);
+void free_eventloop(eventloop *loop);
+void eventloop_spawn(eventloop *loop, objgen *task);
+bool eventloop_run(VM *vm, eventloop *loop);
+
+#endif
@@ -7,6 +7,7 @@ typedef enum exprtype_t
 {
     EXPR_ASSIGN,
     EXPR_BINARY,
+    EXPR_LOGICAL,
     EXPR_GROUPING,
     EXPR_LITERAL_STRING,
     EXPR_LITERAL_NUMBER,
@@ -18,7 +19,11 @@ typedef enum exprtype_t
     EXPR_SET_PROP,
     EXPR_GET_PROP,
     EXPR_METHOD,
-    EXPR_SOURCE
+    EXPR_SOURCE,
+    EXPR_LIST,
+    EXPR_GET_INDEX,
+    EXPR_SET_INDEX,
+    EXPR_DICT
 } exprtype;
 
 typedef struct expr_t
@@ -34,6 +39,7 @@ typedef struct expr_assign_t
     expr *expression;
 } expr_assign;
 
+// Also used for EXPR_LOGICAL, the short-circuit 'and' and 'or'
 typedef struct expr_binary_t
 {
     expr header;
@@ -100,6 +106,32 @@ typedef struct expr_method_t
     expr *call;
 } expr_method;
 
+typedef struct expr_list_t
+{
+    expr header;
+    int count;
+    int capacity;
+    expr **items;
+} expr_list;
+
+typedef struct expr_dict_t
+{
+    expr header;
+    int count;
+    int capacity;
+    expr **keys;
+    expr **values;
+} expr_dict;
+
+typedef struct expr_index_t
+{
+    expr header;
+    expr *refobj;
+    expr *index;
+    // Only set for EXPR_SET_INDEX
+    expr *value;
+} expr_index;
+
 typedef struct expr_source_t
 {
     expr header;
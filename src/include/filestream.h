@@ -0,0 +1,48 @@
+#ifndef ari_filestream_h
+#define ari_filestream_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/* Bulk reads and writes of a regular file go through two buffers, so the
+ * kernel can fill or drain one while the script uses the other. A stream
+ * that reads starts reading ahead as soon as it is opened.
+ *
+ * On Linux each stream has an io_uring of its own with both buffers
+ * registered with it. Where io_uring is missing or refused, a transfer
+ * is done with pread() or pwrite() when it is waited for instead.
+ */
+#define STREAM_BUFFER_SIZE  (64 * 1024)
+
+typedef struct ioring_t ioring;
+
+typedef struct
+{
+    int fd;
+    bool writing;
+    // Where the next transfer starts in the file
+    off_t offset;
+    char *buffers[2];
+    size_t lengths[2];
+    // Where the transfer in flight on each buffer started
+    off_t offsets[2];
+    // The buffer the script reads from or writes to
+    int current;
+    // How far the script has read the current buffer
+    size_t position;
+    // The other buffer has a transfer in flight
+    bool pending;
+    bool failed;
+    ioring *ring;
+} filestream;
+
+filestream *open_filestream(int fd, bool writing);
+bool close_filestream(filestream *stream);
+ssize_t filestream_readline(filestream *stream, char **line,
+        size_t *capacity);
+size_t filestream_read(filestream *stream, char *data, size_t count);
+bool filestream_write(filestream *stream, const char *data, size_t count);
+bool filestream_flush(filestream *stream);
+
+#endif
@@ -3,17 +3,47 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #include "objhash.h"
 #include "objprim.h"
 
+typedef enum
+{
+    COUNT_INT,
+    COUNT_DOUBLE,
+    COUNT_OBJECT,
+} countmode;
+
+/* State of a for loop run by FOR_RANGE and FOR_STEP, kept in the frame
+ * the for statement pushed. The counter stays unboxed while it is a
+ * number; anything else goes through the generic add and compare.
+ */
+typedef struct forloop_t
+{
+    countmode mode;
+    char *name;
+    int cmptype;
+    int64_t counter;
+    double dcounter;
+    // The current value of the counter in COUNT_OBJECT mode
+    object *current;
+    object *step;
+    object *bound;
+    // The iterator of a for-in loop, from GET_ITER
+    object *iterator;
+} forloop;
+
 typedef struct frame_t
 {
     objhash locals;
     size_t pc;
     struct frame_t *next;
     bool is_adhoc;
+    // Pushed by PUSH_FRAME for a block, rather than by a call
+    bool is_block;
     primstring *name;
+    forloop loop;
 } frame;
 
 void init_frame(frame *f);
@@ -9,6 +9,7 @@
 #define VAL_IS_BOOL(value)      (value->type == VAL_BOOL)
 #define VAL_IS_INT(value)       (value->type == VAL_INT)
 #define VAL_IS_DOUBLE(value)    (value->type == VAL_DOUBLE)
+#define VAL_IS_LONG(value)      (value->type == VAL_LONG)
 #define VAL_IS_STRING(value)    (value->type == VAL_STRING)
 #define VAL_IS_NULL(value)      (value->type == VAL_NULL)
 #define VAL_IS_OBJECT(value)    (value->type == VAL_OBJ)
@@ -16,6 +17,7 @@
 #define VAL_AS_BOOL(value)      (value->val_int)
 #define VAL_AS_INT(value)       (value->val_int)
 #define VAL_AS_DOUBLE(value)    (value->val_double)
+#define VAL_AS_LONG(value)      (value->val_long)
 #define VAL_AS_STRING(value)    (value->val_string)
 #define VAL_AS_NULL(value)      (value->val_int)
 #define VAL_AS_OBJECT(value)    (value->val_obj)
@@ -38,6 +40,8 @@ typedef enum
     VAL_STRING,
     VAL_NULL,
     VAL_OBJECT,
+    // Integer constants; VAL_INT is for counts and jump targets
+    VAL_LONG,
 } valtype;
 
 typedef struct value_t
@@ -46,6 +50,7 @@ typedef struct value_t
     union 
     {
         int val_int;
+        int64_t val_long;
         double val_double;
         char *val_string;
         object *val_obj;
@@ -55,6 +60,8 @@ typedef struct value_t
 typedef struct code8_t
 {
     uint8_t bytecode;
+    uint8_t hotness;    // times the operand types matched, for quickening
+    uint8_t deopts;     // times a quickened form fell back
     value operand;
     int line;
 } code8;
@@ -65,6 +72,10 @@ typedef struct instruct_t
     int count;
     int capacity;
     code8 **code;
+    // Machine code for the instructions, once the jit compiled them
+    struct jitcode_t *jitcode;
+    // Machine code for hot loops, keyed by loop header
+    struct jittrace_t *traces;
 } instruct;
 
 void init_instruct(instruct *instructs);
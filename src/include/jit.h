@@ -0,0 +1,110 @@
+#ifndef ari_jit_h
+#define ari_jit_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "instruct.h"
+#include "vm.h"
+
+/* The jit only knows how to emit x86-64. Elsewhere ARI_JIT is ignored
+ * and everything runs in the interpreter.
+ */
+#if defined(ARI_JIT) && !defined(__x86_64__)
+#undef ARI_JIT
+#endif
+
+// Calls to a function before its body is compiled to machine code
+#define JIT_CALL_THRESHOLD  16
+// Backward jumps taken before the loop they close is traced
+#define TRACE_THRESHOLD     32
+// Most instructions recorded for one trace
+#define TRACE_MAX_LENGTH    256
+// Failed recordings of a loop before it is left alone
+#define TRACE_MAX_ABORTS    4
+// Most instructions in a function whose body a trace records a call into
+#define TRACE_MAX_CALLEE    64
+
+typedef intrpstate (*jitentry)(VM *vm, instruct *instructs);
+
+typedef struct jitcode_t
+{
+    uint8_t *memory;
+    size_t size;
+    // Machine code address of every instruction, plus one for the exit
+    void **labels;
+    int count;
+    // Names the code looks up, made once when it was compiled
+    primstring **names;
+    int num_names;
+    int name_capacity;
+    jitentry entry;
+} jitcode;
+
+/* A trace is the machine code for one path through a loop body, from the
+ * loop header back to it. Returns false if an instruction on the trace
+ * returned from the frame.
+ */
+typedef bool (*traceentry)(VM *vm, instruct *instructs);
+
+typedef struct jittrace_t
+{
+    int header;
+    uint8_t *memory;
+    size_t size;
+    traceentry entry;
+    // Names the trace looks up, made once when it was compiled
+    primstring **names;
+    int num_names;
+    int name_capacity;
+    struct jittrace_t *next;
+} jittrace;
+
+typedef struct
+{
+    int pc;
+    int next;
+    // Type both operands of arithmetic or a comparison had, or -1
+    int ptype;
+    // Getter method inlined at a CALL_METHOD
+    object *method;
+    // Function on the stack at a CALL_FUNCTION or CALL_METHOD
+    object *called;
+    // Whether the steps that follow are the body of that call
+    bool inlined;
+    // Function whose body the step is in, NULL for the loop's own
+    objcode *within;
+} tracestep;
+
+typedef struct tracerecorder_t
+{
+    code8 *backedge;
+    int header;
+    int count;
+    // Function whose body is being recorded, NULL in the loop itself
+    objcode *callee;
+    // Something in the callee can't be traced
+    bool failed;
+    tracestep steps[TRACE_MAX_LENGTH];
+} tracerecorder;
+
+extern bool jit_enabled;
+
+bool jit_compile(instruct *instructs);
+intrpstate jit_execute(VM *vm, instruct *instructs);
+void free_jitcode(jitcode *code);
+
+jittrace *find_trace(instruct *instructs, int header);
+tracerecorder *start_trace(code8 *backedge, int header);
+int record_trace_step(tracerecorder *recorder, VM *vm, instruct *instructs,
+        int pc);
+tracerecorder *end_trace_step(tracerecorder *recorder, int step, VM *vm,
+        instruct *instructs);
+bool start_trace_call(tracerecorder *recorder, objcode *funcobj,
+        int argcount);
+void end_trace_call(tracerecorder *recorder);
+void abort_trace(tracerecorder *recorder);
+void free_traces(jittrace *trace);
+
+#endif
@@ -31,5 +31,6 @@ void objhash_set(objhash *ht, struct primstring_t *key,
         struct object_t *value);
 struct object_t *objhash_get(objhash *ht, struct primstring_t *key);
 void reset_objhash(objhash *hashtable);
+void objhash_clear(objhash *hashtable);
 
 #endif
@@ -13,6 +13,8 @@ typedef struct valstack_t
 {
     int count;
     objnode *top;
+    // Popped nodes kept for the next pushes, linked through next
+    objnode *spare;
 } objstack;
 
 void init_objstack(objstack *stack);
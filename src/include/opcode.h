@@ -21,13 +21,41 @@ typedef enum
     OP_GET_PROPERTY,
     OP_GET_SOURCE,
     OP_STORE_NAME,
+    OP_STORE_NAME_KEEP,
     OP_COMPARE,
     OP_BINARY_ADD,
     OP_BINARY_SUB,
     OP_BINARY_MULT,
     OP_BINARY_DIVIDE,
     OP_NEGATE,
-    OP_RETURN
+    OP_RETURN,
+    OP_GET_NAME_PROPERTY,
+    OP_SET_NAME_PROPERTY,
+    OP_COMPARE_NAME_CONST_JMP,
+    OP_ADD_NAME_CONST_STORE,
+    OP_ADD_DOUBLE,
+    OP_SUB_DOUBLE,
+    OP_MULT_DOUBLE,
+    OP_DIVIDE_DOUBLE,
+    OP_COMPARE_DOUBLE_JMP,
+    OP_ADD_INT,
+    OP_SUB_INT,
+    OP_MULT_INT,
+    OP_COMPARE_INT_JMP,
+    OP_TAIL_CALL,
+    OP_BUILD_LIST,
+    OP_INDEX_GET,
+    OP_INDEX_SET,
+    OP_BUILD_DICT,
+    OP_FOR_RANGE,
+    OP_FOR_STEP,
+    OP_GET_ITER,
+    OP_FOR_ITER,
+    OP_JMP_IF_FALSE_KEEP,
+    OP_JMP_IF_TRUE_KEEP,
+    OP_NOT,
+    OP_YIELD,
+    OP_COUNT    // Not an opcode, the number of opcodes
 } opcode;
 
 #endif
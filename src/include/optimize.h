@@ -0,0 +1,8 @@
+#ifndef ari_optimize_h
+#define ari_optimize_h
+
+#include "instruct.h"
+
+void optimize_instructs(instruct *instructs);
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef ari_parallel_h
+#define ari_parallel_h
+
+#include "objcode.h"
+#include "objlist.h"
+#include "vm.h"
+
+/* parallel_map() runs a function over a list on worker threads, each with
+ * a vm of its own. The function and every function and class defined
+ * globally are written once to a bytecode image, which all the workers
+ * read to make their own copies, since running code changes it. Global
+ * values that could be passed are copied into each worker as well, so a
+ * worker that changes one doesn't change the caller's. Other globals,
+ * such as instances and files, aren't there at all.
+ *
+ * Workers take the list in chunks from a shared cursor, so a worker that
+ * gets cheap items takes more chunks. Numbers, strings, bools and null
+ * are handed to the workers as they are, since nothing changes them, and
+ * lists, dicts and float64arrays are copied. Results are copied back
+ * once all the workers have finished.
+ */
+// Most worker threads started for one call
+#define PARALLEL_MAX_WORKERS    256
+// Chunks each worker would take if all items cost the same
+#define PARALLEL_CHUNKS         8
+// Deepest lists and dicts can nest in what goes to or from a worker
+#define PARALLEL_MAX_DEPTH      64
+
+/* Whether obj can go to or come back from a worker, reporting why not as
+ * a TypeError. verb is "pass" or "return", for the message.
+ */
+bool parallel_can_pass(VM *vm, object *obj, const char *verb);
+object *parallel_map(VM *vm, objcode *funcobj, objlist *inputs, int workers);
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef ari_simd_h
+#define ari_simd_h
+
+#include <stddef.h>
+
+/* Loops over raw arrays of doubles for the float64array builtins. On
+ * x86-64 they run with AVX2 when the cpu has it and SSE2 otherwise,
+ * picked the first time one is called. Sums are added up lane by lane,
+ * so their last bits can differ from a plain left to right loop.
+ *
+ * min and max must not be called with an empty array.
+ */
+double simd_sum(const double *a, size_t n);
+double simd_min(const double *a, size_t n);
+double simd_max(const double *a, size_t n);
+double simd_dot(const double *a, const double *b, size_t n);
+void simd_add(double *out, const double *a, const double *b, size_t n);
+void simd_mul(double *out, const double *a, const double *b, size_t n);
+void simd_scale(double *out, const double *a, double k, size_t n);
+void simd_prefix_sum(double *out, const double *a, size_t n);
+
+#endif
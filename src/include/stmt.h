@@ -11,10 +11,12 @@ typedef enum stmttype_t
     STMT_IF,
     STMT_WHILE,
     STMT_FOR,
+    STMT_FOR_IN,
     STMT_FUNCTION,
     STMT_METHOD,
     STMT_CLASS,
     STMT_RETURN,
+    STMT_YIELD,
 } stmttype;
 
 typedef struct stmt_t
@@ -61,6 +63,14 @@ typedef struct stmt_for_t
     stmt *loopbody;
 } stmt_for;
 
+typedef struct stmt_for_in_t
+{
+    stmt header;
+    token *name;
+    expr *iterable;
+    stmt *loopbody;
+} stmt_for_in;
+
 typedef struct stmt_print_t
 {
     stmt header;
@@ -101,4 +111,10 @@ typedef struct stmt_return_t
     expr *value;
 } stmt_return;
 
+typedef struct stmt_yield_t
+{
+    stmt header;
+    expr *value;
+} stmt_yield;
+
 #endif
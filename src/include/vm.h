@@ -5,11 +5,20 @@
 #include "frame.h"
 #include "module.h"
 #include "object.h"
+#include "objgen.h"
 #include "objhash.h"
+#include "objprim.h"
 #include "objstack.h"
 #include "parser.h"
 #include "tokenizer.h"
 
+// Most popped frames kept for reuse
+#define FRAME_POOL_MAX  64
+// Whole numbers the vm shares one object for instead of making new ones
+#define SMALLNUM_MIN    -128
+#define SMALLNUM_MAX    1023
+#define SMALLNUM_COUNT  (SMALLNUM_MAX - SMALLNUM_MIN + 1)
+
 typedef enum
 {
     INTERPRET_OK,
@@ -22,8 +31,25 @@ typedef struct VM_t
     objstack evalstack;
     module global;
     frame *top;
+    // Popped adhoc frames kept for reuse, linked through next
+    frame *framepool;
+    int poolsize;
     object *objs;
     object *objregister;
+    /* Shared by everything that makes these values. Primitives are never
+     * changed once made, so handing out the same one is safe.
+     */
+    object *trueobj;
+    object *falseobj;
+    object *nullobj;
+    objprim *smallints;
+    objprim *smalldoubles;
+    // The generator whose call is running, if any
+    objgen *generator;
+    // Made by the first spawn()
+    struct eventloop_t *events;
+    // The trace being recorded, which calls made now may record into
+    struct tracerecorder_t *recorder;
     int num_objects;
     int callstackpos;
     int framestackpos; 
@@ -34,6 +60,20 @@ VM *init_vm(void);
 void free_vm(VM *vm);
 void reset_vm(VM *vm);
 intrpstate execute(VM *vm, instruct *instructs);
+bool vm_dispatch(VM *vm, instruct *instructs);
+bool vm_inline_getter(VM *vm, object *method);
+object *vm_new_int(VM *vm, int64_t number);
+object *vm_new_double(VM *vm, double number);
+object *vm_find_name(VM *vm, primstring *name);
+void vm_store_name(VM *vm, primstring *name, object *obj);
+bool vm_trace_call(VM *vm, objcode *funcobj, int argcount, bool method);
+void vm_trace_return(VM *vm, objcode *funcobj);
+void vm_trace_finish(VM *vm, objcode *funcobj);
+object *vm_resume_generator(VM *vm, objgen *gen);
+object *vm_call_function(VM *vm, objcode *funcobj, int argcount,
+        object **arguments);
+object *vm_copy_primitive(VM *vm, objprim *prim);
+void vm_add_object(VM *vm, object *obj);
 void print_value(value *val, valtype type);
 void vm_push_frame(VM *vm, frame *newframe);
 int vm_pop_frame(VM *vm);
@@ -1,5 +1,6 @@
 
 #include "instruct.h"
+#include "jit.h"
 #include "memory.h"
 #include "objprim.h"
 
@@ -10,6 +11,8 @@ void init_instruct(instruct* instructs)
     instructs->capacity = 0;
     instructs->current = 0;
     instructs->code = NULL;
+    instructs->jitcode = NULL;
+    instructs->traces = NULL;
 }
 
 void reset_instruct(instruct *instructs)
@@ -24,5 +27,10 @@ void reset_instruct(instruct *instructs)
         }
     }
     FREE(code8**, instructs->code);
+#ifdef ARI_JIT
+    if (instructs->jitcode)
+        free_jitcode(instructs->jitcode);
+    free_traces(instructs->traces);
+#endif
     init_instruct(instructs);
 }
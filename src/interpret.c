@@ -1,5 +1,6 @@
 #include <stdio.h>
 
+#include "cache.h"
 #include "compiler.h"
 #include "interpret.h"
 #include "instruct.h"
@@ -10,10 +11,14 @@ void interpret(AriFile *file)
     const char *source = file->source;
     VM *vm = init_vm();
     init_instruct(&vm->global.instructs);
-    vm->global.instructs = compile(&vm->analyzer, source);
-    if (!vm->global.instructs.count) {
-        reset_instruct(&vm->global.instructs);
-        return;
+    if (!load_bytecode_cache(file, &vm->global.instructs)) {
+        vm->global.instructs = compile(&vm->analyzer, source);
+        if (!vm->global.instructs.count) {
+            reset_instruct(&vm->global.instructs);
+            return;
+        }
+        /* Cached before running, while no instruction is quickened */
+        write_bytecode_cache(file, &vm->global.instructs);
     }
 
     execute(vm, &vm->global.instructs);
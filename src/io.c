@@ -36,9 +36,11 @@ static char *Ari_get_root(const char *filename)
     if (!previous)
         return NULL;
 
-    char *p = strtok(copy, sepdot);
+    // strtok() would keep its place in a static shared by every thread
+    char *saved = NULL;
+    char *p = strtok_r(copy, sepdot, &saved);
     if (p) {
-        char *s = strtok(copy, sepslash);
+        char *s = strtok_r(copy, sepslash, &saved);
         if (s) {
             while (s) {
                 nstringlen = strlen(s);
@@ -49,7 +51,7 @@ static char *Ari_get_root(const char *filename)
                 }
                 memset(previous, 0, allocsize);
                 memcpy(previous, s, nstringlen);
-                s = strtok(NULL, sepslash);
+                s = strtok_r(NULL, sepslash, &saved);
             }
         }
     }
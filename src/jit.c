@@ -0,0 +1,1643 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "debug.h"
+#include "error.h"
+#include "jit.h"
+#include "memory.h"
+#include "objcode.h"
+#include "opcode.h"
+#include "token.h"
+
+#ifdef ARI_JIT
+
+/* Baseline jit for x86-64.
+ *
+ * Every instruction of a function body becomes a block of machine code.
+ * The instructions that dominate loops are done in the machine code
+ * itself:
+ *
+ *  - arithmetic on two ints or two doubles, in general purpose and SSE2
+ *    registers, boxing the result the way vm_int() and vm_double() do;
+ *  - a comparison of two numbers feeding a JMP_FALSE, and the fused
+ *    COMPARE_NAME_CONST_JMP, which branch natively;
+ *  - ADD_NAME_CONST_STORE, LOAD_NAME and STORE_NAME, which look names up
+ *    with a primstring made once at compile time;
+ *  - number constants and jumps.
+ *
+ * The machine code pops and pushes the object stack in place, reusing its
+ * spare nodes. When the operands aren't what the machine code handles, it
+ * falls back to vm_dispatch(), which runs the instruction the way the
+ * interpreter would, and so does every other instruction. After a call to
+ * vm_dispatch() the code continues at whatever pc the instruction left
+ * in the top frame: straight into the next block when it advanced by one,
+ * through a table of block addresses otherwise.
+ *
+ * The pc in the frame is kept up to date at every instruction boundary,
+ * so the machine code can take over a running frame at any instruction.
+ * execute() uses this for on-stack replacement: a hot loop that can't be
+ * traced moves its frame into the machine code mid-loop, module level
+ * code included, and the machine code runs it to the end. The backward
+ * jump of a loop that has a trace calls the trace, and carries on at
+ * whatever pc the trace left the frame at.
+ *
+ * Registers: r12 holds the VM, r13 the instructions and r14 the block
+ * address table. All three are callee-saved, so they survive calls into
+ * the vm. Everything else is scratch within a block.
+ */
+
+#ifdef DEBUG_ARI
+// The jit skips the trace printed by execute()
+bool jit_enabled = false;
+#else
+bool jit_enabled = true;
+#endif
+
+// Targets for jumps that don't go to an instruction
+#define LABEL_EXIT_OK       -1
+#define LABEL_EXIT_ERROR    -2
+#define LABEL_DISPATCH      -3
+
+// Most jumps inside one block that go to the same place
+#define JIT_MAX_JUMPS       16
+
+// Register numbers as they go in ModRM and REX
+#define REG_RAX     0
+#define REG_RCX     1
+#define REG_RDX     2
+#define REG_RSP     4
+#define REG_RSI     6
+#define REG_RDI     7
+#define REG_R8      8
+#define REG_R9      9
+#define REG_R10     10
+#define REG_R11     11
+#define REG_R12     12
+
+// Condition codes of jcc
+#define CC_O        0x0
+#define CC_B        0x2
+#define CC_AE       0x3
+#define CC_E        0x4
+#define CC_NE       0x5
+#define CC_BE       0x6
+#define CC_P        0xa
+#define CC_L        0xc
+#define CC_GE       0xd
+#define CC_LE       0xe
+#define CC_G        0xf
+
+#define STACK_TOP   (offsetof(VM, evalstack) + offsetof(objstack, top))
+#define STACK_SPARE (offsetof(VM, evalstack) + offsetof(objstack, spare))
+#define STACK_COUNT (offsetof(VM, evalstack) + offsetof(objstack, count))
+#define NODE_OBJ    offsetof(objnode, obj)
+#define NODE_NEXT   offsetof(objnode, next)
+#define PRIM_TYPE   offsetof(objprim, ptype)
+#define PRIM_VALUE  offsetof(objprim, val_long)
+
+typedef struct
+{
+    size_t position;
+    int target;
+} jitfixup;
+
+typedef struct
+{
+    uint8_t *bytes;
+    size_t count;
+    size_t capacity;
+    jitfixup *fixups;
+    int num_fixups;
+    int fixup_capacity;
+    // Names the code looks up, owned by the code once it is installed
+    primstring **names;
+    int num_names;
+    int name_capacity;
+    size_t *labels;
+    size_t exit_ok;
+    size_t exit_error;
+    size_t dispatch;
+} jitbuffer;
+
+// Jumps within a block to one place that isn't known yet
+typedef struct
+{
+    size_t positions[JIT_MAX_JUMPS];
+    int count;
+} jitjumps;
+
+static void emit_bytes(jitbuffer *buffer, const uint8_t *bytes, size_t count)
+{
+    if (buffer->count + count > buffer->capacity) {
+        size_t oldcapacity = buffer->capacity;
+        while (buffer->count + count > buffer->capacity)
+            buffer->capacity = GROW_CAPACITY(buffer->capacity);
+        buffer->bytes = GROW_ARRAY(buffer->bytes, uint8_t, oldcapacity,
+                buffer->capacity);
+    }
+    memcpy(buffer->bytes + buffer->count, bytes, count);
+    buffer->count += count;
+}
+
+#define EMIT(buffer, ...)                                           \
+    do {                                                            \
+        const uint8_t bytes_[] = { __VA_ARGS__ };                   \
+        emit_bytes(buffer, bytes_, sizeof(bytes_));                 \
+    } while (0)
+
+static void emit_u32(jitbuffer *buffer, uint32_t number)
+{
+    emit_bytes(buffer, (uint8_t*)&number, 4);
+}
+
+static void emit_u64(jitbuffer *buffer, uint64_t number)
+{
+    emit_bytes(buffer, (uint8_t*)&number, 8);
+}
+
+/* Emits a rel32 for a jump to an instruction or to one of the LABEL_
+ * targets, patched once every block has been placed.
+ */
+static void emit_target(jitbuffer *buffer, int target)
+{
+    if (buffer->num_fixups + 1 > buffer->fixup_capacity) {
+        int oldcapacity = buffer->fixup_capacity;
+        buffer->fixup_capacity = GROW_CAPACITY(oldcapacity);
+        buffer->fixups = GROW_ARRAY(buffer->fixups, jitfixup, oldcapacity,
+                buffer->fixup_capacity);
+    }
+    jitfixup *fixup = &buffer->fixups[buffer->num_fixups++];
+    fixup->position = buffer->count;
+    fixup->target = target;
+    emit_u32(buffer, 0);
+}
+
+// Emits a rel32 for a jump inside the current block
+static size_t emit_local(jitbuffer *buffer)
+{
+    size_t position = buffer->count;
+    emit_u32(buffer, 0);
+    return position;
+}
+
+static void patch_local(jitbuffer *buffer, size_t position)
+{
+    int32_t offset = (int32_t)(buffer->count - (position + 4));
+    memcpy(buffer->bytes + position, &offset, 4);
+}
+
+static void emit_jcc(jitbuffer *buffer, uint8_t condition, jitjumps *jumps)
+{
+    EMIT(buffer, 0x0f, 0x80 | condition);       // jcc rel32
+    jumps->positions[jumps->count++] = emit_local(buffer);
+}
+
+static void emit_jmp_local(jitbuffer *buffer, jitjumps *jumps)
+{
+    EMIT(buffer, 0xe9);                         // jmp rel32
+    jumps->positions[jumps->count++] = emit_local(buffer);
+}
+
+// Points the jumps at the code emitted next
+static void patch_jumps(jitbuffer *buffer, jitjumps *jumps)
+{
+    for (int i = 0; i < jumps->count; i++)
+        patch_local(buffer, jumps->positions[i]);
+    jumps->count = 0;
+}
+
+static void emit_jmp(jitbuffer *buffer, int target)
+{
+    EMIT(buffer, 0xe9);                         // jmp rel32
+    emit_target(buffer, target);
+}
+
+static void emit_rex(jitbuffer *buffer, bool wide, int reg, int base)
+{
+    uint8_t rex = 0x40 | (wide ? 0x08 : 0) | (reg & 8 ? 0x04 : 0) |
+        (base & 8 ? 0x01 : 0);
+    if (rex != 0x40)
+        EMIT(buffer, rex);
+}
+
+// ModRM, and SIB where the base needs one, for [base + disp32]
+static void emit_address(jitbuffer *buffer, int reg, int base, size_t disp)
+{
+    EMIT(buffer, 0x80 | (reg & 7) << 3 | (base & 7));
+    if ((base & 7) == REG_RSP)
+        EMIT(buffer, 0x24);
+    emit_u32(buffer, (uint32_t)disp);
+}
+
+// op reg, [base + disp], or op [base + disp], reg for the store forms
+static void emit_memory_op(jitbuffer *buffer, bool wide, uint8_t op, int reg,
+        int base, size_t disp)
+{
+    emit_rex(buffer, wide, reg, base);
+    EMIT(buffer, op);
+    emit_address(buffer, reg, base, disp);
+}
+
+static void emit_load(jitbuffer *buffer, int reg, int base, size_t disp)
+{
+    emit_memory_op(buffer, true, 0x8b, reg, base, disp);    // mov reg, [m]
+}
+
+static void emit_store(jitbuffer *buffer, int base, size_t disp, int reg)
+{
+    emit_memory_op(buffer, true, 0x89, reg, base, disp);    // mov [m], reg
+}
+
+// op rm, reg on two 64-bit registers
+static void emit_register_op(jitbuffer *buffer, uint8_t op, int rm, int reg)
+{
+    emit_rex(buffer, true, reg, rm);
+    EMIT(buffer, op, 0xc0 | (reg & 7) << 3 | (rm & 7));
+}
+
+static void emit_test(jitbuffer *buffer, int reg)
+{
+    emit_register_op(buffer, 0x85, reg, reg);   // test reg, reg
+}
+
+static void emit_mov_imm(jitbuffer *buffer, int reg, uint64_t number)
+{
+    emit_rex(buffer, true, 0, reg);
+    EMIT(buffer, 0xb8 + (reg & 7));             // mov reg, imm64
+    emit_u64(buffer, number);
+}
+
+// cmp dword [base + disp], imm8
+static void emit_compare_u32(jitbuffer *buffer, int base, size_t disp,
+        uint8_t number)
+{
+    emit_rex(buffer, false, 0, base);
+    EMIT(buffer, 0x83);
+    emit_address(buffer, 7, base, disp);
+    EMIT(buffer, number);
+}
+
+// An SSE2 instruction on an xmm register and [base + disp]
+static void emit_sse_memory(jitbuffer *buffer, uint8_t prefix, uint8_t op,
+        int xmm, int base, size_t disp)
+{
+    EMIT(buffer, prefix);
+    emit_rex(buffer, false, xmm, base);
+    EMIT(buffer, 0x0f, op);
+    emit_address(buffer, xmm, base, disp);
+}
+
+// An SSE2 instruction on two xmm registers below xmm8
+static void emit_sse_register(jitbuffer *buffer, uint8_t prefix, uint8_t op,
+        int xmm, int rm)
+{
+    EMIT(buffer, prefix, 0x0f, op, 0xc0 | xmm << 3 | rm);
+}
+
+// movq xmm, reg
+static void emit_movq(jitbuffer *buffer, int xmm, int reg)
+{
+    EMIT(buffer, 0x66);
+    emit_rex(buffer, true, xmm, reg);
+    EMIT(buffer, 0x0f, 0x6e, 0xc0 | (xmm & 7) << 3 | (reg & 7));
+}
+
+static void emit_call(jitbuffer *buffer, void *function)
+{
+    EMIT(buffer, 0x48, 0xb8);                   // mov rax, imm64
+    emit_u64(buffer, (uint64_t)(uintptr_t)function);
+    EMIT(buffer, 0xff, 0xd0);                   // call rax
+}
+
+static void emit_vm_argument(jitbuffer *buffer)
+{
+    EMIT(buffer, 0x4c, 0x89, 0xe7);             // mov rdi, r12
+}
+
+static void emit_instruct_argument(jitbuffer *buffer)
+{
+    EMIT(buffer, 0x4c, 0x89, 0xee);             // mov rsi, r13
+}
+
+static void emit_pointer_argument(jitbuffer *buffer, uint8_t reg, void *ptr)
+{
+    EMIT(buffer, 0x48, reg);                    // mov rsi, imm64
+    emit_u64(buffer, (uint64_t)(uintptr_t)ptr);
+}
+
+static void emit_load_pc(jitbuffer *buffer)
+{
+    EMIT(buffer, 0x49, 0x8b, 0x84, 0x24);       // mov rax, [r12 + top]
+    emit_u32(buffer, offsetof(VM, top));
+    EMIT(buffer, 0x48, 0x8b, 0x80);             // mov rax, [rax + pc]
+    emit_u32(buffer, offsetof(frame, pc));
+}
+
+static void emit_store_pc(jitbuffer *buffer, int pc)
+{
+    EMIT(buffer, 0x49, 0x8b, 0x84, 0x24);       // mov rax, [r12 + top]
+    emit_u32(buffer, offsetof(VM, top));
+    EMIT(buffer, 0x48, 0xc7, 0x80);             // mov qword [rax + pc], imm32
+    emit_u32(buffer, offsetof(frame, pc));
+    emit_u32(buffer, (uint32_t)pc);
+}
+
+static void emit_check_error(jitbuffer *buffer)
+{
+    EMIT(buffer, 0x41, 0x80, 0xbc, 0x24);       // cmp byte [r12 + haderror], 0
+    emit_u32(buffer, offsetof(VM, haderror));
+    EMIT(buffer, 0x00);
+    EMIT(buffer, 0x0f, 0x85);                   // jne exit_error
+    emit_target(buffer, LABEL_EXIT_ERROR);
+}
+
+// Continues at a known pc, the way the interpreter loop would
+static void emit_goto(jitbuffer *buffer, int pc, int count)
+{
+    emit_store_pc(buffer, pc);
+    emit_jmp(buffer, (pc >= 0 && pc < count) ? pc : LABEL_EXIT_OK);
+}
+
+/* Runs the instruction through the vm, then continues at the pc it left
+ * behind. Falls through into the next block when that is the expected
+ * next pc.
+ */
+static void emit_dispatch(jitbuffer *buffer, int next)
+{
+    emit_vm_argument(buffer);
+    emit_instruct_argument(buffer);
+    emit_call(buffer, vm_dispatch);
+    EMIT(buffer, 0x84, 0xc0);                   // test al, al
+    EMIT(buffer, 0x0f, 0x84);                   // jz exit_ok
+    emit_target(buffer, LABEL_EXIT_OK);
+    emit_check_error(buffer);
+    emit_load_pc(buffer);
+    EMIT(buffer, 0x48, 0x3d);                   // cmp rax, imm32
+    emit_u32(buffer, (uint32_t)next);
+    EMIT(buffer, 0x0f, 0x85);                   // jne dispatch
+    emit_target(buffer, LABEL_DISPATCH);
+}
+
+// A primstring for a name operand, freed along with the code
+static primstring *jit_name(jitbuffer *buffer, char *name)
+{
+    if (buffer->num_names + 1 > buffer->name_capacity) {
+        int oldcapacity = buffer->name_capacity;
+        buffer->name_capacity = GROW_CAPACITY(oldcapacity);
+        buffer->names = GROW_ARRAY(buffer->names, primstring*, oldcapacity,
+                buffer->name_capacity);
+    }
+    primstring *pname = create_primstring(name);
+    buffer->names[buffer->num_names++] = pname;
+    return pname;
+}
+
+static void free_names(primstring **names, int count, int capacity)
+{
+    for (int i = 0; i < count; i++)
+        free_primstring(names[i]);
+    FREE_ARRAY(primstring*, names, capacity);
+}
+
+// Jumps to fail unless the object in reg is a primitive of the type
+static void emit_check_primitive(jitbuffer *buffer, int reg, int ptype,
+        jitjumps *fail)
+{
+    emit_compare_u32(buffer, reg, offsetof(object, type), OBJ_PRIMITIVE);
+    emit_jcc(buffer, CC_NE, fail);
+    emit_compare_u32(buffer, reg, PRIM_TYPE, (uint8_t)ptype);
+    emit_jcc(buffer, CC_NE, fail);
+}
+
+/* Loads the operands of a binary instruction: rdx gets the top node of
+ * the stack and rcx the one below it, r8 the right operand and r9 the
+ * left. Jumps to fail unless both are primitives of the same type, which
+ * is left in eax. A ptype below zero takes ints and doubles alike.
+ */
+static void emit_load_operands(jitbuffer *buffer, int ptype, jitjumps *fail)
+{
+    emit_load(buffer, REG_RDX, REG_R12, STACK_TOP);
+    emit_test(buffer, REG_RDX);
+    emit_jcc(buffer, CC_E, fail);
+    emit_load(buffer, REG_RCX, REG_RDX, NODE_NEXT);
+    emit_test(buffer, REG_RCX);
+    emit_jcc(buffer, CC_E, fail);
+    emit_load(buffer, REG_R8, REG_RDX, NODE_OBJ);
+    emit_test(buffer, REG_R8);
+    emit_jcc(buffer, CC_E, fail);
+    emit_load(buffer, REG_R9, REG_RCX, NODE_OBJ);
+    emit_test(buffer, REG_R9);
+    emit_jcc(buffer, CC_E, fail);
+    emit_compare_u32(buffer, REG_R8, offsetof(object, type), OBJ_PRIMITIVE);
+    emit_jcc(buffer, CC_NE, fail);
+    emit_compare_u32(buffer, REG_R9, offsetof(object, type), OBJ_PRIMITIVE);
+    emit_jcc(buffer, CC_NE, fail);
+    emit_memory_op(buffer, false, 0x8b, REG_RAX, REG_R8, PRIM_TYPE);
+    emit_memory_op(buffer, false, 0x3b, REG_RAX, REG_R9, PRIM_TYPE);
+    emit_jcc(buffer, CC_NE, fail);
+    if (ptype >= 0) {
+        EMIT(buffer, 0x83, 0xf8, (uint8_t)ptype);       // cmp eax, ptype
+        emit_jcc(buffer, CC_NE, fail);
+        return;
+    }
+    jitjumps number = {.count = 0};
+    EMIT(buffer, 0x83, 0xf8, PRIM_INT);                 // cmp eax, PRIM_INT
+    emit_jcc(buffer, CC_E, &number);
+    EMIT(buffer, 0x83, 0xf8, PRIM_DOUBLE);              // cmp eax, PRIM_DOUBLE
+    emit_jcc(buffer, CC_NE, fail);
+    patch_jumps(buffer, &number);
+}
+
+// Moves the two nodes emit_load_operands() loaded to the spare list
+static void emit_pop_operands(jitbuffer *buffer)
+{
+    emit_load(buffer, REG_R10, REG_RCX, NODE_NEXT);
+    emit_store(buffer, REG_R12, STACK_TOP, REG_R10);
+    emit_load(buffer, REG_R11, REG_R12, STACK_SPARE);
+    emit_store(buffer, REG_RCX, NODE_NEXT, REG_R11);
+    emit_store(buffer, REG_R12, STACK_SPARE, REG_RDX);
+}
+
+/* Replaces the two operands on top of the stack with the result in rax.
+ * The nodes are loaded again, since boxing the result may have called
+ * into the vm.
+ */
+static void emit_replace_operands(jitbuffer *buffer)
+{
+    emit_load(buffer, REG_RDX, REG_R12, STACK_TOP);
+    emit_load(buffer, REG_RCX, REG_RDX, NODE_NEXT);
+    emit_store(buffer, REG_RCX, NODE_OBJ, REG_RAX);
+    emit_store(buffer, REG_R12, STACK_TOP, REG_RCX);
+    emit_load(buffer, REG_R11, REG_R12, STACK_SPARE);
+    emit_store(buffer, REG_RDX, NODE_NEXT, REG_R11);
+    emit_store(buffer, REG_R12, STACK_SPARE, REG_RDX);
+}
+
+// Pushes rax, taking a spare node when there is one
+static void emit_push(jitbuffer *buffer)
+{
+    jitjumps allocate = {.count = 0}, done = {.count = 0};
+    emit_load(buffer, REG_RDX, REG_R12, STACK_SPARE);
+    emit_test(buffer, REG_RDX);
+    emit_jcc(buffer, CC_E, &allocate);
+    emit_load(buffer, REG_R11, REG_RDX, NODE_NEXT);
+    emit_store(buffer, REG_R12, STACK_SPARE, REG_R11);
+    emit_store(buffer, REG_RDX, NODE_OBJ, REG_RAX);
+    emit_load(buffer, REG_R11, REG_R12, STACK_TOP);
+    emit_store(buffer, REG_RDX, NODE_NEXT, REG_R11);
+    emit_store(buffer, REG_R12, STACK_TOP, REG_RDX);
+    emit_rex(buffer, false, 0, REG_R12);
+    EMIT(buffer, 0x83);                         // add dword [r12 + count], 1
+    emit_address(buffer, 0, REG_R12, STACK_COUNT);
+    EMIT(buffer, 0x01);
+    emit_jmp_local(buffer, &done);
+
+    patch_jumps(buffer, &allocate);
+    emit_memory_op(buffer, true, 0x8d, REG_RDI, REG_R12,
+            offsetof(VM, evalstack));           // lea rdi, [r12 + evalstack]
+    emit_register_op(buffer, 0x89, REG_RSI, REG_RAX);
+    emit_call(buffer, push_objstack);
+    patch_jumps(buffer, &done);
+}
+
+// Boxes the int in rax, from the shared small ints when it is one
+static void emit_box_int(jitbuffer *buffer)
+{
+    jitjumps allocate = {.count = 0}, done = {.count = 0};
+    emit_register_op(buffer, 0x89, REG_R10, REG_RAX);   // mov r10, rax
+    emit_rex(buffer, true, 0, REG_R10);
+    EMIT(buffer, 0x81, 0xc2);                   // add r10, -SMALLNUM_MIN
+    emit_u32(buffer, (uint32_t)-SMALLNUM_MIN);
+    emit_rex(buffer, true, 0, REG_R10);
+    EMIT(buffer, 0x81, 0xfa);                   // cmp r10, SMALLNUM_COUNT
+    emit_u32(buffer, SMALLNUM_COUNT);
+    emit_jcc(buffer, CC_AE, &allocate);
+    emit_rex(buffer, true, REG_R10, REG_R10);
+    EMIT(buffer, 0x69, 0xd2);                   // imul r10, r10, size
+    emit_u32(buffer, sizeof(objprim));
+    emit_load(buffer, REG_RAX, REG_R12, offsetof(VM, smallints));
+    emit_register_op(buffer, 0x01, REG_RAX, REG_R10);   // add rax, r10
+    emit_jmp_local(buffer, &done);
+
+    patch_jumps(buffer, &allocate);
+    emit_vm_argument(buffer);
+    emit_register_op(buffer, 0x89, REG_RSI, REG_RAX);   // mov rsi, rax
+    emit_call(buffer, vm_new_int);
+    patch_jumps(buffer, &done);
+}
+
+// Boxes the double in xmm0
+static void emit_box_double(jitbuffer *buffer)
+{
+    emit_vm_argument(buffer);
+    emit_call(buffer, vm_new_double);
+}
+
+/* rax = r9 op r8 on the ints of the operands. Jumps to fail on overflow,
+ * which the interpreter turns into a double.
+ */
+static void emit_int_arith(jitbuffer *buffer, char op, jitjumps *fail)
+{
+    emit_load(buffer, REG_RAX, REG_R9, PRIM_VALUE);
+    switch (op) {
+        case '+':
+            emit_memory_op(buffer, true, 0x03, REG_RAX, REG_R8, PRIM_VALUE);
+            break;
+        case '-':
+            emit_memory_op(buffer, true, 0x2b, REG_RAX, REG_R8, PRIM_VALUE);
+            break;
+        default:
+            emit_rex(buffer, true, REG_RAX, REG_R8);
+            EMIT(buffer, 0x0f, 0xaf);           // imul rax, [r8 + value]
+            emit_address(buffer, REG_RAX, REG_R8, PRIM_VALUE);
+            break;
+    }
+    emit_jcc(buffer, CC_O, fail);
+}
+
+static uint8_t sse_arith(char op)
+{
+    switch (op) {
+        case '+':   return 0x58;                // addsd
+        case '-':   return 0x5c;                // subsd
+        case '*':   return 0x59;                // mulsd
+        default:    return 0x5e;                // divsd
+    }
+}
+
+/* xmm0 = r9 op r8 on the doubles of the operands. Division by zero jumps
+ * to fail, so that the interpreter reports it.
+ */
+static void emit_double_arith(jitbuffer *buffer, char op, jitjumps *fail)
+{
+    emit_sse_memory(buffer, 0xf2, 0x10, 0, REG_R9, PRIM_VALUE);
+    if (op == '/') {
+        emit_sse_register(buffer, 0x66, 0x57, 1, 1);    // xorpd xmm1, xmm1
+        emit_sse_memory(buffer, 0x66, 0x2e, 1, REG_R8, PRIM_VALUE);
+        emit_jcc(buffer, CC_E, fail);
+    }
+    emit_sse_memory(buffer, 0xf2, sse_arith(op), 0, REG_R8, PRIM_VALUE);
+}
+
+/* Arithmetic on the two operands on top of the stack, replaced by the
+ * result. ptype picks ints or doubles, or either below zero. Jumps to
+ * fail with the stack untouched for anything else.
+ */
+static void emit_arith(jitbuffer *buffer, char op, int ptype, jitjumps *fail)
+{
+    // Dividing ints gives a double, which the interpreter works out
+    if (op == '/')
+        ptype = PRIM_DOUBLE;
+    emit_load_operands(buffer, ptype, fail);
+    jitjumps doubles = {.count = 0}, done = {.count = 0};
+    if (ptype != PRIM_DOUBLE) {
+        if (ptype < 0) {
+            EMIT(buffer, 0x83, 0xf8, PRIM_INT);         // cmp eax, PRIM_INT
+            emit_jcc(buffer, CC_NE, &doubles);
+        }
+        emit_int_arith(buffer, op, fail);
+        emit_box_int(buffer);
+        if (ptype < 0)
+            emit_jmp_local(buffer, &done);
+    }
+    if (ptype != PRIM_INT) {
+        patch_jumps(buffer, &doubles);
+        emit_double_arith(buffer, op, fail);
+        emit_box_double(buffer);
+    }
+    patch_jumps(buffer, &done);
+    emit_replace_operands(buffer);
+}
+
+static inline bool inlined_compare(int cmptype)
+{
+    switch (cmptype) {
+        case TOKEN_EQUAL_EQUAL:
+        case TOKEN_BANG_EQUAL:
+        case TOKEN_GREATER:
+        case TOKEN_GREATER_EQUAL:
+        case TOKEN_LESS:
+        case TOKEN_LESS_EQUAL:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Compares the ints rax and r10, jumping when the comparison is false
+static void emit_int_branch(jitbuffer *buffer, int cmptype,
+        jitjumps *false_branch)
+{
+    emit_register_op(buffer, 0x39, REG_RAX, REG_R10);   // cmp rax, r10
+    uint8_t condition = CC_NE;
+    switch (cmptype) {
+        case TOKEN_EQUAL_EQUAL:     condition = CC_NE; break;
+        case TOKEN_BANG_EQUAL:      condition = CC_E; break;
+        case TOKEN_GREATER:         condition = CC_LE; break;
+        case TOKEN_GREATER_EQUAL:   condition = CC_L; break;
+        case TOKEN_LESS:            condition = CC_GE; break;
+        case TOKEN_LESS_EQUAL:      condition = CC_G; break;
+    }
+    emit_jcc(buffer, condition, false_branch);
+}
+
+/* Compares the doubles xmm0 and xmm1, jumping when the comparison is
+ * false. An unordered result, from a NaN, is false for all but !=.
+ */
+static void emit_double_branch(jitbuffer *buffer, int cmptype,
+        jitjumps *false_branch)
+{
+    jitjumps true_branch = {.count = 0};
+    switch (cmptype) {
+        case TOKEN_GREATER:
+        case TOKEN_GREATER_EQUAL:
+            // ucomisd xmm0, xmm1
+            emit_sse_register(buffer, 0x66, 0x2e, 0, 1);
+            emit_jcc(buffer, cmptype == TOKEN_GREATER ? CC_BE : CC_B,
+                    false_branch);
+            break;
+        case TOKEN_LESS:
+        case TOKEN_LESS_EQUAL:
+            // ucomisd xmm1, xmm0
+            emit_sse_register(buffer, 0x66, 0x2e, 1, 0);
+            emit_jcc(buffer, cmptype == TOKEN_LESS ? CC_BE : CC_B,
+                    false_branch);
+            break;
+        case TOKEN_EQUAL_EQUAL:
+            emit_sse_register(buffer, 0x66, 0x2e, 0, 1);
+            emit_jcc(buffer, CC_NE, false_branch);
+            emit_jcc(buffer, CC_P, false_branch);
+            break;
+        default:
+            emit_sse_register(buffer, 0x66, 0x2e, 0, 1);
+            emit_jcc(buffer, CC_P, &true_branch);
+            emit_jcc(buffer, CC_E, false_branch);
+            patch_jumps(buffer, &true_branch);
+            break;
+    }
+}
+
+/* Pops and compares the two operands on top of the stack, falling through
+ * when the comparison is true. Jumps to fail with the stack untouched
+ * unless both are ints or both are doubles, or ptype of them if it isn't
+ * below zero.
+ */
+static void emit_compare(jitbuffer *buffer, int cmptype, int ptype,
+        jitjumps *fail, jitjumps *false_branch)
+{
+    emit_load_operands(buffer, ptype, fail);
+    emit_pop_operands(buffer);
+    jitjumps doubles = {.count = 0}, done = {.count = 0};
+    if (ptype != PRIM_DOUBLE) {
+        if (ptype < 0) {
+            EMIT(buffer, 0x83, 0xf8, PRIM_INT);         // cmp eax, PRIM_INT
+            emit_jcc(buffer, CC_NE, &doubles);
+        }
+        emit_load(buffer, REG_RAX, REG_R9, PRIM_VALUE);
+        emit_load(buffer, REG_R10, REG_R8, PRIM_VALUE);
+        emit_int_branch(buffer, cmptype, false_branch);
+        if (ptype < 0)
+            emit_jmp_local(buffer, &done);
+    }
+    if (ptype != PRIM_INT) {
+        patch_jumps(buffer, &doubles);
+        emit_sse_memory(buffer, 0xf2, 0x10, 0, REG_R9, PRIM_VALUE);
+        emit_sse_memory(buffer, 0xf2, 0x10, 1, REG_R8, PRIM_VALUE);
+        emit_double_branch(buffer, cmptype, false_branch);
+    }
+    patch_jumps(buffer, &done);
+}
+
+// Looks the name up into rax, jumping to fail if it isn't bound
+static void emit_find_name(jitbuffer *buffer, primstring *name,
+        jitjumps *fail)
+{
+    emit_vm_argument(buffer);
+    emit_pointer_argument(buffer, 0xbe, name);
+    emit_call(buffer, vm_find_name);
+    emit_test(buffer, REG_RAX);
+    emit_jcc(buffer, CC_E, fail);
+}
+
+// Binds the name to rax in the top frame
+static void emit_store_name(jitbuffer *buffer, primstring *name)
+{
+    emit_register_op(buffer, 0x89, REG_RDX, REG_RAX);   // mov rdx, rax
+    emit_vm_argument(buffer);
+    emit_pointer_argument(buffer, 0xbe, name);
+    emit_call(buffer, vm_store_name);
+}
+
+static void emit_load_name(jitbuffer *buffer, primstring *name,
+        jitjumps *fail)
+{
+    emit_find_name(buffer, name, fail);
+    emit_push(buffer);
+}
+
+// Pops the top of the stack into the name, or jumps to fail if it's empty
+static void emit_pop_name(jitbuffer *buffer, primstring *name,
+        jitjumps *fail)
+{
+    emit_load(buffer, REG_RDX, REG_R12, STACK_TOP);
+    emit_test(buffer, REG_RDX);
+    emit_jcc(buffer, CC_E, fail);
+    emit_load(buffer, REG_RAX, REG_RDX, NODE_OBJ);
+    emit_load(buffer, REG_R10, REG_RDX, NODE_NEXT);
+    emit_store(buffer, REG_R12, STACK_TOP, REG_R10);
+    emit_load(buffer, REG_R11, REG_R12, STACK_SPARE);
+    emit_store(buffer, REG_RDX, NODE_NEXT, REG_R11);
+    emit_store(buffer, REG_R12, STACK_SPARE, REG_RDX);
+    emit_store_name(buffer, name);
+}
+
+// Whether the jit pushes the constant itself: ints and doubles
+static inline bool inlined_constant(value *constant)
+{
+    return constant->type == VAL_LONG || constant->type == VAL_DOUBLE;
+}
+
+// Puts the number object for an int or double constant in rax
+static void emit_number_constant(jitbuffer *buffer, value *constant)
+{
+    if (constant->type == VAL_LONG) {
+        int64_t number = VAL_AS_LONG(constant);
+        if (number >= SMALLNUM_MIN && number <= SMALLNUM_MAX) {
+            emit_load(buffer, REG_RAX, REG_R12, offsetof(VM, smallints));
+            EMIT(buffer, 0x48, 0x05);           // add rax, imm32
+            emit_u32(buffer, (uint32_t)((number - SMALLNUM_MIN) *
+                        sizeof(objprim)));
+            return;
+        }
+        emit_vm_argument(buffer);
+        emit_mov_imm(buffer, REG_RSI, (uint64_t)number);
+        emit_call(buffer, vm_new_int);
+        return;
+    }
+    uint64_t bits;
+    double number = VAL_AS_DOUBLE(constant);
+    memcpy(&bits, &number, sizeof(bits));
+    emit_mov_imm(buffer, REG_RCX, bits);
+    emit_movq(buffer, 0, REG_RCX);
+    emit_box_double(buffer);
+}
+
+/* Loads the number constant of a fused instruction against the value of
+ * a name in rax: ints into rax and r10, doubles into xmm0 and xmm1. Jumps
+ * to fail unless the value has the constant's type.
+ */
+static void emit_name_and_constant(jitbuffer *buffer, value *constant,
+        jitjumps *fail)
+{
+    if (constant->type == VAL_LONG) {
+        emit_check_primitive(buffer, REG_RAX, PRIM_INT, fail);
+        emit_mov_imm(buffer, REG_R10, (uint64_t)VAL_AS_LONG(constant));
+        emit_load(buffer, REG_RAX, REG_RAX, PRIM_VALUE);
+        return;
+    }
+    uint64_t bits;
+    double number = VAL_AS_DOUBLE(constant);
+    memcpy(&bits, &number, sizeof(bits));
+    emit_check_primitive(buffer, REG_RAX, PRIM_DOUBLE, fail);
+    emit_mov_imm(buffer, REG_RCX, bits);
+    emit_movq(buffer, 1, REG_RCX);
+    emit_sse_memory(buffer, 0xf2, 0x10, 0, REG_RAX, PRIM_VALUE);
+}
+
+// Whether the fused instruction at pc has a number constant to inline
+static inline bool inlined_fused(instruct *instructs, int pc)
+{
+    return pc + 3 < instructs->count &&
+        inlined_constant(&instructs->code[pc + 1]->operand);
+}
+
+/* COMPARE_NAME_CONST_JMP, falling through when the comparison is true.
+ * Jumps to fail before changing anything if it can't be done here.
+ */
+static void emit_compare_name_const(jitbuffer *buffer, code8 **code,
+        primstring *name, jitjumps *fail, jitjumps *false_branch)
+{
+    value *constant = &code[1]->operand;
+    int cmptype = VAL_AS_INT((&code[2]->operand));
+    emit_find_name(buffer, name, fail);
+    emit_name_and_constant(buffer, constant, fail);
+    if (constant->type == VAL_LONG)
+        emit_int_branch(buffer, cmptype, false_branch);
+    else
+        emit_double_branch(buffer, cmptype, false_branch);
+}
+
+/* ADD_NAME_CONST_STORE. Jumps to fail before changing anything if it
+ * can't be done here.
+ */
+static void emit_add_name_const(jitbuffer *buffer, code8 **code,
+        primstring *name, primstring *stored, jitjumps *fail)
+{
+    value *constant = &code[1]->operand;
+    emit_find_name(buffer, name, fail);
+    emit_name_and_constant(buffer, constant, fail);
+    if (constant->type == VAL_LONG) {
+        emit_register_op(buffer, 0x01, REG_RAX, REG_R10);   // add rax, r10
+        emit_jcc(buffer, CC_O, fail);
+        emit_box_int(buffer);
+    }
+    else {
+        emit_sse_register(buffer, 0xf2, 0x58, 0, 1);        // addsd xmm0, xmm1
+        emit_box_double(buffer);
+    }
+    emit_store_name(buffer, stored);
+}
+
+static inline bool is_compare_jump(instruct *instructs, int pc)
+{
+    uint8_t bytecode = instructs->code[pc]->bytecode;
+    return (bytecode == OP_COMPARE || bytecode == OP_COMPARE_DOUBLE_JMP ||
+            bytecode == OP_COMPARE_INT_JMP) &&
+        pc + 1 < instructs->count &&
+        instructs->code[pc + 1]->bytecode == OP_JMP_FALSE &&
+        inlined_compare(VAL_AS_INT((&instructs->code[pc]->operand)));
+}
+
+// The operator of an arithmetic instruction, quickened or not
+static inline char arith_op(uint8_t bytecode)
+{
+    switch (bytecode) {
+        case OP_BINARY_ADD:
+        case OP_ADD_DOUBLE:
+        case OP_ADD_INT:
+            return '+';
+        case OP_BINARY_SUB:
+        case OP_SUB_DOUBLE:
+        case OP_SUB_INT:
+            return '-';
+        case OP_BINARY_MULT:
+        case OP_MULT_DOUBLE:
+        case OP_MULT_INT:
+            return '*';
+        case OP_BINARY_DIVIDE:
+        case OP_DIVIDE_DOUBLE:
+            return '/';
+        default:
+            return 0;
+    }
+}
+
+/* Runs the trace of the loop a backward jump closes, then continues at
+ * the pc the trace left off at.
+ */
+static void emit_enter_trace(jitbuffer *buffer, jittrace *trace, int header)
+{
+    emit_store_pc(buffer, header);
+    emit_vm_argument(buffer);
+    emit_instruct_argument(buffer);
+    emit_call(buffer, trace->entry);
+    EMIT(buffer, 0x84, 0xc0);                   // test al, al
+    EMIT(buffer, 0x0f, 0x84);                   // jz exit_ok
+    emit_target(buffer, LABEL_EXIT_OK);
+    emit_check_error(buffer);
+    emit_load_pc(buffer);
+    emit_jmp(buffer, LABEL_DISPATCH);
+}
+
+/* Emits the block of one instruction. Where the machine code does the
+ * instruction itself, it jumps to the vm_dispatch() at the end of the
+ * block for operands it doesn't handle.
+ */
+static void emit_instruction(jitbuffer *buffer, instruct *instructs, int pc)
+{
+    code8 *code = instructs->code[pc];
+    value *operand = &code->operand;
+    int count = instructs->count;
+    jitjumps fail = {.count = 0}, false_branch = {.count = 0};
+
+    buffer->labels[pc] = buffer->count;
+    if (is_compare_jump(instructs, pc)) {
+        int target = VAL_AS_INT((&instructs->code[pc + 1]->operand));
+        emit_compare(buffer, VAL_AS_INT(operand), -1, &fail, &false_branch);
+        emit_goto(buffer, pc + 2, count);
+        patch_jumps(buffer, &false_branch);
+        emit_goto(buffer, target, count);
+        patch_jumps(buffer, &fail);
+        emit_dispatch(buffer, pc + 1);
+        return;
+    }
+    char op = arith_op(code->bytecode);
+    if (op) {
+        emit_arith(buffer, op, -1, &fail);
+        emit_goto(buffer, pc + 1, count);
+        patch_jumps(buffer, &fail);
+        emit_dispatch(buffer, pc + 1);
+        return;
+    }
+    switch (code->bytecode) {
+        case OP_JMP_LOC:
+        {
+            jittrace *trace = VAL_AS_INT(operand) < pc ?
+                find_trace(instructs, VAL_AS_INT(operand)) : NULL;
+            if (trace)
+                emit_enter_trace(buffer, trace, VAL_AS_INT(operand));
+            else
+                emit_goto(buffer, VAL_AS_INT(operand), count);
+            return;
+        }
+        case OP_JMP_AFTER:
+            emit_goto(buffer, pc + VAL_AS_INT(operand), count);
+            return;
+        case OP_LOAD_CONSTANT:
+            if (!inlined_constant(operand))
+                break;
+            emit_number_constant(buffer, operand);
+            emit_push(buffer);
+            emit_goto(buffer, pc + 1, count);
+            return;
+        case OP_LOAD_NAME:
+            emit_load_name(buffer, jit_name(buffer, VAL_AS_STRING(operand)),
+                    &fail);
+            emit_goto(buffer, pc + 1, count);
+            break;
+        case OP_STORE_NAME:
+            emit_pop_name(buffer, jit_name(buffer, VAL_AS_STRING(operand)),
+                    &fail);
+            emit_goto(buffer, pc + 1, count);
+            break;
+        case OP_COMPARE_NAME_CONST_JMP:
+            if (!inlined_fused(instructs, pc) || !inlined_compare(
+                        VAL_AS_INT((&instructs->code[pc + 2]->operand))))
+                break;
+            emit_compare_name_const(buffer, &instructs->code[pc],
+                    jit_name(buffer, VAL_AS_STRING(operand)), &fail,
+                    &false_branch);
+            emit_goto(buffer, pc + 4, count);
+            patch_jumps(buffer, &false_branch);
+            emit_goto(buffer,
+                    VAL_AS_INT((&instructs->code[pc + 3]->operand)), count);
+            break;
+        case OP_ADD_NAME_CONST_STORE:
+            if (!inlined_fused(instructs, pc))
+                break;
+            emit_add_name_const(buffer, &instructs->code[pc],
+                    jit_name(buffer, VAL_AS_STRING(operand)),
+                    jit_name(buffer,
+                        VAL_AS_STRING((&instructs->code[pc + 3]->operand))),
+                    &fail);
+            emit_goto(buffer, pc + 4, count);
+            break;
+    }
+    patch_jumps(buffer, &fail);
+    emit_dispatch(buffer, pc + 1);
+}
+
+static void emit_function(jitbuffer *buffer, instruct *instructs,
+        void **labels)
+{
+    int count = instructs->count;
+
+    // Prologue: enter at whatever pc the top frame is at
+    EMIT(buffer, 0x41, 0x54);                   // push r12
+    EMIT(buffer, 0x41, 0x55);                   // push r13
+    EMIT(buffer, 0x41, 0x56);                   // push r14
+    EMIT(buffer, 0x49, 0x89, 0xfc);             // mov r12, rdi
+    EMIT(buffer, 0x49, 0x89, 0xf5);             // mov r13, rsi
+    EMIT(buffer, 0x49, 0xbe);                   // mov r14, imm64
+    emit_u64(buffer, (uint64_t)(uintptr_t)labels);
+    emit_check_error(buffer);
+    emit_load_pc(buffer);
+    emit_jmp(buffer, LABEL_DISPATCH);
+
+    for (int pc = 0; pc < count; pc++)
+        emit_instruction(buffer, instructs, pc);
+    buffer->labels[count] = buffer->count;
+
+    buffer->exit_ok = buffer->count;
+    EMIT(buffer, 0x31, 0xc0);                   // xor eax, eax
+    size_t epilogue = buffer->count;
+    EMIT(buffer, 0x41, 0x5e);                   // pop r14
+    EMIT(buffer, 0x41, 0x5d);                   // pop r13
+    EMIT(buffer, 0x41, 0x5c);                   // pop r12
+    EMIT(buffer, 0xc3);                         // ret
+
+    buffer->exit_error = buffer->count;
+    emit_vm_argument(buffer);
+    emit_instruct_argument(buffer);
+    emit_call(buffer, runtime_error_line);
+    EMIT(buffer, 0xe9);                         // jmp epilogue
+    emit_u32(buffer, (uint32_t)(epilogue - (buffer->count + 4)));
+
+    // rax holds a pc that is not the next instruction
+    buffer->dispatch = buffer->count;
+    EMIT(buffer, 0x48, 0x3d);                   // cmp rax, count
+    emit_u32(buffer, (uint32_t)count);
+    EMIT(buffer, 0x0f, 0x83);                   // jae exit_ok
+    emit_target(buffer, LABEL_EXIT_OK);
+    EMIT(buffer, 0x41, 0xff, 0x24, 0xc6);       // jmp [r14 + rax * 8]
+}
+
+static void resolve_fixups(jitbuffer *buffer)
+{
+    for (int i = 0; i < buffer->num_fixups; i++) {
+        jitfixup *fixup = &buffer->fixups[i];
+        size_t target = 0;
+        switch (fixup->target) {
+            case LABEL_EXIT_OK:     target = buffer->exit_ok; break;
+            case LABEL_EXIT_ERROR:  target = buffer->exit_error; break;
+            case LABEL_DISPATCH:    target = buffer->dispatch; break;
+            default:                target = buffer->labels[fixup->target];
+        }
+        int32_t offset = (int32_t)(target - (fixup->position + 4));
+        memcpy(buffer->bytes + fixup->position, &offset, 4);
+    }
+}
+
+// Frees the buffer, and the names too unless installed code took them
+static void free_buffer(jitbuffer *buffer, int count)
+{
+    FREE_ARRAY(uint8_t, buffer->bytes, buffer->capacity);
+    FREE_ARRAY(jitfixup, buffer->fixups, buffer->fixup_capacity);
+    FREE_ARRAY(size_t, buffer->labels, count + 1);
+    if (buffer->names)
+        free_names(buffer->names, buffer->num_names, buffer->name_capacity);
+}
+
+/* Copies the emitted code into fresh executable memory. Returns NULL if
+ * the memory can't be had.
+ */
+static uint8_t *install_code(jitbuffer *buffer, size_t *size)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    *size = (buffer->count + page - 1) / page * page;
+    uint8_t *memory = mmap(NULL, *size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+        return NULL;
+    memcpy(memory, buffer->bytes, buffer->count);
+    if (mprotect(memory, *size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(memory, *size);
+        return NULL;
+    }
+    return memory;
+}
+
+/* Compiles the instructions to machine code and attaches it to them.
+ * Returns false if the instructions can't be compiled, in which case
+ * they keep running in the interpreter.
+ */
+bool jit_compile(instruct *instructs)
+{
+    int count = instructs->count;
+    if (!count || instructs->jitcode)
+        return false;
+
+    jitbuffer buffer;
+    memset(&buffer, 0, sizeof(buffer));
+    buffer.labels = ALLOCATE(size_t, count + 1);
+    void **labels = ALLOCATE(void*, count + 1);
+
+    emit_function(&buffer, instructs, labels);
+    resolve_fixups(&buffer);
+
+    size_t size = 0;
+    uint8_t *memory = install_code(&buffer, &size);
+    if (!memory) {
+        free_buffer(&buffer, count);
+        FREE_ARRAY(void*, labels, count + 1);
+        return false;
+    }
+
+    for (int pc = 0; pc <= count; pc++)
+        labels[pc] = memory + buffer.labels[pc];
+
+    jitcode *code = ALLOCATE(jitcode, 1);
+    code->memory = memory;
+    code->size = size;
+    code->labels = labels;
+    code->count = count;
+    code->names = buffer.names;
+    code->num_names = buffer.num_names;
+    code->name_capacity = buffer.name_capacity;
+    code->entry = (jitentry)(void*)memory;
+    instructs->jitcode = code;
+
+    buffer.names = NULL;
+    free_buffer(&buffer, count);
+    return true;
+}
+
+intrpstate jit_execute(VM *vm, instruct *instructs)
+{
+    return instructs->jitcode->entry(vm, instructs);
+}
+
+void free_jitcode(jitcode *code)
+{
+    munmap(code->memory, code->size);
+    FREE_ARRAY(void*, code->labels, code->count + 1);
+    if (code->names)
+        free_names(code->names, code->num_names, code->name_capacity);
+    FREE(jitcode, code);
+}
+
+/* Tracing.
+ *
+ * A backward JMP_LOC that execute() takes TRACE_THRESHOLD times starts a
+ * recording. Every instruction the same execute() call runs from the
+ * loop header until it gets back there is recorded with the pc it went
+ * on to and, for arithmetic and comparisons, the type both operands had.
+ * A CALL_FUNCTION or CALL_METHOD of a small function without loops is
+ * recorded through: the steps of its body follow the call in the trace.
+ * Calls below that aren't recorded, except that a CALL_METHOD of a plain
+ * getter (a method whose body is 'return this.name;') is noted so the
+ * trace can read the property itself.
+ *
+ * The compiled trace runs the recorded steps in a straight line and
+ * jumps back to the start at the end. Number arithmetic and comparisons
+ * are done in machine code for the type that was recorded, names and
+ * number constants as in the baseline jit, and a recorded call enters the
+ * function without going through the interpreter. Each of these guards
+ * its assumptions: operands of another type, a branch going the other
+ * way or another function on the stack leave the trace with the pc at
+ * the instruction the interpreter should carry on from. Other steps run
+ * through vm_dispatch() and leave the trace if the pc isn't where it was
+ * during recording. A trace that leaves inside a recorded call first
+ * runs the rest of the function in the interpreter.
+ */
+
+// Both are doubles or both are ints
+static inline bool same_number_type(object *a, object *b)
+{
+    if (!a || !b || a->type != OBJ_PRIMITIVE || b->type != OBJ_PRIMITIVE)
+        return false;
+    primtype x = ((objprim*)a)->ptype;
+    primtype y = ((objprim*)b)->ptype;
+    return x == y && (x == PRIM_DOUBLE || x == PRIM_INT);
+}
+
+jittrace *find_trace(instruct *instructs, int header)
+{
+    for (jittrace *trace = instructs->traces; trace; trace = trace->next)
+        if (trace->header == header)
+            return trace;
+    return NULL;
+}
+
+tracerecorder *start_trace(code8 *backedge, int header)
+{
+    tracerecorder *recorder = ALLOCATE(tracerecorder, 1);
+    recorder->backedge = backedge;
+    recorder->header = header;
+    recorder->count = 0;
+    recorder->callee = NULL;
+    recorder->failed = false;
+    return recorder;
+}
+
+void abort_trace(tracerecorder *recorder)
+{
+    code8 *backedge = recorder->backedge;
+    backedge->hotness = 0;
+    backedge->deopts++;
+    FREE(tracerecorder, recorder);
+}
+
+// The object depth nodes below the top of the stack
+static object *stack_object(objnode *node, int depth)
+{
+    for (int i = 0; i < depth && node; i++)
+        node = node->next;
+    return node ? node->obj : NULL;
+}
+
+/* Records the instruction at pc before it runs. Returns the index of its
+ * step, for end_trace_step(), or -1 if the trace is full.
+ */
+int record_trace_step(tracerecorder *recorder, VM *vm, instruct *instructs,
+        int pc)
+{
+    if (recorder->count == TRACE_MAX_LENGTH) {
+        recorder->failed = true;
+        return -1;
+    }
+    int index = recorder->count++;
+    tracestep *step = &recorder->steps[index];
+    code8 *code = instructs->code[pc];
+    objnode *top = vm->evalstack.top;
+
+    step->pc = pc;
+    step->next = -1;
+    step->ptype = -1;
+    if (top && top->next && same_number_type(top->obj, top->next->obj))
+        step->ptype = ((objprim*)top->obj)->ptype;
+    step->method = NULL;
+    step->called = NULL;
+    step->inlined = false;
+    step->within = recorder->callee;
+    if (code->bytecode == OP_CALL_FUNCTION || code->bytecode == OP_CALL_METHOD)
+        step->called = stack_object(top, VAL_AS_INT((&code->operand)));
+    if (code->bytecode == OP_CALL_METHOD && VAL_AS_INT((&code->operand)) == 0) {
+        object *method = step->called;
+        if (method && OBJ_IS_CODE(method) &&
+                getter_property((objcode*)method))
+            step->method = method;
+    }
+    return index;
+}
+
+// Whether a call of the function can be recorded into a trace
+static bool traceable_callee(objcode *funcobj, int argcount)
+{
+    instruct *body = &funcobj->instructs;
+    if (funcobj->argcount != (size_t)argcount ||
+            body->count > TRACE_MAX_CALLEE)
+        return false;
+    for (int pc = 0; pc < body->count; pc++) {
+        code8 *code = body->code[pc];
+        switch (code->bytecode) {
+            case OP_JMP_LOC:
+                if (VAL_AS_INT((&code->operand)) <= pc)
+                    return false;
+                break;
+            case OP_FOR_RANGE:
+            case OP_FOR_STEP:
+            case OP_FOR_ITER:
+            case OP_TAIL_CALL:
+            case OP_YIELD:
+                return false;
+        }
+    }
+    return true;
+}
+
+/* Called as the function is entered. Returns true if the call is the one
+ * the step just recorded made and the function is small enough and free
+ * of loops, in which case its body is recorded until end_trace_call().
+ */
+bool start_trace_call(tracerecorder *recorder, objcode *funcobj,
+        int argcount)
+{
+    if (recorder->callee || recorder->failed || !recorder->count)
+        return false;
+    tracestep *step = &recorder->steps[recorder->count - 1];
+    if (step->called != (object*)funcobj ||
+            !traceable_callee(funcobj, argcount))
+        return false;
+    step->inlined = true;
+    recorder->callee = funcobj;
+    return true;
+}
+
+// The recorded body has to have ended with its RETURN
+void end_trace_call(tracerecorder *recorder)
+{
+    tracestep *last = &recorder->steps[recorder->count - 1];
+    objcode *callee = recorder->callee;
+    if (last->within != callee ||
+            callee->instructs.code[last->pc]->bytecode != OP_RETURN)
+        recorder->failed = true;
+    recorder->callee = NULL;
+}
+
+// rsi = the instructions the step is one of
+static void emit_step_instructs(jitbuffer *buffer, tracestep *step)
+{
+    if (step->within)
+        emit_pointer_argument(buffer, 0xbe, &step->within->instructs);
+    else
+        emit_instruct_argument(buffer);
+}
+
+/* Leaves the trace with the pc already in the frame. Inside a recorded
+ * call the rest of the function runs first.
+ */
+static void emit_trace_exit(jitbuffer *buffer, tracestep *step)
+{
+    if (step->within) {
+        emit_vm_argument(buffer);
+        emit_pointer_argument(buffer, 0xbe, step->within);
+        emit_call(buffer, vm_trace_finish);
+    }
+    emit_jmp(buffer, LABEL_EXIT_ERROR);
+}
+
+static void emit_leave(jitbuffer *buffer, tracestep *step, int pc)
+{
+    emit_store_pc(buffer, pc);
+    emit_trace_exit(buffer, step);
+}
+
+/* Runs the step through the vm and goes on to label, as long as the pc
+ * ends up where it did during recording.
+ */
+static void emit_trace_dispatch(jitbuffer *buffer, tracestep *step,
+        int label)
+{
+    jitjumps exits = {.count = 0};
+    emit_store_pc(buffer, step->pc);
+    emit_vm_argument(buffer);
+    emit_step_instructs(buffer, step);
+    emit_call(buffer, vm_dispatch);
+    EMIT(buffer, 0x84, 0xc0);                   // test al, al
+    if (step->within)
+        emit_jcc(buffer, CC_E, &exits);
+    else {
+        EMIT(buffer, 0x0f, 0x84);               // jz exit_ok
+        emit_target(buffer, LABEL_EXIT_OK);
+    }
+    EMIT(buffer, 0x41, 0x80, 0xbc, 0x24);       // cmp byte [r12 + haderror], 0
+    emit_u32(buffer, offsetof(VM, haderror));
+    EMIT(buffer, 0x00);
+    emit_jcc(buffer, CC_NE, &exits);
+    emit_load_pc(buffer);
+    EMIT(buffer, 0x48, 0x3d);                   // cmp rax, imm32
+    emit_u32(buffer, (uint32_t)step->next);
+    emit_jcc(buffer, CC_NE, &exits);
+    emit_jmp(buffer, label);
+    patch_jumps(buffer, &exits);
+    emit_trace_exit(buffer, step);
+}
+
+static void emit_getter(jitbuffer *buffer, tracestep *step, int label)
+{
+    jitjumps generic = {.count = 0};
+    emit_store_pc(buffer, step->pc);
+    emit_vm_argument(buffer);
+    emit_pointer_argument(buffer, 0xbe, step->method);
+    emit_call(buffer, vm_inline_getter);
+    EMIT(buffer, 0x84, 0xc0);                   // test al, al
+    emit_jcc(buffer, CC_E, &generic);
+    emit_jmp(buffer, label);
+    patch_jumps(buffer, &generic);
+    emit_trace_dispatch(buffer, step, label);
+}
+
+// Enters the recorded function, or leaves if another one is on the stack
+static void emit_trace_call(jitbuffer *buffer, code8 *code, tracestep *step,
+        int label)
+{
+    bool method = code->bytecode == OP_CALL_METHOD;
+    int argcount = VAL_AS_INT((&code->operand)) + (method ? 1 : 0);
+    jitjumps guard = {.count = 0};
+    emit_store_pc(buffer, step->pc);
+    emit_vm_argument(buffer);
+    emit_pointer_argument(buffer, 0xbe, step->called);
+    EMIT(buffer, 0xba);                         // mov edx, argcount
+    emit_u32(buffer, (uint32_t)argcount);
+    EMIT(buffer, 0xb9);                         // mov ecx, method
+    emit_u32(buffer, method ? 1 : 0);
+    emit_call(buffer, vm_trace_call);
+    EMIT(buffer, 0x84, 0xc0);                   // test al, al
+    emit_jcc(buffer, CC_E, &guard);
+    emit_jmp(buffer, label);
+    patch_jumps(buffer, &guard);
+    emit_trace_exit(buffer, step);
+}
+
+/* The rest of a branch the trace recorded: carries on at label if the
+ * branch went the recorded way, the comparison having fallen through
+ * when true and jumped to false_branch otherwise, and leaves for the
+ * other pc if not.
+ */
+static void emit_recorded_branch(jitbuffer *buffer, tracestep *step,
+        int label, bool taken, int true_pc, int false_pc,
+        jitjumps *false_branch)
+{
+    if (taken) {
+        emit_jmp(buffer, label);
+        patch_jumps(buffer, false_branch);
+        emit_leave(buffer, step, false_pc);
+    }
+    else {
+        emit_leave(buffer, step, true_pc);
+        patch_jumps(buffer, false_branch);
+        emit_jmp(buffer, label);
+    }
+}
+
+/* The index of the step after a compare-jump, whose JMP_FALSE has a step
+ * of its own unless the COMPARE was quickened to take the branch itself.
+ * Returns 0 if the branch it took wasn't recorded.
+ */
+static int compare_jump_end(tracerecorder *recorder, int i)
+{
+    tracestep *step = &recorder->steps[i];
+    if (step->next != step->pc + 1)
+        return i + 1;
+    if (i + 1 < recorder->count &&
+            recorder->steps[i + 1].pc == step->pc + 1 &&
+            recorder->steps[i + 1].within == step->within)
+        return i + 2;
+    return 0;
+}
+
+/* Emits the step at index i, plus the JMP_FALSE after a comparison that
+ * is done in machine code. Returns the index of the step after them.
+ */
+static int emit_trace_step(jitbuffer *buffer, instruct *instructs,
+        tracerecorder *recorder, int i)
+{
+    tracestep *step = &recorder->steps[i];
+    int pc = step->pc;
+    code8 *code = instructs->code[pc];
+    value *operand = &code->operand;
+    int end = i + 1;
+    int label = end < recorder->count ? end : 0;
+    jitjumps guard = {.count = 0}, false_branch = {.count = 0};
+    char op = arith_op(code->bytecode);
+    int jump_end = is_compare_jump(instructs, pc) && step->ptype >= 0 ?
+        compare_jump_end(recorder, i) : 0;
+
+    if (op && step->ptype >= 0 && (op != '/' || step->ptype == PRIM_DOUBLE)) {
+        emit_arith(buffer, op, step->ptype, &guard);
+        emit_jmp(buffer, label);
+    }
+    else if (jump_end) {
+        end = jump_end;
+        label = end < recorder->count ? end : 0;
+        int taken = recorder->steps[end - 1].next;
+        int target = VAL_AS_INT((&instructs->code[pc + 1]->operand));
+        if (end == i + 2)
+            buffer->labels[i + 1] = buffer->count;
+        emit_compare(buffer, VAL_AS_INT(operand), step->ptype, &guard,
+                &false_branch);
+        emit_recorded_branch(buffer, step, label, taken == pc + 2, pc + 2,
+                target, &false_branch);
+    }
+    else if (code->bytecode == OP_COMPARE_NAME_CONST_JMP &&
+            inlined_fused(instructs, pc) &&
+            inlined_compare(VAL_AS_INT((&instructs->code[pc + 2]->operand)))) {
+        emit_compare_name_const(buffer, &instructs->code[pc],
+                jit_name(buffer, VAL_AS_STRING(operand)), &guard,
+                &false_branch);
+        emit_recorded_branch(buffer, step, label, step->next == pc + 4,
+                pc + 4, VAL_AS_INT((&instructs->code[pc + 3]->operand)),
+                &false_branch);
+    }
+    else if (code->bytecode == OP_ADD_NAME_CONST_STORE &&
+            inlined_fused(instructs, pc)) {
+        emit_add_name_const(buffer, &instructs->code[pc],
+                jit_name(buffer, VAL_AS_STRING(operand)),
+                jit_name(buffer,
+                    VAL_AS_STRING((&instructs->code[pc + 3]->operand))),
+                &guard);
+        emit_jmp(buffer, label);
+    }
+    else if (code->bytecode == OP_LOAD_CONSTANT && inlined_constant(operand)) {
+        emit_number_constant(buffer, operand);
+        emit_push(buffer);
+        emit_jmp(buffer, label);
+    }
+    else if (code->bytecode == OP_LOAD_NAME) {
+        emit_load_name(buffer, jit_name(buffer, VAL_AS_STRING(operand)),
+                &guard);
+        emit_jmp(buffer, label);
+    }
+    else if (code->bytecode == OP_STORE_NAME) {
+        emit_pop_name(buffer, jit_name(buffer, VAL_AS_STRING(operand)),
+                &guard);
+        emit_jmp(buffer, label);
+    }
+    else if (code->bytecode == OP_JMP_LOC || code->bytecode == OP_JMP_AFTER)
+        emit_jmp(buffer, label);
+    else if (code->bytecode == OP_RETURN && step->within) {
+        emit_vm_argument(buffer);
+        emit_pointer_argument(buffer, 0xbe, step->within);
+        emit_call(buffer, vm_trace_return);
+        emit_jmp(buffer, label);
+    }
+    else if (step->inlined)
+        emit_trace_call(buffer, code, step, label);
+    else if (step->method)
+        emit_getter(buffer, step, label);
+    else
+        emit_trace_dispatch(buffer, step, label);
+
+    if (guard.count) {
+        patch_jumps(buffer, &guard);
+        emit_leave(buffer, step, pc);
+    }
+    return end;
+}
+
+static void emit_trace(jitbuffer *buffer, instruct *instructs,
+        tracerecorder *recorder)
+{
+    EMIT(buffer, 0x41, 0x54);                   // push r12
+    EMIT(buffer, 0x41, 0x55);                   // push r13
+    EMIT(buffer, 0x41, 0x56);                   // push r14
+    EMIT(buffer, 0x49, 0x89, 0xfc);             // mov r12, rdi
+    EMIT(buffer, 0x49, 0x89, 0xf5);             // mov r13, rsi
+
+    int i = 0;
+    while (i < recorder->count) {
+        tracestep *step = &recorder->steps[i];
+        buffer->labels[i] = buffer->count;
+        i = emit_trace_step(buffer,
+                step->within ? &step->within->instructs : instructs,
+                recorder, i);
+    }
+
+    // An instruction returned from the frame
+    buffer->exit_ok = buffer->count;
+    EMIT(buffer, 0x31, 0xc0);                   // xor eax, eax
+    size_t epilogue = buffer->count;
+    EMIT(buffer, 0x41, 0x5e);                   // pop r14
+    EMIT(buffer, 0x41, 0x5d);                   // pop r13
+    EMIT(buffer, 0x41, 0x5c);                   // pop r12
+    EMIT(buffer, 0xc3);                         // ret
+
+    // Left the recorded path, or hit an error: back to the interpreter
+    buffer->exit_error = buffer->dispatch = buffer->count;
+    EMIT(buffer, 0xb8);                         // mov eax, 1
+    emit_u32(buffer, 1);
+    EMIT(buffer, 0xe9);                         // jmp epilogue
+    emit_u32(buffer, (uint32_t)(epilogue - (buffer->count + 4)));
+}
+
+static void compile_trace(tracerecorder *recorder, instruct *instructs)
+{
+    jitbuffer buffer;
+    memset(&buffer, 0, sizeof(buffer));
+    buffer.labels = ALLOCATE(size_t, recorder->count + 1);
+
+    emit_trace(&buffer, instructs, recorder);
+    resolve_fixups(&buffer);
+
+    size_t size = 0;
+    uint8_t *memory = install_code(&buffer, &size);
+    if (memory) {
+        jittrace *trace = ALLOCATE(jittrace, 1);
+        trace->header = recorder->header;
+        trace->memory = memory;
+        trace->size = size;
+        trace->entry = (traceentry)(void*)memory;
+        trace->names = buffer.names;
+        trace->num_names = buffer.num_names;
+        trace->name_capacity = buffer.name_capacity;
+        trace->next = instructs->traces;
+        instructs->traces = trace;
+        buffer.names = NULL;
+    }
+    free_buffer(&buffer, recorder->count);
+}
+
+/* Notes where the recorded instruction went. Returns the recorder while
+ * the recording goes on, and NULL once the trace was compiled or the
+ * recording was given up. Inside a recorded call that is left to the
+ * loop, once the call returns.
+ */
+tracerecorder *end_trace_step(tracerecorder *recorder, int step, VM *vm,
+        instruct *instructs)
+{
+    int next = vm->top->pc;
+    /* A quickened instruction that put its generic form back runs again
+     * at the same pc. Only that second run goes into the trace.
+     */
+    if (step >= 0 && step == recorder->count - 1 && !vm->haderror &&
+            next == recorder->steps[step].pc) {
+        recorder->count--;
+        return recorder;
+    }
+    if (step >= 0)
+        recorder->steps[step].next = next;
+    if (recorder->callee) {
+        if (step < 0 || vm->haderror)
+            recorder->failed = true;
+        return recorder;
+    }
+
+    if (step < 0 || recorder->failed || vm->haderror ||
+            next >= instructs->count) {
+        abort_trace(recorder);
+        return NULL;
+    }
+    if (next == recorder->header) {
+        compile_trace(recorder, instructs);
+        FREE(tracerecorder, recorder);
+        return NULL;
+    }
+    // Inner loops get traces of their own
+    for (int i = 0; i < recorder->count; i++)
+        if (!recorder->steps[i].within && recorder->steps[i].pc == next) {
+            abort_trace(recorder);
+            return NULL;
+        }
+    if (recorder->count == TRACE_MAX_LENGTH) {
+        abort_trace(recorder);
+        return NULL;
+    }
+    return recorder;
+}
+
+void free_traces(jittrace *trace)
+{
+    while (trace) {
+        jittrace *next = trace->next;
+        munmap(trace->memory, trace->size);
+        if (trace->names)
+            free_names(trace->names, trace->num_names, trace->name_capacity);
+        FREE(jittrace, trace);
+        trace = next;
+    }
+}
+
+#endif
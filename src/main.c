@@ -2,15 +2,18 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "aot.h"
 #include "compiler.h"
 #include "io.h"
 #include "interpret.h"
+#include "jit.h"
 #include "memory.h"
 #include "object.h"
 #include "repl.h"
 #include "vm.h"
 
 void run_file(const char* path);
+void emit_c_file(const char* path);
 void arimain(int argc, char** argv);
 
 int main(int argc, char** argv)
@@ -22,8 +25,32 @@ int main(int argc, char** argv)
 
 void arimain(int argc, char** argv)
 {
-    if (argc > 1) {
-        run_file(argv[1]);
+    const char *path = NULL;
+    bool emitc = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--jit") == 0) {
+#ifdef ARI_JIT
+            jit_enabled = true;
+#else
+            fprintf(stderr, "ari was built without the jit\n");
+#endif
+        }
+        else if (strcmp(argv[i], "--no-jit") == 0) {
+#ifdef ARI_JIT
+            jit_enabled = false;
+#endif
+        }
+        else if (strcmp(argv[i], "--emit-c") == 0)
+            emitc = true;
+        else if (!path)
+            path = argv[i];
+    }
+
+    if (path) {
+        if (emitc)
+            emit_c_file(path);
+        else
+            run_file(path);
     }
     else
         repl();
@@ -41,3 +68,14 @@ void run_file(const char* path)
         exit(EXIT_FAILURE);
     }
 }
+
+void emit_c_file(const char* path)
+{
+    AriFile *newfile = get_file(path);
+    if (!newfile->source) {
+        printf("Could not read file %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    if (!emit_c(newfile, stdout))
+        exit(EXIT_FAILURE);
+}
@@ -6,8 +6,15 @@
 #include "objclass.h"
 #include "objcode.h"
 #include "object.h"
+#include "objarray.h"
+#include "objdict.h"
+#include "objfile.h"
+#include "objgen.h"
 #include "objhash.h"
+#include "objiter.h"
+#include "objlist.h"
 #include "objprim.h"
+#include "objwait.h"
 
 
 void free_object(void *obj, objtype type)
@@ -36,7 +43,10 @@ void free_object(void *obj, objtype type)
                 free_object(codeobj->arguments[i], OBJ_PRIMITIVE);
             FREE(objprim*, codeobj->arguments);
             reset_frame(&codeobj->localframe);
+            free_inline_operands(codeobj);
             reset_instruct(&codeobj->instructs);
+            if (codeobj->getter)
+                free_primstring(codeobj->getter);
             FREE(objcode, codeobj);
             break;
         }
@@ -58,6 +68,54 @@ void free_object(void *obj, objtype type)
             FREE(objinstance, instobj);
             break;
         }
+        case OBJ_LIST:
+        {
+            objlist *listobj = (objlist*)obj;
+            FREE_ARRAY(object*, listobj->items, listobj->capacity);
+            FREE(objlist, listobj);
+            break;
+        }
+        case OBJ_FLOAT64ARRAY:
+        {
+            objarray *arrayobj = (objarray*)obj;
+            FREE_ARRAY(double, arrayobj->data, arrayobj->count);
+            FREE(objarray, arrayobj);
+            break;
+        }
+        case OBJ_DICT:
+        {
+            free_objdict((objdict*)obj);
+            break;
+        }
+        case OBJ_RANGE:
+        {
+            FREE(objrange, obj);
+            break;
+        }
+        case OBJ_ITERATOR:
+        {
+            FREE(objiter, obj);
+            break;
+        }
+        case OBJ_FILE:
+        {
+            objfile *fileobj = (objfile*)obj;
+            objfile_close(fileobj);
+            // The line buffer may come from getline
+            free(fileobj->line);
+            FREE(objfile, fileobj);
+            break;
+        }
+        case OBJ_GENERATOR:
+        {
+            free_objgen((objgen*)obj);
+            break;
+        }
+        case OBJ_WAIT:
+        {
+            FREE(objwait, obj);
+            break;
+        }
         case OBJ_BUILTIN:
         {
             objbuiltin *builtin_obj = (objbuiltin*)obj;
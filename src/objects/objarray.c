@@ -0,0 +1,17 @@
+#include <stddef.h>
+#include <string.h>
+
+#include "memory.h"
+#include "objarray.h"
+
+
+objarray *init_objarray(int count)
+{
+    objarray *arrayobj = ALLOCATE(objarray, 1);
+    init_object(arrayobj, OBJ_FLOAT64ARRAY);
+    arrayobj->data = count ? ALLOCATE(double, count) : NULL;
+    if (count)
+        memset(arrayobj->data, 0, sizeof(double) * count);
+    arrayobj->count = count;
+    return arrayobj;
+}
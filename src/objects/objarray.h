@@ -0,0 +1,19 @@
+#ifndef ari_objarray_h
+#define ari_objarray_h
+
+#include "object.h"
+
+/* A float64array holds raw doubles back to back instead of a primitive
+ * object per element, so the builtins can hand it straight to the loops
+ * in simd.c.
+ */
+typedef struct
+{
+    object header;
+    double *data;
+    int count;
+} objarray;
+
+objarray *init_objarray(int count);
+
+#endif
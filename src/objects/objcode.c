@@ -1,8 +1,12 @@
+#include <stdbool.h>
+#include <string.h>
+
 #include "frame.h"
 #include "instruct.h"
 #include "memory.h"
 #include "object.h"
 #include "objcode.h"
+#include "opcode.h"
 
 objcode *init_objcode(int argcount, objprim **arguments)
 {
@@ -11,8 +15,183 @@ objcode *init_objcode(int argcount, objprim **arguments)
     codeobj->argcount = argcount;
     codeobj->arguments = arguments;
     codeobj->depth = 0;
+    codeobj->calls = 0;
+    codeobj->inlining = INLINE_UNKNOWN;
+    codeobj->getter = NULL;
+    codeobj->operands = NULL;
+    codeobj->yields = YIELDS_UNKNOWN;
     init_object(codeobj, OBJ_CODE);
     init_frame(&codeobj->localframe);
     init_instruct(&codeobj->instructs);
     return codeobj;
 }
+
+static inline bool is_this(value *operand)
+{
+    return VAL_IS_STRING(operand) &&
+        strcmp(VAL_AS_STRING(operand), "this") == 0;
+}
+
+static bool is_getter(objcode *codeobj)
+{
+    instruct *body = &codeobj->instructs;
+    if (codeobj->argcount != 1 || body->count != 3)
+        return false;
+    code8 **code = body->code;
+    bool loads_this = (code[0]->bytecode == OP_LOAD_NAME ||
+            code[0]->bytecode == OP_GET_NAME_PROPERTY) &&
+        is_this(&code[0]->operand);
+    return loads_this && code[1]->bytecode == OP_GET_PROPERTY &&
+        code[2]->bytecode == OP_RETURN;
+}
+
+/* Whether the body only loads constants and names, reads properties and
+ * does arithmetic, and returns the one value that leaves on the stack,
+ * e.g. 'return this.width * this.height + border;'.
+ */
+static bool is_expression(instruct *body)
+{
+    if (body->count < 2 || body->count > INLINE_MAX_LENGTH ||
+            body->code[body->count - 1]->bytecode != OP_RETURN)
+        return false;
+
+    int depth = 0;
+    for (int pc = 0; pc < body->count - 1; pc++) {
+        code8 *code = body->code[pc];
+        switch (code->bytecode) {
+            case OP_LOAD_CONSTANT:
+                if (code->operand.type == VAL_EMPTY)
+                    return false;
+                depth++;
+                break;
+            case OP_LOAD_NAME:
+                depth++;
+                break;
+            case OP_GET_NAME_PROPERTY:
+                // The GET_PROPERTY after it holds the property
+                if (body->code[pc + 1]->bytecode != OP_GET_PROPERTY)
+                    return false;
+                pc++;
+                depth++;
+                break;
+            case OP_GET_PROPERTY:
+                if (depth < 1)
+                    return false;
+                break;
+            case OP_BINARY_ADD:
+            case OP_BINARY_SUB:
+            case OP_BINARY_MULT:
+            case OP_BINARY_DIVIDE:
+            case OP_ADD_DOUBLE:
+            case OP_SUB_DOUBLE:
+            case OP_MULT_DOUBLE:
+            case OP_DIVIDE_DOUBLE:
+            case OP_ADD_INT:
+            case OP_SUB_INT:
+            case OP_MULT_INT:
+                if (depth < 2)
+                    return false;
+                depth--;
+                break;
+            default:
+                return false;
+        }
+    }
+    return depth == 1;
+}
+
+static int argument_index(objcode *codeobj, char *name)
+{
+    for (size_t k = 0; k < codeobj->argcount; k++) {
+        if (strcmp(PRIM_AS_RAWSTRING(codeobj->arguments[k]), name) == 0)
+            return k;
+    }
+    return -1;
+}
+
+// Pre-hashes the names and properties an INLINE_EXPRESSION body reads
+static void make_operands(objcode *codeobj)
+{
+    instruct *body = &codeobj->instructs;
+    codeobj->operands = ALLOCATE(inlineoperand, body->count);
+    for (int pc = 0; pc < body->count; pc++) {
+        code8 *code = body->code[pc];
+        inlineoperand *operand = &codeobj->operands[pc];
+        operand->name = NULL;
+        operand->argument = -1;
+        switch (code->bytecode) {
+            case OP_LOAD_NAME:
+            case OP_GET_NAME_PROPERTY:
+                operand->argument = argument_index(codeobj,
+                        VAL_AS_STRING((&code->operand)));
+                /* fall through */
+            case OP_GET_PROPERTY:
+                operand->name = create_primstring(
+                        VAL_AS_STRING((&code->operand)));
+                break;
+        }
+    }
+}
+
+static inlinekind classify_inlining(objcode *codeobj)
+{
+    if (is_getter(codeobj)) {
+        code8 **code = codeobj->instructs.code;
+        codeobj->getter = create_primstring(
+                VAL_AS_STRING((&code[1]->operand)));
+        return INLINE_GETTER;
+    }
+    if (is_expression(&codeobj->instructs)) {
+        make_operands(codeobj);
+        return INLINE_EXPRESSION;
+    }
+    return INLINE_NONE;
+}
+
+/* Returns the property a method returns if its body is nothing but
+ * 'return this.name;', or NULL.
+ */
+primstring *getter_property(objcode *codeobj)
+{
+    if (codeobj->inlining == INLINE_UNKNOWN)
+        codeobj->inlining = classify_inlining(codeobj);
+    return codeobj->getter;
+}
+
+/* Returns the pre-hashed operands of a function whose body only reads
+ * names and returns one expression, or NULL for any other function.
+ */
+inlineoperand *inline_operands(objcode *codeobj)
+{
+    if (codeobj->inlining == INLINE_UNKNOWN)
+        codeobj->inlining = classify_inlining(codeobj);
+    return codeobj->operands;
+}
+
+void free_inline_operands(objcode *codeobj)
+{
+    if (!codeobj->operands)
+        return;
+    for (int pc = 0; pc < codeobj->instructs.count; pc++) {
+        if (codeobj->operands[pc].name)
+            free_primstring(codeobj->operands[pc].name);
+    }
+    FREE_ARRAY(inlineoperand, codeobj->operands, codeobj->instructs.count);
+    codeobj->operands = NULL;
+}
+
+/* Whether the body has a YIELD of its own, which makes calling it give a
+ * generator. Functions defined inside the body are code objects of their
+ * own and aren't looked at.
+ */
+bool is_generator(objcode *codeobj)
+{
+    if (codeobj->yields == YIELDS_UNKNOWN) {
+        codeobj->yields = YIELDS_NEVER;
+        instruct *body = &codeobj->instructs;
+        for (int i = 0; i < body->count; i++)
+            if (body->code[i]->bytecode == OP_YIELD)
+                codeobj->yields = YIELDS;
+    }
+    return codeobj->yields == YIELDS;
+}
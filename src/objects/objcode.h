@@ -1,6 +1,7 @@
 #ifndef ari_objcode_h
 #define ari_objcode_h
 
+#include <stdbool.h>
 #include <stddef.h>
 
 #include "frame.h"
@@ -8,6 +9,34 @@
 #include "object.h"
 #include "objprim.h"
 
+// Longest body a call can be replaced with the expression of
+#define INLINE_MAX_LENGTH   16
+
+// What a call of the code can be replaced with, worked out on first use
+typedef enum
+{
+    INLINE_UNKNOWN,
+    INLINE_NONE,
+    INLINE_GETTER,
+    INLINE_EXPRESSION,
+} inlinekind;
+
+// A name or property an INLINE_EXPRESSION body reads
+typedef struct
+{
+    primstring *name;
+    // Which argument the name is bound to, or -1
+    int argument;
+} inlineoperand;
+
+// Whether a call of the code runs it or makes a generator of it
+typedef enum
+{
+    YIELDS_UNKNOWN,
+    YIELDS_NEVER,
+    YIELDS,
+} yieldkind;
+
 typedef struct objcode_t
 {
     object header;
@@ -17,8 +46,19 @@ typedef struct objcode_t
     frame localframe;
     instruct instructs;
     size_t depth;
+    size_t calls;
+    inlinekind inlining;
+    // Property an INLINE_GETTER returns
+    primstring *getter;
+    // Operands of an INLINE_EXPRESSION body, by pc
+    inlineoperand *operands;
+    yieldkind yields;
 } objcode;
 
 objcode *init_objcode(int argcount, objprim **arguments);
+primstring *getter_property(objcode *codeobj);
+inlineoperand *inline_operands(objcode *codeobj);
+void free_inline_operands(objcode *codeobj);
+bool is_generator(objcode *codeobj);
 
 #endif
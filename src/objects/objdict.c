@@ -0,0 +1,199 @@
+#include <stddef.h>
+#include <string.h>
+
+#include "memory.h"
+#include "objdict.h"
+
+
+static uint32_t hash_key(objprim *key)
+{
+    if (key->ptype == PRIM_STRING) {
+        // FNV-1a
+        primstring *string = PRIM_AS_STRING(key);
+        uint32_t hash = 2166136261u;
+        for (int i = 0; i < string->length; i++) {
+            hash ^= (uint8_t)string->_string_[i];
+            hash *= 16777619u;
+        }
+        return hash;
+    }
+    // Ints hash as doubles so that 1 and 1.0 find the same entry
+    double number = PRIM_NUMBER_AS_DOUBLE(key);
+    if (number == 0)
+        number = 0;
+    uint64_t bits = 0;
+    memcpy(&bits, &number, sizeof(bits));
+    bits ^= bits >> 33;
+    bits *= 0xff51afd7ed558ccdull;
+    bits ^= bits >> 33;
+    return (uint32_t)bits;
+}
+
+static bool keys_equal(objprim *a, objprim *b)
+{
+    if (PRIM_IS_NUMBER(a) && PRIM_IS_NUMBER(b)) {
+        if (a->ptype == PRIM_INT && b->ptype == PRIM_INT)
+            return PRIM_AS_INT(a) == PRIM_AS_INT(b);
+        return PRIM_NUMBER_AS_DOUBLE(a) == PRIM_NUMBER_AS_DOUBLE(b);
+    }
+    if (a->ptype != b->ptype)
+        return false;
+    primstring *x = PRIM_AS_STRING(a);
+    primstring *y = PRIM_AS_STRING(b);
+    return x->length == y->length &&
+        memcmp(x->_string_, y->_string_, x->length) == 0;
+}
+
+/* Finds the slot of the index table holding key. If it isn't there,
+ * returns the slot it would be inserted in, and sets *found to false.
+ */
+static int32_t *find_slot(objdict *dict, objprim *key, uint32_t hash,
+        bool *found)
+{
+    uint32_t mask = dict->indexsize - 1;
+    int32_t *free_pos = NULL;
+    for (uint32_t i = hash & mask; ; i = (i + 1) & mask) {
+        int32_t *pos = &dict->indices[i];
+        if (*pos == DICT_EMPTY) {
+            *found = false;
+            return free_pos ? free_pos : pos;
+        }
+        if (*pos == DICT_REMOVED) {
+            if (!free_pos)
+                free_pos = pos;
+            continue;
+        }
+        dictentry *entry = &dict->entries[*pos];
+        if (entry->hash == hash && keys_equal(entry->key, key)) {
+            *found = true;
+            return pos;
+        }
+    }
+}
+
+/* Moves the live entries, in order, into an array with room for at
+ * least mincount of them, and rebuilds the index table at twice that
+ * size so it stays at most half full.
+ */
+static void resize(objdict *dict, int mincount)
+{
+    int capacity = DEFAULT_CAPACITY;
+    while (capacity < mincount)
+        capacity *= 2;
+
+    dictentry *entries = ALLOCATE(dictentry, capacity);
+    int count = 0;
+    for (int i = 0; i < dict->used; i++)
+        if (dict->entries[i].key)
+            entries[count++] = dict->entries[i];
+    FREE_ARRAY(dictentry, dict->entries, dict->capacity);
+    FREE_ARRAY(int32_t, dict->indices, dict->indexsize);
+
+    dict->entries = entries;
+    dict->capacity = capacity;
+    dict->used = count;
+    dict->indexsize = capacity * 2;
+    dict->indices = ALLOCATE(int32_t, dict->indexsize);
+    for (uint32_t i = 0; i < dict->indexsize; i++)
+        dict->indices[i] = DICT_EMPTY;
+
+    uint32_t mask = dict->indexsize - 1;
+    for (int i = 0; i < count; i++) {
+        uint32_t pos = entries[i].hash & mask;
+        while (dict->indices[pos] != DICT_EMPTY)
+            pos = (pos + 1) & mask;
+        dict->indices[pos] = i;
+    }
+}
+
+objdict *init_objdict(void)
+{
+    objdict *dict = ALLOCATE(objdict, 1);
+    init_object(dict, OBJ_DICT);
+    dict->indices = NULL;
+    dict->indexsize = 0;
+    dict->entries = NULL;
+    dict->count = 0;
+    dict->used = 0;
+    dict->capacity = 0;
+    resize(dict, 0);
+    return dict;
+}
+
+void free_objdict(objdict *dict)
+{
+    for (int i = 0; i < dict->used; i++)
+        if (dict->entries[i].key && !dict->entries[i].handed_out)
+            free_object(dict->entries[i].key, OBJ_PRIMITIVE);
+    FREE_ARRAY(dictentry, dict->entries, dict->capacity);
+    FREE_ARRAY(int32_t, dict->indices, dict->indexsize);
+    FREE(objdict, dict);
+}
+
+bool objdict_valid_key(object *key)
+{
+    if (!key || !OBJ_IS_PRIMITIVE(key))
+        return false;
+    primtype ptype = ((objprim*)key)->ptype;
+    return ptype == PRIM_STRING || ptype == PRIM_DOUBLE || ptype == PRIM_INT;
+}
+
+objprim *objdict_copy_key(objprim *key)
+{
+    objprim *copy = create_new_primitive(key->ptype);
+    if (key->ptype == PRIM_STRING)
+        PRIM_AS_STRING(copy) = create_primstring(PRIM_AS_RAWSTRING(key));
+    else if (key->ptype == PRIM_INT)
+        PRIM_AS_INT(copy) = PRIM_AS_INT(key);
+    else
+        PRIM_AS_DOUBLE(copy) = PRIM_AS_DOUBLE(key);
+    return copy;
+}
+
+object *objdict_get(objdict *dict, object *key)
+{
+    objprim *primkey = (objprim*)key;
+    bool found = false;
+    int32_t *pos = find_slot(dict, primkey, hash_key(primkey), &found);
+    return found ? dict->entries[*pos].value : NULL;
+}
+
+void objdict_set(objdict *dict, object *key, object *value)
+{
+    objprim *primkey = (objprim*)key;
+    uint32_t hash = hash_key(primkey);
+    bool found = false;
+    int32_t *pos = find_slot(dict, primkey, hash, &found);
+    if (found) {
+        dict->entries[*pos].value = value;
+        return;
+    }
+    if (dict->used == dict->capacity) {
+        resize(dict, dict->count + dict->count / 2 + 1);
+        pos = find_slot(dict, primkey, hash, &found);
+    }
+    dictentry *entry = &dict->entries[dict->used];
+    entry->hash = hash;
+    entry->key = objdict_copy_key(primkey);
+    entry->handed_out = false;
+    entry->value = value;
+    *pos = dict->used++;
+    dict->count++;
+}
+
+bool objdict_remove(objdict *dict, object *key)
+{
+    objprim *primkey = (objprim*)key;
+    bool found = false;
+    int32_t *pos = find_slot(dict, primkey, hash_key(primkey), &found);
+    if (!found)
+        return false;
+    dictentry *entry = &dict->entries[*pos];
+    if (!entry->handed_out)
+        free_object(entry->key, OBJ_PRIMITIVE);
+    entry->key = NULL;
+    entry->value = NULL;
+    *pos = DICT_REMOVED;
+    dict->count--;
+    return true;
+}
@@ -0,0 +1,53 @@
+#ifndef ari_objdict_h
+#define ari_objdict_h
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "object.h"
+#include "objprim.h"
+
+/* A dict keeps its entries in one dense array in insertion order, with
+ * a separate table of int32 positions into it for lookups, so iterating
+ * walks contiguous memory and empty hash slots cost four bytes instead
+ * of a whole entry. Removing an entry leaves a hole in the array until
+ * the next resize compacts it.
+ *
+ * Keys are strings or numbers, and the dict keeps its own copy of them.
+ * A for-in loop hands out those copies as they are.
+ */
+#define DICT_EMPTY      -1
+#define DICT_REMOVED    -2
+
+typedef struct
+{
+    uint32_t hash;
+    // The vm frees a key once a for-in loop hands it out
+    bool handed_out;
+    // NULL once the entry is removed
+    objprim *key;
+    object *value;
+} dictentry;
+
+typedef struct
+{
+    object header;
+    int32_t *indices;
+    uint32_t indexsize;
+    dictentry *entries;
+    // Live entries
+    int count;
+    // Entries used in the array, removed ones included
+    int used;
+    int capacity;
+} objdict;
+
+objdict *init_objdict(void);
+void free_objdict(objdict *dict);
+bool objdict_valid_key(object *key);
+object *objdict_get(objdict *dict, object *key);
+void objdict_set(objdict *dict, object *key, object *value);
+bool objdict_remove(objdict *dict, object *key);
+objprim *objdict_copy_key(objprim *key);
+
+#endif
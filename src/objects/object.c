@@ -2,8 +2,13 @@
 
 #include "builtin.h"
 #include "memory.h"
+#include "objarray.h"
 #include "objclass.h"
 #include "objcode.h"
+#include "objdict.h"
+#include "objfile.h"
+#include "objiter.h"
+#include "objlist.h"
 #include "object.h"
 #include "objprim.h"
 
@@ -34,6 +39,9 @@ void print_object(object *obj)
                 case PRIM_DOUBLE:
                     printf("%f", PRIM_AS_DOUBLE(prim));
                     break;
+                case PRIM_INT:
+                    printf("%lld", (long long)PRIM_AS_INT(prim));
+                    break;
                 case PRIM_STRING:
                     printf("%s", PRIM_AS_RAWSTRING(prim));
                     break;
@@ -72,6 +80,80 @@ void print_object(object *obj)
             printf("<builtin>");
             break;
         }
+        case OBJ_LIST:
+        {
+            objlist *listobj = (objlist*)obj;
+            printf("[");
+            for (int i = 0; i < listobj->count; i++) {
+                if (i)
+                    printf(", ");
+                object *item = listobj->items[i];
+                if (item == obj)
+                    printf("[...]");
+                else
+                    print_object(item);
+            }
+            printf("]");
+            break;
+        }
+        case OBJ_FLOAT64ARRAY:
+        {
+            objarray *arrayobj = (objarray*)obj;
+            printf("float64array([");
+            for (int i = 0; i < arrayobj->count; i++)
+                printf(i ? ", %f" : "%f", arrayobj->data[i]);
+            printf("])");
+            break;
+        }
+        case OBJ_DICT:
+        {
+            objdict *dict = (objdict*)obj;
+            bool first = true;
+            printf("{");
+            for (int i = 0; i < dict->used; i++) {
+                dictentry *entry = &dict->entries[i];
+                if (!entry->key)
+                    continue;
+                if (!first)
+                    printf(", ");
+                first = false;
+                print_object((object*)entry->key);
+                printf(": ");
+                if (entry->value == obj)
+                    printf("{...}");
+                else
+                    print_object(entry->value);
+            }
+            printf("}");
+            break;
+        }
+        case OBJ_RANGE:
+        {
+            objrange *range = (objrange*)obj;
+            printf("range(%lld, %lld, %lld)", (long long)range->start,
+                    (long long)range->stop, (long long)range->step);
+            break;
+        }
+        case OBJ_ITERATOR:
+        {
+            printf("<iterator> at %p", obj);
+            break;
+        }
+        case OBJ_FILE:
+        {
+            printf("<file> at %p", obj);
+            break;
+        }
+        case OBJ_GENERATOR:
+        {
+            printf("<generator> at %p", obj);
+            break;
+        }
+        case OBJ_WAIT:
+        {
+            printf("<wait> at %p", obj);
+            break;
+        }
         default:
             break;
         }
@@ -10,6 +10,14 @@
 #define OBJ_IS_MODULE(obj)      (obj->type == OBJ_MODULE)
 #define OBJ_IS_CODE(obj)        (obj->type == OBJ_CODE)
 #define OBJ_IS_BUILTIN(obj)     (obj->type == OBJ_BUILTIN)
+#define OBJ_IS_LIST(obj)        (obj->type == OBJ_LIST)
+#define OBJ_IS_FLOAT64ARRAY(obj) (obj->type == OBJ_FLOAT64ARRAY)
+#define OBJ_IS_DICT(obj)        (obj->type == OBJ_DICT)
+#define OBJ_IS_RANGE(obj)       (obj->type == OBJ_RANGE)
+#define OBJ_IS_ITERATOR(obj)    (obj->type == OBJ_ITERATOR)
+#define OBJ_IS_FILE(obj)        (obj->type == OBJ_FILE)
+#define OBJ_IS_GENERATOR(obj)   (obj->type == OBJ_GENERATOR)
+#define OBJ_IS_WAIT(obj)        (obj->type == OBJ_WAIT)
 
 struct object_t;
 
@@ -23,6 +31,14 @@ typedef enum
     OBJ_MODULE,
     OBJ_CODE,
     OBJ_BUILTIN,
+    OBJ_LIST,
+    OBJ_FLOAT64ARRAY,
+    OBJ_DICT,
+    OBJ_RANGE,
+    OBJ_ITERATOR,
+    OBJ_FILE,
+    OBJ_GENERATOR,
+    OBJ_WAIT,
 } objtype;
 
 typedef struct object_t
@@ -0,0 +1,90 @@
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+#include "memory.h"
+#include "objfile.h"
+
+
+objfile *init_objfile(FILE *fp)
+{
+    objfile *file = ALLOCATE(objfile, 1);
+    init_object(file, OBJ_FILE);
+    file->fp = fp;
+    int access = fcntl(fileno(fp), F_GETFL) & O_ACCMODE;
+    file->reader = access != O_WRONLY ? open_filestream(fileno(fp), false) :
+        NULL;
+    file->writer = access != O_RDONLY ? open_filestream(fileno(fp), true) :
+        NULL;
+    file->line = NULL;
+    file->linecapacity = 0;
+    return file;
+}
+
+/* Reads the next line without its newline. Returns NULL at the end of
+ * the file, or once it is closed. The line is only good until the next
+ * read.
+ */
+char *objfile_readline(objfile *file)
+{
+    if (!file->fp)
+        return NULL;
+    ssize_t length = file->reader ?
+        filestream_readline(file->reader, &file->line, &file->linecapacity) :
+        getline(&file->line, &file->linecapacity, file->fp);
+    if (length < 0)
+        return NULL;
+    if (length && file->line[length - 1] == '\n')
+        file->line[length - 1] = '\0';
+    return file->line;
+}
+
+/* Reads up to count bytes into the line buffer, with a '\0' after them.
+ * Returns NULL at the end of the file, or once it is closed.
+ */
+char *objfile_read(objfile *file, size_t count, size_t *length)
+{
+    if (!file->fp)
+        return NULL;
+    if (count + 1 > file->linecapacity) {
+        file->line = GROW_ARRAY(file->line, char, file->linecapacity,
+                count + 1);
+        file->linecapacity = count + 1;
+    }
+    *length = file->reader ?
+        filestream_read(file->reader, file->line, count) :
+        fread(file->line, 1, count, file->fp);
+    if (*length == 0)
+        return NULL;
+    file->line[*length] = '\0';
+    return file->line;
+}
+
+// Returns false if the file is closed or the write failed
+bool objfile_write(objfile *file, const char *data, size_t count)
+{
+    if (!file->fp)
+        return false;
+    if (file->writer)
+        return filestream_write(file->writer, data, count);
+    return fwrite(data, 1, count, file->fp) == count &&
+        fflush(file->fp) == 0;
+}
+
+// Returns false if what was left to write out couldn't be
+bool objfile_close(objfile *file)
+{
+    bool ok = true;
+    if (file->reader)
+        close_filestream(file->reader);
+    if (file->writer)
+        ok = close_filestream(file->writer);
+    file->reader = NULL;
+    file->writer = NULL;
+    if (file->fp && fclose(file->fp) != 0)
+        ok = false;
+    file->fp = NULL;
+    return ok;
+}
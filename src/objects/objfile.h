@@ -0,0 +1,30 @@
+#ifndef ari_objfile_h
+#define ari_objfile_h
+
+#include <stdio.h>
+
+#include "filestream.h"
+#include "object.h"
+
+/* A file opened by open(). Looping over it reads one line at a time
+ * into a buffer the file keeps, so only the string for each line is
+ * allocated. A regular file is read and written through filestreams,
+ * and anything else, like a pipe, through stdio.
+ */
+typedef struct
+{
+    object header;
+    FILE *fp;
+    filestream *reader;
+    filestream *writer;
+    char *line;
+    size_t linecapacity;
+} objfile;
+
+objfile *init_objfile(FILE *fp);
+char *objfile_readline(objfile *file);
+char *objfile_read(objfile *file, size_t count, size_t *length);
+bool objfile_write(objfile *file, const char *data, size_t count);
+bool objfile_close(objfile *file);
+
+#endif
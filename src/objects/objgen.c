@@ -0,0 +1,42 @@
+#include <stddef.h>
+
+#include "frame.h"
+#include "memory.h"
+#include "objgen.h"
+
+
+objgen *init_objgen(objcode *code, frame *base)
+{
+    objgen *gen = ALLOCATE(objgen, 1);
+    init_object(gen, OBJ_GENERATOR);
+    gen->code = code;
+    gen->top = base;
+    gen->base = base;
+    gen->framecount = 1;
+    gen->stacktop = NULL;
+    gen->stackbottom = NULL;
+    gen->stackbase = NULL;
+    gen->value = NULL;
+    gen->running = false;
+    gen->done = false;
+    return gen;
+}
+
+// A generator that never finished still holds its frames and stack nodes
+void free_objgen(objgen *gen)
+{
+    frame *current = gen->top;
+    for (int i = 0; current && i < gen->framecount; i++) {
+        frame *next = current->next;
+        reset_frame(current);
+        FREE(frame, current);
+        current = next;
+    }
+    objnode *node = gen->stacktop;
+    while (node) {
+        objnode *next = node == gen->stackbottom ? NULL : node->next;
+        FREE(objnode, node);
+        node = next;
+    }
+    FREE(objgen, gen);
+}
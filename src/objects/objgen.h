@@ -0,0 +1,40 @@
+#ifndef ari_objgen_h
+#define ari_objgen_h
+
+#include <stdbool.h>
+
+#include "frame.h"
+#include "objcode.h"
+#include "object.h"
+#include "objstack.h"
+
+/* A generator is a call of a function that yields, stopped between two
+ * values. While it is stopped it owns the frames the call had pushed,
+ * from the innermost block down to the function's own frame, and the
+ * stack nodes it had pushed. Resuming links both back on top of the
+ * running ones, so nothing is copied either way.
+ */
+typedef struct
+{
+    object header;
+    objcode *code;
+    // Innermost suspended frame, NULL while the call runs or once done
+    frame *top;
+    // The frame of the call itself, the outermost of the suspended ones
+    frame *base;
+    int framecount;
+    // Suspended stack nodes, top first, or NULL if there were none
+    objnode *stacktop;
+    objnode *stackbottom;
+    // Top of the stack below the call while it runs
+    objnode *stackbase;
+    // What the last yield gave
+    object *value;
+    bool running;
+    bool done;
+} objgen;
+
+objgen *init_objgen(objcode *code, frame *base);
+void free_objgen(objgen *gen);
+
+#endif
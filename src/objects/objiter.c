@@ -0,0 +1,34 @@
+#include <stddef.h>
+
+#include "memory.h"
+#include "objiter.h"
+
+
+objrange *init_objrange(int64_t start, int64_t stop, int64_t step)
+{
+    objrange *range = ALLOCATE(objrange, 1);
+    init_object(range, OBJ_RANGE);
+    range->start = start;
+    range->stop = stop;
+    range->step = step;
+    return range;
+}
+
+// Whether a value counted to from start has not yet passed stop
+bool objrange_contains(objrange *range, int64_t value)
+{
+    return range->step > 0 ? value < range->stop : value > range->stop;
+}
+
+objiter *init_objiter(iterkind kind, object *source)
+{
+    objiter *iter = ALLOCATE(objiter, 1);
+    init_object(iter, OBJ_ITERATOR);
+    iter->kind = kind;
+    iter->source = source;
+    iter->position = 0;
+    iter->next = NULL;
+    if (kind == ITER_RANGE)
+        iter->position = ((objrange*)source)->start;
+    return iter;
+}
@@ -0,0 +1,50 @@
+#ifndef ari_objiter_h
+#define ari_objiter_h
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "object.h"
+
+/* A range stands for the ints from start up to, but not including,
+ * stop, without building a list of them.
+ */
+typedef struct
+{
+    object header;
+    int64_t start;
+    int64_t stop;
+    int64_t step;
+} objrange;
+
+typedef enum
+{
+    ITER_RANGE,
+    ITER_LIST,
+    ITER_FLOAT64ARRAY,
+    ITER_DICT,
+    ITER_FILE,
+    ITER_INSTANCE,
+    ITER_GENERATOR,
+} iterkind;
+
+/* The state of one for-in loop, made by GET_ITER and stepped by
+ * FOR_ITER. The builtin kinds keep their place in the object they
+ * walk; an instance is asked for each value through its __next__.
+ */
+typedef struct
+{
+    object header;
+    iterkind kind;
+    object *source;
+    // The next int of a range, or the next index into the source
+    int64_t position;
+    // __next__ of an instance iterator
+    object *next;
+} objiter;
+
+objrange *init_objrange(int64_t start, int64_t stop, int64_t step);
+bool objrange_contains(objrange *range, int64_t value);
+objiter *init_objiter(iterkind kind, object *source);
+
+#endif
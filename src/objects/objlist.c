@@ -0,0 +1,26 @@
+#include <stddef.h>
+
+#include "memory.h"
+#include "objlist.h"
+
+
+objlist *init_objlist(int capacity)
+{
+    objlist *listobj = ALLOCATE(objlist, 1);
+    init_object(listobj, OBJ_LIST);
+    listobj->items = capacity ? ALLOCATE(object*, capacity) : NULL;
+    listobj->count = 0;
+    listobj->capacity = capacity;
+    return listobj;
+}
+
+void objlist_append(objlist *list, object *item)
+{
+    if (list->count + 1 > list->capacity) {
+        int oldcapacity = list->capacity;
+        list->capacity = GROW_CAPACITY(oldcapacity);
+        list->items = GROW_ARRAY(list->items, object*, oldcapacity,
+                list->capacity);
+    }
+    list->items[list->count++] = item;
+}
@@ -0,0 +1,20 @@
+#ifndef ari_objlist_h
+#define ari_objlist_h
+
+#include "object.h"
+
+/* A list keeps its elements in one contiguous array, which doubles in
+ * size whenever it runs out of room.
+ */
+typedef struct
+{
+    object header;
+    object **items;
+    int count;
+    int capacity;
+} objlist;
+
+objlist *init_objlist(int capacity);
+void objlist_append(objlist *list, object *item);
+
+#endif
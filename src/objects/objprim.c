@@ -34,6 +34,13 @@ static void inline init_double(objprim *obj)
     obj->val_double = 0;
 }
 
+static void inline init_int(objprim *obj)
+{
+    obj->header.type = OBJ_PRIMITIVE;
+    obj->ptype = PRIM_INT;
+    obj->val_long = 0;
+}
+
 static void inline init_bool(objprim *obj)
 {
     obj->header.type = OBJ_PRIMITIVE;
@@ -84,12 +91,21 @@ primstring *create_primstring(char *_string_)
 objprim *create_new_primitive(primtype ptype)
 {
     objprim *obj = ALLOCATE(objprim, 1);
+    init_primitive(obj, ptype);
+    return obj;
+}
+
+void init_primitive(objprim *obj, primtype ptype)
+{
     init_object(obj, OBJ_PRIMITIVE);
 
     switch (ptype) {
         case PRIM_DOUBLE:
             init_double(obj);
             break;
+        case PRIM_INT:
+            init_int(obj);
+            break;
         case PRIM_BOOL:
             init_bool(obj);
             break;
@@ -104,67 +120,6 @@ objprim *create_new_primitive(primtype ptype)
     obj->header.__sub__ = prim_binary_sub;
     obj->header.__mul__ = prim_binary_mul;
     obj->header.__div__ = prim_binary_div;
-    return obj;
-}
-
-void convert_prim(objprim *prim, primtype type)
-{
-    primtype current = prim->ptype;
-    switch (current) {
-        case PRIM_DOUBLE:
-        {
-            if (type == PRIM_DOUBLE)
-                return;
-            else if (type == PRIM_STRING) {
-                double newdouble = PRIM_AS_DOUBLE(prim);
-                sprintf(PRIM_AS_RAWSTRING(prim), "%lf", newdouble);
-                prim->ptype = PRIM_DOUBLE;
-            }
-            else if (type == PRIM_BOOL) {
-                PRIM_AS_BOOL(prim) = (PRIM_AS_DOUBLE(prim) >= 1 ? true : false);
-                prim->ptype = PRIM_BOOL;
-            }
-            else if (type == PRIM_NULL) {
-                PRIM_AS_NULL(prim) = 0;
-                prim->ptype = PRIM_NULL;
-            }
-        }
-        case PRIM_STRING:
-        {
-            if (type == PRIM_STRING)
-                return;
-            else if (type == PRIM_DOUBLE) {
-                double newdouble = atof(PRIM_AS_RAWSTRING(prim));
-                PRIM_AS_DOUBLE(prim) = newdouble;
-                prim->ptype = PRIM_DOUBLE;
-            }
-            else if (type == PRIM_BOOL)
-                return;
-            else if (type == PRIM_NULL) {
-                PRIM_AS_NULL(prim) = 0;
-                prim->ptype = PRIM_NULL;
-            }
-        }
-        case PRIM_BOOL:
-        {
-            if (type == PRIM_BOOL)
-                return;
-            else if (type == PRIM_DOUBLE) {
-                double newdouble = (double)PRIM_AS_BOOL(prim);
-                PRIM_AS_DOUBLE(prim) = newdouble;
-                prim->ptype = PRIM_DOUBLE;
-            }
-            else if (type == PRIM_STRING)
-                return;
-            else if (type == PRIM_NULL) {
-                PRIM_AS_NULL(prim) = 0;
-                prim->ptype = PRIM_NULL;
-            }
-
-        }
-        default:
-            return;
-    }
 }
 
 static bool match(objprim *a, objprim *b, primtype type)
@@ -194,11 +149,12 @@ static objprim *repeat(objprim *a, int times)
 {
     primstring *string_a = PRIM_AS_STRING(a);
 
+    if (times < 0)
+        times = 0;
     int length = string_a->length * times;
     char *newstring = ALLOCATE(char, length + 1);
-    memcpy(newstring, string_a->_string_, string_a->length);
     for (int i = 0; i < times; i++)
-        memcpy(newstring + (string_a->length * (i +1)), string_a->_string_,
+        memcpy(newstring + (string_a->length * i), string_a->_string_,
                 string_a->length);
     newstring[length] = '\0';
 
@@ -209,6 +165,55 @@ static objprim *repeat(objprim *a, int times)
     return newprim;
 }
 
+static bool is_arith_operand(objprim *prim)
+{
+    return (prim->ptype == PRIM_INT || prim->ptype == PRIM_DOUBLE ||
+            prim->ptype == PRIM_BOOL);
+}
+
+static int64_t as_int(objprim *prim)
+{
+    return (prim->ptype == PRIM_BOOL ? PRIM_AS_BOOL(prim) : PRIM_AS_INT(prim));
+}
+
+static double as_double(objprim *prim)
+{
+    switch (prim->ptype) {
+        case PRIM_INT:      return (double)PRIM_AS_INT(prim);
+        case PRIM_BOOL:     return (double)PRIM_AS_BOOL(prim);
+        default:            return PRIM_AS_DOUBLE(prim);
+    }
+}
+
+/* Arithmetic where one side is an int and the other an int, double or
+ * bool. The result stays an int unless a double is involved or the
+ * int result would overflow, and division always gives a double.
+ */
+static objprim *int_binary(objprim *a, objprim *b, char op)
+{
+    objprim *c = NULL;
+
+    if (op != '/' && a->ptype != PRIM_DOUBLE && b->ptype != PRIM_DOUBLE) {
+        int64_t result;
+        if (int_arith(op, as_int(a), as_int(b), &result)) {
+            c = create_new_primitive(PRIM_INT);
+            PRIM_AS_INT(c) = result;
+            return c;
+        }
+    }
+
+    double x = as_double(a);
+    double y = as_double(b);
+    c = create_new_primitive(PRIM_DOUBLE);
+    switch (op) {
+        case '+':   PRIM_AS_DOUBLE(c) = x + y; break;
+        case '-':   PRIM_AS_DOUBLE(c) = x - y; break;
+        case '*':   PRIM_AS_DOUBLE(c) = x * y; break;
+        case '/':   PRIM_AS_DOUBLE(c) = x / y; break;
+    }
+    return c;
+}
+
 object *prim_binary_add(object *this_, object *other)
 {
     if (this_->type != OBJ_PRIMITIVE || other->type != OBJ_PRIMITIVE)
@@ -218,6 +223,12 @@ object *prim_binary_add(object *this_, object *other)
     objprim *b = (objprim*)other;
     objprim *c = NULL;
 
+    if (match(a, b, PRIM_INT)) {
+        if (!is_arith_operand(a) || !is_arith_operand(b))
+            return NULL;
+        return (object*)int_binary(a, b, '+');
+    }
+
     if (match(a, b, PRIM_DOUBLE)) {
         if ((a->ptype == PRIM_DOUBLE && b->ptype == PRIM_DOUBLE)) {
             c = create_new_primitive(PRIM_DOUBLE);
@@ -226,9 +237,7 @@ object *prim_binary_add(object *this_, object *other)
         else if ((a->ptype == PRIM_BOOL && b->ptype == PRIM_DOUBLE) ||
                  (a->ptype == PRIM_DOUBLE && b->ptype == PRIM_BOOL)) {
             c = create_new_primitive(PRIM_DOUBLE);
-            convert_prim(a, PRIM_DOUBLE);
-            convert_prim(b, PRIM_DOUBLE);
-            PRIM_AS_DOUBLE(c) = PRIM_AS_DOUBLE(a) + PRIM_AS_DOUBLE(b);
+            PRIM_AS_DOUBLE(c) = as_double(a) + as_double(b);
         }
         else if ((a->ptype == PRIM_STRING && b->ptype == PRIM_DOUBLE) ||
                  (a->ptype == PRIM_DOUBLE && b->ptype == PRIM_STRING) ||
@@ -273,6 +282,12 @@ object *prim_binary_sub(object *this_, object *other)
     objprim *b = (objprim*)other;
     objprim *c = NULL;
 
+    if (match(a, b, PRIM_INT)) {
+        if (!is_arith_operand(a) || !is_arith_operand(b))
+            return NULL;
+        return (object*)int_binary(a, b, '-');
+    }
+
     if (match(a, b, PRIM_DOUBLE)) {
         if ((a->ptype == PRIM_DOUBLE && b->ptype == PRIM_DOUBLE)) {
             c = create_new_primitive(PRIM_DOUBLE);
@@ -281,9 +296,7 @@ object *prim_binary_sub(object *this_, object *other)
         else if ((a->ptype == PRIM_BOOL && b->ptype == PRIM_DOUBLE) ||
                  (a->ptype == PRIM_DOUBLE && b->ptype == PRIM_BOOL)) {
             c = create_new_primitive(PRIM_DOUBLE);
-            convert_prim(a, PRIM_DOUBLE);
-            convert_prim(b, PRIM_DOUBLE);
-            PRIM_AS_DOUBLE(c) = PRIM_AS_DOUBLE(a) - PRIM_AS_DOUBLE(b);
+            PRIM_AS_DOUBLE(c) = as_double(a) - as_double(b);
         }
         else if ((a->ptype == PRIM_STRING && b->ptype == PRIM_DOUBLE) ||
                  (a->ptype == PRIM_DOUBLE && b->ptype == PRIM_STRING) ||
@@ -322,6 +335,21 @@ object *prim_binary_mul(object *this_, object *other)
     objprim *b = (objprim*)other;
     objprim *c = NULL;
 
+    if (match(a, b, PRIM_INT)) {
+        if (a->ptype == PRIM_STRING || b->ptype == PRIM_STRING) {
+            objprim *basestring = (a->ptype == PRIM_STRING ? a : b);
+            objprim *count = (a->ptype == PRIM_STRING ? b : a);
+            if (count->ptype != PRIM_INT)
+                return NULL;
+            int64_t times = PRIM_AS_INT(count);
+            return (object*)repeat(basestring, times > INT_MAX ? INT_MAX :
+                    (int)times);
+        }
+        if (!is_arith_operand(a) || !is_arith_operand(b))
+            return NULL;
+        return (object*)int_binary(a, b, '*');
+    }
+
     if (match(a, b, PRIM_DOUBLE)) {
         if ((a->ptype == PRIM_DOUBLE && b->ptype == PRIM_DOUBLE)) {
             c = create_new_primitive(PRIM_DOUBLE);
@@ -330,9 +358,7 @@ object *prim_binary_mul(object *this_, object *other)
         else if ((a->ptype == PRIM_BOOL && b->ptype == PRIM_DOUBLE) ||
                  (a->ptype == PRIM_DOUBLE && b->ptype == PRIM_BOOL)) {
             c = create_new_primitive(PRIM_DOUBLE);
-            convert_prim(a, PRIM_DOUBLE);
-            convert_prim(b, PRIM_DOUBLE);
-            PRIM_AS_DOUBLE(c) = PRIM_AS_DOUBLE(a) * PRIM_AS_DOUBLE(b);
+            PRIM_AS_DOUBLE(c) = as_double(a) * as_double(b);
         }
         else if ((a->ptype == PRIM_STRING && b->ptype == PRIM_DOUBLE) ||
                  (a->ptype == PRIM_DOUBLE && b->ptype == PRIM_STRING)) {
@@ -380,6 +406,12 @@ object *prim_binary_div(object *this_, object *other)
     objprim *b = (objprim*)other;
     objprim *c = NULL;
 
+    if (match(a, b, PRIM_INT)) {
+        if (!is_arith_operand(a) || !is_arith_operand(b))
+            return NULL;
+        return (object*)int_binary(a, b, '/');
+    }
+
     if (match(a, b, PRIM_DOUBLE)) {
         if ((a->ptype == PRIM_DOUBLE && b->ptype == PRIM_DOUBLE)) {
             c = create_new_primitive(PRIM_DOUBLE);
@@ -388,9 +420,7 @@ object *prim_binary_div(object *this_, object *other)
         else if ((a->ptype == PRIM_BOOL && b->ptype == PRIM_DOUBLE) ||
                  (a->ptype == PRIM_DOUBLE && b->ptype == PRIM_BOOL)) {
             c = create_new_primitive(PRIM_DOUBLE);
-            convert_prim(a, PRIM_DOUBLE);
-            convert_prim(b, PRIM_DOUBLE);
-            PRIM_AS_DOUBLE(c) = PRIM_AS_DOUBLE(a) / PRIM_AS_DOUBLE(b);
+            PRIM_AS_DOUBLE(c) = as_double(a) / as_double(b);
         }
         else if ((a->ptype == PRIM_STRING && b->ptype == PRIM_DOUBLE) ||
                  (a->ptype == PRIM_DOUBLE && b->ptype == PRIM_STRING) ||
@@ -427,6 +457,15 @@ bool check_zero_div(object *a, object *b)
 
     objprim *dividend = (objprim*)a;
     objprim *divisor = (objprim*)b;
+    if (divisor->ptype == PRIM_INT && is_arith_operand(dividend))
+        return PRIM_AS_INT(divisor) == 0;
+    if (dividend->ptype == PRIM_INT) {
+        if (divisor->ptype == PRIM_DOUBLE)
+            return PRIM_AS_DOUBLE(divisor) == 0;
+        if (divisor->ptype == PRIM_BOOL)
+            return PRIM_AS_BOOL(divisor) == 0;
+        return false;
+    }
     if ((dividend->ptype == PRIM_DOUBLE && divisor->ptype == PRIM_DOUBLE)) {
         if (PRIM_AS_DOUBLE(divisor) == 0)
             return true;
@@ -442,33 +481,78 @@ bool check_zero_div(object *a, object *b)
     return false;
 }
 
-object *binary_comp(objprim *a, objprim *b, tokentype optype)
+static bool compare_ints(int64_t a, int64_t b, tokentype optype)
 {
-    if ((!a) || (!b))
-        return NULL;
+    switch (optype) {
+        case TOKEN_EQUAL_EQUAL:     return a == b;
+        case TOKEN_BANG_EQUAL:      return a != b;
+        case TOKEN_GREATER:         return a > b;
+        case TOKEN_GREATER_EQUAL:   return a >= b;
+        case TOKEN_LESS:            return a < b;
+        case TOKEN_LESS_EQUAL:      return a <= b;
+        default:                    return false;
+    }
+}
+
+static bool compare_numbers(double a, double b, tokentype optype)
+{
+    switch (optype) {
+        case TOKEN_EQUAL_EQUAL:     return a == b;
+        case TOKEN_BANG_EQUAL:      return a != b;
+        case TOKEN_GREATER:         return a > b;
+        case TOKEN_GREATER_EQUAL:   return a >= b;
+        case TOKEN_LESS:            return a < b;
+        case TOKEN_LESS_EQUAL:      return a <= b;
+        default:                    return false;
+    }
+}
+
+// Whether two primitives of which at most one is a number are equal
+static bool prims_equal(objprim *a, objprim *b)
+{
+    if (a->ptype != b->ptype)
+        return false;
+    switch (a->ptype) {
+        case PRIM_STRING:
+            return strcmp(PRIM_AS_RAWSTRING(a), PRIM_AS_RAWSTRING(b)) == 0;
+        case PRIM_BOOL:
+            return PRIM_AS_BOOL(a) == PRIM_AS_BOOL(b);
+        case PRIM_DOUBLE:
+            return PRIM_AS_DOUBLE(a) == PRIM_AS_DOUBLE(b);
+        default:
+            return true;
+    }
+}
 
-    objprim *c = create_new_primitive(PRIM_BOOL);
+bool binary_comp(objprim *a, objprim *b, tokentype optype)
+{
+    bool equality = optype == TOKEN_EQUAL_EQUAL || optype == TOKEN_BANG_EQUAL;
+
+    /* Anything that is not a primitive is only equal to itself, and has
+     * no order.
+     */
+    if (a->header.type != OBJ_PRIMITIVE || b->header.type != OBJ_PRIMITIVE)
+        return equality && ((a == b) == (optype == TOKEN_EQUAL_EQUAL));
+
+    if (a->ptype == PRIM_INT && b->ptype == PRIM_INT)
+        return compare_ints(PRIM_AS_INT(a), PRIM_AS_INT(b), optype);
+    if (match(a, b, PRIM_INT) && PRIM_IS_NUMBER(a) && PRIM_IS_NUMBER(b))
+        return compare_numbers(PRIM_NUMBER_AS_DOUBLE(a),
+                PRIM_NUMBER_AS_DOUBLE(b), optype);
+    if (equality)
+        return prims_equal(a, b) == (optype == TOKEN_EQUAL_EQUAL);
 
     switch (optype) {
-        case TOKEN_EQUAL_EQUAL:
-            PRIM_AS_BOOL(c) = (PRIM_AS_DOUBLE(a) == PRIM_AS_DOUBLE(b));
-            break;
         case TOKEN_GREATER:
-            PRIM_AS_BOOL(c) = (PRIM_AS_DOUBLE(a) > PRIM_AS_DOUBLE(b));
-            break;
+            return PRIM_AS_DOUBLE(a) > PRIM_AS_DOUBLE(b);
         case TOKEN_GREATER_EQUAL:
-            PRIM_AS_BOOL(c) = (PRIM_AS_DOUBLE(a) >= PRIM_AS_DOUBLE(b));
-            break;
+            return PRIM_AS_DOUBLE(a) >= PRIM_AS_DOUBLE(b);
         case TOKEN_LESS:
-            PRIM_AS_BOOL(c) = (PRIM_AS_DOUBLE(a) < PRIM_AS_DOUBLE(b));
-            break;
+            return PRIM_AS_DOUBLE(a) < PRIM_AS_DOUBLE(b);
         case TOKEN_LESS_EQUAL:
-            PRIM_AS_BOOL(c) = (PRIM_AS_DOUBLE(a) <= PRIM_AS_DOUBLE(b));
-            break;
+            return PRIM_AS_DOUBLE(a) <= PRIM_AS_DOUBLE(b);
         default:
             // future error code here
-            break;
+            return false;
     }
-    return (object*)c;
 }
-
@@ -3,6 +3,7 @@
 
 #define PRIM_AS_BOOL(obj)               (obj->val_int)
 #define PRIM_AS_DOUBLE(obj)             (obj->val_double)
+#define PRIM_AS_INT(obj)                (obj->val_long)
 #define PRIM_AS_NULL(obj)               (obj->val_int)
 #define PRIM_AS_STRING(obj)             (obj->val_string)
 #define PRIM_AS_RAWSTRING(obj)          (obj->val_string->_string_)
@@ -13,6 +14,14 @@
 
 #define PRIMSTRING_AS_RAWSTRING(obj)    (obj->_string_)
 
+#define PRIM_IS_NUMBER(obj)     \
+    (obj->ptype == PRIM_DOUBLE || obj->ptype == PRIM_INT)
+#define PRIM_NUMBER_AS_DOUBLE(obj)      \
+    (obj->ptype == PRIM_INT ? (double)obj->val_long : obj->val_double)
+
+#include <stdbool.h>
+#include <stdint.h>
+
 #include "object.h"
 #include "token.h"
 
@@ -22,6 +31,7 @@ typedef enum
     PRIM_STRING,
     PRIM_BOOL,
     PRIM_NULL,
+    PRIM_INT,
 } primtype;
 
 typedef struct primstring_t
@@ -38,18 +48,33 @@ typedef struct objprim_t
     union
     {
         int val_int;
+        int64_t val_long;
         double val_double;
         primstring *val_string;
     };
 } objprim;
 
+/* Integer +, - and * for the given operator character. Returns false
+ * if the result doesn't fit in 64 bits, in which case callers redo the
+ * operation in doubles.
+ */
+static inline bool int_arith(char op, int64_t a, int64_t b, int64_t *result)
+{
+    switch (op) {
+        case '+':   return !__builtin_add_overflow(a, b, result);
+        case '-':   return !__builtin_sub_overflow(a, b, result);
+        case '*':   return !__builtin_mul_overflow(a, b, result);
+        default:    return false;
+    }
+}
+
 objprim *create_new_primitive(primtype ptype);
+void init_primitive(objprim *obj, primtype ptype);
 int hashkey(char *key, int length);
 primstring *create_primstring(char *_string_);
 primstring *init_primstring(int length, uint32_t hash, char *takenstring);
-void convert_prim(objprim *prim, primtype type);
 void free_primstring(primstring *del);
 bool check_zero_div(object *a, object *b);
-object *binary_comp(objprim *a, objprim *b, tokentype optype);
+bool binary_comp(objprim *a, objprim *b, tokentype optype);
 
 #endif
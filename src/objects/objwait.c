@@ -0,0 +1,16 @@
+#include <stddef.h>
+
+#include "memory.h"
+#include "objwait.h"
+
+
+objwait *init_objwait(waitkind kind)
+{
+    objwait *wait = ALLOCATE(objwait, 1);
+    init_object(wait, OBJ_WAIT);
+    wait->kind = kind;
+    wait->seconds = 0;
+    wait->fd = -1;
+    wait->fp = NULL;
+    return wait;
+}
@@ -0,0 +1,32 @@
+#ifndef ari_objwait_h
+#define ari_objwait_h
+
+#include <stdio.h>
+
+#include "object.h"
+
+typedef enum
+{
+    WAIT_TIMER,
+    WAIT_READ,
+    WAIT_WRITE,
+} waitkind;
+
+/* What a task run by the event loop yields to be put aside until
+ * something happens: sleep() gives a timer, await_read() and
+ * await_write() a file descriptor to watch. Anything else a task yields
+ * just lets the other ready tasks run first.
+ */
+typedef struct
+{
+    object header;
+    waitkind kind;
+    double seconds;
+    int fd;
+    // The stdio file behind fd, if any, whose buffer may already hold input
+    FILE *fp;
+} objwait;
+
+objwait *init_objwait(waitkind kind);
+
+#endif
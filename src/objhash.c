@@ -49,10 +49,7 @@ static objentry *objhash_find_entry(objentry **entries, uint32_t size,
     objentry *next = entries[bin];
 
     while (next && next->key && is_key(key, next->key) == false) {
-        if (bin < size)
-            bin++;
-        else
-            bin = 0;
+        bin = (bin + 1) & (size - 1);
         next = entries[bin];
     }
 
@@ -90,12 +87,10 @@ static void check_capacity(objhash* ht)
         objentry *entry = ht->table[i];
         if (!entry) continue;
 
-        objentry *dest = objhash_find_entry(entries, newsize, entry->key,
-                                         &bin);
-        dest->key = entry->key;
-        dest->value = entry->value;
+        // Finds the empty bin the entry moves to
+        objhash_find_entry(entries, newsize, entry->key, &bin);
+        entries[bin] = entry;
         ht->count++;
-        FREE(objentry, entry);
     }
     FREE(objentry*, ht->table);
     ht->table = entries;
@@ -130,6 +125,16 @@ void reset_objhash(objhash *ht)
     FREE(objentry*, ht->table);
 }
 
+/* Removes every entry but keeps the table for reuse */
+void objhash_clear(objhash *ht)
+{
+    for (int i = 0; i < ht->capacity; ++i) {
+        objhash_remove_entry(ht->table[i]);
+        ht->table[i] = NULL;
+    }
+    ht->count = 0;
+}
+
 bool objhash_remove(objhash *ht, primstring *key)
 {
     uint32_t bin = 0;
@@ -152,16 +157,17 @@ void objhash_set(objhash *ht, primstring *key, object *value)
     uint32_t bin = 0;
     uint32_t size = ht->capacity; 
     objentry *find = objhash_find_entry(ht->table, size, key, &bin);
+    // Rebinding a name keeps its entry
+    if (find) {
+        find->value = value;
+        return;
+    }
     objentry *newpair = objhash_newpair(key, value);
 
     if (!newpair) {
         // future error code here
         return;
     }
-    if (find) {
-        objhash_remove_entry(find);
-        ht->count--;
-    }
 
     ht->table[bin] = newpair;
     ht->count++;
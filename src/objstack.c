@@ -9,6 +9,7 @@ void init_objstack(objstack *stack)
 {
     stack->count = 0;
     stack->top = NULL;
+    stack->spare = NULL;
 }
 
 void reset_objstack(objstack *stack)
@@ -16,11 +17,20 @@ void reset_objstack(objstack *stack)
     object *obj = NULL;
     while ((obj = pop_objstack(stack)))
         ;
+    while (stack->spare) {
+        objnode *node = stack->spare;
+        stack->spare = node->next;
+        FREE(objnode, node);
+    }
 }
 
 void push_objstack(objstack *stack, object *obj)
 {
-    objnode *node = ALLOCATE(objnode, 1);
+    objnode *node = stack->spare;
+    if (node)
+        stack->spare = node->next;
+    else
+        node = ALLOCATE(objnode, 1);
     node->obj = obj;
     node->next = stack->top;
     stack->top = node;
@@ -35,7 +45,8 @@ object *pop_objstack(objstack *stack)
     objnode *popped = stack->top;
     object *obj = popped->obj;
     stack->top = popped->next;
-    FREE(objnode, popped);
+    popped->next = stack->spare;
+    stack->spare = popped;
     return obj;
 }
 
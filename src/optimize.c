@@ -0,0 +1,315 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include "instruct.h"
+#include "memory.h"
+#include "opcode.h"
+#include "optimize.h"
+
+/* Upper bound on rewrite rounds. Each round can only shrink the code, so
+ * this is just a guard against pathological input.
+ */
+#define MAX_OPTIMIZE_PASSES 8
+
+
+static inline bool is_jump(uint8_t bytecode)
+{
+    return bytecode == OP_JMP_LOC || bytecode == OP_JMP_AFTER ||
+           bytecode == OP_JMP_FALSE || bytecode == OP_FOR_STEP ||
+           bytecode == OP_FOR_ITER || bytecode == OP_JMP_IF_FALSE_KEEP ||
+           bytecode == OP_JMP_IF_TRUE_KEEP;
+}
+
+static inline int jump_target(instruct *instructs, int location)
+{
+    code8 *code = instructs->code[location];
+    value *operand = &code->operand;
+    if (code->bytecode == OP_JMP_AFTER)
+        return location + VAL_AS_INT(operand);
+    return VAL_AS_INT(operand);
+}
+
+static inline void set_jump_target(instruct *instructs, int location,
+        int target)
+{
+    code8 *code = instructs->code[location];
+    value *operand = &code->operand;
+    if (code->bytecode == OP_JMP_AFTER)
+        VAL_AS_INT(operand) = target - location;
+    else
+        VAL_AS_INT(operand) = target;
+}
+
+static void free_code(code8 *code)
+{
+    value *operand = &code->operand;
+    if (VAL_IS_STRING(operand))
+        FREE(char, VAL_AS_STRING(operand));
+    FREE(code8, code);
+}
+
+/* Retargets jumps whose destination is an unconditional jump. */
+static bool thread_jumps(instruct *instructs)
+{
+    bool changed = false;
+    int count = instructs->count;
+
+    for (int i = 0; i < count; i++) {
+        if (!is_jump(instructs->code[i]->bytecode))
+            continue;
+        int target = jump_target(instructs, i);
+        int hops = 0;
+        while (target < count && hops++ < count &&
+                instructs->code[target]->bytecode == OP_JMP_LOC &&
+                jump_target(instructs, target) != target)
+            target = jump_target(instructs, target);
+
+        if (target != jump_target(instructs, i)) {
+            set_jump_target(instructs, i, target);
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+static void mark_jump_targets(instruct *instructs, bool *targets)
+{
+    int count = instructs->count;
+    for (int i = 0; i <= count; i++)
+        targets[i] = false;
+    for (int i = 0; i < count; i++)
+        if (is_jump(instructs->code[i]->bytecode)) {
+            int target = jump_target(instructs, i);
+            if (target >= 0 && target <= count)
+                targets[target] = true;
+        }
+}
+
+/* Flags every instruction that can be reached from the entry point.
+ * Anything after a RETURN or an unconditional jump that no jump lands
+ * on is left unmarked.
+ */
+static void mark_reachable(instruct *instructs, bool *reachable,
+        int *worklist)
+{
+    int count = instructs->count;
+    int top = 0;
+    for (int i = 0; i < count; i++)
+        reachable[i] = false;
+
+    if (count)
+        worklist[top++] = 0;
+    while (top) {
+        int i = worklist[--top];
+        if (i < 0 || i >= count || reachable[i])
+            continue;
+        reachable[i] = true;
+
+        uint8_t bytecode = instructs->code[i]->bytecode;
+        if (is_jump(bytecode))
+            worklist[top++] = jump_target(instructs, i);
+        if (bytecode != OP_RETURN && bytecode != OP_JMP_LOC &&
+                bytecode != OP_JMP_AFTER)
+            worklist[top++] = i + 1;
+    }
+}
+
+static inline bool same_name(code8 *a, code8 *b)
+{
+    value *x = &a->operand;
+    value *y = &b->operand;
+    return VAL_IS_STRING(x) && VAL_IS_STRING(y) &&
+        strcmp(VAL_AS_STRING(x), VAL_AS_STRING(y)) == 0;
+}
+
+/* Drops every instruction not flagged in keep, and rewrites the absolute
+ * jump targets recorded by patch_jump to the new positions.
+ */
+static bool compact(instruct *instructs, bool *keep, int *newindex)
+{
+    int count = instructs->count;
+    int kept = 0;
+
+    for (int i = 0; i < count; i++) {
+        newindex[i] = kept;
+        if (keep[i])
+            kept++;
+    }
+    newindex[count] = kept;
+
+    if (kept == count)
+        return false;
+
+    for (int i = 0; i < count; i++) {
+        if (!keep[i] || !is_jump(instructs->code[i]->bytecode))
+            continue;
+        int target = jump_target(instructs, i);
+        if (target < 0 || target > count)
+            continue;
+        int bytecode = instructs->code[i]->bytecode;
+        value *operand = &instructs->code[i]->operand;
+        if (bytecode == OP_JMP_AFTER)
+            VAL_AS_INT(operand) = newindex[target] - newindex[i];
+        else
+            VAL_AS_INT(operand) = newindex[target];
+    }
+
+    for (int i = 0; i < count; i++) {
+        code8 *code = instructs->code[i];
+        instructs->code[i] = NULL;
+        if (keep[i])
+            instructs->code[newindex[i]] = code;
+        else
+            free_code(code);
+    }
+    instructs->count = kept;
+    return true;
+}
+
+static inline bool binds_name(uint8_t bytecode)
+{
+    return bytecode == OP_STORE_NAME || bytecode == OP_STORE_NAME_KEEP;
+}
+
+/* A block only needs a frame of its own for the names assigned in it.
+ * Drops the PUSH_FRAME and POP_FRAME around a block that assigns none;
+ * its reads end up in the enclosing frame either way. Blocks nested in
+ * it have frames of their own and don't count.
+ */
+static bool elide_block_frames(instruct *instructs, bool *keep, int *scratch)
+{
+    int count = instructs->count;
+    for (int i = 0; i < count; i++)
+        keep[i] = true;
+
+    for (int i = 0; i < count; i++) {
+        if (instructs->code[i]->bytecode != OP_PUSH_FRAME)
+            continue;
+        int depth = 0;
+        bool binds = false;
+        int end = i + 1;
+        for (; end < count; end++) {
+            uint8_t bytecode = instructs->code[end]->bytecode;
+            if (bytecode == OP_PUSH_FRAME)
+                depth++;
+            else if (bytecode == OP_POP_FRAME) {
+                if (!depth)
+                    break;
+                depth--;
+            }
+            else if (!depth && binds_name(bytecode))
+                binds = true;
+        }
+        if (end < count && !binds)
+            keep[i] = keep[end] = false;
+    }
+    return compact(instructs, keep, scratch);
+}
+
+static bool optimize_pass(instruct *instructs, bool *keep, bool *targets,
+        int *scratch)
+{
+    int count = instructs->count;
+    bool changed = thread_jumps(instructs);
+
+    mark_reachable(instructs, keep, scratch);
+    mark_jump_targets(instructs, targets);
+
+    for (int i = 0; i < count; i++) {
+        if (!keep[i])
+            continue;
+        code8 *code = instructs->code[i];
+        switch (code->bytecode) {
+            /* LOAD_METHOD does nothing besides advancing the pc */
+            case OP_LOAD_METHOD:
+                keep[i] = false;
+                break;
+            /* A jump to the next instruction is a no-op */
+            case OP_JMP_LOC:
+            case OP_JMP_AFTER:
+            {
+                int target = jump_target(instructs, i);
+                if (target == i + 1)
+                    keep[i] = false;
+                break;
+            }
+            /* STORE_NAME x; LOAD_NAME x leaves the stored object on the
+             * stack, as long as nothing jumps between the two.
+             */
+            case OP_STORE_NAME:
+            {
+                if (i + 1 < count && keep[i + 1] && !targets[i + 1] &&
+                        instructs->code[i + 1]->bytecode == OP_LOAD_NAME &&
+                        same_name(code, instructs->code[i + 1])) {
+                    code->bytecode = OP_STORE_NAME_KEEP;
+                    keep[i + 1] = false;
+                }
+                break;
+            }
+            default:
+                break;
+        }
+    }
+    return compact(instructs, keep, scratch) || changed;
+}
+
+static inline bool sequence_at(instruct *instructs, int location,
+        const uint8_t *sequence, int length)
+{
+    if (location + length > instructs->count)
+        return false;
+    for (int i = 0; i < length; i++)
+        if (instructs->code[location + i]->bytecode != sequence[i])
+            return false;
+    return true;
+}
+
+static const uint8_t compare_jmp_sequence[] =
+    { OP_LOAD_NAME, OP_LOAD_CONSTANT, OP_COMPARE, OP_JMP_FALSE };
+static const uint8_t add_store_sequence[] =
+    { OP_LOAD_NAME, OP_LOAD_CONSTANT, OP_BINARY_ADD, OP_STORE_NAME };
+static const uint8_t get_property_sequence[] =
+    { OP_LOAD_NAME, OP_GET_PROPERTY };
+static const uint8_t set_property_sequence[] =
+    { OP_LOAD_NAME, OP_SET_PROPERTY };
+
+/* Marks the start of the most frequent opcode sequences (as counted with
+ * DEBUG_ARI_OPSTATS) with a superinstruction. Only the first bytecode is
+ * rewritten; the vm reads the remaining operands from the instructions
+ * that follow, which stay untouched for any jump that lands inside.
+ */
+static void fuse_superinstructions(instruct *instructs)
+{
+    for (int i = 0; i < instructs->count; i++) {
+        code8 *code = instructs->code[i];
+        if (sequence_at(instructs, i, compare_jmp_sequence, 4))
+            code->bytecode = OP_COMPARE_NAME_CONST_JMP;
+        else if (sequence_at(instructs, i, add_store_sequence, 4))
+            code->bytecode = OP_ADD_NAME_CONST_STORE;
+        else if (sequence_at(instructs, i, get_property_sequence, 2))
+            code->bytecode = OP_GET_NAME_PROPERTY;
+        else if (sequence_at(instructs, i, set_property_sequence, 2))
+            code->bytecode = OP_SET_NAME_PROPERTY;
+    }
+}
+
+void optimize_instructs(instruct *instructs)
+{
+    int count = instructs->count;
+    if (!count)
+        return;
+
+    bool *keep = ALLOCATE(bool, count + 1);
+    bool *targets = ALLOCATE(bool, count + 1);
+    int *scratch = ALLOCATE(int, (count + 1) * 2);
+
+    elide_block_frames(instructs, keep, scratch);
+    for (int pass = 0; pass < MAX_OPTIMIZE_PASSES; pass++)
+        if (!optimize_pass(instructs, keep, targets, scratch))
+            break;
+    fuse_superinstructions(instructs);
+
+    FREE_ARRAY(bool, keep, count + 1);
+    FREE_ARRAY(bool, targets, count + 1);
+    FREE_ARRAY(int, scratch, (count + 1) * 2);
+}
@@ -0,0 +1,400 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "cache.h"
+#include "error.h"
+#include "memory.h"
+#include "objarray.h"
+#include "objclass.h"
+#include "objdict.h"
+#include "opcode.h"
+#include "parallel.h"
+
+// What the function is defined as in the workers if it has no global name
+#define MAPPED_NAME     "parallel_map()"
+
+typedef struct
+{
+    objlist *inputs;
+    // The caller's global values the code names, which workers copy
+    objhash *globals;
+    // What the function returned for each item, made by a worker's vm
+    object **results;
+    const uint8_t *image;
+    size_t imagesize;
+    // The name the workers find the function under
+    char *name;
+    int chunk;
+    // The first item no worker has taken yet
+    int64_t next;
+    bool failed;
+} mapjob;
+
+typedef struct
+{
+    mapjob *job;
+    VM *vm;
+    pthread_t thread;
+    bool started;
+} mapworker;
+
+typedef enum
+{
+    PASS_OK,
+    PASS_TYPE,
+    PASS_DEPTH,
+} passcheck;
+
+static passcheck check_pass(object *obj, int depth)
+{
+    if (!obj)
+        return PASS_OK;
+    switch (obj->type) {
+        case OBJ_PRIMITIVE:
+        case OBJ_FLOAT64ARRAY:
+            return PASS_OK;
+        case OBJ_LIST:
+        {
+            // A list that holds itself never gets to the bottom
+            if (depth == PARALLEL_MAX_DEPTH)
+                return PASS_DEPTH;
+            objlist *list = (objlist*)obj;
+            for (int i = 0; i < list->count; i++) {
+                passcheck check = check_pass(list->items[i], depth + 1);
+                if (check != PASS_OK)
+                    return check;
+            }
+            return PASS_OK;
+        }
+        case OBJ_DICT:
+        {
+            if (depth == PARALLEL_MAX_DEPTH)
+                return PASS_DEPTH;
+            objdict *dict = (objdict*)obj;
+            for (int i = 0; i < dict->used; i++) {
+                if (!dict->entries[i].key)
+                    continue;
+                passcheck check = check_pass(dict->entries[i].value,
+                        depth + 1);
+                if (check != PASS_OK)
+                    return check;
+            }
+            return PASS_OK;
+        }
+        default:
+            return PASS_TYPE;
+    }
+}
+
+bool parallel_can_pass(VM *vm, object *obj, const char *verb)
+{
+    switch (check_pass(obj, 0)) {
+        case PASS_OK:
+            return true;
+        case PASS_TYPE:
+            runtime_error(vm, &vm->evalstack, 0,
+                    "TypeError: parallel_map() can only %s numbers, strings, "
+                    "bools, null, lists, dicts and float64arrays", verb);
+            return false;
+        default:
+            runtime_error(vm, &vm->evalstack, 0,
+                    "TypeError: parallel_map() cannot %s lists or dicts "
+                    "nested more than %d deep, or that hold themselves",
+                    verb, PARALLEL_MAX_DEPTH);
+            return false;
+    }
+}
+
+/* Copies an object that parallel_can_pass() takes into the vm to. With
+ * share set, primitives the calling vm owns are used as they are.
+ */
+static object *copy_object(VM *to, object *obj, bool share)
+{
+    if (!obj)
+        return to->nullobj;
+    switch (obj->type) {
+        case OBJ_PRIMITIVE:
+            if (share && obj->accounted)
+                return obj;
+            return vm_copy_primitive(to, (objprim*)obj);
+        case OBJ_FLOAT64ARRAY:
+        {
+            objarray *array = (objarray*)obj;
+            objarray *copy = init_objarray(array->count);
+            memcpy(copy->data, array->data, sizeof(double) * array->count);
+            vm_add_object(to, (object*)copy);
+            return (object*)copy;
+        }
+        case OBJ_LIST:
+        {
+            objlist *list = (objlist*)obj;
+            objlist *copy = init_objlist(list->count);
+            for (int i = 0; i < list->count; i++)
+                objlist_append(copy, copy_object(to, list->items[i], share));
+            vm_add_object(to, (object*)copy);
+            return (object*)copy;
+        }
+        case OBJ_DICT:
+        {
+            objdict *dict = (objdict*)obj;
+            objdict *copy = init_objdict();
+            for (int i = 0; i < dict->used; i++) {
+                dictentry *entry = &dict->entries[i];
+                if (entry->key)
+                    objdict_set(copy, (object*)entry->key,
+                            copy_object(to, entry->value, share));
+            }
+            vm_add_object(to, (object*)copy);
+            return (object*)copy;
+        }
+        default:
+            return to->nullobj;
+    }
+}
+
+static void add_code(instruct *prelude, uint8_t bytecode, value operand)
+{
+    if (prelude->count == prelude->capacity) {
+        int oldcapacity = prelude->capacity;
+        prelude->capacity = GROW_CAPACITY(oldcapacity);
+        prelude->code = GROW_ARRAY(prelude->code, code8*, oldcapacity,
+                prelude->capacity);
+        for (int i = oldcapacity; i < prelude->capacity; i++)
+            prelude->code[i] = NULL;
+    }
+    code8 *code = ALLOCATE(code8, 1);
+    code->bytecode = bytecode;
+    code->hotness = 0;
+    code->deopts = 0;
+    code->operand = operand;
+    code->line = 0;
+    prelude->code[prelude->count++] = code;
+}
+
+static void define_global(instruct *prelude, uint8_t bytecode, object *obj,
+        const char *name)
+{
+    value defined = {.type = VAL_OBJECT, .val_obj = obj};
+    add_code(prelude, bytecode, defined);
+    size_t length = strlen(name);
+    value stored = {.type = VAL_STRING};
+    stored.val_string = ALLOCATE(char, length + 1);
+    memcpy(stored.val_string, name, length + 1);
+    add_code(prelude, OP_STORE_NAME, stored);
+}
+
+/* Adds to used each global value the code could load by name, if it can
+ * be passed. Every string operand is taken for a name, which at worst
+ * copies a value the workers never look at.
+ */
+static void find_globals(objhash *globals, instruct *instructs,
+        objhash *used)
+{
+    for (int i = 0; i < instructs->count; i++) {
+        value *operand = &instructs->code[i]->operand;
+        if (VAL_IS_STRING(operand)) {
+            primstring *name = create_primstring(VAL_AS_STRING(operand));
+            object *found = objhash_get(globals, name);
+            if (found && check_pass(found, 0) == PASS_OK)
+                objhash_set(used, name, found);
+            free_primstring(name);
+        }
+        else if (operand->type == VAL_OBJECT) {
+            object *obj = VAL_AS_OBJECT(operand);
+            if (OBJ_IS_CODE(obj))
+                find_globals(globals, &((objcode*)obj)->instructs, used);
+            else if (OBJ_IS_CLASS(obj))
+                find_globals(globals, &((objclass*)obj)->instructs, used);
+        }
+    }
+}
+
+/* Writes the image the workers start from: code that defines every global
+ * function and class, and funcobj under MAPPED_NAME if it isn't one of
+ * them. Sets name to what funcobj is defined as, and fills used with the
+ * global values for the workers to copy. Returns NULL if it can't be
+ * written.
+ */
+static uint8_t *write_prelude(VM *vm, objcode *funcobj, char **name,
+        size_t *size, objhash *used)
+{
+    instruct prelude;
+    init_instruct(&prelude);
+    *name = NULL;
+    objhash *globals = &vm->global.local.locals;
+    for (uint32_t i = 0; i < globals->capacity; i++) {
+        objentry *entry = globals->table[i];
+        if (!entry || !entry->key || !entry->value)
+            continue;
+        if (OBJ_IS_CLASS(entry->value)) {
+            define_global(&prelude, OP_MAKE_CLASS, entry->value,
+                    PRIMSTRING_AS_RAWSTRING(entry->key));
+            continue;
+        }
+        if (!OBJ_IS_CODE(entry->value))
+            continue;
+        define_global(&prelude, OP_MAKE_FUNCTION, entry->value,
+                PRIMSTRING_AS_RAWSTRING(entry->key));
+        if (entry->value == (object*)funcobj && !*name)
+            *name = PRIMSTRING_AS_RAWSTRING(entry->key);
+    }
+    if (!*name) {
+        define_global(&prelude, OP_MAKE_FUNCTION, (object*)funcobj,
+                MAPPED_NAME);
+        *name = MAPPED_NAME;
+    }
+    add_code(&prelude, OP_RETURN, EMPTY_VAL);
+    find_globals(globals, &prelude, used);
+
+    uint8_t *image = write_bytecode_image(&prelude, size);
+    // The functions are only borrowed, and reset_instruct() leaves them
+    reset_instruct(&prelude);
+    return image;
+}
+
+/* Gives the worker's vm a copy of the global values find_globals() chose.
+ * Anything else, such as an instance or a file, stays behind, and the
+ * function fails to find it by name.
+ */
+static void copy_globals(VM *vm, objhash *globals)
+{
+    for (uint32_t i = 0; i < globals->capacity; i++) {
+        objentry *entry = globals->table[i];
+        if (!entry || !entry->key || !entry->value)
+            continue;
+        objhash_set(&vm->global.local.locals, entry->key,
+                copy_object(vm, entry->value, true));
+    }
+}
+
+static void *run_worker(void *argument)
+{
+    mapworker *worker = (mapworker*)argument;
+    mapjob *job = worker->job;
+    VM *vm = init_vm();
+    worker->vm = vm;
+
+    instruct *prelude = &vm->global.instructs;
+    init_instruct(prelude);
+    objcode *funcobj = NULL;
+    if (load_bytecode_image(job->image, job->imagesize, prelude)) {
+        // The vm frees the functions with itself, called or not
+        for (int i = 0; i < prelude->count; i++) {
+            value *operand = &prelude->code[i]->operand;
+            uint8_t bytecode = prelude->code[i]->bytecode;
+            if (bytecode == OP_MAKE_FUNCTION || bytecode == OP_MAKE_CLASS)
+                vm_add_object(vm, VAL_AS_OBJECT(operand));
+        }
+        execute(vm, prelude);
+        copy_globals(vm, job->globals);
+        primstring *name = create_primstring(job->name);
+        object *found = objhash_get(&vm->global.local.locals, name);
+        free_primstring(name);
+        if (found && OBJ_IS_CODE(found))
+            funcobj = (objcode*)found;
+    }
+    if (!funcobj || vm->haderror) {
+        __atomic_store_n(&job->failed, true, __ATOMIC_RELAXED);
+        return NULL;
+    }
+
+    int count = job->inputs->count;
+    while (!__atomic_load_n(&job->failed, __ATOMIC_RELAXED)) {
+        int64_t start = __atomic_fetch_add(&job->next, job->chunk,
+                __ATOMIC_RELAXED);
+        if (start >= count)
+            break;
+        int end = start + job->chunk < count ? start + job->chunk : count;
+        for (int i = start; i < end; i++) {
+            object *item = copy_object(vm, job->inputs->items[i], true);
+            object *result = vm_call_function(vm, funcobj, 1, &item);
+            if (vm->haderror) {
+                __atomic_store_n(&job->failed, true, __ATOMIC_RELAXED);
+                return NULL;
+            }
+            job->results[i] = result;
+        }
+    }
+    return NULL;
+}
+
+/* Returns the list of results, or NULL after reporting why there is none.
+ * The inputs must all pass parallel_can_pass().
+ */
+object *parallel_map(VM *vm, objcode *funcobj, objlist *inputs, int workers)
+{
+    int count = inputs->count;
+    if (count == 0)
+        return (object*)init_objlist(0);
+
+    mapjob job;
+    objhash used;
+    init_objhash(&used, DEFAULT_HT_SIZE);
+    job.image = write_prelude(vm, funcobj, &job.name, &job.imagesize, &used);
+    if (!job.image) {
+        reset_objhash(&used);
+        runtime_error(vm, &vm->evalstack, 0,
+                "RuntimeError: parallel_map() cannot copy the function");
+        return NULL;
+    }
+    if (workers > count)
+        workers = count;
+    if (workers > PARALLEL_MAX_WORKERS)
+        workers = PARALLEL_MAX_WORKERS;
+    job.inputs = inputs;
+    job.globals = &used;
+    job.results = ALLOCATE(object*, count);
+    for (int i = 0; i < count; i++)
+        job.results[i] = NULL;
+    job.chunk = count / (workers * PARALLEL_CHUNKS);
+    if (job.chunk < 1)
+        job.chunk = 1;
+    job.next = 0;
+    job.failed = false;
+
+    mapworker *pool = ALLOCATE(mapworker, workers);
+    for (int i = 0; i < workers; i++) {
+        pool[i].job = &job;
+        pool[i].vm = NULL;
+        pool[i].started = pthread_create(&pool[i].thread, NULL, run_worker,
+                &pool[i]) == 0;
+    }
+    // A worker that got no thread works in this one, alongside the rest
+    for (int i = 0; i < workers; i++)
+        if (!pool[i].started)
+            run_worker(&pool[i]);
+    for (int i = 0; i < workers; i++)
+        if (pool[i].started)
+            pthread_join(pool[i].thread, NULL);
+
+    objlist *results = NULL;
+    if (job.failed)
+        runtime_error(vm, &vm->evalstack, 0,
+                "RuntimeError: parallel_map() stopped on an error in a "
+                "worker");
+    else {
+        bool valid = true;
+        for (int i = 0; valid && i < count; i++)
+            valid = parallel_can_pass(vm, job.results[i], "return");
+        if (valid) {
+            results = init_objlist(count);
+            for (int i = 0; i < count; i++)
+                objlist_append(results,
+                        copy_object(vm, job.results[i], false));
+        }
+    }
+
+    // The results are copied, so the workers' vms can go
+    for (int i = 0; i < workers; i++) {
+        if (!pool[i].vm)
+            continue;
+        reset_instruct(&pool[i].vm->global.instructs);
+        free_vm(pool[i].vm);
+    }
+    FREE_ARRAY(mapworker, pool, workers);
+    FREE_ARRAY(object*, job.results, count);
+    reset_objhash(&used);
+    FREE_ARRAY(uint8_t, (uint8_t*)job.image, job.imagesize);
+    return (object*)results;
+}
@@ -77,6 +77,17 @@ static stmt_for *init_stmt_for(int line)
     return new_stmt;
 }
 
+static stmt_for_in *init_stmt_for_in(int line)
+{
+    stmt_for_in *new_stmt = ALLOCATE(stmt_for_in, 1);
+    new_stmt->header.type = STMT_FOR_IN;
+    new_stmt->header.line = line;
+    new_stmt->name = NULL;
+    new_stmt->iterable = NULL;
+    new_stmt->loopbody = NULL;
+    return new_stmt;
+}
+
 static stmt_function *init_stmt_function(int line)
 {
     stmt_function *new_stmt = ALLOCATE(stmt_function, 1);
@@ -119,6 +130,15 @@ static stmt_return *init_stmt_return(int line)
     return new_stmt;
 }
 
+static stmt_yield *init_stmt_yield(int line)
+{
+    stmt_yield *new_stmt = ALLOCATE(stmt_yield, 1);
+    new_stmt->header.type = STMT_YIELD;
+    new_stmt->header.line = line;
+    new_stmt->value = NULL;
+    return new_stmt;
+}
+
 static void *init_stmt(stmttype type, int line)
 {
     switch (type) {
@@ -132,6 +152,8 @@ static void *init_stmt(stmttype type, int line)
             return init_stmt_while(line);
         case STMT_FOR:
             return init_stmt_for(line);
+        case STMT_FOR_IN:
+            return init_stmt_for_in(line);
         case STMT_FUNCTION:
             return init_stmt_function(line);
         case STMT_METHOD:
@@ -140,6 +162,8 @@ static void *init_stmt(stmttype type, int line)
             return init_stmt_class(line);
         case STMT_RETURN:
             return init_stmt_return(line);
+        case STMT_YIELD:
+            return init_stmt_yield(line);
     }
     // Should be unreachable
     return NULL;
@@ -155,10 +179,10 @@ static expr_assign *init_expr_assign(void)
     return new_expr;
 }
 
-static expr_binary *init_expr_binary(void)
+static expr_binary *init_expr_binary(exprtype type)
 {
     expr_binary *new_expr = ALLOCATE(expr_binary, 1);
-    new_expr->header.type = EXPR_BINARY;
+    new_expr->header.type = type;
     new_expr->operator = NULL;
     new_expr->left = NULL;
     new_expr->right = NULL;
@@ -247,13 +271,45 @@ static expr_source *init_expr_source(void)
     return new_expr;
 }
 
+static expr_list *init_expr_list(void)
+{
+    expr_list *new_expr = ALLOCATE(expr_list, 1);
+    new_expr->header.type = EXPR_LIST;
+    new_expr->count = 0;
+    new_expr->capacity = 0;
+    new_expr->items = NULL;
+    return new_expr;
+}
+
+static expr_dict *init_expr_dict(void)
+{
+    expr_dict *new_expr = ALLOCATE(expr_dict, 1);
+    new_expr->header.type = EXPR_DICT;
+    new_expr->count = 0;
+    new_expr->capacity = 0;
+    new_expr->keys = NULL;
+    new_expr->values = NULL;
+    return new_expr;
+}
+
+static expr_index *init_expr_index(exprtype type)
+{
+    expr_index *new_expr = ALLOCATE(expr_index, 1);
+    new_expr->header.type = type;
+    new_expr->refobj = NULL;
+    new_expr->index = NULL;
+    new_expr->value = NULL;
+    return new_expr;
+}
+
 static void *init_expr(exprtype type)
 {
     switch (type) {
         case EXPR_ASSIGN:
             return init_expr_assign();
         case EXPR_BINARY:
-            return init_expr_binary();
+        case EXPR_LOGICAL:
+            return init_expr_binary(type);
         case EXPR_GROUPING:
             return init_expr_grouping();
         case EXPR_LITERAL_STRING:
@@ -275,6 +331,13 @@ static void *init_expr(exprtype type)
             return init_expr_method();
         case EXPR_SOURCE:
             return init_expr_source();
+        case EXPR_LIST:
+            return init_expr_list();
+        case EXPR_GET_INDEX:
+        case EXPR_SET_INDEX:
+            return init_expr_index(type);
+        case EXPR_DICT:
+            return init_expr_dict();
     }
     // Not reachable.
     return NULL;
@@ -293,6 +356,7 @@ static void delete_expression(expr *pexpr)
                 break;
             }
             case EXPR_BINARY:
+            case EXPR_LOGICAL:
             {
                 expr_binary *del = (expr_binary*)pexpr;
                 delete_expression(del->left);
@@ -366,6 +430,37 @@ static void delete_expression(expr *pexpr)
                 FREE(expr_source, del);
                 break;
             }
+            case EXPR_LIST:
+            {
+                expr_list *del = (expr_list*)pexpr;
+                for (int i = 0; i < del->count; i++)
+                    delete_expression(del->items[i]);
+                FREE_ARRAY(expr*, del->items, del->capacity);
+                FREE(expr_list, del);
+                break;
+            }
+            case EXPR_DICT:
+            {
+                expr_dict *del = (expr_dict*)pexpr;
+                for (int i = 0; i < del->count; i++) {
+                    delete_expression(del->keys[i]);
+                    delete_expression(del->values[i]);
+                }
+                FREE_ARRAY(expr*, del->keys, del->capacity);
+                FREE_ARRAY(expr*, del->values, del->capacity);
+                FREE(expr_dict, del);
+                break;
+            }
+            case EXPR_GET_INDEX:
+            case EXPR_SET_INDEX:
+            {
+                expr_index *del = (expr_index*)pexpr;
+                delete_expression(del->refobj);
+                delete_expression(del->index);
+                delete_expression(del->value);
+                FREE(expr_index, del);
+                break;
+            }
         }
     }
 }
@@ -417,6 +512,14 @@ static void delete_statements(stmt *pstmt)
                 FREE(stmt_for, del);
                 break;
             }
+            case STMT_FOR_IN:
+            {
+                stmt_for_in *del = (stmt_for_in*)pstmt;
+                delete_expression(del->iterable);
+                delete_statements(del->loopbody);
+                FREE(stmt_for_in, del);
+                break;
+            }
             case STMT_FUNCTION:
             {
                 stmt_function *del = (stmt_function*)pstmt;
@@ -446,6 +549,13 @@ static void delete_statements(stmt *pstmt)
                 FREE(stmt_return, del);
                 break;
             }
+            case STMT_YIELD:
+            {
+                stmt_yield *del = (stmt_yield*)pstmt;
+                delete_expression(del->value);
+                FREE(stmt_yield, del);
+                break;
+            }
         }
     }
 }
@@ -484,6 +594,7 @@ static void synchronize(parser *analyzer)
             case TOKEN_IF:
             case TOKEN_WHILE:
             case TOKEN_RETURN:
+            case TOKEN_YIELD:
                 return;
             default:
                 ;
@@ -534,6 +645,13 @@ static bool check(parser *analyzer, tokentype type)
     return peek(analyzer)->type == type;
 }
 
+static bool check_next(parser *analyzer, tokentype type)
+{
+    if (is_at_end(analyzer))
+        return false;
+    return analyzer->scan.tokens[analyzer->current + 1]->type == type;
+}
+
 static inline token *previous(parser *analyzer)
 {
     return analyzer->scan.tokens[analyzer->current - 1];
@@ -603,6 +721,16 @@ static stmt *get_for_statement(stmt *initializer, stmt *condition,
     return (stmt*)new_stmt;
 }
 
+static stmt *get_for_in_statement(token *name, expr *iterable,
+        stmt *loopbody, int line)
+{
+    stmt_for_in *new_stmt = init_stmt(STMT_FOR_IN, line);
+    new_stmt->name = name;
+    new_stmt->iterable = iterable;
+    new_stmt->loopbody = loopbody;
+    return (stmt*)new_stmt;
+}
+
 static stmt *get_function_statement(token *name, int num_parameters, 
         token **parameters, stmt *body, int line)
 {
@@ -644,6 +772,13 @@ static stmt *get_return_statement(expr *value, int line)
     return (stmt*)new_stmt;
 }
 
+static stmt *get_yield_statement(expr *value, int line)
+{
+    stmt_yield *new_stmt = init_stmt(STMT_YIELD, line);
+    new_stmt->value = value;
+    return (stmt*)new_stmt;
+}
+
 static expr *get_assign_expr(expr *assign_expr, expr *value)
 {
     expr_var *var_expr = (expr_var*)assign_expr;
@@ -663,6 +798,15 @@ static expr *get_binary_expr(token *operator, expr *left, expr *right)
     return (expr*)new_expr;
 }
 
+static expr *get_logical_expr(token *operator, expr *left, expr *right)
+{
+    expr_binary *new_expr = init_expr(EXPR_LOGICAL);
+    new_expr->left = left;
+    new_expr->right = right;
+    new_expr->operator = operator;
+    return (expr*)new_expr;
+}
+
 static expr *get_grouping_expr(expr *group_expr)
 {
     expr_grouping *new_expr = init_expr(EXPR_GROUPING);
@@ -732,6 +876,37 @@ static expr *get_setproperty_expr(parser *analyzer, token *name,
     return (expr*)new_expr;
 }
 
+static expr *get_list_expr(parser *analyzer, expr **items, int count,
+        int capacity)
+{
+    expr_list *new_expr = init_expr(EXPR_LIST);
+    new_expr->items = items;
+    new_expr->count = count;
+    new_expr->capacity = capacity;
+    return (expr*)new_expr;
+}
+
+static expr *get_dict_expr(parser *analyzer, expr **keys, expr **values,
+        int count, int capacity)
+{
+    expr_dict *new_expr = init_expr(EXPR_DICT);
+    new_expr->keys = keys;
+    new_expr->values = values;
+    new_expr->count = count;
+    new_expr->capacity = capacity;
+    return (expr*)new_expr;
+}
+
+static expr *get_index_expr(parser *analyzer, expr *refobj, expr *index, 
+        expr *value)
+{
+    expr_index *new_expr = init_expr(value ? EXPR_SET_INDEX : EXPR_GET_INDEX);
+    new_expr->refobj = refobj;
+    new_expr->index = index;
+    new_expr->value = value;
+    return (expr*)new_expr;
+}
+
 static expr *get_source_expr(parser *analyzer, token *source_name)
 {
     expr_source *new_expr = init_expr(EXPR_SOURCE);
@@ -739,6 +914,58 @@ static expr *get_source_expr(parser *analyzer, token *source_name)
     return (expr*)new_expr;
 }
 
+static expr *list(parser *analyzer)
+{
+#ifdef DEBUG_ARI_PARSER
+    printf("list()\n");
+#endif
+    int i = 0;
+    int oldcapacity = 0;
+    int capacity = GROW_CAPACITY(0);
+    expr **items = ALLOCATE(expr*, capacity);
+
+    if (!check(analyzer, TOKEN_RIGHT_BRACKET)) {
+        do {
+            if (i > capacity - 1) {
+                oldcapacity = capacity;
+                capacity = GROW_CAPACITY(capacity);
+                items = GROW_ARRAY(items, expr*, oldcapacity, capacity);
+            }
+            items[i++] = expression(analyzer);
+        } while (match(analyzer, TOKEN_COMMA));
+    }
+    consume(analyzer, TOKEN_RIGHT_BRACKET, "Expect ']' after list items.");
+    return get_list_expr(analyzer, items, i, capacity);
+}
+
+static expr *dict(parser *analyzer)
+{
+#ifdef DEBUG_ARI_PARSER
+    printf("dict()\n");
+#endif
+    int i = 0;
+    int oldcapacity = 0;
+    int capacity = GROW_CAPACITY(0);
+    expr **keys = ALLOCATE(expr*, capacity);
+    expr **values = ALLOCATE(expr*, capacity);
+
+    if (!check(analyzer, TOKEN_RIGHT_BRACE)) {
+        do {
+            if (i > capacity - 1) {
+                oldcapacity = capacity;
+                capacity = GROW_CAPACITY(capacity);
+                keys = GROW_ARRAY(keys, expr*, oldcapacity, capacity);
+                values = GROW_ARRAY(values, expr*, oldcapacity, capacity);
+            }
+            keys[i] = expression(analyzer);
+            consume(analyzer, TOKEN_COLON, "Expect ':' after dict key.");
+            values[i++] = expression(analyzer);
+        } while (match(analyzer, TOKEN_COMMA));
+    }
+    consume(analyzer, TOKEN_RIGHT_BRACE, "Expect '}' after dict items.");
+    return get_dict_expr(analyzer, keys, values, i, capacity);
+}
+
 static expr *primary(parser *analyzer)
 {
 #ifdef DEBUG_ARI_PARSER
@@ -786,6 +1013,10 @@ static expr *primary(parser *analyzer)
         consume(analyzer, TOKEN_RIGHT_PAREN, "Expect ')' after expression.");
         return get_grouping_expr(new_expr);
     }
+    if (match(analyzer, TOKEN_LEFT_BRACKET))
+        return list(analyzer);
+    if (match(analyzer, TOKEN_LEFT_BRACE))
+        return dict(analyzer);
 
     error(analyzer, "Expect expression.");
     return NULL;
@@ -835,6 +1066,21 @@ static expr *dot(parser *analyzer, expr *refobj)
     return get_property(analyzer, name, refobj);
 }
 
+static expr *subscript(parser *analyzer, expr *refobj)
+{
+#ifdef DEBUG_ARI_PARSER
+    printf("subscript()\n");
+#endif
+    expr *index = expression(analyzer);
+    consume(analyzer, TOKEN_RIGHT_BRACKET, "Expect ']' after index.");
+
+    if (match(analyzer, TOKEN_EQUAL)) {
+        expr *value = expression(analyzer);
+        return get_index_expr(analyzer, refobj, index, value);
+    }
+    return get_index_expr(analyzer, refobj, index, NULL);
+}
+
 static expr *finish_call(parser *analyzer, expr *callee, bool is_method)
 {
 #ifdef DEBUG_ARI_PARSER
@@ -879,6 +1125,8 @@ static expr *call(parser *analyzer)
             new_expr = finish_call(analyzer, new_expr, false);
         else if (match(analyzer, TOKEN_DOT))
             new_expr = dot(analyzer, new_expr);
+        else if (match(analyzer, TOKEN_LEFT_BRACKET))
+            new_expr = subscript(analyzer, new_expr);
         else
             break;
     }
@@ -965,12 +1213,40 @@ static expr *equality(parser *analyzer)
     return new_expr;
 }
 
+static expr *logic_and(parser *analyzer)
+{
+#ifdef DEBUG_ARI_PARSER
+    printf("logic_and()\n");
+#endif
+    expr *new_expr = equality(analyzer);
+    while (match(analyzer, TOKEN_AND)) {
+        token *opcode = previous(analyzer);
+        expr *right = equality(analyzer);
+        new_expr = get_logical_expr(opcode, new_expr, right);
+    }
+    return new_expr;
+}
+
+static expr *logic_or(parser *analyzer)
+{
+#ifdef DEBUG_ARI_PARSER
+    printf("logic_or()\n");
+#endif
+    expr *new_expr = logic_and(analyzer);
+    while (match(analyzer, TOKEN_OR)) {
+        token *opcode = previous(analyzer);
+        expr *right = logic_and(analyzer);
+        new_expr = get_logical_expr(opcode, new_expr, right);
+    }
+    return new_expr;
+}
+
 static expr* assignment(parser *analyzer)
 {
 #ifdef DEBUG_ARI_PARSER
     printf("assignment()\n");
 #endif
-    expr *new_expr = equality(analyzer);
+    expr *new_expr = logic_or(analyzer);
     if (match(analyzer, TOKEN_EQUAL)) {
         if (!new_expr)
             return NULL;
@@ -1215,6 +1491,15 @@ static stmt *for_statement(parser *analyzer)
     printf("for_statement()\n");
 #endif
     consume(analyzer, TOKEN_LEFT_PAREN, "Expect '(' after 'for'.");
+    if (check(analyzer, TOKEN_IDENTIFIER) && check_next(analyzer, TOKEN_IN)) {
+        token *name = advance(analyzer);
+        advance(analyzer);
+        expr *iterable = expression(analyzer);
+        consume(analyzer, TOKEN_RIGHT_PAREN,
+                "Expect ')' after for iterable.");
+        stmt *loop_body = statement(analyzer);
+        return get_for_in_statement(name, iterable, loop_body, line);
+    }
     stmt *initializer = statement(analyzer);
     stmt *condition = statement(analyzer);
     stmt *iterator = iterator_statement(analyzer);
@@ -1263,6 +1548,20 @@ static stmt *return_statement(parser *analyzer)
     return get_return_statement(value, line);
 }
 
+static stmt *yield_statement(parser *analyzer)
+{
+    int line = source_line(analyzer);
+#ifdef DEBUG_ARI_PARSER
+    printf("yield_statement()\n");
+#endif
+    expr *value = NULL;
+    if (!check(analyzer, TOKEN_SEMICOLON))
+        value = expression(analyzer);
+
+    consume(analyzer, TOKEN_SEMICOLON, "Expect ';' after yield value.");
+    return get_yield_statement(value, line);
+}
+
 static stmt *statement(parser *analyzer)
 {
 #ifdef DEBUG_ARI_PARSER
@@ -1272,6 +1571,8 @@ static stmt *statement(parser *analyzer)
         return for_statement(analyzer);
     if (match(analyzer, TOKEN_RETURN))
         return return_statement(analyzer);
+    if (match(analyzer, TOKEN_YIELD))
+        return yield_statement(analyzer);
     if (match(analyzer, TOKEN_WHILE))
         return while_statement(analyzer);
     if (match(analyzer, TOKEN_IF))
@@ -6,7 +6,7 @@ typedef enum tokentype_t
     // Single-character tokens
     TOKEN_LEFT_PAREN, TOKEN_RIGHT_PAREN, TOKEN_LEFT_BRACE, TOKEN_RIGHT_BRACE,
     TOKEN_LEFT_BRACKET, TOKEN_RIGHT_BRACKET, TOKEN_COMMA, TOKEN_DOT,
-    TOKEN_MINUS, TOKEN_PLUS, TOKEN_SEMICOLON,
+    TOKEN_MINUS, TOKEN_PLUS, TOKEN_SEMICOLON, TOKEN_COLON,
     TOKEN_SLASH, TOKEN_STAR,
 
     // One or two character tokens
@@ -20,8 +20,8 @@ typedef enum tokentype_t
 
     // Keywords
     TOKEN_AND, TOKEN_CLASS, TOKEN_ELSE, TOKEN_FALSE, TOKEN_FUN, TOKEN_FOR,
-    TOKEN_IF, TOKEN_NULL, TOKEN_OR, TOKEN_RETURN, TOKEN_SOURCE, TOKEN_SUPER, 
-    TOKEN_THIS, TOKEN_TRUE, TOKEN_VAR, TOKEN_WHILE,
+    TOKEN_IF, TOKEN_IN, TOKEN_NULL, TOKEN_OR, TOKEN_RETURN, TOKEN_SOURCE, TOKEN_SUPER, 
+    TOKEN_THIS, TOKEN_TRUE, TOKEN_VAR, TOKEN_WHILE, TOKEN_YIELD,
 
     TOKEN_ERROR,
     TOKEN_EOF
@@ -124,9 +124,19 @@ static inline void identifier(scanner *scan)
                               break;
                       }
                   break;
-        case 'i': type = check_keyword(scan, 1, 1, "f", TOKEN_IF); break;
+        case 'i':
+                  if (scan->current - scan->start > 1)
+                      switch (scan->start[1]) {
+                          case 'f':
+                              type = check_keyword(scan, 2, 0, "", TOKEN_IF);
+                              break;
+                          case 'n':
+                              type = check_keyword(scan, 2, 0, "", TOKEN_IN);
+                              break;
+                      }
+                  break;
         case 'n': type = check_keyword(scan, 1, 3, "ull", TOKEN_NULL); break;
-        case 'o': type = check_keyword(scan, 1, 2, "r", TOKEN_OR); break;
+        case 'o': type = check_keyword(scan, 1, 1, "r", TOKEN_OR); break;
         case 'r': type = check_keyword(scan, 1, 5, "eturn", TOKEN_RETURN); break;
         case 's': 
                   if (scan->current - scan->start > 1)
@@ -154,6 +164,7 @@ static inline void identifier(scanner *scan)
                   break;
         case 'v': type = check_keyword(scan, 1, 2, "ar", TOKEN_VAR); break;
         case 'w': type = check_keyword(scan, 1, 4, "hile", TOKEN_WHILE); break;
+        case 'y': type = check_keyword(scan, 1, 4, "ield", TOKEN_YIELD); break;
     }
     add_token(scan, type);
 }
@@ -234,6 +245,7 @@ static void scan_token(scanner *scan)
                         add_token(scan, TOKEN_SLASH);
                     break;
         case ';':   add_token(scan, TOKEN_SEMICOLON); break;
+        case ':':   add_token(scan, TOKEN_COLON); break;
         case '!':
                     add_token(scan, match(scan, '=') 
                             ? TOKEN_BANG_EQUAL: TOKEN_BANG);
@@ -304,6 +316,7 @@ void print_token(token *tok)
         case TOKEN_MINUS: msg = "MINUS"; break;
         case TOKEN_PLUS: msg = "PLUS"; break;
         case TOKEN_SEMICOLON: msg = "SEMICOLON"; break;
+        case TOKEN_COLON: msg = "COLON"; break;
         case TOKEN_SLASH: msg = "SLASH"; break;
         case TOKEN_STAR: msg = "STAR"; break;
         case TOKEN_BANG: msg = "BANG"; break;
@@ -324,6 +337,7 @@ void print_token(token *tok)
         case TOKEN_FUN: msg = "FUN"; break;
         case TOKEN_FOR: msg = "FOR"; break;
         case TOKEN_IF: msg = "IF"; break;
+        case TOKEN_IN: msg = "IN"; break;
         case TOKEN_NULL: msg = "NULL"; break;
         case TOKEN_OR: msg = "OR"; break;
         case TOKEN_RETURN: msg = "RETURN"; break;
@@ -332,6 +346,7 @@ void print_token(token *tok)
         case TOKEN_TRUE: msg = "TRUE"; break;
         case TOKEN_VAR: msg = "VAR"; break;
         case TOKEN_WHILE: msg = "WHILE"; break;
+        case TOKEN_YIELD: msg = "YIELD"; break;
         case TOKEN_EXIT: msg = "EXIT"; break;
         case TOKEN_ERROR: msg = "ERROR"; break;
         case TOKEN_EOF: msg = "EOF"; break;
@@ -0,0 +1,403 @@
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "simd.h"
+
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
+typedef struct
+{
+    double (*sum)(const double *a, size_t n);
+    double (*min)(const double *a, size_t n);
+    double (*max)(const double *a, size_t n);
+    double (*dot)(const double *a, const double *b, size_t n);
+    void (*add)(double *out, const double *a, const double *b, size_t n);
+    void (*mul)(double *out, const double *a, const double *b, size_t n);
+    void (*scale)(double *out, const double *a, double k, size_t n);
+    void (*prefix_sum)(double *out, const double *a, size_t n);
+} simdkernels;
+
+/* Plain loops, which the vector versions also finish their tails with. */
+
+static double sum_scalar(const double *a, size_t n)
+{
+    double total = 0;
+    for (size_t i = 0; i < n; i++)
+        total += a[i];
+    return total;
+}
+
+static double dot_scalar(const double *a, const double *b, size_t n)
+{
+    double total = 0;
+    for (size_t i = 0; i < n; i++)
+        total += a[i] * b[i];
+    return total;
+}
+
+static void add_scalar(double *out, const double *a, const double *b, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        out[i] = a[i] + b[i];
+}
+
+static void mul_scalar(double *out, const double *a, const double *b, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        out[i] = a[i] * b[i];
+}
+
+static void scale_scalar(double *out, const double *a, double k, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        out[i] = a[i] * k;
+}
+
+#ifndef __x86_64__
+static double min_scalar(const double *a, size_t n)
+{
+    double result = a[0];
+    for (size_t i = 1; i < n; i++)
+        if (a[i] < result)
+            result = a[i];
+    return result;
+}
+
+static double max_scalar(const double *a, size_t n)
+{
+    double result = a[0];
+    for (size_t i = 1; i < n; i++)
+        if (a[i] > result)
+            result = a[i];
+    return result;
+}
+
+static void prefix_sum_scalar(double *out, const double *a, size_t n)
+{
+    double total = 0;
+    for (size_t i = 0; i < n; i++) {
+        total += a[i];
+        out[i] = total;
+    }
+}
+
+static const simdkernels scalar_kernels = {
+    sum_scalar, min_scalar, max_scalar, dot_scalar,
+    add_scalar, mul_scalar, scale_scalar, prefix_sum_scalar
+};
+#endif
+
+#ifdef __x86_64__
+
+/* SSE2, which every x86-64 cpu has. Two doubles per register, with two
+ * accumulators for the reductions so consecutive adds don't wait on
+ * each other.
+ */
+
+static double sum_sse2(const double *a, size_t n)
+{
+    __m128d acc0 = _mm_setzero_pd();
+    __m128d acc1 = _mm_setzero_pd();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        acc0 = _mm_add_pd(acc0, _mm_loadu_pd(a + i));
+        acc1 = _mm_add_pd(acc1, _mm_loadu_pd(a + i + 2));
+    }
+    acc0 = _mm_add_pd(acc0, acc1);
+    acc0 = _mm_add_sd(acc0, _mm_unpackhi_pd(acc0, acc0));
+    return _mm_cvtsd_f64(acc0) + sum_scalar(a + i, n - i);
+}
+
+static double min_sse2(const double *a, size_t n)
+{
+    __m128d acc = _mm_set1_pd(a[0]);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2)
+        acc = _mm_min_pd(acc, _mm_loadu_pd(a + i));
+    acc = _mm_min_sd(acc, _mm_unpackhi_pd(acc, acc));
+    double result = _mm_cvtsd_f64(acc);
+    if (i < n && a[i] < result)
+        result = a[i];
+    return result;
+}
+
+static double max_sse2(const double *a, size_t n)
+{
+    __m128d acc = _mm_set1_pd(a[0]);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2)
+        acc = _mm_max_pd(acc, _mm_loadu_pd(a + i));
+    acc = _mm_max_sd(acc, _mm_unpackhi_pd(acc, acc));
+    double result = _mm_cvtsd_f64(acc);
+    if (i < n && a[i] > result)
+        result = a[i];
+    return result;
+}
+
+static double dot_sse2(const double *a, const double *b, size_t n)
+{
+    __m128d acc0 = _mm_setzero_pd();
+    __m128d acc1 = _mm_setzero_pd();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        acc0 = _mm_add_pd(acc0,
+                _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+        acc1 = _mm_add_pd(acc1,
+                _mm_mul_pd(_mm_loadu_pd(a + i + 2), _mm_loadu_pd(b + i + 2)));
+    }
+    acc0 = _mm_add_pd(acc0, acc1);
+    acc0 = _mm_add_sd(acc0, _mm_unpackhi_pd(acc0, acc0));
+    return _mm_cvtsd_f64(acc0) + dot_scalar(a + i, b + i, n - i);
+}
+
+static void add_sse2(double *out, const double *a, const double *b, size_t n)
+{
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2)
+        _mm_storeu_pd(out + i,
+                _mm_add_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+    add_scalar(out + i, a + i, b + i, n - i);
+}
+
+static void mul_sse2(double *out, const double *a, const double *b, size_t n)
+{
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2)
+        _mm_storeu_pd(out + i,
+                _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+    mul_scalar(out + i, a + i, b + i, n - i);
+}
+
+static void scale_sse2(double *out, const double *a, double k, size_t n)
+{
+    __m128d factor = _mm_set1_pd(k);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2)
+        _mm_storeu_pd(out + i, _mm_mul_pd(_mm_loadu_pd(a + i), factor));
+    scale_scalar(out + i, a + i, k, n - i);
+}
+
+/* Each pair becomes [a0, a0 + a1] by adding a copy of itself shifted
+ * up one lane, then the running total carried over from the pairs
+ * before it.
+ */
+static void prefix_sum_sse2(double *out, const double *a, size_t n)
+{
+    __m128d carry = _mm_setzero_pd();
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128d x = _mm_loadu_pd(a + i);
+        x = _mm_add_pd(x,
+                _mm_castsi128_pd(_mm_slli_si128(_mm_castpd_si128(x), 8)));
+        x = _mm_add_pd(x, carry);
+        _mm_storeu_pd(out + i, x);
+        carry = _mm_unpackhi_pd(x, x);
+    }
+    if (i < n)
+        out[i] = a[i] + _mm_cvtsd_f64(carry);
+}
+
+static const simdkernels sse2_kernels = {
+    sum_sse2, min_sse2, max_sse2, dot_sse2,
+    add_sse2, mul_sse2, scale_sse2, prefix_sum_sse2
+};
+
+/* AVX2. Four doubles per register, compiled for the one function at a
+ * time so the rest of the binary still runs on any x86-64 cpu.
+ */
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 static inline double hadd_avx2(__m256d x)
+{
+    __m128d pair = _mm_add_pd(_mm256_castpd256_pd128(x),
+            _mm256_extractf128_pd(x, 1));
+    pair = _mm_add_sd(pair, _mm_unpackhi_pd(pair, pair));
+    return _mm_cvtsd_f64(pair);
+}
+
+AVX2 static double sum_avx2(const double *a, size_t n)
+{
+    __m256d acc0 = _mm256_setzero_pd();
+    __m256d acc1 = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm256_add_pd(acc0, _mm256_loadu_pd(a + i));
+        acc1 = _mm256_add_pd(acc1, _mm256_loadu_pd(a + i + 4));
+    }
+    return hadd_avx2(_mm256_add_pd(acc0, acc1)) + sum_sse2(a + i, n - i);
+}
+
+AVX2 static double min_avx2(const double *a, size_t n)
+{
+    __m256d acc = _mm256_set1_pd(a[0]);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+        acc = _mm256_min_pd(acc, _mm256_loadu_pd(a + i));
+    __m128d pair = _mm_min_pd(_mm256_castpd256_pd128(acc),
+            _mm256_extractf128_pd(acc, 1));
+    pair = _mm_min_sd(pair, _mm_unpackhi_pd(pair, pair));
+    double result = _mm_cvtsd_f64(pair);
+    for (; i < n; i++)
+        if (a[i] < result)
+            result = a[i];
+    return result;
+}
+
+AVX2 static double max_avx2(const double *a, size_t n)
+{
+    __m256d acc = _mm256_set1_pd(a[0]);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+        acc = _mm256_max_pd(acc, _mm256_loadu_pd(a + i));
+    __m128d pair = _mm_max_pd(_mm256_castpd256_pd128(acc),
+            _mm256_extractf128_pd(acc, 1));
+    pair = _mm_max_sd(pair, _mm_unpackhi_pd(pair, pair));
+    double result = _mm_cvtsd_f64(pair);
+    for (; i < n; i++)
+        if (a[i] > result)
+            result = a[i];
+    return result;
+}
+
+AVX2 static double dot_avx2(const double *a, const double *b, size_t n)
+{
+    __m256d acc0 = _mm256_setzero_pd();
+    __m256d acc1 = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm256_add_pd(acc0, _mm256_mul_pd(_mm256_loadu_pd(a + i),
+                    _mm256_loadu_pd(b + i)));
+        acc1 = _mm256_add_pd(acc1, _mm256_mul_pd(_mm256_loadu_pd(a + i + 4),
+                    _mm256_loadu_pd(b + i + 4)));
+    }
+    return hadd_avx2(_mm256_add_pd(acc0, acc1)) +
+        dot_sse2(a + i, b + i, n - i);
+}
+
+AVX2 static void add_avx2(double *out, const double *a, const double *b,
+        size_t n)
+{
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+        _mm256_storeu_pd(out + i,
+                _mm256_add_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+    add_scalar(out + i, a + i, b + i, n - i);
+}
+
+AVX2 static void mul_avx2(double *out, const double *a, const double *b,
+        size_t n)
+{
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+        _mm256_storeu_pd(out + i,
+                _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+    mul_scalar(out + i, a + i, b + i, n - i);
+}
+
+AVX2 static void scale_avx2(double *out, const double *a, double k, size_t n)
+{
+    __m256d factor = _mm256_set1_pd(k);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+        _mm256_storeu_pd(out + i, _mm256_mul_pd(_mm256_loadu_pd(a + i),
+                    factor));
+    scale_scalar(out + i, a + i, k, n - i);
+}
+
+/* The same as the SSE2 version with one more step: shift up one lane
+ * and add, then shift up two lanes and add.
+ */
+AVX2 static void prefix_sum_avx2(double *out, const double *a, size_t n)
+{
+    __m256d zero = _mm256_setzero_pd();
+    __m256d carry = zero;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d x = _mm256_loadu_pd(a + i);
+        // [0, x0, x1, x2]
+        x = _mm256_add_pd(x,
+                _mm256_blend_pd(_mm256_permute4x64_pd(x, 0x90), zero, 0x1));
+        // [0, 0, x0, x1]
+        x = _mm256_add_pd(x,
+                _mm256_blend_pd(_mm256_permute4x64_pd(x, 0x40), zero, 0x3));
+        x = _mm256_add_pd(x, carry);
+        _mm256_storeu_pd(out + i, x);
+        carry = _mm256_permute4x64_pd(x, 0xff);
+    }
+    double total = _mm256_cvtsd_f64(carry);
+    for (; i < n; i++) {
+        total += a[i];
+        out[i] = total;
+    }
+}
+
+static const simdkernels avx2_kernels = {
+    sum_avx2, min_avx2, max_avx2, dot_avx2,
+    add_avx2, mul_avx2, scale_avx2, prefix_sum_avx2
+};
+
+#endif
+
+/* Picked by the first call on any thread. Threads racing to pick them
+ * all pick the same ones, so the pointer only has to be read and written
+ * whole.
+ */
+static const simdkernels *kernels = NULL;
+
+static inline const simdkernels *get_kernels(void)
+{
+    const simdkernels *picked = __atomic_load_n(&kernels, __ATOMIC_ACQUIRE);
+    if (!picked) {
+#ifdef __x86_64__
+        __builtin_cpu_init();
+        picked = __builtin_cpu_supports("avx2") ? &avx2_kernels :
+            &sse2_kernels;
+#else
+        picked = &scalar_kernels;
+#endif
+        __atomic_store_n(&kernels, picked, __ATOMIC_RELEASE);
+    }
+    return picked;
+}
+
+double simd_sum(const double *a, size_t n)
+{
+    return get_kernels()->sum(a, n);
+}
+
+double simd_min(const double *a, size_t n)
+{
+    return get_kernels()->min(a, n);
+}
+
+double simd_max(const double *a, size_t n)
+{
+    return get_kernels()->max(a, n);
+}
+
+double simd_dot(const double *a, const double *b, size_t n)
+{
+    return get_kernels()->dot(a, b, n);
+}
+
+void simd_add(double *out, const double *a, const double *b, size_t n)
+{
+    get_kernels()->add(out, a, b, n);
+}
+
+void simd_mul(double *out, const double *a, const double *b, size_t n)
+{
+    get_kernels()->mul(out, a, b, n);
+}
+
+void simd_scale(double *out, const double *a, double k, size_t n)
+{
+    get_kernels()->scale(out, a, k, n);
+}
+
+void simd_prefix_sum(double *out, const double *a, size_t n)
+{
+    get_kernels()->prefix_sum(out, a, n);
+}
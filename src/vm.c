@@ -7,11 +7,19 @@
 #include "compiler.h"
 #include "debug.h"
 #include "error.h"
+#include "eventloop.h"
 #include "instruct.h"
 #include "frame.h"
+#include "jit.h"
 #include "memory.h"
+#include "objarray.h"
 #include "objclass.h"
 #include "objcode.h"
+#include "objdict.h"
+#include "objfile.h"
+#include "objgen.h"
+#include "objiter.h"
+#include "objlist.h"
 #include "objstack.h"
 #include "opcode.h"
 #include "token.h"
@@ -25,12 +33,39 @@ void vm_push_frame(VM *vm, frame *newframe)
     vm->framestackpos++;
 }
 
+/* Adhoc frames for blocks and recursive calls come from the pool when
+ * it has any, which saves allocating a frame and its hash table.
+ */
+static frame *vm_new_frame(VM *vm)
+{
+    frame *newframe = vm->framepool;
+    if (newframe) {
+        vm->framepool = newframe->next;
+        vm->poolsize--;
+    }
+    else {
+        newframe = ALLOCATE(frame, 1);
+        init_frame(newframe);
+    }
+    newframe->next = NULL;
+    newframe->is_adhoc = true;
+    return newframe;
+}
+
 int vm_pop_frame(VM *vm)
 {
     frame* popped = pop_frame(&vm->top);
     int current = popped->pc;
     popped->pc = 0;
-    if (popped->is_adhoc) {
+    if (popped->is_adhoc && vm->poolsize < FRAME_POOL_MAX) {
+        objhash_clear(&popped->locals);
+        popped->is_block = false;
+        popped->name = NULL;
+        popped->next = vm->framepool;
+        vm->framepool = popped;
+        vm->poolsize++;
+    }
+    else if (popped->is_adhoc) {
         reset_frame(popped);
         FREE(frame, popped);
     }
@@ -38,6 +73,13 @@ int vm_pop_frame(VM *vm)
     return current;
 }
 
+// Leaving a function leaves the frames of the blocks it is in as well
+static inline void pop_block_frames(VM *vm)
+{
+    while (vm->top->is_block)
+        vm_pop_frame(vm);
+}
+
 static inline void advance(frame *currentframe)
 {
     currentframe->pc++;
@@ -61,7 +103,7 @@ static void construct_primstring(objprim *primobj, char *_string_)
 }
 
 
-static void vm_add_object(VM *vm, object *obj)
+void vm_add_object(VM *vm, object *obj)
 {
     if (has_been_added(obj))
         return;
@@ -72,6 +114,33 @@ static void vm_add_object(VM *vm, object *obj)
     obj->accounted = true;
 }
 
+static inline object *vm_bool(VM *vm, bool truth)
+{
+    return truth ? vm->trueobj : vm->falseobj;
+}
+
+static inline object *vm_int(VM *vm, int64_t number)
+{
+    if (number >= SMALLNUM_MIN && number <= SMALLNUM_MAX)
+        return (object*)&vm->smallints[number - SMALLNUM_MIN];
+    objprim *prim = create_new_primitive(PRIM_INT);
+    PRIM_AS_INT(prim) = number;
+    vm_add_object(vm, (object*)prim);
+    return (object*)prim;
+}
+
+static inline object *vm_double(VM *vm, double number)
+{
+    // -0.0 prints differently from 0.0, so it isn't shared
+    if (number >= SMALLNUM_MIN && number <= SMALLNUM_MAX &&
+            number == (int)number && !(number == 0 && signbit(number)))
+        return (object*)&vm->smalldoubles[(int)number - SMALLNUM_MIN];
+    objprim *prim = create_new_primitive(PRIM_DOUBLE);
+    PRIM_AS_DOUBLE(prim) = number;
+    vm_add_object(vm, (object*)prim);
+    return (object*)prim;
+}
+
 static inline void delete_value(value *val, valtype type)
 {
     if (type == VAL_STRING)
@@ -83,50 +152,118 @@ static inline void set_name(frame *localframe, primstring *name, object *val)
     objhash_set(&localframe->locals, name, val);
 }
 
-static inline object *get_name(frame *localframe, char *name)
+static inline object *find_name(frame *localframe, primstring *name)
 {
     frame *current = localframe;
     object *obj = NULL;
-    primstring *pname = create_primstring(name);
     do {
-        obj = objhash_get(&current->locals, pname);
+        obj = objhash_get(&current->locals, name);
         current = current->next;
     } while ((!obj) && (current));
-    free_primstring(pname);
     return obj;
 }
 
-static void call_function(VM *vm, object *obj, int argcount, object **arguments)
+// The object depth places down from the top of the stack, or NULL
+static inline object *stack_object(objstack *stack, int depth)
 {
-    objcode *funcobj = (objcode*)obj;
-    frame *localframe = NULL;
+    objnode *node = stack->top;
+    for (int i = 0; i < depth && node; i++)
+        node = node->next;
+    return node ? node->obj : NULL;
+}
 
-    if (funcobj->depth == 0) {
-        vm_add_object(vm, (object*)funcobj);
-        localframe = &funcobj->localframe;
-    }
-    else {
-        localframe = ALLOCATE(frame, 1);
-        init_frame(localframe);
-        localframe->is_adhoc = true;
-    }
-    vm_push_frame(vm, localframe);
+static inline object *get_name(frame *localframe, char *name)
+{
+    primstring *pname = create_primstring(name);
+    object *obj = find_name(localframe, pname);
+    free_primstring(pname);
+    return obj;
+}
 
+static void bind_arguments(frame *localframe, objcode *funcobj, int argcount,
+        object **arguments)
+{
     for (int k = 0, i = argcount - 1; k < argcount; k++) {
 #ifdef DEBUG_ARI
         printf("   \tcode object argument %d: %s\n", k + 1,
                 PRIM_AS_RAWSTRING(funcobj->arguments[k]));
 #endif
-        set_name(vm->top,
+        set_name(localframe,
                 PRIM_AS_STRING(funcobj->arguments[k]),
                 arguments[i--]);
     }
 #ifdef DEBUG_ARI
     printf("\n");
 #endif
+}
+
+/* Calling a function that yields runs none of it. The arguments are bound
+ * in a frame of the generator's own, which it runs in once resumed.
+ */
+static void start_generator(VM *vm, objcode *funcobj, int argcount,
+        object **arguments)
+{
+    frame *localframe = ALLOCATE(frame, 1);
+    init_frame(localframe);
+    localframe->is_adhoc = true;
+    bind_arguments(localframe, funcobj, argcount, arguments);
+
+    objgen *gen = init_objgen(funcobj, localframe);
+    vm_add_object(vm, (object*)gen);
+    push_objstack(&vm->evalstack, (object*)gen);
+    advance(vm->top);
+}
+
+// Pushes the frame the function runs in, with the arguments bound in it
+static void enter_function(VM *vm, objcode *funcobj, int argcount,
+        object **arguments)
+{
+    frame *localframe = NULL;
+    if (funcobj->depth == 0) {
+        vm_add_object(vm, (object*)funcobj);
+        localframe = &funcobj->localframe;
+    }
+    else
+        localframe = vm_new_frame(vm);
+    vm_push_frame(vm, localframe);
+    bind_arguments(vm->top, funcobj, argcount, arguments);
     funcobj->depth++;
     funcobj->instructs.current = 0;
+}
+
+static intrpstate run(VM *vm, instruct *instructs, tracerecorder *callee);
+
+static void call_function(VM *vm, object *obj, int argcount, object **arguments)
+{
+    objcode *funcobj = (objcode*)obj;
+
+    if (is_generator(funcobj)) {
+        start_generator(vm, funcobj, argcount, arguments);
+        return;
+    }
+    enter_function(vm, funcobj, argcount, arguments);
+#ifdef ARI_JIT
+    /* A small function called from a loop being recorded is recorded as
+     * part of the loop's trace. Calls below it are left out.
+     */
+    tracerecorder *recorder = vm->recorder;
+    vm->recorder = NULL;
+    if (recorder && start_trace_call(recorder, funcobj, argcount)) {
+        run(vm, &funcobj->instructs, recorder);
+        end_trace_call(recorder);
+    }
+    else {
+        if (jit_enabled && ++funcobj->calls == JIT_CALL_THRESHOLD)
+            jit_compile(&funcobj->instructs);
+        if (funcobj->instructs.jitcode)
+            jit_execute(vm, &funcobj->instructs);
+        else
+            execute(vm, &funcobj->instructs);
+    }
+    vm->recorder = recorder;
+#else
     execute(vm, &funcobj->instructs);
+#endif
     funcobj->depth--;
 }
 
@@ -150,10 +287,9 @@ static void create_new_instance(VM *vm, object *obj, int argcount, object **argu
 
 static inline void op_push_frame(VM *vm)
 {
-    frame *newframe = ALLOCATE(frame, 1);
-    init_frame(newframe);
+    frame *newframe = vm_new_frame(vm);
     newframe->pc = vm->top->pc;
-    newframe->is_adhoc = true;
+    newframe->is_block = true;
     vm_push_frame(vm, newframe);
     advance(vm->top);
 }
@@ -183,7 +319,7 @@ static inline void op_jmp_false(VM *vm, int jump, objprim *condition)
         vm->top->pc = jump;
 }
 
-static inline void op_load_constant(VM *vm, int line, int type, value *constant)
+static object *load_constant(VM *vm, int line, int type, value *constant)
 {
     objstack *stack = &vm->evalstack;
 
@@ -192,34 +328,78 @@ static inline void op_load_constant(VM *vm, int line, int type, value *constant)
         case VAL_EMPTY: 
         {
             runtime_error(vm, stack, line, "No object found.");
-            return;
+            return NULL;
         }
         case VAL_BOOL:
-            prim = create_new_primitive(PRIM_BOOL);
-            PRIM_AS_BOOL(prim) = VAL_AS_BOOL(constant);
-            break;
+            return vm_bool(vm, VAL_AS_BOOL(constant));
         case VAL_DOUBLE:
-            prim = create_new_primitive(PRIM_DOUBLE);
-            PRIM_AS_DOUBLE(prim) = VAL_AS_DOUBLE(constant);
-            break;
+            return vm_double(vm, VAL_AS_DOUBLE(constant));
+        case VAL_LONG:
+            return vm_int(vm, VAL_AS_LONG(constant));
         case VAL_STRING:
             prim = create_new_primitive(PRIM_STRING);
             construct_primstring(prim, VAL_AS_STRING(constant));
             break;
         case VAL_NULL:
-            prim = create_new_primitive(PRIM_NULL);
-            PRIM_AS_NULL(prim) = VAL_AS_NULL(constant);
-            break;
+            return vm->nullobj;
         default:
         {
             runtime_error(vm, stack, line,
                     "Cannot load non-constant value.");
-            return;
+            return NULL;
         }
     }
     object *obj = (object*)prim;
     vm_add_object(vm, obj);
-    push_objstack(stack, obj);
+    return obj;
+}
+
+/* What 'and', 'or' and '!' take as false: false, null, zero and the
+ * empty string. Everything else is true.
+ */
+static inline bool is_truthy(object *obj)
+{
+    if (!obj)
+        return false;
+    if (!OBJ_IS_PRIMITIVE(obj))
+        return true;
+    objprim *prim = (objprim*)obj;
+    switch (prim->ptype) {
+        case PRIM_BOOL:     return PRIM_AS_BOOL(prim);
+        case PRIM_NULL:     return false;
+        case PRIM_INT:      return PRIM_AS_INT(prim) != 0;
+        case PRIM_DOUBLE:   return PRIM_AS_DOUBLE(prim) != 0;
+        case PRIM_STRING:   return PRIM_AS_STRING(prim)->length != 0;
+        default:            return true;
+    }
+}
+
+// The value stays on the stack if the jump is taken, and is popped if not
+static inline void op_jmp_keep(VM *vm, int jump, bool when)
+{
+    objstack *stack = &vm->evalstack;
+    if (is_truthy(peek_objstack(stack)) == when)
+        vm->top->pc = jump;
+    else {
+        pop_objstack(stack);
+        advance(vm->top);
+    }
+}
+
+static inline void op_not(VM *vm)
+{
+    objstack *stack = &vm->evalstack;
+    object *obj = pop_objstack(stack);
+    push_objstack(stack, is_truthy(obj) ? vm->falseobj : vm->trueobj);
+    advance(vm->top);
+}
+
+static inline void op_load_constant(VM *vm, int line, int type, value *constant)
+{
+    object *obj = load_constant(vm, line, type, constant);
+    if (!obj)
+        return;
+    push_objstack(&vm->evalstack, obj);
     advance(vm->top);
 }
 
@@ -240,18 +420,10 @@ static inline void op_load_method(VM *vm)
     advance(vm->top);
 }
 
-static inline void op_call_function(VM *vm, int line, int argcount)
+static void call_object(VM *vm, int line, object *popped, int argcount,
+        object **arguments)
 {
-    objstack *stack = &vm->evalstack; 
-    object **arguments = ALLOCATE(object*, argcount + 1);
-#ifdef DEBUG_ARI
-    printf("\n");
-#endif
-    for (int i = 0; i < argcount; ++i) 
-        arguments[i] = pop_objstack(stack);
-    
-    object *popped = pop_objstack(stack);
-
+    objstack *stack = &vm->evalstack;
     if (!popped) {
         runtime_error(vm, &vm->evalstack, line,
                 "CallError: object is not callable");
@@ -264,9 +436,15 @@ static inline void op_call_function(VM *vm, int line, int argcount)
         call_function(vm, popped, argcount, arguments);
     else if (OBJ_IS_BUILTIN(popped)) {
         object *obj = call_builtin(vm, popped, argcount, arguments);
+        if (vm->haderror) {
+            FREE(object*, arguments);
+            return;
+        }
         advance(vm->top);
-        if (obj)
+        if (obj) {
+            vm_add_object(vm, obj);
             push_objstack(stack, obj);
+        }
     }
     else {
         runtime_error(vm, &vm->evalstack, line,
@@ -276,6 +454,54 @@ static inline void op_call_function(VM *vm, int line, int argcount)
     FREE(object*, arguments);
 }
 
+static bool inline_call(VM *vm, object *callee, int argcount, bool method);
+
+static inline void op_call_function(VM *vm, int line, int argcount)
+{
+    objstack *stack = &vm->evalstack; 
+    if (inline_call(vm, stack_object(stack, argcount), argcount, false))
+        return;
+    object **arguments = ALLOCATE(object*, argcount + 1);
+#ifdef DEBUG_ARI
+    printf("\n");
+#endif
+    for (int i = 0; i < argcount; ++i) 
+        arguments[i] = pop_objstack(stack);
+    
+    object *popped = pop_objstack(stack);
+    call_object(vm, line, popped, argcount, arguments);
+}
+
+/* When the callee is the function being run, the frames of the blocks
+ * the call is in are dropped, its arguments are bound in its own frame
+ * and the body starts over, instead of recursing. Other callees get an
+ * ordinary call, and the RETURN after the TAIL_CALL returns their result.
+ */
+static inline void op_tail_call(VM *vm, instruct *instructs, int line,
+        int argcount)
+{
+    objstack *stack = &vm->evalstack;
+    if (inline_call(vm, stack_object(stack, argcount), argcount, false))
+        return;
+    object **arguments = ALLOCATE(object*, argcount + 1);
+    for (int i = 0; i < argcount; ++i)
+        arguments[i] = pop_objstack(stack);
+
+    object *popped = pop_objstack(stack);
+    objcode *funcobj = (objcode*)popped;
+    if (!popped || !OBJ_IS_CODE(popped) || &funcobj->instructs != instructs ||
+            !vm->top->next || funcobj->argcount != (size_t)argcount ||
+            is_generator(funcobj)) {
+        call_object(vm, line, popped, argcount, arguments);
+        return;
+    }
+
+    pop_block_frames(vm);
+    bind_arguments(vm->top, funcobj, argcount, arguments);
+    FREE(object*, arguments);
+    vm->top->pc = 0;
+}
+
 static inline void op_make_function(VM *vm, value *operand)
 {
     object *func = VAL_AS_OBJECT(operand);
@@ -291,8 +517,44 @@ static inline void op_make_class(VM *vm, value *operand)
     push_objstack(&vm->evalstack, VAL_AS_OBJECT(operand));
 }
 
+/* Runs a CALL_METHOD of a method whose body is 'return this.name;'
+ * without calling it: the property is read from the instance in the
+ * object register and replaces the method on the stack. Returns false,
+ * leaving everything as it was, for any other method or an instance
+ * without the property, and the method is called as usual.
+ */
+static bool inline_getter(VM *vm, object *method)
+{
+    object *receiver = vm->objregister;
+    if (!method || !OBJ_IS_CODE(method) || !receiver ||
+            !OBJ_IS_INSTANCE(receiver))
+        return false;
+    primstring *name = getter_property((objcode*)method);
+    if (!name)
+        return false;
+
+    objinstance *instobj = (objinstance*)receiver;
+    object *prop = objhash_get(instobj->header.__attrs__, name);
+    if (!prop)
+        prop = objhash_get(instobj->class->header.__attrs__, name);
+    if (!prop)
+        return false;
+
+    vm_add_object(vm, method);
+    pop_objstack(&vm->evalstack);
+    push_objstack(&vm->evalstack, prop);
+    advance(vm->top);
+    return true;
+}
+
 static inline void op_call_method(VM *vm, int argcount)
 {
+    if (argcount == 1 && inline_getter(vm, peek_objstack(&vm->evalstack)))
+        return;
+    if (inline_call(vm, stack_object(&vm->evalstack, argcount - 1), argcount,
+                true))
+        return;
+
     object **arguments = ALLOCATE(object*, argcount);
     
     int i = 0;
@@ -302,7 +564,6 @@ static inline void op_call_method(VM *vm, int argcount)
     arguments[i] = vm->objregister;
     object *popped = pop_objstack(&vm->evalstack);
     call_function(vm, popped, argcount, arguments);
-    advance(vm->top);
 }
 
 static inline void op_make_method(VM *vm, value *operand)
@@ -311,12 +572,11 @@ static inline void op_make_method(VM *vm, value *operand)
     advance(vm->top);
 }
 
-static inline void op_get_property(VM *vm, int line, char *getname)
+static bool get_property(VM *vm, int line, object *obj, char *getname)
 {
     objstack *stack = &vm->evalstack;
     
     // Store instance in object register
-    object *obj = pop_objstack(stack);
     vm->objregister = obj;
 
     primstring *name = create_primstring(getname);
@@ -331,7 +591,8 @@ static inline void op_get_property(VM *vm, int line, char *getname)
             else {
                 runtime_error_loadname(vm, 
                         PRIMSTRING_AS_RAWSTRING(name), line);
-                return;
+                free_primstring(name);
+                return false;
             }
             break;
         }
@@ -348,7 +609,8 @@ static inline void op_get_property(VM *vm, int line, char *getname)
             if (!prop) {
                 runtime_error_loadname(vm, 
                         PRIMSTRING_AS_RAWSTRING(name), line);
-                return;
+                free_primstring(name);
+                return false;
             }
             push_objstack(stack, prop);
             break;
@@ -357,17 +619,25 @@ static inline void op_get_property(VM *vm, int line, char *getname)
         {
             runtime_error(vm, stack, line,
                 "Invalid Operation: object has no attributes.");
-            return;
+            free_primstring(name);
+            return false;
         }
     }
-    advance(vm->top);
+    free_primstring(name);
+    return true;
 }
 
-static inline void op_set_property(VM *vm, int line, char *setname)
+static inline void op_get_property(VM *vm, int line, char *getname)
+{
+    object *obj = pop_objstack(&vm->evalstack);
+    if (get_property(vm, line, obj, getname))
+        advance(vm->top);
+}
+
+static bool set_property(VM *vm, int line, object *obj, char *setname)
 {
     objstack *stack = &vm->evalstack;
 
-    object *obj = pop_objstack(&vm->evalstack);
     primstring *name = create_primstring(setname);
     object *val = pop_objstack(&vm->evalstack);
     switch (obj->type) {
@@ -389,8 +659,159 @@ static inline void op_set_property(VM *vm, int line, char *setname)
             sprintf(msg, "Error: object has no attribute %s.",
                     PRIMSTRING_AS_RAWSTRING(name));
             runtime_error(vm, stack, line, msg);
+            free_primstring(name);
+            return false;
+        }
+    }
+    free_primstring(name);
+    return true;
+}
+
+static inline void op_set_property(VM *vm, int line, char *setname)
+{
+    object *obj = pop_objstack(&vm->evalstack);
+    if (set_property(vm, line, obj, setname))
+        advance(vm->top);
+}
+
+static inline void op_build_list(VM *vm, int count)
+{
+    objlist *listobj = init_objlist(count);
+    listobj->count = count;
+    for (int i = count - 1; i >= 0; i--)
+        listobj->items[i] = pop_objstack(&vm->evalstack);
+    object *obj = (object*)listobj;
+    vm_add_object(vm, obj);
+    push_objstack(&vm->evalstack, obj);
+    advance(vm->top);
+}
+
+static inline bool check_key(VM *vm, int line, object *key)
+{
+    if (objdict_valid_key(key))
+        return true;
+    runtime_error(vm, &vm->evalstack, line,
+            "TypeError: dict keys must be strings or numbers");
+    return false;
+}
+
+static inline void op_build_dict(VM *vm, int line, int count)
+{
+    /* Keys and values were pushed in pairs, in order */
+    object **items = ALLOCATE(object*, count * 2);
+    for (int i = count * 2 - 1; i >= 0; i--)
+        items[i] = pop_objstack(&vm->evalstack);
+
+    objdict *dict = init_objdict();
+    object *obj = (object*)dict;
+    vm_add_object(vm, obj);
+    for (int i = 0; i < count; i++) {
+        if (!check_key(vm, line, items[i * 2])) {
+            FREE_ARRAY(object*, items, count * 2);
+            return;
+        }
+        objdict_set(dict, items[i * 2], items[i * 2 + 1]);
+    }
+    FREE_ARRAY(object*, items, count * 2);
+    push_objstack(&vm->evalstack, obj);
+    advance(vm->top);
+}
+
+/* Finds the position an INDEX_GET or INDEX_SET refers to in a list or
+ * float64array. The index has to be a whole number inside it.
+ */
+static bool find_position(VM *vm, int line, object *obj, object *index,
+        int *position)
+{
+    int count = 0;
+    if (obj && OBJ_IS_LIST(obj))
+        count = ((objlist*)obj)->count;
+    else if (obj && OBJ_IS_FLOAT64ARRAY(obj))
+        count = ((objarray*)obj)->count;
+    else {
+        runtime_error(vm, &vm->evalstack, line,
+                "TypeError: object is not subscriptable");
+        return false;
+    }
+    objprim *prim = (objprim*)index;
+    if (!prim || !OBJ_IS_PRIMITIVE(index) || !PRIM_IS_NUMBER(prim)) {
+        runtime_error(vm, &vm->evalstack, line,
+                "TypeError: index must be a number");
+        return false;
+    }
+    if (prim->ptype == PRIM_INT) {
+        if (PRIM_AS_INT(prim) < 0 || PRIM_AS_INT(prim) >= count) {
+            runtime_error(vm, &vm->evalstack, line,
+                    "IndexError: index out of range");
+            return false;
+        }
+        *position = (int)PRIM_AS_INT(prim);
+        return true;
+    }
+    double number = PRIM_AS_DOUBLE(prim);
+    if (number < 0 || number >= count || number != (int)number) {
+        runtime_error(vm, &vm->evalstack, line,
+                "IndexError: index out of range");
+        return false;
+    }
+    *position = (int)number;
+    return true;
+}
+
+static inline void op_index_get(VM *vm, int line)
+{
+    object *index = pop_objstack(&vm->evalstack);
+    object *obj = pop_objstack(&vm->evalstack);
+    if (obj && OBJ_IS_DICT(obj)) {
+        if (!check_key(vm, line, index))
+            return;
+        object *found = objdict_get((objdict*)obj, index);
+        if (!found) {
+            runtime_error(vm, &vm->evalstack, line,
+                    "KeyError: key not found");
+            return;
+        }
+        push_objstack(&vm->evalstack, found);
+        advance(vm->top);
+        return;
+    }
+    int position = 0;
+    if (!find_position(vm, line, obj, index, &position))
+        return;
+    object *item = NULL;
+    if (OBJ_IS_LIST(obj))
+        item = ((objlist*)obj)->items[position];
+    else
+        item = vm_double(vm, ((objarray*)obj)->data[position]);
+    push_objstack(&vm->evalstack, item);
+    advance(vm->top);
+}
+
+static inline void op_index_set(VM *vm, int line)
+{
+    object *index = pop_objstack(&vm->evalstack);
+    object *obj = pop_objstack(&vm->evalstack);
+    object *val = pop_objstack(&vm->evalstack);
+    if (obj && OBJ_IS_DICT(obj)) {
+        if (!check_key(vm, line, index))
+            return;
+        objdict_set((objdict*)obj, index, val);
+        advance(vm->top);
+        return;
+    }
+    int position = 0;
+    if (!find_position(vm, line, obj, index, &position))
+        return;
+    if (OBJ_IS_LIST(obj))
+        ((objlist*)obj)->items[position] = val;
+    else {
+        objprim *prim = (objprim*)val;
+        if (!prim || !OBJ_IS_PRIMITIVE(val) || !PRIM_IS_NUMBER(prim)) {
+            runtime_error(vm, &vm->evalstack, line,
+                    "TypeError: float64array items must be numbers");
             return;
         }
+        ((objarray*)obj)->data[position] = PRIM_NUMBER_AS_DOUBLE(prim);
     }
     advance(vm->top);
 }
@@ -406,6 +827,16 @@ static inline void op_store_name(VM *vm, char *name)
     object *obj = pop_objstack(&vm->evalstack);
     primstring *pname = create_primstring(name);
     set_name(vm->top, pname, obj);
+    free_primstring(pname);
+    advance(vm->top);
+}
+
+static inline void op_store_name_keep(VM *vm, char *name)
+{
+    object *obj = peek_objstack(&vm->evalstack);
+    primstring *pname = create_primstring(name);
+    set_name(vm->top, pname, obj);
+    free_primstring(pname);
     advance(vm->top);
 }
 
@@ -420,26 +851,19 @@ static inline void op_compare(VM *vm, int line, int cmptype)
         return;
     }
 
-    object *obj = binary_comp(a, b, cmptype);
-    
-    vm_add_object(vm, obj);
-    push_objstack(&vm->evalstack, obj);
+    push_objstack(&vm->evalstack, vm_bool(vm, binary_comp(a, b, cmptype)));
     advance(vm->top);
 }
 
-static inline void op_binary_add(VM *vm, int line)
+static object *binary_add(VM *vm, int line, object *a, object *b)
 {
-    objstack *stack = &vm->evalstack;
-
-    object *b = pop_objstack(stack);
-    object *a = pop_objstack(stack);
     object *c = NULL;
 
     if (!a->__add__)
         if (!b->__add__) {
             runtime_error_unsupported_operation(vm, line,
                     '+');
-            return;
+            return NULL;
         }
         else
             c = b->__add__(a, b);
@@ -449,12 +873,25 @@ static inline void op_binary_add(VM *vm, int line)
     if (!c) {
         runtime_error_unsupported_operation(vm,
                 line, '+');
-        return;
+        return NULL;
     }
 
     vm_add_object(vm, c);
-    push_objstack(stack, c);
-    advance(vm->top);
+    return c;
+}
+
+static inline void op_binary_add(VM *vm, int line)
+{
+    objstack *stack = &vm->evalstack;
+
+    object *b = pop_objstack(stack);
+    object *a = pop_objstack(stack);
+    object *c = binary_add(vm, line, a, b);
+    if (!c)
+        return;
+
+    push_objstack(stack, c);
+    advance(vm->top);
 }
 
 static inline void op_binary_sub(VM *vm, int line)
@@ -551,32 +988,20 @@ static inline void op_negate(VM *vm, int line)
 {
     objstack *stack = &vm->evalstack;
 
-    objprim *prim = create_new_primitive(PRIM_DOUBLE);
-    PRIM_AS_DOUBLE(prim) = 1;
-
-    vm_add_object(vm, (object*)prim);
-    push_objstack(stack, (object*)prim);
+    objprim *a = (objprim*)pop_objstack(stack);
+    if ((!a) || a->header.type != OBJ_PRIMITIVE || !PRIM_IS_NUMBER(a)) {
+        runtime_error_unsupported_operation(vm, line, '-');
+        return;
+    }
 
-    object *b = pop_objstack(stack);
-    object *a = pop_objstack(stack);
     object *c = NULL;
-
-    if (!a->__mul__)
-        if (!b->__mul__) {
-            runtime_error_unsupported_operation(vm,
-                    line, '*');
-            return;
-        }
-        else
-            c = b->__mul__(a, b);
+    int64_t negated;
+    if (a->ptype == PRIM_INT && int_arith('-', 0, PRIM_AS_INT(a), &negated))
+        c = vm_int(vm, negated);
     else
-        c = a->__mul__(a, b);
+        c = vm_double(vm, -PRIM_NUMBER_AS_DOUBLE(a));
 
-    if (!c) {
-        runtime_error_unsupported_operation(vm, line,
-                '*');
-        return;
-    }
+    push_objstack(stack, c);
     advance(vm->top);
 }
 
@@ -588,6 +1013,7 @@ static inline void op_pop(VM *vm)
 
 static inline void op_return(VM *vm)
 {
+    pop_block_frames(vm);
     if (vm->top->next) {
         vm_pop_frame(vm);
         advance(vm->top);
@@ -599,358 +1025,1698 @@ static inline void op_return(VM *vm)
 #endif
 }
 
-intrpstate execute(VM *vm, instruct *instructs)
+static inline bool is_primdouble(object *obj)
+{
+    return obj && obj->type == OBJ_PRIMITIVE &&
+        ((objprim*)obj)->ptype == PRIM_DOUBLE;
+}
+
+static inline bool is_primint(object *obj)
+{
+    return obj && obj->type == OBJ_PRIMITIVE &&
+        ((objprim*)obj)->ptype == PRIM_INT;
+}
+
+static inline bool compare_ints(int64_t a, int64_t b, int cmptype)
+{
+    switch (cmptype) {
+        case TOKEN_EQUAL_EQUAL:     return a == b;
+        case TOKEN_BANG_EQUAL:      return a != b;
+        case TOKEN_GREATER:         return a > b;
+        case TOKEN_GREATER_EQUAL:   return a >= b;
+        case TOKEN_LESS:            return a < b;
+        case TOKEN_LESS_EQUAL:      return a <= b;
+        default:                    return false;
+    }
+}
+
+static inline bool compare_doubles(double a, double b, int cmptype)
+{
+    switch (cmptype) {
+        case TOKEN_EQUAL_EQUAL:     return a == b;
+        case TOKEN_BANG_EQUAL:      return a != b;
+        case TOKEN_GREATER:         return a > b;
+        case TOKEN_GREATER_EQUAL:   return a >= b;
+        case TOKEN_LESS:            return a < b;
+        case TOKEN_LESS_EQUAL:      return a <= b;
+        default:                    return false;
+    }
+}
+
+/* Quickening: the generic arithmetic and compare instructions count how
+ * often both operands were numbers. After QUICKEN_THRESHOLD runs in a row
+ * the instruction is rewritten in place to a form that works on the
+ * doubles or ints directly, whichever the last operands were. The
+ * quickened form checks its operands first and puts the generic
+ * bytecode back when they don't match. An instruction that deoptimized
+ * QUICKEN_MAX_DEOPTS times stays generic.
+ */
+#define QUICKEN_THRESHOLD   8
+#define QUICKEN_MAX_DEOPTS  4
+
+static inline bool doubles_on_stack(objstack *stack)
+{
+    objnode *top = stack->top;
+    return top && top->next && is_primdouble(top->obj) &&
+        is_primdouble(top->next->obj);
+}
+
+static inline bool ints_on_stack(objstack *stack)
+{
+    objnode *top = stack->top;
+    return top && top->next && is_primint(top->obj) &&
+        is_primint(top->next->obj);
+}
+
+static inline void quicken(code8 *code, bool stable, uint8_t quickened)
+{
+    if (!stable) {
+        code->hotness = 0;
+        return;
+    }
+    if (code->deopts < QUICKEN_MAX_DEOPTS &&
+            ++code->hotness >= QUICKEN_THRESHOLD)
+        code->bytecode = quickened;
+}
+
+static inline void quicken_numbers(code8 *code, objstack *stack,
+        uint8_t doubles, uint8_t ints)
+{
+    if (ints_on_stack(stack))
+        quicken(code, true, ints);
+    else
+        quicken(code, doubles_on_stack(stack), doubles);
+}
+
+static inline void deoptimize(code8 *code)
+{
+    switch (code->bytecode) {
+        case OP_ADD_DOUBLE:         code->bytecode = OP_BINARY_ADD; break;
+        case OP_SUB_DOUBLE:         code->bytecode = OP_BINARY_SUB; break;
+        case OP_MULT_DOUBLE:        code->bytecode = OP_BINARY_MULT; break;
+        case OP_DIVIDE_DOUBLE:      code->bytecode = OP_BINARY_DIVIDE; break;
+        case OP_COMPARE_DOUBLE_JMP: code->bytecode = OP_COMPARE; break;
+        case OP_ADD_INT:            code->bytecode = OP_BINARY_ADD; break;
+        case OP_SUB_INT:            code->bytecode = OP_BINARY_SUB; break;
+        case OP_MULT_INT:           code->bytecode = OP_BINARY_MULT; break;
+        case OP_COMPARE_INT_JMP:    code->bytecode = OP_COMPARE; break;
+        default:                    break;
+    }
+    code->hotness = 0;
+    code->deopts++;
+}
+
+// The operator of a generic or quickened arithmetic instruction
+static inline char arith_operator(uint8_t bytecode)
+{
+    switch (bytecode) {
+        case OP_BINARY_ADD:
+        case OP_ADD_DOUBLE:
+        case OP_ADD_INT:
+            return '+';
+        case OP_BINARY_SUB:
+        case OP_SUB_DOUBLE:
+        case OP_SUB_INT:
+            return '-';
+        case OP_BINARY_MULT:
+        case OP_MULT_DOUBLE:
+        case OP_MULT_INT:
+            return '*';
+        default:
+            return '/';
+    }
+}
+
+static inline bool op_arith_double(VM *vm, uint8_t bytecode)
 {
-    if (vm->framestackpos == 0)
-        if (vm->haderror)
-            vm->haderror = false;
     objstack *stack = &vm->evalstack;
-#ifdef DEBUG_ARI
-    uint64_t count = instructs->count;
-    int compress = (int)log10(count);
-    printf("\nCurrent Frame: %p\n", vm->top);
-    printf("Frame\tInstruct   OP\t\t\toperand\n");
-    printf("-----\t--------   ----------\t\t--------\n");
-#endif
-    while (vm->top->pc < instructs->count) {
-        uint64_t current = vm->top->pc;
-        code8 *code = instructs->code[current];
-        int line = code->line;
-        if (vm->haderror) {
-            fprintf(stderr, "[line %d] in script\n", line);
-            return INTERPRET_RUNTIME_ERROR;
+    if (!doubles_on_stack(stack))
+        return false;
+
+    char op = arith_operator(bytecode);
+    double b = PRIM_AS_DOUBLE(((objprim*)stack->top->obj));
+    // Division by zero is reported by the generic instruction
+    if (op == '/' && b == 0)
+        return false;
+    pop_objstack(stack);
+    double a = PRIM_AS_DOUBLE(((objprim*)pop_objstack(stack)));
+
+    double c;
+    switch (op) {
+        case '+':   c = a + b; break;
+        case '-':   c = a - b; break;
+        case '*':   c = a * b; break;
+        default:    c = a / b; break;
+    }
+    push_objstack(stack, vm_double(vm, c));
+    advance(vm->top);
+    return true;
+}
+
+/* Adds, subtracts or multiplies two ints. A result that doesn't fit in
+ * an int is given as a double. Division is left to the double and
+ * generic instructions, since it always gives a double.
+ */
+static inline bool op_arith_int(VM *vm, uint8_t bytecode)
+{
+    objstack *stack = &vm->evalstack;
+    char op = arith_operator(bytecode);
+    if (op == '/' || !ints_on_stack(stack))
+        return false;
+
+    int64_t b = PRIM_AS_INT(((objprim*)pop_objstack(stack)));
+    int64_t a = PRIM_AS_INT(((objprim*)pop_objstack(stack)));
+
+    object *c = NULL;
+    int64_t result;
+    if (int_arith(op, a, b, &result))
+        c = vm_int(vm, result);
+    else {
+        switch (op) {
+            case '+':   c = vm_double(vm, (double)a + (double)b); break;
+            case '-':   c = vm_double(vm, (double)a - (double)b); break;
+            default:    c = vm_double(vm, (double)a * (double)b); break;
         }
-        value *operand = &code->operand;
-        valtype type = code->operand.type;
-#ifdef DEBUG_ARI
-        printf("|%03d|\t", vm->framestackpos);
-        printf("|%*ld|\t   ", compress, current + 1);
-        print_bytecode(code->bytecode);
-        printf("\t(");
-        print_value(operand, type);
-        printf(")");
-        printf("\n");
-#endif
-        switch (code->bytecode) {
-            /* PUSH_FRAME: Pushes an adhoc frame onto the frame stack. 
-             * Adhoc frames are used to create new scopes outside of a 
-             * new function or class.
-             */
-            case OP_PUSH_FRAME:
-            {
-                op_push_frame(vm);
-                break;
-            }
-            /* POP_FRAME: Pops an adhoc frame from the frame stack.
-             */
-            case OP_POP_FRAME:
-            {
-                op_pop_frame(vm);
-                break;
-            }
-            /* JMP_LOC: Directly jumps to a new location in 
-             * the instructions.
-             */
-            case OP_JMP_LOC:
-            {
-                int jump = VAL_AS_INT(operand);
-                op_jmp_loc(vm, jump);
-                break;
-            }
-            /* JMP_AFTER: Uses an offset to make a jump in
-             * the instructions.
-             */
-            case OP_JMP_AFTER:
-            {
-                int jump = VAL_AS_INT(operand);
-                op_jmp_after(vm, jump);
-                break;
-            }
-            /* JMP_FALSE: Only jump if condition is true. Note
-             * the other jump operations do not directly evalute
-             * whether to jump based on conditions.
-             */
-            case OP_JMP_FALSE:
-            {
-                objprim *condition = (objprim*)pop_objstack(stack);
-                if (!condition) { 
-                    runtime_error(vm, stack, line,
-                            "ConditionError: No condition found.");
-                    continue;
-                }
-                int jump = VAL_AS_INT(operand);
-                op_jmp_false(vm, jump, condition);
-                break;
-            }
-            /* LOAD_CONSTANT: Takes a value from the compiler
-             * and creates a new objprim object and pushes it
-             * onto the object stack.
-             */
+    }
+    push_objstack(stack, c);
+    advance(vm->top);
+    return true;
+}
+
+/* A call of a function whose body only reads names and returns one
+ * expression (see inline_operands) is replaced with the expression,
+ * worked out here with the arguments on the stack in place of the names
+ * bound to them. Only what can't fail is done here: reading names that
+ * are there, properties of instances that have them, and arithmetic on
+ * two ints or two doubles. For anything else inline_call() returns
+ * false with nothing changed, and the function is called as usual and
+ * reports any error itself.
+ */
+static object *inline_argument(VM *vm, int argument, int argcount,
+        bool method)
+{
+    if (method && argument == 0)
+        return vm->objregister;
+    return stack_object(&vm->evalstack, argcount - 1 - argument);
+}
+
+static inline object *inline_name(VM *vm, inlineoperand *operand,
+        int argcount, bool method)
+{
+    if (operand->argument >= 0)
+        return inline_argument(vm, operand->argument, argcount, method);
+    return find_name(vm->top, operand->name);
+}
+
+static inline object *inline_property(object *obj, primstring *name)
+{
+    if (!obj || !OBJ_IS_INSTANCE(obj))
+        return NULL;
+    objinstance *instobj = (objinstance*)obj;
+    object *prop = objhash_get(instobj->header.__attrs__, name);
+    if (!prop)
+        prop = objhash_get(instobj->class->header.__attrs__, name);
+    return prop;
+}
+
+static object *inline_arith(VM *vm, char op, object *a, object *b)
+{
+    if (is_primint(a) && is_primint(b) && op != '/') {
+        int64_t x = PRIM_AS_INT(((objprim*)a));
+        int64_t y = PRIM_AS_INT(((objprim*)b));
+        int64_t result;
+        if (int_arith(op, x, y, &result))
+            return vm_int(vm, result);
+        switch (op) {
+            case '+':   return vm_double(vm, (double)x + (double)y);
+            case '-':   return vm_double(vm, (double)x - (double)y);
+            default:    return vm_double(vm, (double)x * (double)y);
+        }
+    }
+    if (!is_primdouble(a) || !is_primdouble(b))
+        return NULL;
+    double x = PRIM_AS_DOUBLE(((objprim*)a));
+    double y = PRIM_AS_DOUBLE(((objprim*)b));
+    switch (op) {
+        case '+':   return vm_double(vm, x + y);
+        case '-':   return vm_double(vm, x - y);
+        case '*':   return vm_double(vm, x * y);
+        default:    return y == 0 ? NULL : vm_double(vm, x / y);
+    }
+}
+
+static bool inline_call(VM *vm, object *callee, int argcount, bool method)
+{
+    if (!callee || !OBJ_IS_CODE(callee))
+        return false;
+    objcode *funcobj = (objcode*)callee;
+    inlineoperand *operands = inline_operands(funcobj);
+    if (!operands || funcobj->argcount != (size_t)argcount)
+        return false;
+
+    code8 **code = funcobj->instructs.code;
+    object *values[INLINE_MAX_LENGTH];
+    object *receiver = vm->objregister;
+    int count = 0;
+    for (int pc = 0; code[pc]->bytecode != OP_RETURN; pc++) {
+        value *operand = &code[pc]->operand;
+        object *result = NULL;
+        switch (code[pc]->bytecode) {
             case OP_LOAD_CONSTANT:
-            {
-                op_load_constant(vm, line, type, operand);
+                result = load_constant(vm, code[pc]->line, operand->type,
+                        operand);
                 break;
-            }
-            /* LOAD_NAME: searches through the linked object
-             * hashtables to find an entry. If found, it places
-             * that object onto the stack.
-             */
             case OP_LOAD_NAME:
-            {
-                char *name = VAL_AS_STRING(operand);
-                op_load_name(vm, line, name);
-                break;
-            }
-            /* LOAD_METHOD: This operation only advances the 
-             * program counter at this point. May be removed later on.
-             */
-            case OP_LOAD_METHOD:
-            {
-                op_load_method(vm);
-                break;
-            }
-            /* CALL_FUNCTION: Call operation used to call functions
-             * and create objects.
-             */ 
-            case OP_CALL_FUNCTION:
-            {
-                int argcount = VAL_AS_INT(operand);
-                op_call_function(vm, line, argcount);
-                break;
-            }
-            /* MAKE_FUNCTION: Takes a function passed from the
-             * compiler and places it on object stack.
-             */
-            case OP_MAKE_FUNCTION:
-            {
-                op_make_function(vm, operand);
-                break;
-            }
-            /* MAKE_CLASS: Takes a class passed from the
-             * compiler and passes the class body to execute()
-             * to transform class definition into a new class.
-             * Afterwards, class is placed on the object stack.
-             */
-            case OP_MAKE_CLASS:
-            {
-                op_make_class(vm, operand);
-                break;
-            }
-            /* CALL_METHOD: Similar to CALL_FUNCTION, this
-             * operation calls a method instead of a function. The 
-             * biggest difference between the two are that 
-             * OP_CALL_METHOD places the object the method is called 
-             * against in the object register.
-             *
-             * This allows the method to use 'this' in the method body,
-             * and get attributes directly from the instance.
-             */
-            case OP_CALL_METHOD:
-            {
-                int argcount = VAL_AS_INT(operand) + 1;
-                op_call_method(vm, argcount);
+                result = inline_name(vm, &operands[pc], argcount, method);
                 break;
-            }
-            /* MAKE_METHOD: Takes a method constructed in the compiler
-             * and places it on the object stack.
-             */
-            case OP_MAKE_METHOD:
-            {
-                op_make_method(vm, operand);
+            case OP_GET_NAME_PROPERTY:
+                receiver = inline_name(vm, &operands[pc], argcount, method);
+                pc++;
+                result = inline_property(receiver, operands[pc].name);
                 break;
-            }
-            /* GET_PROPERTY: Similar to LOAD_NAME, this operation
-             * attempts to retrieve an attribute from an object.
-             *
-             * This is done differently than LOAD_NAME, however, as
-             * it looks only at the hashtable of the object, and doesn't
-             * search the frame stack at all.  
-             */
             case OP_GET_PROPERTY:
-            {
-                char *name = VAL_AS_STRING(operand);
-                op_get_property(vm, line, name);
-                break;
-            }
-            /* SET_PROPERTY: Pops an object from the object stack
-             * and stores it in the hashtable of the object that this
-             * operation was called against.
-             *
-             * e.g.: foo.bar = "Hello!"; 
-             */
-            case OP_SET_PROPERTY:
-            {
-                char *name = VAL_AS_STRING(operand);
-                op_set_property(vm, line, name);
-                break;
-            }
-            case OP_GET_SOURCE:
-            {
-                char *name = VAL_AS_STRING(operand);
-                op_get_source(vm, line, name);
-                break;
-            }
-            /* STORE_NAME: Pops an object from the object stack
-             * and stores it in the hashtable of top frame on the
-             * frame stack.
-             *
-             * e.g.:
-             *          // Stored at global hashtable
-             *          foo = "happy!";
-             *          {
-             *              // Stored at hashtable created by new scope
-             *              bar = "sad!";
-             *          }
-             */
-            case OP_STORE_NAME:
-            {
-                char *name = VAL_AS_STRING(operand);
-                op_store_name(vm, name);
-                break;
-            }
-            /* COMPARE: takes two objprims, compares them and returns
-             * objprim bool object of either true or false.
-             *
-             * Right now this is limited to objprims, but will
-             * be working to expand this to all objects soon.
-             */
-            case OP_COMPARE:
-            {
-                int cmptype = VAL_AS_INT(operand);
-                op_compare(vm, line, cmptype);
-                break;
-            }
-            /* BINARY_ADD: takes two obprims, adds them together
-             * and places the result on the object stack.
-             *
-             * Will be adding functionality to allow user-defined 
-             * binary_add operations for any non built-in object.
-             */
-            case OP_BINARY_ADD:
-            {
-                op_binary_add(vm, line);
-                break;
-            }
-            /* BINARY_SUB: takes two objprims, subtracts them from
-             * each other, and places the result on the object stack.
-             *
-             * Like BINARY_ADD, more functionality coming soon.
-             */
-            case OP_BINARY_SUB:
-            {
-                op_binary_sub(vm, line);
-                break;
-            }
-            /* BINARY_MULT: takes two objprims, multiplies them together, 
-             * and places the result on the object stack.
-             *
-             * Like BINARY_ADD, more functionality coming soon.
-             */
-            case OP_BINARY_MULT:
-            {
-                op_binary_mult(vm, line);
-                break;
-            }
-            /* BINARY_DIVIDE: takes two objprims, divides them, 
-             * and places the result on the object stack.
-             *
-             * Like BINARY_ADD, more functionality coming soon.
-             */
-            case OP_BINARY_DIVIDE:
-            {
-                op_binary_div(vm, line);
+                receiver = values[--count];
+                result = inline_property(receiver, operands[pc].name);
                 break;
-            }
-            /* NEGATE: takes an objprim, negates it
-             * and places the result on the object stack.
-             *
-             */
-            case OP_NEGATE:
-            {
-                op_negate(vm, line);
-                break;
-            }
-            /* POP: pops the object stack.
-             *
-             * Note: this discards the object on the stack.
-             */
-            case OP_POP:
-            {
-                op_pop(vm);
+            default:
+                count -= 2;
+                result = inline_arith(vm, arith_operator(code[pc]->bytecode),
+                        values[count], values[count + 1]);
                 break;
-            }
-            /* RETURN: Ends an ari function or method and returns
-             * to original caller.
-             */
-            case OP_RETURN:
-            {
-                op_return(vm);
-                return INTERPRET_OK;
-            }
         }
+        if (!result)
+            return false;
+        values[count++] = result;
     }
-    return INTERPRET_OK;
+
+    // Pops the arguments and the function, like the call would
+    int popped = method ? argcount - 1 : argcount;
+    for (int i = 0; i <= popped; i++)
+        pop_objstack(&vm->evalstack);
+    push_objstack(&vm->evalstack, values[0]);
+    // Left as the GET_PROPERTY in the body would have left it
+    vm->objregister = receiver;
+    vm_add_object(vm, callee);
+    advance(vm->top);
+    return true;
 }
 
-void reset_vm(VM *vm)
+/* Pops and compares two numbers. Returns -1, leaving the stack alone,
+ * if the operands are anything else.
+ */
+static inline int compare_doubles_on_stack(VM *vm, int cmptype)
 {
-    vm->top->pc = 0;
-    reset_parser(&vm->analyzer);
+    objstack *stack = &vm->evalstack;
+    if (!doubles_on_stack(stack))
+        return -1;
+
+    double b = PRIM_AS_DOUBLE(((objprim*)pop_objstack(stack)));
+    double a = PRIM_AS_DOUBLE(((objprim*)pop_objstack(stack)));
+    return compare_doubles(a, b, cmptype);
 }
 
-void free_vm(VM *vm)
+// Same as compare_doubles_on_stack, for two ints
+static inline int compare_ints_on_stack(VM *vm, int cmptype)
 {
-    object *current = NULL;
-    object *next = NULL;
-    while ((current = vm->objs)) {
-        next = current->next;
-        FREE_OBJECT(current);
-        vm->objs = next;
-    }
-    reset_objstack(&vm->evalstack);
-    init_objstack(&vm->evalstack);
-    reset_parser(&vm->analyzer);
-    reset_frame(&vm->global.local);
-    FREE(VM, vm);
+    objstack *stack = &vm->evalstack;
+    if (!ints_on_stack(stack))
+        return -1;
+
+    int64_t b = PRIM_AS_INT(((objprim*)pop_objstack(stack)));
+    int64_t a = PRIM_AS_INT(((objprim*)pop_objstack(stack)));
+    return compare_ints(a, b, cmptype);
 }
 
-VM *init_vm(void)
+static inline void compare_jump(VM *vm, code8 **code, int result)
 {
-    VM *vm = ALLOCATE(VM, 1);
-    init_parser(&vm->analyzer);
-    init_objstack(&vm->evalstack);
-    init_module(&vm->global);
-    vm->top = &vm->global.local;
-    vm->objs = NULL;
-    vm->objregister = NULL;
-    vm->num_objects = 0;
-    vm->framestackpos = 0;
-    vm->haderror = false;
+    if (result)
+        vm->top->pc += 2;
+    else
+        vm->top->pc = VAL_AS_INT((&code[1]->operand));
+}
 
-    builtin funcs[] = {builtin_println, builtin_input, builtin_type, 
-                       builtin_clock};
-    char *names[] = {"print", "input", "type", "clock"};
+static inline bool op_compare_double_jmp(VM *vm, code8 **code)
+{
+    int result = compare_doubles_on_stack(vm,
+            VAL_AS_INT((&code[0]->operand)));
+    if (result < 0)
+        return false;
+    compare_jump(vm, code, result);
+    return true;
+}
 
-    object *obj = NULL;
-    for (int i = 0; i < 4; i++) {
-        obj = load_builtin(vm, names[i], funcs[i]);
-        vm_add_object(vm, obj);
-    }
+static inline bool op_compare_int_jmp(VM *vm, code8 **code)
+{
+    int result = compare_ints_on_stack(vm, VAL_AS_INT((&code[0]->operand)));
+    if (result < 0)
+        return false;
+    compare_jump(vm, code, result);
+    return true;
+}
 
-    return vm;
+static inline bool is_primnumber(object *obj)
+{
+    return obj && obj->type == OBJ_PRIMITIVE && PRIM_IS_NUMBER(((objprim*)obj));
 }
 
-void print_value(value *val, valtype type)
+/* FOR_RANGE and FOR_STEP run the counted for loops picked out by the
+ * compiler. The counter lives unboxed in the loop state of the frame,
+ * and the loop name is rebound to a new object once per iteration.
+ */
+static inline bool loop_test(VM *vm, forloop *loop)
 {
-    switch (type) {
-        case VAL_EMPTY:
-            printf("%-4s", "empty");
-            break;
-        case VAL_INT:
-            printf("%-4d", VAL_AS_INT(val));
-            break;
-        case VAL_DOUBLE:
-            printf("%-4f", VAL_AS_DOUBLE(val));
+    objprim *bound = (objprim*)loop->bound;
+    switch (loop->mode) {
+        case COUNT_INT:
+            if (bound->ptype == PRIM_INT)
+                return compare_ints(loop->counter, PRIM_AS_INT(bound),
+                        loop->cmptype);
+            return compare_doubles((double)loop->counter,
+                    PRIM_AS_DOUBLE(bound), loop->cmptype);
+        case COUNT_DOUBLE:
+            return compare_doubles(loop->dcounter,
+                    PRIM_NUMBER_AS_DOUBLE(bound), loop->cmptype);
+        default:
+        {
+            return binary_comp((objprim*)loop->current, bound,
+                    loop->cmptype);
+        }
+    }
+}
+
+static inline void op_for_range(VM *vm, code8 **code)
+{
+    objstack *stack = &vm->evalstack;
+    forloop *loop = &vm->top->loop;
+    char *name = VAL_AS_STRING((&code[0]->operand));
+
+    object *step = pop_objstack(stack);
+    object *bound = pop_objstack(stack);
+    object *start = get_name(vm->top, name);
+    if (!start) {
+        runtime_error_loadname(vm, name, code[0]->line);
+        return;
+    }
+    if (!bound) {
+        runtime_error(vm, stack, code[0]->line,
+                "ComparisonError: object not found");
+        return;
+    }
+
+    loop->name = name;
+    loop->cmptype = VAL_AS_INT((&code[1]->operand));
+    loop->current = start;
+    loop->step = step;
+    loop->bound = bound;
+    if (is_primint(start) && is_primint(step) && is_primnumber(bound)) {
+        loop->mode = COUNT_INT;
+        loop->counter = PRIM_AS_INT(((objprim*)start));
+    }
+    else if (is_primnumber(start) && is_primnumber(bound)) {
+        loop->mode = COUNT_DOUBLE;
+        loop->dcounter = PRIM_NUMBER_AS_DOUBLE(((objprim*)start));
+    }
+    else
+        loop->mode = COUNT_OBJECT;
+
+    if (loop_test(vm, loop))
+        vm->top->pc += 3;
+    else
+        vm->top->pc = VAL_AS_INT((&code[2]->operand));
+}
+
+static inline void op_for_step(VM *vm, code8 *code)
+{
+    forloop *loop = &vm->top->loop;
+    objprim *step = (objprim*)loop->step;
+
+    switch (loop->mode) {
+        case COUNT_INT:
+        {
+            int64_t next;
+            if (int_arith('+', loop->counter, PRIM_AS_INT(step), &next)) {
+                loop->counter = next;
+                loop->current = vm_int(vm, next);
+                break;
+            }
+            // The counter overflowed, and carries on as a double
+            loop->mode = COUNT_DOUBLE;
+            loop->dcounter = (double)loop->counter;
+        }
+        /* fall through */
+        case COUNT_DOUBLE:
+            loop->dcounter += PRIM_NUMBER_AS_DOUBLE(step);
+            loop->current = vm_double(vm, loop->dcounter);
+            break;
+        default:
+        {
+            object *next = binary_add(vm, code->line, loop->current,
+                    loop->step);
+            if (!next)
+                return;
+            loop->current = next;
+            break;
+        }
+    }
+
+    primstring *pname = create_primstring(loop->name);
+    set_name(vm->top, pname, loop->current);
+    free_primstring(pname);
+
+    if (loop_test(vm, loop))
+        vm->top->pc = VAL_AS_INT((&code->operand));
+    else
+        advance(vm->top);
+}
+
+/* Runs a generator on to its next yield and returns the value, or NULL
+ * once its function has returned. Its frames go back on top of the
+ * running ones for the time being, and its stack nodes on top of the
+ * stack. The pc of the frame that resumed it is left as it was.
+ */
+static object *resume_generator(VM *vm, objgen *gen)
+{
+    objstack *stack = &vm->evalstack;
+    if (gen->done)
+        return NULL;
+    if (gen->running) {
+        runtime_error(vm, stack, 0, "ValueError: generator already running");
+        return NULL;
+    }
+
+    frame *resumer = vm->top;
+    size_t pc = resumer->pc;
+    gen->stackbase = stack->top;
+    if (gen->stacktop) {
+        gen->stackbottom->next = stack->top;
+        stack->top = gen->stacktop;
+        gen->stacktop = gen->stackbottom = NULL;
+    }
+    gen->base->next = resumer;
+    vm->top = gen->top;
+    vm->framestackpos += gen->framecount;
+    gen->top = NULL;
+
+    objgen *outer = vm->generator;
+    vm->generator = gen;
+    gen->running = true;
+    execute(vm, &gen->code->instructs);
+    gen->running = false;
+    vm->generator = outer;
+
+    object *item = gen->value;
+    gen->value = NULL;
+    if (!gen->top) {
+        // It returned, or failed, and its frames are gone
+        gen->done = true;
+        item = NULL;
+        if (!vm->haderror)
+            while (stack->top != gen->stackbase)
+                pop_objstack(stack);
+    }
+    resumer->pc = pc;
+    return item;
+}
+
+/* Hands the yielded value to resume_generator() and takes the frames and
+ * stack nodes of the call off the running ones. Returns false, leaving
+ * them where they are, if the code running is not a generator's.
+ */
+static bool op_yield(VM *vm, instruct *instructs, int line)
+{
+    objstack *stack = &vm->evalstack;
+    objgen *gen = vm->generator;
+    if (!gen || instructs != &gen->code->instructs) {
+        runtime_error(vm, stack, line,
+                "SyntaxError: yield outside a function");
+        return false;
+    }
+    gen->value = pop_objstack(stack);
+    advance(vm->top);
+
+    if (stack->top != gen->stackbase) {
+        objnode *bottom = stack->top;
+        while (bottom->next != gen->stackbase)
+            bottom = bottom->next;
+        gen->stacktop = stack->top;
+        gen->stackbottom = bottom;
+        stack->top = gen->stackbase;
+        bottom->next = NULL;
+    }
+
+    int count = 1;
+    for (frame *current = vm->top; current != gen->base;
+            current = current->next)
+        count++;
+    gen->top = vm->top;
+    gen->framecount = count;
+    vm->top = gen->base->next;
+    gen->base->next = NULL;
+    vm->framestackpos -= count;
+    return true;
+}
+
+/* GET_ITER and FOR_ITER run for-in loops. Ranges, lists, float64arrays,
+ * dicts and files are walked in place, and lists and dicts hand out the
+ * objects they hold. An instance takes part through __iter__, which
+ * returns the iterator, and __next__, which returns each value in turn
+ * and null or nothing once there are no more.
+ */
+static object *find_method(object *obj, char *name)
+{
+    objinstance *instobj = (objinstance*)obj;
+    primstring *pname = create_primstring(name);
+    object *method = objhash_get(instobj->class->header.__attrs__, pname);
+    free_primstring(pname);
+    return method && OBJ_IS_CODE(method) ? method : NULL;
+}
+
+/* Runs a method without arguments to completion and returns its result,
+ * or NULL if it returned nothing. Returning advances the pc of the
+ * calling frame, which the caller has to set again afterwards.
+ */
+static object *call_method_now(VM *vm, object *method, object *receiver)
+{
+    objstack *stack = &vm->evalstack;
+    int depth = stack->count;
+    object *arguments[1] = {receiver};
+    call_function(vm, method, 1, arguments);
+    if (vm->haderror || stack->count == depth)
+        return NULL;
+    return pop_objstack(stack);
+}
+
+static objiter *builtin_iterator(object *obj)
+{
+    switch (obj->type) {
+        case OBJ_RANGE:
+            return init_objiter(ITER_RANGE, obj);
+        case OBJ_LIST:
+            return init_objiter(ITER_LIST, obj);
+        case OBJ_FLOAT64ARRAY:
+            return init_objiter(ITER_FLOAT64ARRAY, obj);
+        case OBJ_DICT:
+            return init_objiter(ITER_DICT, obj);
+        case OBJ_FILE:
+            return init_objiter(ITER_FILE, obj);
+        case OBJ_GENERATOR:
+            return init_objiter(ITER_GENERATOR, obj);
+        default:
+            return NULL;
+    }
+}
+
+static inline void op_get_iter(VM *vm, int line)
+{
+    objstack *stack = &vm->evalstack;
+    frame *loopframe = vm->top;
+    size_t pc = loopframe->pc;
+    object *obj = pop_objstack(stack);
+    objiter *iter = NULL;
+
+    if (obj && OBJ_IS_INSTANCE(obj)) {
+        object *method = find_method(obj, "__iter__");
+        if (method)
+            obj = call_method_now(vm, method, obj);
+        if (vm->haderror)
+            return;
+    }
+    if (obj && OBJ_IS_INSTANCE(obj)) {
+        object *next = find_method(obj, "__next__");
+        if (next) {
+            iter = init_objiter(ITER_INSTANCE, obj);
+            iter->next = next;
+        }
+    }
+    else if (obj)
+        iter = builtin_iterator(obj);
+    if (!iter) {
+        runtime_error(vm, stack, line, "TypeError: object is not iterable");
+        return;
+    }
+
+    vm_add_object(vm, (object*)iter);
+    loopframe->loop.iterator = (object*)iter;
+    loopframe->pc = pc + 1;
+}
+
+static inline object *range_next(VM *vm, objiter *iter)
+{
+    objrange *range = (objrange*)iter->source;
+    if (!objrange_contains(range, iter->position))
+        return NULL;
+    object *item = vm_int(vm, iter->position);
+    // Counting past the largest int ends the range
+    if (!int_arith('+', iter->position, range->step, &iter->position))
+        iter->position = range->stop;
+    return item;
+}
+
+static inline object *dict_next(VM *vm, objiter *iter)
+{
+    objdict *dict = (objdict*)iter->source;
+    while (iter->position < dict->used && !dict->entries[iter->position].key)
+        iter->position++;
+    if (iter->position >= dict->used)
+        return NULL;
+    dictentry *entry = &dict->entries[iter->position++];
+    entry->handed_out = true;
+    vm_add_object(vm, (object*)entry->key);
+    return (object*)entry->key;
+}
+
+static inline object *file_next(VM *vm, objiter *iter)
+{
+    char *line = objfile_readline((objfile*)iter->source);
+    if (!line)
+        return NULL;
+    objprim *prim = create_new_primitive(PRIM_STRING);
+    PRIM_AS_STRING(prim) = create_primstring(line);
+    vm_add_object(vm, (object*)prim);
+    return (object*)prim;
+}
+
+static inline void op_for_iter(VM *vm, code8 *code)
+{
+    frame *loopframe = vm->top;
+    objiter *iter = (objiter*)loopframe->loop.iterator;
+    size_t pc = loopframe->pc;
+    object *item = NULL;
+
+    switch (iter->kind) {
+        case ITER_RANGE:
+            item = range_next(vm, iter);
+            break;
+        case ITER_LIST:
+        {
+            objlist *list = (objlist*)iter->source;
+            if (iter->position < list->count)
+                item = list->items[iter->position++];
+            break;
+        }
+        case ITER_FLOAT64ARRAY:
+        {
+            objarray *array = (objarray*)iter->source;
+            if (iter->position < array->count)
+                item = vm_double(vm, array->data[iter->position++]);
+            break;
+        }
+        case ITER_DICT:
+            item = dict_next(vm, iter);
+            break;
+        case ITER_FILE:
+            item = file_next(vm, iter);
+            break;
+        case ITER_INSTANCE:
+        {
+            item = call_method_now(vm, iter->next, iter->source);
+            if (vm->haderror)
+                return;
+            if (item && OBJ_IS_PRIMITIVE(item) &&
+                    ((objprim*)item)->ptype == PRIM_NULL)
+                item = NULL;
+            break;
+        }
+        case ITER_GENERATOR:
+        {
+            item = resume_generator(vm, (objgen*)iter->source);
+            if (vm->haderror)
+                return;
+            break;
+        }
+    }
+
+    if (item) {
+        push_objstack(&vm->evalstack, item);
+        loopframe->pc = pc + 1;
+    }
+    else
+        loopframe->pc = VAL_AS_INT((&code->operand));
+}
+
+/* The superinstructions below are written over the first instruction of
+ * the sequence they replace, and read the operands of the rest of the
+ * sequence from the instructions that follow. Those instructions are
+ * left in place, so a jump into the middle of a sequence still works.
+ */
+static inline void op_get_name_property(VM *vm, code8 **code)
+{
+    char *name = VAL_AS_STRING((&code[0]->operand));
+    object *obj = get_name(vm->top, name);
+    if (!obj) {
+        runtime_error_loadname(vm, name, code[0]->line);
+        return;
+    }
+    char *getname = VAL_AS_STRING((&code[1]->operand));
+    if (get_property(vm, code[1]->line, obj, getname))
+        vm->top->pc += 2;
+}
+
+static inline void op_set_name_property(VM *vm, code8 **code)
+{
+    char *name = VAL_AS_STRING((&code[0]->operand));
+    object *obj = get_name(vm->top, name);
+    if (!obj) {
+        runtime_error_loadname(vm, name, code[0]->line);
+        return;
+    }
+    char *setname = VAL_AS_STRING((&code[1]->operand));
+    if (set_property(vm, code[1]->line, obj, setname))
+        vm->top->pc += 2;
+}
+
+static inline void op_compare_name_const_jmp(VM *vm, code8 **code)
+{
+    char *name = VAL_AS_STRING((&code[0]->operand));
+    value *constant = &code[1]->operand;
+    int cmptype = VAL_AS_INT((&code[2]->operand));
+    int jump = VAL_AS_INT((&code[3]->operand));
+
+    object *a = get_name(vm->top, name);
+    if (!a) {
+        runtime_error_loadname(vm, name, code[0]->line);
+        return;
+    }
+
+    bool result;
+    if (is_primint(a) && VAL_IS_LONG(constant))
+        result = compare_ints(PRIM_AS_INT(((objprim*)a)),
+                VAL_AS_LONG(constant), cmptype);
+    else if (is_primdouble(a) && VAL_IS_DOUBLE(constant))
+        result = compare_doubles(PRIM_AS_DOUBLE(((objprim*)a)),
+                VAL_AS_DOUBLE(constant), cmptype);
+    else {
+        object *b = load_constant(vm, code[1]->line, constant->type,
+                constant);
+        if (!b)
+            return;
+        result = binary_comp((objprim*)a, (objprim*)b, cmptype);
+    }
+
+    if (result)
+        vm->top->pc += 4;
+    else
+        vm->top->pc = jump;
+}
+
+static inline void op_add_name_const_store(VM *vm, code8 **code)
+{
+    char *name = VAL_AS_STRING((&code[0]->operand));
+    value *constant = &code[1]->operand;
+
+    object *a = get_name(vm->top, name);
+    if (!a) {
+        runtime_error_loadname(vm, name, code[0]->line);
+        return;
+    }
+
+    object *c = NULL;
+    int64_t result;
+    if (is_primint(a) && VAL_IS_LONG(constant) &&
+            int_arith('+', PRIM_AS_INT(((objprim*)a)), VAL_AS_LONG(constant),
+                &result)) {
+        c = vm_int(vm, result);
+    }
+    else if (is_primdouble(a) && VAL_IS_DOUBLE(constant))
+        c = vm_double(vm, PRIM_AS_DOUBLE(((objprim*)a)) +
+                VAL_AS_DOUBLE(constant));
+    else {
+        object *b = load_constant(vm, code[1]->line, constant->type,
+                constant);
+        if (!b)
+            return;
+        c = binary_add(vm, code[2]->line, a, b);
+        if (!c)
+            return;
+    }
+
+    primstring *pname = create_primstring(
+            VAL_AS_STRING((&code[3]->operand)));
+    set_name(vm->top, pname, c);
+    free_primstring(pname);
+    vm->top->pc += 4;
+}
+
+/* Runs the instruction at the current pc of the top frame. Returns false
+ * once the instruction returned from the frame.
+ */
+static inline bool dispatch(VM *vm, instruct *instructs, uint64_t current)
+{
+    objstack *stack = &vm->evalstack;
+    code8 *code = instructs->code[current];
+    int line = code->line;
+    value *operand = &code->operand;
+    valtype type = code->operand.type;
+
+    switch (code->bytecode) {
+        /* PUSH_FRAME: Pushes an adhoc frame onto the frame stack. 
+         * Adhoc frames are used to create new scopes outside of a 
+         * new function or class.
+         */
+        case OP_PUSH_FRAME:
+        {
+            op_push_frame(vm);
+            break;
+        }
+        /* POP_FRAME: Pops an adhoc frame from the frame stack.
+         */
+        case OP_POP_FRAME:
+        {
+            op_pop_frame(vm);
+            break;
+        }
+        /* JMP_LOC: Directly jumps to a new location in 
+         * the instructions.
+         */
+        case OP_JMP_LOC:
+        {
+            int jump = VAL_AS_INT(operand);
+            op_jmp_loc(vm, jump);
+            break;
+        }
+        /* JMP_AFTER: Uses an offset to make a jump in
+         * the instructions.
+         */
+        case OP_JMP_AFTER:
+        {
+            int jump = VAL_AS_INT(operand);
+            op_jmp_after(vm, jump);
+            break;
+        }
+        /* JMP_FALSE: Only jump if condition is true. Note
+         * the other jump operations do not directly evalute
+         * whether to jump based on conditions.
+         */
+        case OP_JMP_FALSE:
+        {
+            objprim *condition = (objprim*)pop_objstack(stack);
+            if (!condition) { 
+                runtime_error(vm, stack, line,
+                        "ConditionError: No condition found.");
+                return true;
+            }
+            int jump = VAL_AS_INT(operand);
+            op_jmp_false(vm, jump, condition);
+            break;
+        }
+        /* JMP_IF_FALSE_KEEP: Short-circuits 'and'. Jumps with the
+         * value left on the stack if it is false, and pops it to go
+         * on to the right side otherwise.
+         */
+        case OP_JMP_IF_FALSE_KEEP:
+        {
+            op_jmp_keep(vm, VAL_AS_INT(operand), false);
+            break;
+        }
+        /* JMP_IF_TRUE_KEEP: The same for 'or', jumping if the value
+         * is true.
+         */
+        case OP_JMP_IF_TRUE_KEEP:
+        {
+            op_jmp_keep(vm, VAL_AS_INT(operand), true);
+            break;
+        }
+        /* LOAD_CONSTANT: Takes a value from the compiler
+         * and creates a new objprim object and pushes it
+         * onto the object stack.
+         */
+        case OP_LOAD_CONSTANT:
+        {
+            op_load_constant(vm, line, type, operand);
+            break;
+        }
+        /* LOAD_NAME: searches through the linked object
+         * hashtables to find an entry. If found, it places
+         * that object onto the stack.
+         */
+        case OP_LOAD_NAME:
+        {
+            char *name = VAL_AS_STRING(operand);
+            op_load_name(vm, line, name);
+            break;
+        }
+        /* LOAD_METHOD: This operation only advances the 
+         * program counter. The optimizer strips it from compiled
+         * code.
+         */
+        case OP_LOAD_METHOD:
+        {
+            op_load_method(vm);
+            break;
+        }
+        /* CALL_FUNCTION: Call operation used to call functions
+         * and create objects.
+         */ 
+        case OP_CALL_FUNCTION:
+        {
+            int argcount = VAL_AS_INT(operand);
+            op_call_function(vm, line, argcount);
+            break;
+        }
+        /* TAIL_CALL: CALL_FUNCTION in front of a RETURN. A function
+         * calling itself reuses its frame.
+         */
+        case OP_TAIL_CALL:
+        {
+            int argcount = VAL_AS_INT(operand);
+            op_tail_call(vm, instructs, line, argcount);
+            break;
+        }
+        /* MAKE_FUNCTION: Takes a function passed from the
+         * compiler and places it on object stack.
+         */
+        case OP_MAKE_FUNCTION:
+        {
+            op_make_function(vm, operand);
+            break;
+        }
+        /* MAKE_CLASS: Takes a class passed from the
+         * compiler and passes the class body to execute()
+         * to transform class definition into a new class.
+         * Afterwards, class is placed on the object stack.
+         */
+        case OP_MAKE_CLASS:
+        {
+            op_make_class(vm, operand);
+            break;
+        }
+        /* CALL_METHOD: Similar to CALL_FUNCTION, this
+         * operation calls a method instead of a function. The 
+         * biggest difference between the two are that 
+         * OP_CALL_METHOD places the object the method is called 
+         * against in the object register.
+         *
+         * This allows the method to use 'this' in the method body,
+         * and get attributes directly from the instance.
+         */
+        case OP_CALL_METHOD:
+        {
+            int argcount = VAL_AS_INT(operand) + 1;
+            op_call_method(vm, argcount);
+            break;
+        }
+        /* MAKE_METHOD: Takes a method constructed in the compiler
+         * and places it on the object stack.
+         */
+        case OP_MAKE_METHOD:
+        {
+            op_make_method(vm, operand);
+            break;
+        }
+        /* GET_PROPERTY: Similar to LOAD_NAME, this operation
+         * attempts to retrieve an attribute from an object.
+         *
+         * This is done differently than LOAD_NAME, however, as
+         * it looks only at the hashtable of the object, and doesn't
+         * search the frame stack at all.  
+         */
+        case OP_GET_PROPERTY:
+        {
+            char *name = VAL_AS_STRING(operand);
+            op_get_property(vm, line, name);
+            break;
+        }
+        /* SET_PROPERTY: Pops an object from the object stack
+         * and stores it in the hashtable of the object that this
+         * operation was called against.
+         *
+         * e.g.: foo.bar = "Hello!"; 
+         */
+        case OP_SET_PROPERTY:
+        {
+            char *name = VAL_AS_STRING(operand);
+            op_set_property(vm, line, name);
+            break;
+        }
+        case OP_GET_SOURCE:
+        {
+            char *name = VAL_AS_STRING(operand);
+            op_get_source(vm, line, name);
+            break;
+        }
+        /* BUILD_LIST: Pops as many objects as the operand says
+         * and places a new list holding them, in order, on the
+         * object stack.
+         */
+        case OP_BUILD_LIST:
+        {
+            int count = VAL_AS_INT(operand);
+            op_build_list(vm, count);
+            break;
+        }
+        /* BUILD_DICT: Pops as many key and value pairs as the
+         * operand says and places a new dict holding them on the
+         * object stack.
+         */
+        case OP_BUILD_DICT:
+        {
+            int count = VAL_AS_INT(operand);
+            op_build_dict(vm, line, count);
+            break;
+        }
+        /* INDEX_GET: Pops an index and a list or float64array
+         * and places the item at that index on the object stack.
+         * For a dict the index is the key.
+         *
+         * e.g.: foo[0]
+         */
+        case OP_INDEX_GET:
+        {
+            op_index_get(vm, line);
+            break;
+        }
+        /* INDEX_SET: Pops an index, a list or float64array and
+         * a value and stores the value at that index. For a dict
+         * the index is the key.
+         *
+         * e.g.: foo[0] = "Hello!";
+         */
+        case OP_INDEX_SET:
+        {
+            op_index_set(vm, line);
+            break;
+        }
+        /* STORE_NAME: Pops an object from the object stack
+         * and stores it in the hashtable of top frame on the
+         * frame stack.
+         *
+         * e.g.:
+         *          // Stored at global hashtable
+         *          foo = "happy!";
+         *          {
+         *              // Stored at hashtable created by new scope
+         *              bar = "sad!";
+         *          }
+         */
+        case OP_STORE_NAME:
+        {
+            char *name = VAL_AS_STRING(operand);
+            op_store_name(vm, name);
+            break;
+        }
+        /* STORE_NAME_KEEP: Same as STORE_NAME, but leaves the
+         * object on the object stack. Emitted by the optimizer in
+         * place of a STORE_NAME followed by a LOAD_NAME of the
+         * same name.
+         */
+        case OP_STORE_NAME_KEEP:
+        {
+            char *name = VAL_AS_STRING(operand);
+            op_store_name_keep(vm, name);
+            break;
+        }
+        /* GET_NAME_PROPERTY: Superinstruction for LOAD_NAME
+         * followed by GET_PROPERTY, e.g. 'this.name' or
+         * 'foo.bar()'.
+         */
+        case OP_GET_NAME_PROPERTY:
+        {
+            op_get_name_property(vm, &instructs->code[current]);
+            break;
+        }
+        /* SET_NAME_PROPERTY: Superinstruction for LOAD_NAME
+         * followed by SET_PROPERTY, e.g. 'this.name = name;'.
+         */
+        case OP_SET_NAME_PROPERTY:
+        {
+            op_set_name_property(vm, &instructs->code[current]);
+            break;
+        }
+        /* COMPARE_NAME_CONST_JMP: Superinstruction for LOAD_NAME,
+         * LOAD_CONSTANT, COMPARE and JMP_FALSE, the shape of most
+         * loop and if conditions, e.g. 'while (i < 100)'. Numbers
+         * are compared without creating any objects.
+         */
+        case OP_COMPARE_NAME_CONST_JMP:
+        {
+            op_compare_name_const_jmp(vm, &instructs->code[current]);
+            break;
+        }
+        /* ADD_NAME_CONST_STORE: Superinstruction for LOAD_NAME,
+         * LOAD_CONSTANT, BINARY_ADD and STORE_NAME, e.g.
+         * 'i = i + 1;'.
+         */
+        case OP_ADD_NAME_CONST_STORE:
+        {
+            op_add_name_const_store(vm, &instructs->code[current]);
+            break;
+        }
+        /* FOR_RANGE: Starts a counted for loop, with the bound and
+         * step on the stack and the loop name already assigned. The
+         * COMPARE and JMP_FALSE after it hold the comparison and the
+         * exit, and are skipped.
+         */
+        case OP_FOR_RANGE:
+        {
+            op_for_range(vm, &instructs->code[current]);
+            break;
+        }
+        /* FOR_STEP: Adds the step to the counter of a counted for
+         * loop, and jumps back to the top of the body while the
+         * comparison holds.
+         */
+        case OP_FOR_STEP:
+        {
+            op_for_step(vm, code);
+            break;
+        }
+        /* GET_ITER: Pops an object and stores an iterator over it in
+         * the frame of the for-in loop, calling __iter__ on an
+         * instance that has one.
+         */
+        case OP_GET_ITER:
+        {
+            op_get_iter(vm, code->line);
+            break;
+        }
+        /* FOR_ITER: Pushes the next value of the loop's iterator, or
+         * jumps past the loop once there are none left.
+         */
+        case OP_FOR_ITER:
+        {
+            op_for_iter(vm, code);
+            break;
+        }
+        /* COMPARE: takes two objprims, compares them and returns
+         * objprim bool object of either true or false.
+         *
+         * Right now this is limited to objprims, but will
+         * be working to expand this to all objects soon.
+         */
+        case OP_COMPARE:
+        {
+            if (current + 1 < instructs->count &&
+                    instructs->code[current + 1]->bytecode == OP_JMP_FALSE)
+                quicken_numbers(code, stack, OP_COMPARE_DOUBLE_JMP,
+                        OP_COMPARE_INT_JMP);
+            else
+                quicken(code, false, OP_COMPARE);
+            int cmptype = VAL_AS_INT(operand);
+            op_compare(vm, line, cmptype);
+            break;
+        }
+        /* COMPARE_DOUBLE_JMP: Quickened COMPARE of two numbers
+         * that is followed by JMP_FALSE. Takes the branch directly
+         * instead of creating a bool object for JMP_FALSE.
+         */
+        case OP_COMPARE_DOUBLE_JMP:
+        {
+            if (!op_compare_double_jmp(vm, &instructs->code[current]))
+                deoptimize(code);
+            break;
+        }
+        /* COMPARE_INT_JMP: COMPARE_DOUBLE_JMP for two ints.
+         */
+        case OP_COMPARE_INT_JMP:
+        {
+            if (!op_compare_int_jmp(vm, &instructs->code[current]))
+                deoptimize(code);
+            break;
+        }
+        /* ADD_DOUBLE, SUB_DOUBLE, MULT_DOUBLE, DIVIDE_DOUBLE:
+         * Quickened BINARY_* for two numbers. Falls back to the
+         * generic instruction on any other operands.
+         */
+        case OP_ADD_DOUBLE:
+        case OP_SUB_DOUBLE:
+        case OP_MULT_DOUBLE:
+        case OP_DIVIDE_DOUBLE:
+        {
+            if (!op_arith_double(vm, code->bytecode))
+                deoptimize(code);
+            break;
+        }
+        /* ADD_INT, SUB_INT, MULT_INT: Quickened BINARY_* for two
+         * ints. A result that overflows comes out as a double.
+         */
+        case OP_ADD_INT:
+        case OP_SUB_INT:
+        case OP_MULT_INT:
+        {
+            if (!op_arith_int(vm, code->bytecode))
+                deoptimize(code);
+            break;
+        }
+        /* BINARY_ADD: takes two obprims, adds them together
+         * and places the result on the object stack.
+         *
+         * Will be adding functionality to allow user-defined 
+         * binary_add operations for any non built-in object.
+         */
+        case OP_BINARY_ADD:
+        {
+            quicken_numbers(code, stack, OP_ADD_DOUBLE, OP_ADD_INT);
+            op_binary_add(vm, line);
+            break;
+        }
+        /* BINARY_SUB: takes two objprims, subtracts them from
+         * each other, and places the result on the object stack.
+         *
+         * Like BINARY_ADD, more functionality coming soon.
+         */
+        case OP_BINARY_SUB:
+        {
+            quicken_numbers(code, stack, OP_SUB_DOUBLE, OP_SUB_INT);
+            op_binary_sub(vm, line);
+            break;
+        }
+        /* BINARY_MULT: takes two objprims, multiplies them together, 
+         * and places the result on the object stack.
+         *
+         * Like BINARY_ADD, more functionality coming soon.
+         */
+        case OP_BINARY_MULT:
+        {
+            quicken_numbers(code, stack, OP_MULT_DOUBLE, OP_MULT_INT);
+            op_binary_mult(vm, line);
+            break;
+        }
+        /* BINARY_DIVIDE: takes two objprims, divides them, 
+         * and places the result on the object stack.
+         *
+         * Like BINARY_ADD, more functionality coming soon.
+         */
+        case OP_BINARY_DIVIDE:
+        {
+            quicken(code, doubles_on_stack(stack), OP_DIVIDE_DOUBLE);
+            op_binary_div(vm, line);
+            break;
+        }
+        /* NEGATE: takes an objprim, negates it
+         * and places the result on the object stack.
+         *
+         */
+        case OP_NEGATE:
+        {
+            op_negate(vm, line);
+            break;
+        }
+        /* NOT: pops an object and pushes the shared true if it is
+         * false, or the shared false otherwise.
+         */
+        case OP_NOT:
+        {
+            op_not(vm);
+            break;
+        }
+        /* POP: pops the object stack.
+         *
+         * Note: this discards the object on the stack.
+         */
+        case OP_POP:
+        {
+            op_pop(vm);
+            break;
+        }
+        /* RETURN: Ends an ari function or method and returns
+         * to original caller.
+         */
+        case OP_RETURN:
+        {
+            op_return(vm);
+            return false;
+        }
+        /* YIELD: pops the value a generator gives, and stops the
+         * generator's call until it is resumed.
+         */
+        case OP_YIELD:
+            return !op_yield(vm, instructs, line);
+    }
+    return true;
+}
+
+#ifdef ARI_JIT
+// Gives up the recording of a loop its function left partway through
+static void stop_recording(VM *vm, tracerecorder *recorder)
+{
+    vm->recorder = NULL;
+    abort_trace(recorder);
+}
+#endif
+
+/* Runs the instructions in the top frame until they return. With callee
+ * set they are the body of a call made by a loop being recorded, and go
+ * into its trace one by one.
+ */
+static intrpstate run(VM *vm, instruct *instructs, tracerecorder *callee)
+{
+    if (vm->framestackpos == 0)
+        if (vm->haderror)
+            vm->haderror = false;
+#ifdef DEBUG_ARI
+    uint64_t count = instructs->count;
+    int compress = (int)log10(count);
+    printf("\nCurrent Frame: %p\n", vm->top);
+    printf("Frame\tInstruct   OP\t\t\toperand\n");
+    printf("-----\t--------   ----------\t\t--------\n");
+#endif
+#ifdef DEBUG_ARI_OPSTATS
+    uint8_t previous = OP_RETURN;
+#endif
+#ifdef ARI_JIT
+    tracerecorder *recorder = callee;
+#else
+    (void)callee;
+#endif
+    while (vm->top->pc < instructs->count) {
+        uint64_t current = vm->top->pc;
+        code8 *code = instructs->code[current];
+        if (vm->haderror) {
+            fprintf(stderr, "[line %d] in script\n", code->line);
+#ifdef ARI_JIT
+            if (recorder && !callee)
+                stop_recording(vm, recorder);
+#endif
+            return INTERPRET_RUNTIME_ERROR;
+        }
+#ifdef DEBUG_ARI
+        printf("|%03d|\t", vm->framestackpos);
+        printf("|%*ld|\t   ", compress, current + 1);
+        print_bytecode(code->bytecode);
+        printf("\t(");
+        print_value(&code->operand, code->operand.type);
+        printf(")");
+        printf("\n");
+#endif
+#ifdef DEBUG_ARI_OPSTATS
+        record_opcode_pair(previous, code->bytecode);
+        previous = code->bytecode;
+#endif
+#ifdef ARI_JIT
+        int step = -1;
+        if (recorder) {
+            // Calls the loop itself makes may be recorded through
+            vm->recorder = callee ? NULL : recorder;
+            step = record_trace_step(recorder, vm, instructs, current);
+        }
+#endif
+        if (!dispatch(vm, instructs, current)) {
+#ifdef ARI_JIT
+            if (recorder && !callee)
+                stop_recording(vm, recorder);
+#endif
+            return INTERPRET_OK;
+        }
+#ifdef ARI_JIT
+        if (recorder) {
+            vm->recorder = NULL;
+            recorder = end_trace_step(recorder, step, vm, instructs);
+        }
+        /* A backward jump closes a loop. Run its trace if there is one,
+         * or start recording once the loop is hot.
+         */
+        else if (jit_enabled && (code->bytecode == OP_JMP_LOC ||
+                    code->bytecode == OP_FOR_STEP) &&
+                vm->top->pc < current) {
+            int header = vm->top->pc;
+            jittrace *trace = find_trace(instructs, header);
+            if (trace) {
+                if (!trace->entry(vm, instructs))
+                    return INTERPRET_OK;
+            }
+            else if (code->deopts < TRACE_MAX_ABORTS) {
+                if (++code->hotness >= TRACE_THRESHOLD)
+                    recorder = start_trace(code, header);
+            }
+            /* The loop is hot but can't be traced. Carry on with the
+             * frame as it is in machine code for the whole body, which
+             * picks up at the loop header.
+             */
+            else if (instructs->jitcode || jit_compile(instructs))
+                return jit_execute(vm, instructs);
+        }
+#endif
+    }
+#ifdef ARI_JIT
+    if (recorder && !callee)
+        stop_recording(vm, recorder);
+#endif
+    return INTERPRET_OK;
+}
+
+intrpstate execute(VM *vm, instruct *instructs)
+{
+    return run(vm, instructs, NULL);
+}
+
+bool vm_dispatch(VM *vm, instruct *instructs)
+{
+    return dispatch(vm, instructs, vm->top->pc);
+}
+
+/* The shared or new number objects, for machine code and builtins to put
+ * their results in
+ */
+object *vm_new_int(VM *vm, int64_t number)
+{
+    return vm_int(vm, number);
+}
+
+object *vm_new_double(VM *vm, double number)
+{
+    return vm_double(vm, number);
+}
+
+/* Name lookups for machine code, which makes the primstring of a name
+ * once when it is compiled rather than on every lookup.
+ */
+object *vm_find_name(VM *vm, primstring *name)
+{
+    return find_name(vm->top, name);
+}
+
+void vm_store_name(VM *vm, primstring *name, object *obj)
+{
+    set_name(vm->top, name, obj);
+}
+
+/* Enters the function a trace recorded a CALL_FUNCTION or CALL_METHOD of,
+ * popping the arguments and the function. Returns false, leaving the
+ * stack as it was, if the function on the stack is another one.
+ */
+bool vm_trace_call(VM *vm, objcode *funcobj, int argcount, bool method)
+{
+    objstack *stack = &vm->evalstack;
+    int popped = method ? argcount - 1 : argcount;
+    objnode *node = stack->top;
+    for (int i = 0; i < popped && node; i++)
+        node = node->next;
+    if (!node || node->obj != (object*)funcobj)
+        return false;
+
+    object **arguments = ALLOCATE(object*, argcount);
+    int i = 0;
+    for (i = 0; i < popped; i++)
+        arguments[i] = pop_objstack(stack);
+    if (method)
+        arguments[i] = vm->objregister;
+    pop_objstack(stack);
+    enter_function(vm, funcobj, argcount, arguments);
+    FREE_ARRAY(object*, arguments, argcount);
+    return true;
+}
+
+// The RETURN that ends a function vm_trace_call() entered
+void vm_trace_return(VM *vm, objcode *funcobj)
+{
+    op_return(vm);
+    funcobj->depth--;
+}
+
+/* Runs the rest of a function vm_trace_call() entered in the interpreter,
+ * for a trace that left its recorded path inside it.
+ */
+void vm_trace_finish(VM *vm, objcode *funcobj)
+{
+    execute(vm, &funcobj->instructs);
+    funcobj->depth--;
+}
+
+// For next(), which resumes generators outside of a for-in loop
+object *vm_resume_generator(VM *vm, objgen *gen)
+{
+    return resume_generator(vm, gen);
+}
+
+/* Calls a function from outside of any instruction, as the workers of
+ * parallel_map() do. Returns what it returned, or NULL if it returned
+ * nothing. A call that fails leaves no frames or stack nodes behind.
+ */
+object *vm_call_function(VM *vm, objcode *funcobj, int argcount,
+        object **arguments)
+{
+    objstack *stack = &vm->evalstack;
+    objnode *base = stack->top;
+    frame *caller = vm->top;
+    size_t pc = caller->pc;
+    call_function(vm, (object*)funcobj, argcount, arguments);
+    if (vm->haderror) {
+        while (vm->top != caller)
+            vm_pop_frame(vm);
+        while (stack->top != base)
+            pop_objstack(stack);
+    }
+    caller->pc = pc;
+    return stack->top != base ? pop_objstack(stack) : NULL;
+}
+
+// The value of a primitive from another vm, as one of this vm's
+object *vm_copy_primitive(VM *vm, objprim *prim)
+{
+    switch (prim->ptype) {
+        case PRIM_BOOL:     return vm_bool(vm, PRIM_AS_BOOL(prim));
+        case PRIM_INT:      return vm_int(vm, PRIM_AS_INT(prim));
+        case PRIM_DOUBLE:   return vm_double(vm, PRIM_AS_DOUBLE(prim));
+        case PRIM_STRING:
+        {
+            objprim *copy = create_new_primitive(PRIM_STRING);
+            PRIM_AS_STRING(copy) = create_primstring(PRIM_AS_RAWSTRING(prim));
+            vm_add_object(vm, (object*)copy);
+            return (object*)copy;
+        }
+        default:
+            return vm->nullobj;
+    }
+}
+
+/* Stands in for the CALL_METHOD of a trace step, as long as the method
+ * on the stack is still the getter that was recorded.
+ */
+bool vm_inline_getter(VM *vm, object *method)
+{
+    return peek_objstack(&vm->evalstack) == method &&
+        inline_getter(vm, method);
+}
+
+void reset_vm(VM *vm)
+{
+    vm->top->pc = 0;
+    reset_parser(&vm->analyzer);
+}
+
+static void init_shared_values(VM *vm)
+{
+    objprim *prim = create_new_primitive(PRIM_BOOL);
+    PRIM_AS_BOOL(prim) = true;
+    vm->trueobj = (object*)prim;
+    vm_add_object(vm, vm->trueobj);
+    prim = create_new_primitive(PRIM_BOOL);
+    PRIM_AS_BOOL(prim) = false;
+    vm->falseobj = (object*)prim;
+    vm_add_object(vm, vm->falseobj);
+    prim = create_new_primitive(PRIM_NULL);
+    vm->nullobj = (object*)prim;
+    vm_add_object(vm, vm->nullobj);
+
+    /* The small numbers live in two arrays freed with the vm. Marking them
+     * accounted keeps them out of the object list.
+     */
+    vm->smallints = ALLOCATE(objprim, SMALLNUM_COUNT);
+    vm->smalldoubles = ALLOCATE(objprim, SMALLNUM_COUNT);
+    for (int i = 0; i < SMALLNUM_COUNT; i++) {
+        init_primitive(&vm->smallints[i], PRIM_INT);
+        PRIM_AS_INT((&vm->smallints[i])) = SMALLNUM_MIN + i;
+        vm->smallints[i].header.accounted = true;
+        init_primitive(&vm->smalldoubles[i], PRIM_DOUBLE);
+        PRIM_AS_DOUBLE((&vm->smalldoubles[i])) = SMALLNUM_MIN + i;
+        vm->smalldoubles[i].header.accounted = true;
+    }
+}
+
+void free_vm(VM *vm)
+{
+#ifdef DEBUG_ARI_OPSTATS
+    print_opcode_stats();
+#endif
+    object *current = NULL;
+    object *next = NULL;
+    while ((current = vm->objs)) {
+        next = current->next;
+        FREE_OBJECT(current);
+        vm->objs = next;
+    }
+    FREE_ARRAY(objprim, vm->smallints, SMALLNUM_COUNT);
+    FREE_ARRAY(objprim, vm->smalldoubles, SMALLNUM_COUNT);
+    if (vm->events)
+        free_eventloop(vm->events);
+    reset_objstack(&vm->evalstack);
+    init_objstack(&vm->evalstack);
+    reset_parser(&vm->analyzer);
+    reset_frame(&vm->global.local);
+    frame *pooled = NULL;
+    while ((pooled = vm->framepool)) {
+        vm->framepool = pooled->next;
+        reset_frame(pooled);
+        FREE(frame, pooled);
+    }
+    FREE(VM, vm);
+}
+
+VM *init_vm(void)
+{
+    VM *vm = ALLOCATE(VM, 1);
+    init_parser(&vm->analyzer);
+    // A script loaded from its cache is never scanned
+    init_scanner(&vm->analyzer.scan);
+    init_objstack(&vm->evalstack);
+    init_module(&vm->global);
+    vm->top = &vm->global.local;
+    vm->framepool = NULL;
+    vm->poolsize = 0;
+    vm->objs = NULL;
+    vm->objregister = NULL;
+    vm->num_objects = 0;
+    vm->framestackpos = 0;
+    vm->haderror = false;
+    vm->generator = NULL;
+    vm->events = NULL;
+    vm->recorder = NULL;
+
+    init_shared_values(vm);
+
+    builtin funcs[] = {builtin_println, builtin_input, builtin_type, 
+                       builtin_clock, builtin_len, builtin_append,
+                       builtin_float64array, builtin_sum, builtin_min,
+                       builtin_max, builtin_dot, builtin_add, builtin_mul,
+                       builtin_scale, builtin_prefix_sum, builtin_contains,
+                       builtin_delete, builtin_keys, builtin_values,
+                       builtin_range, builtin_open, builtin_close,
+                       builtin_next, builtin_readline, builtin_spawn,
+                       builtin_run, builtin_sleep, builtin_await_read,
+                       builtin_await_write, builtin_read, builtin_write,
+                       builtin_writeline, builtin_parallel_map,
+                       builtin_remove};
+    char *names[] = {"print", "input", "type", "clock", "len", "append",
+                     "float64array", "sum", "min", "max", "dot", "add",
+                     "mul", "scale", "prefix_sum", "contains", "delete",
+                     "keys", "values", "range", "open", "close", "next",
+                     "readline", "spawn", "run", "sleep", "await_read",
+                     "await_write", "read", "write", "writeline",
+                     "parallel_map", "remove"};
+
+    object *obj = NULL;
+    for (size_t i = 0; i < sizeof(funcs) / sizeof(funcs[0]); i++) {
+        obj = load_builtin(vm, names[i], funcs[i]);
+        vm_add_object(vm, obj);
+    }
+
+    return vm;
+}
+
+void print_value(value *val, valtype type)
+{
+    switch (type) {
+        case VAL_EMPTY:
+            printf("%-4s", "empty");
+            break;
+        case VAL_INT:
+            printf("%-4d", VAL_AS_INT(val));
+            break;
+        case VAL_DOUBLE:
+            printf("%-4f", VAL_AS_DOUBLE(val));
+            break;
+        case VAL_LONG:
+            printf("%-4lld", (long long)VAL_AS_LONG(val));
             break;
         case VAL_STRING:
             printf("%-4s", VAL_AS_STRING(val));